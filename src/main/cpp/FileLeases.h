@@ -0,0 +1,331 @@
+/* Copyright (c) 2009-2015 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RAMCLOUDTOOLS_FILELEASES_H
+#define RAMCLOUDTOOLS_FILELEASES_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "Cycles.h"
+#include "OptionParser.h"
+#include "StorageBackend.h"
+
+namespace RAMCloud {
+
+/**
+ * Options for loading files under leases (see FileLeases).
+ */
+struct FileLeaseOptions {
+  /*
+   * Name of the lease table, or empty to split the files statically.
+   */
+  std::string table;
+
+  /*
+   * How long a lease may go unrenewed before others take it over.
+   */
+  double seconds;
+
+  bool
+  enabled() const
+  {
+    return !table.empty();
+  }
+};
+
+/**
+ * Add the options that fill in a FileLeaseOptions to a tool's options.
+ */
+inline void
+addFileLeaseOptions(OptionsDescription& options,
+    FileLeaseOptions* leaseOptions)
+{
+  options.add_options()
+    ("leaseTable",
+     ProgramOptions::value<std::string>(&leaseOptions->table)->
+         default_value(""),
+     "Hand out files dynamically, by leases in this table, instead of "
+     "splitting them by --clientIndex. Clients then start on their own "
+     "share, go on to files that others haven't got to, and take over the "
+     "files of clients that die. Use a new table for each load "
+     "[default: none].")
+    ("leaseSeconds",
+     ProgramOptions::value<double>(&leaseOptions->seconds)->
+         default_value(30),
+     "How long a client may go without renewing its lease on a file before "
+     "others take the file over [default: 30].");
+}
+
+/**
+ * Hands out the files of a snapshot to loaders on any number of hosts, one
+ * at a time, by leasing them through a coordination table in the store.
+ * Each file has one object in the table, keyed by the file name:
+ *
+ *   "leased OWNER"  while a loader holds the file, and
+ *   "done OWNER"    once the file has been loaded.
+ *
+ * A file is claimed by creating its object with a conditional write, so
+ * only one loader can win it. The holder renews its lease by rewriting the
+ * object, which bumps its version. Rather than trusting the hosts' clocks,
+ * other loaders time leases themselves: a lease whose version hasn't changed
+ * for leaseSeconds is taken to belong to a dead or stuck loader, and is
+ * taken over with a write conditional on that version.
+ *
+ * Done files stay done, so each load needs a lease table of its own.
+ * Like the StorageBackend it uses, a FileLeases must only be used by one
+ * thread.
+ */
+class FileLeases {
+ public:
+  /**
+   * \param backend
+   *      Store holding the lease table.
+   * \param leaseTableId
+   *      Table of leases, shared by every loader of the snapshot.
+   * \param fileList
+   *      Every file in the snapshot, in the same order for every loader.
+   * \param firstFile
+   *      Index in fileList at which to start claiming. Giving each loader a
+   *      different start keeps them from contending for the same files.
+   * \param owner
+   *      Name of this loader, recorded in its leases for diagnosis.
+   * \param leaseSeconds
+   *      How long a lease may go unrenewed before others take it over.
+   */
+  FileLeases(StorageBackend* backend, uint64_t leaseTableId,
+      const std::vector<std::string>& fileList, int firstFile,
+      const std::string& owner, double leaseSeconds)
+    : backend(backend)
+    , leaseTableId(leaseTableId)
+    , fileList(fileList)
+    , owner(owner)
+    , leaseSeconds(leaseSeconds)
+    , cursor(fileList.empty() ? 0 : firstFile % (int)fileList.size())
+    , lapStart(cursor)
+    , othersPending(false)
+    , files(fileList.size())
+    , current(-1)
+    , currentVersion(0)
+    , lastRenewal(0)
+  {}
+
+  /**
+   * Claim a file to load. If every file that isn't done is leased by
+   * another loader, wait for one of them to finish or for its lease to
+   * expire.
+   *
+   * \return
+   *      Index in fileList of the claimed file, or -1 once every file has
+   *      been loaded.
+   */
+  int
+  claim()
+  {
+    int count = (int)fileList.size();
+    if (count == 0) {
+      return -1;
+    }
+    while (true) {
+      int index = cursor;
+      cursor = (cursor + 1) % count;
+      if (tryClaim(index)) {
+        return index;
+      }
+      if (cursor != lapStart) {
+        continue;
+      }
+
+      // A full pass over the files found nothing to claim.
+      if (!othersPending) {
+        return -1;
+      }
+      othersPending = false;
+      usleep((useconds_t)(leaseSeconds * 1e6 / 4));
+    }
+  }
+
+  /**
+   * Renew the lease on the claimed file, if it's due. Call this regularly
+   * while loading the file.
+   *
+   * \return
+   *      False if another loader has taken over the file, in which case it
+   *      should be abandoned.
+   */
+  bool
+  renew()
+  {
+    uint64_t now = Cycles::rdtsc();
+    if (Cycles::toSeconds(now - lastRenewal) < leaseSeconds / 3) {
+      return true;
+    }
+    if (!backend->conditionalWrite(leaseTableId, fileList[current],
+        "leased " + owner, currentVersion, &currentVersion)) {
+      fprintf(stderr, "Lost the lease on %s\n", fileList[current].c_str());
+      current = -1;
+      return false;
+    }
+    lastRenewal = now;
+    return true;
+  }
+
+  /**
+   * Record that the claimed file has been loaded. This succeeds even if
+   * the lease was taken over meanwhile, so that the new holder stops.
+   */
+  void
+  finish()
+  {
+    const std::string& key = fileList[current];
+    uint64_t version = currentVersion;
+    while (!backend->conditionalWrite(leaseTableId, key, "done " + owner,
+        version, &version)) {
+      std::string value;
+      if (!backend->readVersioned(leaseTableId, key, &value, &version)) {
+        version = 0;
+      }
+    }
+    files[current].done = true;
+    current = -1;
+  }
+
+ private:
+  /**
+   * What this loader knows about one file.
+   */
+  struct FileState {
+    FileState()
+      : done(false)
+      , seenVersion(0)
+      , seenSince(0)
+    {}
+
+    /*
+     * Whether the file is known to have been loaded.
+     */
+    bool done;
+
+    /*
+     * Version of the file's lease when it was last read, and when that
+     * version was first seen.
+     */
+    uint64_t seenVersion;
+    uint64_t seenSince;
+  };
+
+  /**
+   * Try to claim one file, by creating its lease or by taking over an
+   * expired one.
+   *
+   * \return
+   *      True if the file was claimed.
+   */
+  bool
+  tryClaim(int index)
+  {
+    FileState& file = files[index];
+    if (file.done) {
+      return false;
+    }
+
+    const std::string& key = fileList[index];
+    std::string lease = "leased " + owner;
+    uint64_t version;
+    if (backend->conditionalWrite(leaseTableId, key, lease, 0, &version)) {
+      take(index, version);
+      return true;
+    }
+
+    std::string value;
+    if (!backend->readVersioned(leaseTableId, key, &value, &version)) {
+      // The lease table was dropped underneath us; try again later.
+      othersPending = true;
+      return false;
+    }
+    if (value.compare(0, 5, "done ") == 0) {
+      file.done = true;
+      return false;
+    }
+
+    othersPending = true;
+    uint64_t now = Cycles::rdtsc();
+    if (version != file.seenVersion) {
+      file.seenVersion = version;
+      file.seenSince = now;
+      return false;
+    }
+    if (Cycles::toSeconds(now - file.seenSince) < leaseSeconds) {
+      return false;
+    }
+    if (!backend->conditionalWrite(leaseTableId, key, lease, version,
+        &version)) {
+      return false;
+    }
+    printf("Took over %s from expired lease: %s\n", key.c_str(),
+        value.c_str());
+    take(index, version);
+    return true;
+  }
+
+  void
+  take(int index, uint64_t version)
+  {
+    current = index;
+    currentVersion = version;
+    lastRenewal = Cycles::rdtsc();
+    lapStart = cursor;
+  }
+
+  StorageBackend* backend;
+  uint64_t leaseTableId;
+  const std::vector<std::string>& fileList;
+  std::string owner;
+  double leaseSeconds;
+
+  /*
+   * Next file to try to claim, and where the current pass over the files
+   * started. A pass starts over after each claim.
+   */
+  int cursor;
+  int lapStart;
+
+  /*
+   * Set when the current pass has seen a file that isn't done but is held
+   * by another loader.
+   */
+  bool othersPending;
+
+  std::vector<FileState> files;
+
+  /*
+   * The claimed file, or -1, and the version of its lease.
+   */
+  int current;
+  uint64_t currentVersion;
+
+  /*
+   * When the claimed file's lease was last written.
+   */
+  uint64_t lastRenewal;
+};
+
+} // namespace RAMCloud
+
+#endif // RAMCLOUDTOOLS_FILELEASES_H
@@ -17,9 +17,13 @@
 #include <string.h>
 #include <getopt.h>
 #include <assert.h>
+#include <math.h>
+#include <unistd.h>
 
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <vector>
 
 #include "ClusterMetrics.h"
 #include "Context.h"
@@ -33,9 +37,134 @@
 #include "Tub.h"
 #include "IndexLookup.h"
 #include "TableEnumerator.h"
+#include "CoordinatorClient.h"
+#include "ServerList.h"
 
 using namespace RAMCloud;
 
+/**
+ * Find the service locators of every server in the cluster that is up.
+ *
+ * \param context
+ *      Context of the client connected to the cluster.
+ * \param[out] locators
+ *      Filled in with the service locator of each server.
+ */
+void
+listServers(Context* context, std::vector<string>* locators)
+{
+    ProtoBuf::ServerList serverList;
+    CoordinatorClient::getServerList(context, &serverList);
+    locators->clear();
+    for (int i = 0; i < serverList.server_size(); i++) {
+        const ProtoBuf::ServerList_Entry& entry = serverList.server(i);
+        if (static_cast<ServerStatus>(entry.status()) == ServerStatus::UP) {
+            locators->push_back(entry.service_locator());
+        }
+    }
+}
+
+/**
+ * Fetch the metrics of many servers concurrently. All RPCs are issued
+ * before any is waited on, so the whole collection takes about as long as
+ * the slowest server.
+ *
+ * \param client
+ *      Client connected to the cluster.
+ * \param locators
+ *      Service locators of the servers to query.
+ * \param[out] metrics
+ *      Filled in with one entry per locator. Servers that couldn't be
+ *      reached have empty metrics.
+ */
+void
+collectMetrics(RamCloud* client, std::vector<string>& locators,
+        std::vector<ServerMetrics>* metrics)
+{
+    std::vector<Tub<GetMetricsLocatorRpc>> rpcs(locators.size());
+    for (size_t i = 0; i < locators.size(); i++) {
+        rpcs[i].construct(client, locators[i].c_str());
+    }
+
+    metrics->clear();
+    metrics->resize(locators.size());
+    for (size_t i = 0; i < locators.size(); i++) {
+        try {
+            metrics->at(i) = rpcs[i]->wait();
+        } catch (RAMCloud::Exception& e) {
+            // Includes TransportException, for servers that are down.
+            LOG(WARNING, "Couldn't get metrics from %s: %s",
+                locators[i].c_str(), e.str().c_str());
+        }
+    }
+}
+
+/**
+ * Cluster-wide view of one metric.
+ */
+struct MetricSummary {
+    /*
+     * Metric name.
+     */
+    string name;
+
+    /*
+     * Sum over all servers.
+     */
+    double total = 0;
+
+    /*
+     * Smallest and largest per server values.
+     */
+    double min = 0;
+    double max = 0;
+
+    /*
+     * Index (into the locators) of the server with the largest value.
+     */
+    size_t maxServer = 0;
+
+    /*
+     * Number of servers reporting the metric.
+     */
+    int servers = 0;
+};
+
+/**
+ * Combine per server values of each metric into a cluster-wide view.
+ *
+ * \param values
+ *      values[i] is the value of every metric on server i.
+ * \param[out] summaries
+ *      Filled in with one entry per metric name, in name order.
+ */
+void
+summarize(std::vector<std::map<string, double>>& values,
+        std::vector<MetricSummary>* summaries)
+{
+    std::map<string, MetricSummary> byName;
+    for (size_t i = 0; i < values.size(); i++) {
+        for (auto& it : values[i]) {
+            MetricSummary& s = byName[it.first];
+            if (s.servers == 0 || it.second < s.min) {
+                s.min = it.second;
+            }
+            if (s.servers == 0 || it.second > s.max) {
+                s.max = it.second;
+                s.maxServer = i;
+            }
+            s.name = it.first;
+            s.total += it.second;
+            s.servers++;
+        }
+    }
+
+    summaries->clear();
+    for (auto& it : byName) {
+        summaries->push_back(it.second);
+    }
+}
+
 int
 main(int argc, char *argv[])
 try
@@ -43,6 +172,9 @@ try
     int clientIndex;
     int numClients;
     string serverLocator;
+    bool perServer;
+    double diff;
+    int limit;
 
     // Set line buffering for stdout so that printf's and log messages
     // interleave properly.
@@ -67,7 +199,22 @@ try
 
         ("serverLocator",
          ProgramOptions::value<string>(&serverLocator),
-         "Location of the server to get stats for.");
+         "Location of the server to get stats for. If omitted, get metrics "
+         "from every server in the cluster.")
+        ("perServer",
+         ProgramOptions::bool_switch(&perServer),
+         "Print each server's metrics, not just the cluster-wide view.")
+        ("diff",
+         ProgramOptions::value<double>(&diff)->
+            default_value(0),
+         "If non-zero, take two snapshots this many seconds apart and print "
+         "the rate of change of each metric, largest change first "
+         "(default: 0).")
+        ("limit",
+         ProgramOptions::value<int>(&limit)->
+            default_value(0),
+         "If non-zero, print only this many metrics in diff mode "
+         "(default: 0).");
     
     OptionParser optionParser(clientOptions, argc, argv);
     context.transportManager->setSessionTimeout(
@@ -83,10 +230,103 @@ try
     RamCloud client(&context, locator.c_str(),
             optionParser.options.getClusterName().c_str());
 
-    ServerMetrics metrics = client.getMetrics(serverLocator.c_str());
-    for (ServerMetrics::iterator it = metrics.begin(); it != metrics.end(); 
-        it++) {
-      printf("%s: %d\n", it->first.c_str(), it->second);
+    std::vector<string> locators;
+    if (serverLocator.size() > 0) {
+        locators.push_back(serverLocator);
+    } else {
+        listServers(&context, &locators);
+    }
+    LOG(NOTICE, "Collecting metrics from %lu servers", locators.size());
+
+    std::vector<ServerMetrics> before;
+    uint64_t beforeStart = Cycles::rdtsc();
+    collectMetrics(&client, locators, &before);
+    uint64_t beforeEnd = Cycles::rdtsc();
+
+    if (diff == 0) {
+        std::vector<std::map<string, double>> values(locators.size());
+        for (size_t i = 0; i < locators.size(); i++) {
+            for (ServerMetrics::iterator it = before[i].begin();
+                    it != before[i].end(); it++) {
+                values[i][it->first] = (double)it->second;
+            }
+        }
+
+        if (perServer) {
+            for (size_t i = 0; i < locators.size(); i++) {
+                printf("%s\n", locators[i].c_str());
+                for (auto& it : values[i]) {
+                    printf("  %s: %.0f\n", it.first.c_str(), it.second);
+                }
+            }
+            printf("\n");
+        }
+
+        std::vector<MetricSummary> summaries;
+        summarize(values, &summaries);
+        printf("%-40s %16s %16s %16s %8s  %s\n", "Metric", "Total", "Min",
+               "Max", "Servers", "Max server");
+        for (MetricSummary& s : summaries) {
+            printf("%-40s %16.0f %16.0f %16.0f %8d  %s\n", s.name.c_str(),
+                   s.total, s.min, s.max, s.servers,
+                   locators[s.maxServer].c_str());
+        }
+        return 0;
+    }
+
+    usleep((useconds_t)(diff * 1e6));
+    std::vector<ServerMetrics> after;
+    uint64_t afterStart = Cycles::rdtsc();
+    collectMetrics(&client, locators, &after);
+    uint64_t afterEnd = Cycles::rdtsc();
+    // Each server is read at some point during each collection, so measure
+    // from the middle of the first collection to the middle of the second.
+    double seconds = Cycles::toSeconds(
+            ((afterStart - beforeStart) + (afterEnd - beforeEnd)) / 2);
+
+    // Rate of change of every metric on every server. Metrics missing from
+    // either snapshot (e.g. the server was unreachable) are skipped.
+    std::vector<std::map<string, double>> rates(locators.size());
+    for (size_t i = 0; i < locators.size(); i++) {
+        for (ServerMetrics::iterator it = after[i].begin();
+                it != after[i].end(); it++) {
+            ServerMetrics::iterator prev = before[i].find(it->first);
+            if (prev == before[i].end()) {
+                continue;
+            }
+            rates[i][it->first] =
+                ((double)it->second - (double)prev->second) / seconds;
+        }
+    }
+
+    std::vector<MetricSummary> summaries;
+    summarize(rates, &summaries);
+    std::sort(summaries.begin(), summaries.end(),
+            [](const MetricSummary& a, const MetricSummary& b) {
+                return fabs(a.total) > fabs(b.total);
+            });
+    if (limit > 0 && summaries.size() > (size_t)limit) {
+        summaries.resize(limit);
+    }
+
+    printf("Change over %.2f seconds, per second:\n", seconds);
+    printf("%-40s %16s %16s %16s  %s\n", "Metric", "Total/s", "Min/s",
+           "Max/s", "Max server");
+    for (MetricSummary& s : summaries) {
+        if (s.total == 0 && s.max == 0 && s.min == 0) {
+            continue;
+        }
+        printf("%-40s %16.1f %16.1f %16.1f  %s\n", s.name.c_str(),
+               s.total, s.min, s.max, locators[s.maxServer].c_str());
+        if (perServer) {
+            for (size_t i = 0; i < locators.size(); i++) {
+                auto it = rates[i].find(s.name);
+                if (it != rates[i].end() && it->second != 0) {
+                    printf("    %-36s %16.1f\n", locators[i].c_str(),
+                           it->second);
+                }
+            }
+        }
     }
 
     return 0;
@@ -17,9 +17,13 @@
 #include <string.h>
 #include <getopt.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <tuple>
+#include <vector>
 
 #include "ClusterMetrics.h"
 #include "Context.h"
@@ -33,9 +37,98 @@
 #include "Tub.h"
 #include "IndexLookup.h"
 #include "TableEnumerator.h"
+#include "CoordinatorClient.h"
+#include "ServerList.h"
 
 using namespace RAMCloud;
 
+/**
+ * Find the service locators of every master in the cluster that is up.
+ *
+ * \param context
+ *      Context of the client connected to the cluster.
+ * \param[out] locators
+ *      Filled in with the service locator of each master.
+ */
+void
+listMasters(Context* context, std::vector<string>* locators)
+{
+    ProtoBuf::ServerList serverList;
+    CoordinatorClient::getMasterList(context, &serverList);
+    locators->clear();
+    for (int i = 0; i < serverList.server_size(); i++) {
+        const ProtoBuf::ServerList_Entry& entry = serverList.server(i);
+        if (static_cast<ServerStatus>(entry.status()) == ServerStatus::UP) {
+            locators->push_back(entry.service_locator());
+        }
+    }
+}
+
+/**
+ * Fetch the statistics of many servers concurrently. All RPCs are issued
+ * before any is waited on, so the whole collection takes about as long as
+ * the slowest server.
+ *
+ * \param client
+ *      Client connected to the cluster.
+ * \param locators
+ *      Service locators of the servers to query.
+ * \param[out] stats
+ *      Filled in with one entry per locator. Servers that couldn't be
+ *      reached have empty statistics.
+ */
+void
+collectStatistics(RamCloud* client, std::vector<string>& locators,
+        std::vector<ProtoBuf::ServerStatistics>* stats)
+{
+    std::vector<Tub<GetServerStatisticsRpc>> rpcs(locators.size());
+    for (size_t i = 0; i < locators.size(); i++) {
+        rpcs[i].construct(client, locators[i].c_str());
+    }
+
+    stats->clear();
+    stats->resize(locators.size());
+    for (size_t i = 0; i < locators.size(); i++) {
+        try {
+            rpcs[i]->wait(stats->at(i));
+        } catch (RAMCloud::Exception& e) {
+            // Includes TransportException, for servers that are down.
+            LOG(WARNING, "Couldn't get statistics from %s: %s",
+                locators[i].c_str(), e.str().c_str());
+        }
+    }
+}
+
+/**
+ * Identifies a tablet: table id, start key hash and end key hash.
+ */
+typedef std::tuple<uint64_t, uint64_t, uint64_t> TabletKey;
+
+/**
+ * Read and write count of every tablet reported by a set of servers.
+ *
+ * \param stats
+ *      Statistics from each server.
+ * \param[out] counts
+ *      Filled in with each tablet's count and the index of the server
+ *      that reported it.
+ */
+void
+tabletCounts(std::vector<ProtoBuf::ServerStatistics>& stats,
+        std::map<TabletKey, std::pair<uint64_t, size_t>>* counts)
+{
+    counts->clear();
+    for (size_t i = 0; i < stats.size(); i++) {
+        for (int t = 0; t < stats[i].tabletentry_size(); t++) {
+            const ProtoBuf::ServerStatistics_TabletEntry& entry =
+                stats[i].tabletentry(t);
+            TabletKey key(entry.table_id(), entry.start_key_hash(),
+                          entry.end_key_hash());
+            (*counts)[key] = std::make_pair(entry.number_read_and_writes(), i);
+        }
+    }
+}
+
 int
 main(int argc, char *argv[])
 try
@@ -43,6 +136,9 @@ try
     int clientIndex;
     int numClients;
     string serverLocator;
+    bool perServer;
+    double diff;
+    int limit;
 
     // Set line buffering for stdout so that printf's and log messages
     // interleave properly.
@@ -67,7 +163,21 @@ try
 
         ("serverLocator",
          ProgramOptions::value<string>(&serverLocator),
-         "Location of the server to get stats for.");
+         "Location of the server to get stats for. If omitted, get stats "
+         "from every master in the cluster.")
+        ("perServer",
+         ProgramOptions::bool_switch(&perServer),
+         "Print each server's raw ServerStatistics too.")
+        ("diff",
+         ProgramOptions::value<double>(&diff)->
+            default_value(0),
+         "If non-zero, take two snapshots this many seconds apart and print "
+         "each tablet's read and write rate, busiest first (default: 0).")
+        ("limit",
+         ProgramOptions::value<int>(&limit)->
+            default_value(0),
+         "If non-zero, print only this many tablets in diff mode "
+         "(default: 0).");
     
     OptionParser optionParser(clientOptions, argc, argv);
     context.transportManager->setSessionTimeout(
@@ -83,9 +193,133 @@ try
     RamCloud client(&context, locator.c_str(),
             optionParser.options.getClusterName().c_str());
 
-    ProtoBuf::ServerStatistics serverStats;
-    client.getServerStatistics(serverLocator.c_str(), serverStats);
-    printf("ServerStatistics: %s\n", serverStats.ShortDebugString().c_str());
+    std::vector<string> locators;
+    if (serverLocator.size() > 0) {
+        locators.push_back(serverLocator);
+    } else {
+        listMasters(&context, &locators);
+    }
+    LOG(NOTICE, "Collecting statistics from %lu servers", locators.size());
+
+    std::vector<ProtoBuf::ServerStatistics> before;
+    uint64_t beforeStart = Cycles::rdtsc();
+    collectStatistics(&client, locators, &before);
+    uint64_t beforeEnd = Cycles::rdtsc();
+
+    if (diff == 0) {
+        if (perServer) {
+            for (size_t i = 0; i < locators.size(); i++) {
+                printf("%s: %s\n", locators[i].c_str(),
+                       before[i].ShortDebugString().c_str());
+            }
+            printf("\n");
+        }
+
+        // Per server and per table totals.
+        std::map<TabletKey, std::pair<uint64_t, size_t>> counts;
+        tabletCounts(before, &counts);
+        std::vector<uint64_t> serverOps(locators.size(), 0);
+        std::vector<int> serverTablets(locators.size(), 0);
+        std::map<uint64_t, std::pair<uint64_t, int>> tableOps;
+        uint64_t totalOps = 0;
+        for (auto& it : counts) {
+            uint64_t ops = it.second.first;
+            serverOps[it.second.second] += ops;
+            serverTablets[it.second.second]++;
+            tableOps[std::get<0>(it.first)].first += ops;
+            tableOps[std::get<0>(it.first)].second++;
+            totalOps += ops;
+        }
+
+        printf("%-40s %8s %16s %8s\n", "Server", "Tablets", "Reads+writes",
+               "Share");
+        for (size_t i = 0; i < locators.size(); i++) {
+            printf("%-40s %8d %16lu %7.1f%%\n", locators[i].c_str(),
+                   serverTablets[i], serverOps[i],
+                   totalOps ? 100.0 * serverOps[i] / totalOps : 0.0);
+        }
+        printf("\n%-40s %8s %16s %8s\n", "Table", "Tablets", "Reads+writes",
+               "Share");
+        for (auto& it : tableOps) {
+            printf("%-40lu %8d %16lu %7.1f%%\n", it.first, it.second.second,
+                   it.second.first,
+                   totalOps ? 100.0 * it.second.first / totalOps : 0.0);
+        }
+        printf("\n%-40s %8lu %16lu\n", "Total", counts.size(), totalOps);
+        return 0;
+    }
+
+    usleep((useconds_t)(diff * 1e6));
+    std::vector<ProtoBuf::ServerStatistics> after;
+    uint64_t afterStart = Cycles::rdtsc();
+    collectStatistics(&client, locators, &after);
+    uint64_t afterEnd = Cycles::rdtsc();
+    // Each server is read at some point during each collection, so measure
+    // from the middle of the first collection to the middle of the second.
+    double seconds = Cycles::toSeconds(
+            ((afterStart - beforeStart) + (afterEnd - beforeEnd)) / 2);
+
+    // Tablets that moved or split between the snapshots have no previous
+    // count to compare against, and are skipped.
+    std::map<TabletKey, std::pair<uint64_t, size_t>> beforeCounts;
+    std::map<TabletKey, std::pair<uint64_t, size_t>> afterCounts;
+    tabletCounts(before, &beforeCounts);
+    tabletCounts(after, &afterCounts);
+
+    struct TabletRate {
+        TabletKey tablet;
+        size_t server;
+        double rate;
+    };
+    std::vector<TabletRate> rates;
+    std::vector<double> serverRates(locators.size(), 0);
+    double totalRate = 0;
+    int skipped = 0;
+    for (auto& it : afterCounts) {
+        auto prev = beforeCounts.find(it.first);
+        if (prev == beforeCounts.end() ||
+                prev->second.second != it.second.second ||
+                prev->second.first > it.second.first) {
+            skipped++;
+            continue;
+        }
+        TabletRate r;
+        r.tablet = it.first;
+        r.server = it.second.second;
+        r.rate = (double)(it.second.first - prev->second.first) / seconds;
+        rates.push_back(r);
+        serverRates[r.server] += r.rate;
+        totalRate += r.rate;
+    }
+    std::sort(rates.begin(), rates.end(),
+            [](const TabletRate& a, const TabletRate& b) {
+                return a.rate > b.rate;
+            });
+    if (limit > 0 && rates.size() > (size_t)limit) {
+        rates.resize(limit);
+    }
+
+    printf("Change over %.2f seconds, per second:\n", seconds);
+    printf("%-40s %16s %8s\n", "Server", "Reads+writes/s", "Share");
+    for (size_t i = 0; i < locators.size(); i++) {
+        printf("%-40s %16.1f %7.1f%%\n", locators[i].c_str(), serverRates[i],
+               totalRate > 0 ? 100.0 * serverRates[i] / totalRate : 0.0);
+    }
+
+    printf("\n%20s %18s %18s %16s  %s\n", "Table", "Start hash", "End hash",
+           "Reads+writes/s", "Server");
+    for (TabletRate& r : rates) {
+        if (r.rate == 0) {
+            break;
+        }
+        printf("%20lu 0x%016lx 0x%016lx %16.1f  %s\n",
+               std::get<0>(r.tablet), std::get<1>(r.tablet),
+               std::get<2>(r.tablet), r.rate, locators[r.server].c_str());
+    }
+    if (skipped > 0) {
+        printf("\n%d tablets moved or changed during the interval and were "
+               "skipped.\n", skipped);
+    }
 
     return 0;
 } catch (RAMCloud::ClientException& e) {
@@ -0,0 +1,408 @@
+/* Copyright (c) 2009-2015 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+#include "Context.h"
+#include "Cycles.h"
+#include "ShortMacros.h"
+#include "OptionParser.h"
+#include "RamCloud.h"
+#include "ImageFile.h"
+#include "ImageIO.h"
+#include "SyntheticImage.h"
+
+using namespace RAMCloud;
+
+/**
+ * What a reader saw, for checking that every strategy parses the same
+ * image.
+ */
+struct ParseResult {
+  uint64_t records = 0;
+  uint64_t bytes = 0;
+  uint64_t checksum = 0;
+
+  void
+  add(uint32_t numKeys, const void* primaryKey, uint32_t keyLength,
+      uint32_t valueLength, uint64_t diskBytes)
+  {
+    uint8_t last = keyLength > 0 ? ((const uint8_t*)primaryKey)[keyLength - 1]
+        : 0;
+    checksum = checksum * 31 + numKeys + keyLength + valueLength + last;
+    records++;
+    bytes += diskBytes;
+  }
+};
+
+/**
+ * Split a comma separated list.
+ */
+static std::vector<string>
+splitList(const string& list)
+{
+  std::vector<string> items;
+  std::stringstream in(list);
+  string item;
+  while (std::getline(in, item, ',')) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+/**
+ * Get a file out of the page cache (cold) or into it (warm).
+ */
+static void
+prepareCache(const string& path, bool warm)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw Exception(HERE, "couldn't open " + path, errno);
+  }
+  if (warm) {
+    std::vector<char> buffer(1 << 20);
+    while (read(fd, &buffer[0], buffer.size()) > 0) {
+    }
+  } else {
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  }
+  close(fd);
+}
+
+/**
+ * Parse an image with one of the reader strategies.
+ */
+static ParseResult
+readImage(const string& reader, const string& path, size_t blockSize,
+    int queueDepth)
+{
+  ParseResult result;
+  if (reader == "ifstream") {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    ImageRecord record;
+    while (readImageRecord(in, &record)) {
+      result.add((uint32_t)record.keys.size(), record.keys[0].data(),
+          (uint32_t)record.keys[0].size(), (uint32_t)record.value.size(),
+          record.diskBytes);
+    }
+    return result;
+  }
+
+  std::unique_ptr<ImageBlockReader> blocks;
+  if (reader == "fread") {
+    blocks.reset(new FreadBlockReader(path, blockSize));
+  } else if (reader == "mmap") {
+    blocks.reset(new MmapBlockReader(path));
+  } else if (reader == "pread") {
+    blocks.reset(new ThreadedBlockReader(path, blockSize, queueDepth,
+        BUFFERED_IO));
+  } else if (reader == "direct") {
+    blocks.reset(new DirectBlockReader(path, blockSize));
+  } else if (reader == "io_uring") {
+    blocks.reset(new IoUringBlockReader(path, blockSize, queueDepth,
+        BUFFERED_IO));
+  } else if (reader == "io_uring_direct") {
+    blocks.reset(new IoUringBlockReader(path, blockSize, queueDepth,
+        DIRECT_IO));
+  } else if (reader == "io_uring_fadvise") {
+    blocks.reset(new IoUringBlockReader(path, blockSize, queueDepth,
+        FADVISE_IO));
+  } else {
+    throw Exception(HERE, "unknown reader " + reader, 0);
+  }
+
+  ImageRecordParser parser(blocks.get());
+  ImageRecordView view;
+  while (parser.next(&view)) {
+    result.add((uint32_t)view.keys.size(), view.keys[0].key,
+        view.keys[0].keyLength, view.valueLength, view.diskBytes);
+  }
+  return result;
+}
+
+/**
+ * Write an image with one of the writer strategies.
+ *
+ * \param[out] syncSeconds
+ *      Set to the time taken to flush the image to disk afterwards.
+ * \return
+ *      Number of bytes written.
+ */
+static uint64_t
+writeImage(const string& writer, const string& path,
+    std::vector<ImageRecord>& pool, uint64_t numRecords, size_t blockSize,
+    double* syncSeconds)
+{
+  uint64_t bytes = 0;
+  uint64_t syncStart;
+  if (writer == "ofstream") {
+    std::ofstream out(path.c_str(), std::ios::binary);
+    for (uint64_t i = 0; i < numRecords; i++) {
+      bytes += writeImageRecord(out, pool[i % pool.size()]);
+    }
+    out.close();
+    syncStart = Cycles::rdtsc();
+  } else if (writer == "fwrite") {
+    FILE* out = fopen(path.c_str(), "wb");
+    if (out == NULL) {
+      throw Exception(HERE, "couldn't create " + path, errno);
+    }
+    setvbuf(out, NULL, _IOFBF, blockSize);
+    std::vector<char> buffer;
+    std::vector<KeyInfo> keys;
+    for (uint64_t i = 0; i < numRecords; i++) {
+      ImageRecord& record = pool[i % pool.size()];
+      keys.resize(record.keys.size());
+      for (size_t k = 0; k < record.keys.size(); k++) {
+        keys[k].key = record.keys[k].data();
+        keys[k].keyLength = (KeyLength)record.keys[k].size();
+      }
+      uint64_t size = imageRecordSize((uint32_t)keys.size(), keys.data(),
+          (uint32_t)record.value.size());
+      buffer.resize(size);
+      encodeImageRecord(&buffer[0], (uint32_t)keys.size(), keys.data(),
+          record.value.data(), (uint32_t)record.value.size());
+      fwrite(&buffer[0], 1, size, out);
+      bytes += size;
+    }
+    fflush(out);
+    syncStart = Cycles::rdtsc();
+    fsync(fileno(out));
+    fclose(out);
+    *syncSeconds = Cycles::toSeconds(Cycles::rdtsc() - syncStart);
+    return bytes;
+  } else if (writer == "write" || writer == "direct" ||
+      writer == "fadvise") {
+    ImageIoMode mode = BUFFERED_IO;
+    if (writer != "write") {
+      mode = parseImageIoMode(writer);
+    }
+    ImageFileWriter out(path, mode, blockSize);
+    for (uint64_t i = 0; i < numRecords; i++) {
+      bytes += out.write(pool[i % pool.size()]);
+    }
+    syncStart = Cycles::rdtsc();
+    out.close(true);
+    *syncSeconds = Cycles::toSeconds(Cycles::rdtsc() - syncStart);
+    return bytes;
+  } else {
+    throw Exception(HERE, "unknown writer " + writer, 0);
+  }
+
+  int fd = open(path.c_str(), O_WRONLY);
+  fsync(fd);
+  close(fd);
+  *syncSeconds = Cycles::toSeconds(Cycles::rdtsc() - syncStart);
+  return bytes;
+}
+
+/**
+ * A microbenchmark for the table image I/O layer. Generates a synthetic image
+ * and measures how fast each way of writing and reading (and parsing) it
+ * goes, with the image in or out of the page cache. No RAMCloud cluster is
+ * needed.
+ */
+int
+main(int argc, char *argv[])
+try
+{
+  string dir;
+  long numRecords;
+  int keySize;
+  string valueSize;
+  string keyPattern;
+  int numSecondaryKeys;
+  uint64_t seed;
+  int blockSize;
+  int queueDepth;
+  string readers;
+  string writers;
+  string cacheModes;
+  bool keepFiles;
+
+  // Set line buffering for stdout so that printf's and log messages
+  // interleave properly.
+  setvbuf(stdout, NULL, _IOLBF, 1024);
+
+  // Need external context to set log levels with OptionParser
+  Context context(false);
+
+  OptionsDescription clientOptions("ImageBench");
+  clientOptions.add_options()
+
+    ("dir",
+     ProgramOptions::value<string>(&dir)->default_value("/tmp"),
+     "Directory for the benchmark's image files. Should be on the device "
+     "being measured [default: /tmp].")
+    ("numRecords",
+     ProgramOptions::value<long>(&numRecords)->default_value(1000000),
+     "Number of records in the image [default: 1000000].")
+    ("keySize",
+     ProgramOptions::value<int>(&keySize)->default_value(30),
+     "Size of each key in bytes [default: 30].")
+    ("valueSize",
+     ProgramOptions::value<string>(&valueSize)->default_value("100"),
+     "Distribution of value sizes in bytes: N, fixed:N, uniform:MIN:MAX or "
+     "lognormal:MEAN:STDDEV [default: 100].")
+    ("keyPattern",
+     ProgramOptions::value<string>(&keyPattern)->default_value("sequential"),
+     "Primary keys: sequential or hashed [default: sequential].")
+    ("numSecondaryKeys",
+     ProgramOptions::value<int>(&numSecondaryKeys)->default_value(0),
+     "Number of secondary keys in each record [default: 0].")
+    ("seed",
+     ProgramOptions::value<uint64_t>(&seed)->default_value(0),
+     "Seed for generating the image [default: 0].")
+    ("blockSize",
+     ProgramOptions::value<int>(&blockSize)->default_value(1 << 20),
+     "Size of each read or write for the block based strategies "
+     "[default: 1048576].")
+    ("queueDepth",
+     ProgramOptions::value<int>(&queueDepth)->default_value(8),
+     "Number of reads kept queued by the pread and io_uring readers "
+     "[default: 8].")
+    ("readers",
+     ProgramOptions::value<string>(&readers)->
+         default_value(
+             "ifstream,fread,mmap,direct,pread,io_uring,io_uring_direct,"
+             "io_uring_fadvise"),
+     "Comma separated reader strategies to measure "
+     "[default: ifstream,fread,mmap,direct,pread,io_uring,io_uring_direct,"
+     "io_uring_fadvise].")
+    ("writers",
+     ProgramOptions::value<string>(&writers)->
+         default_value("ofstream,fwrite,write,direct,fadvise"),
+     "Comma separated writer strategies to measure "
+     "[default: ofstream,fwrite,write,direct,fadvise].")
+    ("cache",
+     ProgramOptions::value<string>(&cacheModes)->default_value("cold,warm"),
+     "Comma separated page cache states to read in: cold evicts the image "
+     "first, warm reads it into the cache first [default: cold,warm].")
+    ("keepFiles",
+     ProgramOptions::bool_switch(&keepFiles),
+     "Leave the image files in dir afterwards.");
+
+  OptionParser optionParser(clientOptions, argc, argv);
+
+  SyntheticImage image;
+  image.keySize = keySize;
+  image.numSecondaryKeys = numSecondaryKeys;
+  image.seed = seed;
+  if (!image.valueSize.parse(valueSize)) {
+    fprintf(stderr, "Invalid --valueSize: %s\n", valueSize.c_str());
+    return 1;
+  }
+  if (keyPattern == "hashed") {
+    image.keyPattern = HASHED_KEYS;
+  } else if (keyPattern != "sequential") {
+    fprintf(stderr, "Invalid --keyPattern: %s\n", keyPattern.c_str());
+    return 1;
+  }
+
+  // Writers cycle through a pool of records so that generating them isn't
+  // part of what's measured.
+  std::vector<ImageRecord> pool(std::min(numRecords, 65536l));
+  for (size_t i = 0; i < pool.size(); i++) {
+    image.makeRecord(i, &pool[i]);
+  }
+
+  printf("ImageBench: {numRecords: %ld, keySize: %d, valueSize: %s, "
+      "keyPattern: %s, numSecondaryKeys: %d, blockSize: %d, "
+      "queueDepth: %d, dir: %s}\n", numRecords, keySize, valueSize.c_str(),
+      keyPattern.c_str(), numSecondaryKeys, blockSize, queueDepth,
+      dir.c_str());
+
+  printf("\n%12s %12s %12s %12s %12s\n", "writer", "seconds", "GB/s",
+      "Mrecords/s", "synced GB/s");
+  for (const string& writer : splitList(writers)) {
+    string path = dir + "/ImageBench." + writer + ".img";
+    try {
+      double syncSeconds = 0;
+      uint64_t start = Cycles::rdtsc();
+      uint64_t bytes = writeImage(writer, path, pool, numRecords, blockSize,
+          &syncSeconds);
+      double seconds = Cycles::toSeconds(Cycles::rdtsc() - start) -
+          syncSeconds;
+      printf("%12s %12.3f %12.3f %12.3f %12.3f\n", writer.c_str(), seconds,
+          (double)bytes / seconds / 1e9, (double)numRecords / seconds / 1e6,
+          (double)bytes / (seconds + syncSeconds) / 1e9);
+    } catch (Exception& e) {
+      printf("%12s unavailable: %s\n", writer.c_str(), e.str().c_str());
+    }
+    if (!keepFiles) {
+      unlink(path.c_str());
+    }
+  }
+
+  // Readers all parse the same image.
+  string path = dir + "/ImageBench.img";
+  {
+    ImageFileWriter out(path, BUFFERED_IO, blockSize);
+    for (long i = 0; i < numRecords; i++) {
+      out.write(pool[i % pool.size()]);
+    }
+    out.close(true);
+  }
+
+  printf("\n%12s %12s %12s %12s %12s\n", "reader", "cache", "seconds",
+      "GB/s", "Mrecords/s");
+  Tub<ParseResult> expected;
+  for (const string& cache : splitList(cacheModes)) {
+    for (const string& reader : splitList(readers)) {
+      try {
+        prepareCache(path, cache == "warm");
+        uint64_t start = Cycles::rdtsc();
+        ParseResult result = readImage(reader, path, blockSize, queueDepth);
+        double seconds = Cycles::toSeconds(Cycles::rdtsc() - start);
+        printf("%12s %12s %12.3f %12.3f %12.3f\n", reader.c_str(),
+            cache.c_str(), seconds, (double)result.bytes / seconds / 1e9,
+            (double)result.records / seconds / 1e6);
+
+        if (!expected) {
+          expected.construct(result);
+        } else if (result.records != expected->records ||
+            result.checksum != expected->checksum) {
+          printf("%12s parsed %lu records (checksum %lx), expected %lu "
+              "(checksum %lx)\n", reader.c_str(), result.records,
+              result.checksum, expected->records, expected->checksum);
+        }
+      } catch (Exception& e) {
+        printf("%12s %12s unavailable: %s\n", reader.c_str(), cache.c_str(),
+            e.str().c_str());
+      }
+    }
+  }
+
+  if (!keepFiles) {
+    unlink(path.c_str());
+  }
+
+  return 0;
+} catch (Exception& e) {
+    fprintf(stderr, "Exception: %s\n", e.str().c_str());
+    return 1;
+}
@@ -0,0 +1,406 @@
+/* Copyright (c) 2009-2015 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RAMCLOUDTOOLS_IMAGEFILE_H
+#define RAMCLOUDTOOLS_IMAGEFILE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "RamCloud.h"
+#include "Tub.h"
+
+/*
+ * Table image files (.img) are a plain concatenation of records, one per
+ * object. A record for an object with only a primary key is:
+ *
+ *   uint32_t keyLength | key | uint32_t dataLength | data
+ *
+ * RAMCloud keys are at most 64KB long, so the top bit of keyLength is never
+ * set in such a record. Objects with secondary keys are written with that bit
+ * set and the number of keys in the low bits, followed by each key:
+ *
+ *   uint32_t (IMAGE_MULTIKEY_FLAG | numKeys) |
+ *       numKeys x (uint32_t keyLength | key) |
+ *       uint32_t dataLength | data
+ *
+ * Key 0 is the primary key, key i is the object's key for secondary index i.
+ * Images without secondary keys are therefore byte-for-byte what older
+ * versions of these tools produced.
+ */
+#define IMAGE_MULTIKEY_FLAG 0x80000000u
+
+namespace RAMCloud {
+
+/**
+ * One object read from a table image file.
+ */
+struct ImageRecord {
+  /*
+   * The object's keys. keys[0] is the primary key, keys[i] is the key for
+   * secondary index i.
+   */
+  std::vector<std::string> keys;
+
+  /*
+   * The object's value.
+   */
+  std::string value;
+
+  /*
+   * Number of bytes the record occupied in the image file.
+   */
+  uint64_t diskBytes = 0;
+};
+
+/**
+ * Read the next record from a table image stream.
+ *
+ * \param in
+ *      Stream positioned at the start of a record.
+ * \param[out] record
+ *      Filled in with the record's contents. Its buffers are reused between
+ *      calls, so passing the same record repeatedly avoids reallocation.
+ * \return
+ *      True if a complete record was read, false at the end of the stream.
+ */
+inline bool
+readImageRecord(std::istream& in, ImageRecord* record)
+{
+  uint32_t header;
+  if (!in.read((char*)&header, sizeof(header))) {
+    return false;
+  }
+
+  uint32_t numKeys = 1;
+  uint32_t keyLength = header;
+  record->diskBytes = sizeof(header);
+  if (header & IMAGE_MULTIKEY_FLAG) {
+    numKeys = header & ~IMAGE_MULTIKEY_FLAG;
+    if (!in.read((char*)&keyLength, sizeof(keyLength))) {
+      return false;
+    }
+    record->diskBytes += sizeof(keyLength);
+  }
+
+  record->keys.resize(numKeys);
+  for (uint32_t i = 0; i < numKeys; i++) {
+    if (i > 0) {
+      if (!in.read((char*)&keyLength, sizeof(keyLength))) {
+        return false;
+      }
+      record->diskBytes += sizeof(keyLength);
+    }
+    record->keys[i].resize(keyLength);
+    if (!in.read(&record->keys[i][0], keyLength)) {
+      return false;
+    }
+    record->diskBytes += keyLength;
+  }
+
+  uint32_t dataLength;
+  if (!in.read((char*)&dataLength, sizeof(dataLength))) {
+    return false;
+  }
+  record->value.resize(dataLength);
+  if (!in.read(&record->value[0], dataLength)) {
+    return false;
+  }
+  record->diskBytes += sizeof(dataLength) + dataLength;
+
+  return true;
+}
+
+/**
+ * One record parsed in place from a buffer of table image data. Its keys and
+ * value point into that buffer.
+ */
+struct ImageRecordView {
+  /*
+   * The object's keys, primary key first.
+   */
+  std::vector<KeyInfo> keys;
+
+  /*
+   * The object's value.
+   */
+  const char* value = NULL;
+
+  /*
+   * Length of the object's value in bytes.
+   */
+  uint32_t valueLength = 0;
+
+  /*
+   * Number of bytes the record occupies in the image.
+   */
+  uint64_t diskBytes = 0;
+};
+
+/**
+ * Parse the record at the start of a buffer of table image data, without
+ * copying it.
+ *
+ * \param data
+ *      Start of the record.
+ * \param length
+ *      Number of bytes available at data.
+ * \param[out] view
+ *      Filled in with the record. Its vectors are reused between calls.
+ * \return
+ *      True if the buffer holds a complete record, false if it ends partway
+ *      through one.
+ */
+inline bool
+parseImageRecord(const char* data, size_t length, ImageRecordView* view)
+{
+  size_t offset = 0;
+  uint32_t header;
+  if (length < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, data, sizeof(header));
+  offset += sizeof(header);
+
+  uint32_t numKeys = 1;
+  if (header & IMAGE_MULTIKEY_FLAG) {
+    numKeys = header & ~IMAGE_MULTIKEY_FLAG;
+  } else {
+    offset = 0;
+  }
+
+  view->keys.resize(numKeys);
+  for (uint32_t i = 0; i < numKeys; i++) {
+    uint32_t keyLength;
+    if (length - offset < sizeof(keyLength)) {
+      return false;
+    }
+    memcpy(&keyLength, data + offset, sizeof(keyLength));
+    offset += sizeof(keyLength);
+    if (length - offset < keyLength) {
+      return false;
+    }
+    view->keys[i].key = data + offset;
+    view->keys[i].keyLength = (KeyLength)keyLength;
+    offset += keyLength;
+  }
+
+  uint32_t dataLength;
+  if (length - offset < sizeof(dataLength)) {
+    return false;
+  }
+  memcpy(&dataLength, data + offset, sizeof(dataLength));
+  offset += sizeof(dataLength);
+  if (length - offset < dataLength) {
+    return false;
+  }
+  view->value = data + offset;
+  view->valueLength = dataLength;
+  view->diskBytes = offset + dataLength;
+
+  return true;
+}
+
+/**
+ * Return the number of bytes a record occupies in a table image.
+ */
+inline uint64_t
+imageRecordSize(uint32_t numKeys, const KeyInfo* keys, uint32_t dataLength)
+{
+  uint64_t bytes = (numKeys > 1 ? sizeof(uint32_t) : 0) +
+      sizeof(uint32_t) + dataLength;
+  for (uint32_t i = 0; i < numKeys; i++) {
+    bytes += sizeof(uint32_t) + keys[i].keyLength;
+  }
+  return bytes;
+}
+
+/**
+ * Encode a record in table image format into a buffer.
+ *
+ * \param out
+ *      Buffer of at least imageRecordSize() bytes.
+ * \param numKeys
+ *      Number of keys in the keys array.
+ * \param keys
+ *      The object's keys, primary key first.
+ * \param data
+ *      The object's value.
+ * \param dataLength
+ *      Length of the object's value in bytes.
+ * \return
+ *      The byte just past the encoded record.
+ */
+inline char*
+encodeImageRecord(char* out, uint32_t numKeys, const KeyInfo* keys,
+    const void* data, uint32_t dataLength)
+{
+  if (numKeys > 1) {
+    uint32_t header = IMAGE_MULTIKEY_FLAG | numKeys;
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+  }
+
+  for (uint32_t i = 0; i < numKeys; i++) {
+    uint32_t keyLength = keys[i].keyLength;
+    memcpy(out, &keyLength, sizeof(keyLength));
+    out += sizeof(keyLength);
+    memcpy(out, keys[i].key, keyLength);
+    out += keyLength;
+  }
+
+  memcpy(out, &dataLength, sizeof(dataLength));
+  out += sizeof(dataLength);
+  memcpy(out, data, dataLength);
+  return out + dataLength;
+}
+
+/**
+ * Append a record to a table image stream.
+ *
+ * \param out
+ *      Stream to write to.
+ * \param numKeys
+ *      Number of keys in the keys array. Records with a single key are
+ *      written in the original single-key format.
+ * \param keys
+ *      The object's keys, primary key first.
+ * \param data
+ *      The object's value.
+ * \param dataLength
+ *      Length of the object's value in bytes.
+ * \return
+ *      Number of bytes written.
+ */
+inline uint64_t
+writeImageRecord(std::ostream& out, uint32_t numKeys, const KeyInfo* keys,
+    const void* data, uint32_t dataLength)
+{
+  uint64_t bytes = 0;
+  if (numKeys > 1) {
+    uint32_t header = IMAGE_MULTIKEY_FLAG | numKeys;
+    out.write((char*) &header, sizeof(uint32_t));
+    bytes += sizeof(uint32_t);
+  }
+
+  for (uint32_t i = 0; i < numKeys; i++) {
+    uint32_t keyLength = keys[i].keyLength;
+    out.write((char*) &keyLength, sizeof(uint32_t));
+    out.write((char*) keys[i].key, keyLength);
+    bytes += sizeof(uint32_t) + keyLength;
+  }
+
+  out.write((char*) &dataLength, sizeof(uint32_t));
+  out.write((char*) data, dataLength);
+  bytes += sizeof(uint32_t) + dataLength;
+
+  return bytes;
+}
+
+/**
+ * Append a record to a table image stream.
+ *
+ * \param out
+ *      Stream to write to.
+ * \param record
+ *      Record to write.
+ * \return
+ *      Number of bytes written.
+ */
+inline uint64_t
+writeImageRecord(std::ostream& out, const ImageRecord& record)
+{
+  std::vector<KeyInfo> keys(record.keys.size());
+  for (size_t i = 0; i < record.keys.size(); i++) {
+    keys[i].key = record.keys[i].data();
+    keys[i].keyLength = (KeyLength)record.keys[i].size();
+  }
+  return writeImageRecord(out, (uint32_t)keys.size(), keys.data(),
+      record.value.data(), (uint32_t)record.value.size());
+}
+
+/**
+ * Construct the MultiWriteObjects for a batch of image records, using every
+ * key of each record so that multi-key objects get their secondary index
+ * entries written along with them.
+ *
+ * \param tableId
+ *      Table to write the objects to.
+ * \param records
+ *      Records to write. Must stay unmodified until the multiwrite completes.
+ * \param count
+ *      Number of records (from the start of records) in the batch.
+ * \param[out] keyInfo
+ *      Storage for the batch's key descriptors. Must stay unmodified until
+ *      the multiwrite completes.
+ * \param[out] objects
+ *      Array of at least count entries, filled in with the batch's objects.
+ * \param[out] requests
+ *      Array of at least count entries, filled in with pointers to objects.
+ * \return
+ *      Total number of key and value bytes in the batch.
+ */
+inline uint64_t
+prepareMultiWrite(uint64_t tableId, std::vector<ImageRecord>& records,
+    uint32_t count, std::vector<KeyInfo>* keyInfo,
+    Tub<MultiWriteObject>* objects, MultiWriteObject** requests)
+{
+  // Size keyInfo up front; objects keep pointers into it.
+  size_t totalKeys = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    totalKeys += records[i].keys.size();
+  }
+  keyInfo->resize(totalKeys);
+
+  uint64_t bytes = 0;
+  size_t k = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    ImageRecord& record = records[i];
+    KeyInfo* keys = &keyInfo->at(k);
+    for (size_t j = 0; j < record.keys.size(); j++) {
+      keyInfo->at(k).key = record.keys[j].data();
+      keyInfo->at(k).keyLength = (KeyLength)record.keys[j].size();
+      bytes += record.keys[j].size();
+      k++;
+    }
+
+    if (record.keys.size() == 1) {
+      objects[i].construct(tableId,
+                           (const void*) record.keys[0].data(),
+                           (KeyLength) record.keys[0].size(),
+                           (const void*) record.value.data(),
+                           (uint32_t) record.value.size());
+    } else {
+      objects[i].construct(tableId,
+                           (const void*) record.value.data(),
+                           (uint32_t) record.value.size(),
+                           (KeyCount) record.keys.size(),
+                           keys);
+    }
+    requests[i] = objects[i].get();
+    bytes += record.value.size();
+  }
+
+  return bytes;
+}
+
+} // namespace RAMCloud
+
+#endif // RAMCLOUDTOOLS_IMAGEFILE_H
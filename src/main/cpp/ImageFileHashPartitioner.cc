@@ -34,6 +34,8 @@
 #include "Tub.h"
 #include "IndexLookup.h"
 #include "TableEnumerator.h"
+#include "ImageFile.h"
+#include "ImageIO.h"
 
 using namespace RAMCloud;
 
@@ -58,6 +60,7 @@ try
   uint64_t tableId;
   uint64_t serverSpan;
   string outputDir;
+  ImageReadOptions readOptions;
 
   // Set line buffering for stdout so that printf's and log messages
   // interleave properly.
@@ -81,17 +84,20 @@ try
     ("outputDir",
      ProgramOptions::value<string>(&outputDir),
      "Directory to write tablets in.");
+  addImageReadOptions(clientOptions, &readOptions);
   
   OptionParser optionParser(clientOptions, argc, argv);
+  ImageIoMode ioMode = parseImageIoMode(readOptions.ioMode);
 
   printf("ImageFileHashPartitioner: {inputFile: %s, tableId: %lu, "
-      "serverSpan: %lu, outputDir: %s}\n", inputFile.c_str(), tableId, 
-      serverSpan, outputDir.c_str());
+      "serverSpan: %lu, outputDir: %s, ioMode: %s}\n", inputFile.c_str(),
+      tableId, serverSpan, outputDir.c_str(), readOptions.ioMode.c_str());
 
   // Calculate the hash range for each tablet and open tablet image files.
   uint64_t endKeyHashes[serverSpan];
   uint64_t tabletRange = 1 + ~0UL / serverSpan;
-  std::ofstream outFiles[serverSpan];
+  // One write buffer per tablet, so keep them smaller than usual.
+  std::vector<std::unique_ptr<ImageFileWriter>> outFiles(serverSpan);
   for (uint32_t i = 0; i < serverSpan; i++) {
     uint64_t startKeyHash = i * tabletRange;
     uint64_t endKeyHash = startKeyHash + tabletRange - 1;
@@ -112,59 +118,27 @@ try
           fileName.substr(0,fileName.find(".img")).c_str(),
           i + 1, tableId, startKeyHash, endKeyHash); 
     }
-    outFiles[i].open(outFileName, std::ios::binary);
+    outFiles[i].reset(new ImageFileWriter(outFileName, ioMode, 256 << 10));
     printf("Creating %s ...\n", outFileName);
     free(outFileName);
   }
 
+  std::unique_ptr<ImageBatchReader> reader;
   if (inputFile.compare("-") == 0) {
-    uint64_t totalBytesProcessed = 0;
-    char lenBuffer[sizeof(uint32_t)];
-    while(std::cin.read(lenBuffer, sizeof(lenBuffer))) {
-      uint32_t keyLength = *((uint32_t*) lenBuffer); 
-      char keyBuffer[keyLength];
-      std::cin.read(keyBuffer, keyLength);
-      
-      std::cin.read(lenBuffer, sizeof(lenBuffer));
-      uint32_t dataLength = *((uint32_t*) lenBuffer);
-      char dataBuffer[dataLength];
-      std::cin.read(dataBuffer, dataLength);
-
-      uint64_t keyHash = Key::getHash(tableId, (const void*)keyBuffer, 
-          (uint16_t)keyLength);
-
-      uint64_t tablet = 0;
-      for (uint32_t i = 0; i < serverSpan; i++) {
-        if (keyHash <= endKeyHashes[i]) {
-          tablet = i;
-          break;
-        }
-      }
+    reader.reset(new ImageBatchReader(std::cin, 1000));
+  } else {
+    reader.reset(new ImageBatchReader(inputFile, readOptions, 1000));
+  }
 
-      outFiles[tablet].write((char*) &keyLength, sizeof(uint32_t));
-      outFiles[tablet].write((char*) keyBuffer, keyLength);
-      outFiles[tablet].write((char*) &dataLength, sizeof(uint32_t));
-      outFiles[tablet].write((char*) dataBuffer, dataLength);
+  uint64_t totalBytesProcessed = 0;
+  ImageBatch* batch;
+  while ((batch = reader->next()) != NULL) {
+    for (uint32_t b = 0; b < batch->count; b++) {
+      const ImageRecord& record = batch->records[b];
 
-      totalBytesProcessed += sizeof(uint32_t) * 2 + keyLength + dataLength;
-    }
-  } else {
-    std::ifstream infile(inputFile);
-
-    uint64_t totalBytesProcessed = 0;
-    char lenBuffer[sizeof(uint32_t)];
-    while(infile.read(lenBuffer, sizeof(lenBuffer))) {
-      uint32_t keyLength = *((uint32_t*) lenBuffer); 
-      char keyBuffer[keyLength];
-      infile.read(keyBuffer, keyLength);
-      
-      infile.read(lenBuffer, sizeof(lenBuffer));
-      uint32_t dataLength = *((uint32_t*) lenBuffer);
-      char dataBuffer[dataLength];
-      infile.read(dataBuffer, dataLength);
-
-      uint64_t keyHash = Key::getHash(tableId, (const void*)keyBuffer, 
-          (uint16_t)keyLength);
+      // Objects are placed by the hash of their primary key only.
+      uint64_t keyHash = Key::getHash(tableId, 
+          (const void*)record.keys[0].data(), (uint16_t)record.keys[0].size());
 
       uint64_t tablet = 0;
       for (uint32_t i = 0; i < serverSpan; i++) {
@@ -174,17 +148,14 @@ try
         }
       }
 
-      outFiles[tablet].write((char*) &keyLength, sizeof(uint32_t));
-      outFiles[tablet].write((char*) keyBuffer, keyLength);
-      outFiles[tablet].write((char*) &dataLength, sizeof(uint32_t));
-      outFiles[tablet].write((char*) dataBuffer, dataLength);
+      outFiles[tablet]->write(record);
 
-      totalBytesProcessed += sizeof(uint32_t) * 2 + keyLength + dataLength;
+      totalBytesProcessed += record.diskBytes;
     }
   }
 
   for (uint32_t i = 0; i < serverSpan; i++) {
-    outFiles[i].close();
+    outFiles[i]->close();
   }
 
   printf("Done! Partitioned table image into %lu tablets.\n", serverSpan);
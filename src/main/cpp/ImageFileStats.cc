@@ -17,9 +17,11 @@
 #include <string.h>
 #include <getopt.h>
 #include <assert.h>
+#include <math.h>
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 
 #include "ClusterMetrics.h"
 #include "Context.h"
@@ -33,6 +35,7 @@
 #include "Tub.h"
 #include "IndexLookup.h"
 #include "TableEnumerator.h"
+#include "ImageFile.h"
 
 using namespace RAMCloud;
 
@@ -62,29 +65,32 @@ try
   uint64_t totalFileSize = 0;
   uint64_t totalObjectSize = 0;
   uint64_t totalMetadataSize = 0;
-  char lenBuffer[sizeof(uint32_t)];
-  while(std::cin.read(lenBuffer, sizeof(lenBuffer))) {
-    totalMetadataSize += sizeof(lenBuffer);
-    totalFileSize += sizeof(lenBuffer);
-
-    uint32_t keyLength = *((uint32_t*) lenBuffer); 
-    char keyBuffer[keyLength];
-    std::cin.read(keyBuffer, keyLength);
-    totalKeySize += (uint64_t)keyLength;
-    totalObjectSize += (uint64_t)keyLength;
-    totalFileSize += (uint64_t)keyLength;
-
-    std::cin.read(lenBuffer, sizeof(lenBuffer));
-    totalMetadataSize += sizeof(lenBuffer);
-    totalFileSize += sizeof(lenBuffer);
-
-    uint32_t dataLength = *((uint32_t*) lenBuffer);
-    char dataBuffer[dataLength];
-    std::cin.read(dataBuffer, dataLength);
-    totalValueSize += (uint64_t)dataLength;
-    totalObjectSize += (uint64_t)dataLength;
-    totalFileSize += (uint64_t)dataLength;
-
+  uint64_t totalSecondaryKeySize = 0;
+  uint64_t multiKeyObjectCount = 0;
+  uint64_t totalSecondaryKeyCount = 0;
+  double valueSizeSquares = 0;
+  ImageRecord record;
+  while(readImageRecord(std::cin, &record)) {
+    uint64_t keySize = 0;
+    for (size_t i = 0; i < record.keys.size(); i++) {
+      keySize += record.keys[i].size();
+      if (i > 0) {
+        totalSecondaryKeySize += record.keys[i].size();
+      }
+    }
+    uint64_t dataLength = record.value.size();
+    valueSizeSquares += (double)dataLength * (double)dataLength;
+    totalSecondaryKeyCount += record.keys.size() - 1;
+
+    totalKeySize += keySize;
+    totalValueSize += dataLength;
+    totalObjectSize += keySize + dataLength;
+    totalMetadataSize += record.diskBytes - keySize - dataLength;
+    totalFileSize += record.diskBytes;
+
+    if (record.keys.size() > 1) {
+      multiKeyObjectCount++;
+    }
     totalObjectCount++;
   }
 
@@ -94,9 +100,17 @@ try
   printf("    Raw Object Bytes: %lu, (%.1f%)\n", totalObjectSize, 100.0 * (double)totalObjectSize / (double)totalFileSize);
   printf("      Total Key Bytes: %lu, (%.1f%)\n", totalKeySize, 100.0 * (double)totalKeySize / (double)totalObjectSize);
   printf("      Total Value Bytes: %lu, (%.1f%)\n", totalValueSize, 100.0 * (double)totalValueSize / (double)totalObjectSize);
+  printf("        Secondary Key Bytes: %lu, (%.1f%%)\n", totalSecondaryKeySize, 100.0 * (double)totalSecondaryKeySize / (double)totalObjectSize);
   printf("  Total Object Count: %lu\n", totalObjectCount);
+  printf("  Objects With Secondary Keys: %lu\n", multiKeyObjectCount);
   printf("  Average Key Size: %lu\n", totalKeySize / totalObjectCount);
   printf("  Average Value Size: %lu\n", totalValueSize / totalObjectCount);
+  double meanValueSize = (double)totalValueSize / (double)totalObjectCount;
+  printf("  Value Size Std Dev: %.0f\n", sqrt(std::max(0.0,
+      valueSizeSquares / (double)totalObjectCount -
+      meanValueSize * meanValueSize)));
+  printf("  Average Secondary Key Count: %.2f\n",
+      (double)totalSecondaryKeyCount / (double)totalObjectCount);
 
   return 0;
 } catch (Exception& e) {
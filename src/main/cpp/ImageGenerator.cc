@@ -0,0 +1,347 @@
+/* Copyright (c) 2009-2015 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "Context.h"
+#include "Cycles.h"
+#include "ShortMacros.h"
+#include "OptionParser.h"
+#include "RamCloud.h"
+#include "ImageFile.h"
+#include "ImageIO.h"
+#include "SyntheticImage.h"
+
+using namespace RAMCloud;
+
+/*
+ * Records generated per chunk when writing a single image file.
+ */
+#define RECORDS_PER_CHUNK 4096
+
+/**
+ * State shared by the generator threads.
+ */
+struct Generator {
+  Generator()
+    : image()
+    , numRecords(0)
+    , numPartitions(0)
+    , outputFile()
+    , splitSuffixFormat()
+    , nextWork(0)
+    , turnMutex()
+    , turn()
+    , nextChunkToWrite(0)
+    , fd(-1)
+    , bytesWritten(0)
+    , recordsWritten(0)
+    , failed(false)
+  {}
+
+  SyntheticImage image;
+  uint64_t numRecords;
+  int numPartitions;
+  std::string outputFile;
+  std::string splitSuffixFormat;
+
+  /*
+   * Next chunk (single file) or partition to generate.
+   */
+  std::atomic<uint64_t> nextWork;
+
+  /*
+   * Threads take turns appending their chunks to a single file, in order.
+   */
+  std::mutex turnMutex;
+  std::condition_variable turn;
+  uint64_t nextChunkToWrite;
+  int fd;
+
+  std::atomic<uint64_t> bytesWritten;
+  std::atomic<uint64_t> recordsWritten;
+  std::atomic<bool> failed;
+};
+
+/**
+ * Generate chunks of a single image file. Each thread encodes a chunk in
+ * memory, then waits its turn to append it, so the file comes out in record
+ * order while generation runs in parallel.
+ */
+void
+chunkGeneratorThread(Generator* gen)
+{
+  uint64_t numChunks = (gen->numRecords + RECORDS_PER_CHUNK - 1) /
+      RECORDS_PER_CHUNK;
+  ImageRecord record;
+  std::vector<KeyInfo> keys;
+  std::string chunk;
+
+  while (!gen->failed) {
+    uint64_t chunkIndex = gen->nextWork++;
+    if (chunkIndex >= numChunks) {
+      break;
+    }
+
+    uint64_t first = chunkIndex * RECORDS_PER_CHUNK;
+    uint64_t last = std::min(first + RECORDS_PER_CHUNK, gen->numRecords);
+    chunk.clear();
+    for (uint64_t i = first; i < last; i++) {
+      gen->image.makeRecord(i, &record);
+      keys.resize(record.keys.size());
+      for (size_t k = 0; k < record.keys.size(); k++) {
+        keys[k].key = record.keys[k].data();
+        keys[k].keyLength = (KeyLength)record.keys[k].size();
+      }
+      size_t offset = chunk.size();
+      chunk.resize(offset + imageRecordSize((uint32_t)keys.size(),
+          keys.data(), (uint32_t)record.value.size()));
+      encodeImageRecord(&chunk[offset], (uint32_t)keys.size(), keys.data(),
+          record.value.data(), (uint32_t)record.value.size());
+    }
+
+    std::unique_lock<std::mutex> lock(gen->turnMutex);
+    gen->turn.wait(lock, [&] {
+      return gen->nextChunkToWrite == chunkIndex || gen->failed;
+    });
+    if (gen->failed) {
+      break;
+    }
+    size_t done = 0;
+    while (done < chunk.size()) {
+      ssize_t n = write(gen->fd, chunk.data() + done, chunk.size() - done);
+      if (n < 0) {
+        fprintf(stderr, "Write failed: %s\n", strerror(errno));
+        gen->failed = true;
+        break;
+      }
+      done += n;
+    }
+    gen->bytesWritten += chunk.size();
+    gen->recordsWritten += last - first;
+    gen->nextChunkToWrite++;
+    gen->turn.notify_all();
+  }
+}
+
+/**
+ * Generate whole partitions, each into its own file.
+ */
+void
+partitionGeneratorThread(Generator* gen)
+{
+  ImageRecord record;
+  while (!gen->failed) {
+    uint64_t partition = gen->nextWork++;
+    if (partition >= (uint64_t)gen->numPartitions) {
+      break;
+    }
+
+    char* fileName;
+    asprintf(&fileName, (gen->outputFile + gen->splitSuffixFormat).c_str(),
+        (int)partition);
+    std::string path(fileName);
+    free(fileName);
+
+    uint64_t first = gen->numRecords * partition / gen->numPartitions;
+    uint64_t last = gen->numRecords * (partition + 1) / gen->numPartitions;
+    try {
+      ImageFileWriter out(path, BUFFERED_IO, 1 << 20);
+      for (uint64_t i = first; i < last; i++) {
+        gen->image.makeRecord(i, &record);
+        out.write(record);
+      }
+      gen->bytesWritten += out.size();
+      out.close();
+    } catch (Exception& e) {
+      fprintf(stderr, "Writing %s failed: %s\n", path.c_str(),
+          e.str().c_str());
+      gen->failed = true;
+      return;
+    }
+    gen->recordsWritten += last - first;
+  }
+}
+
+/**
+ * A utility for generating synthetic table images, for rehearsing bulk loads
+ * and benchmarking the loaders and partitioners without production data.
+ * The same options always produce the same image, however many threads are
+ * used.
+ */
+int
+main(int argc, char *argv[])
+try
+{
+  long numRecords;
+  string outputFile;
+  int numPartitions;
+  string splitSuffixFormat;
+  int numThreads;
+  int keySize;
+  string keyPattern;
+  int numSecondaryKeys;
+  string valueSize;
+  string fitStats;
+  double compressibility;
+  uint64_t seed;
+
+  // Set line buffering for stdout so that printf's and log messages
+  // interleave properly.
+  setvbuf(stdout, NULL, _IOLBF, 1024);
+
+  // Need external context to set log levels with OptionParser
+  Context context(false);
+
+  OptionsDescription clientOptions("ImageGenerator");
+  clientOptions.add_options()
+
+    ("numRecords",
+     ProgramOptions::value<long>(&numRecords)->default_value(1000000),
+     "Number of records to generate [default: 1000000].")
+    ("outputFile",
+     ProgramOptions::value<string>(&outputFile),
+     "Image file to write. With --numPartitions, the base name of the "
+     "partitions.")
+    ("numPartitions",
+     ProgramOptions::value<int>(&numPartitions)->default_value(0),
+     "Number of partitions to split the image into, named with "
+     "--splitSuffixFormat as TableImageSplitter would. 0 writes a single "
+     "file [default: 0].")
+    ("splitSuffixFormat",
+     ProgramOptions::value<string>(&splitSuffixFormat)->
+         default_value(".part%04d"),
+     "Format string of the suffix to use for partitions. Must contain "
+     "exactly one %d [default: \".part%04d\"].")
+    ("numThreads",
+     ProgramOptions::value<int>(&numThreads)->default_value(1),
+     "Number of threads generating records [default: 1].")
+    ("keySize",
+     ProgramOptions::value<int>(&keySize)->default_value(30),
+     "Size of each key in bytes [default: 30].")
+    ("keyPattern",
+     ProgramOptions::value<string>(&keyPattern)->default_value("sequential"),
+     "Primary keys: sequential (sorted by record number) or hashed (unique "
+     "but unordered) [default: sequential].")
+    ("numSecondaryKeys",
+     ProgramOptions::value<int>(&numSecondaryKeys)->default_value(0),
+     "Number of secondary keys in each record [default: 0].")
+    ("valueSize",
+     ProgramOptions::value<string>(&valueSize)->default_value("100"),
+     "Distribution of value sizes in bytes: N, fixed:N, uniform:MIN:MAX or "
+     "lognormal:MEAN:STDDEV [default: 100].")
+    ("fitStats",
+     ProgramOptions::value<string>(&fitStats)->default_value(""),
+     "File holding ImageFileStats output for an existing image. Its key "
+     "size, secondary key count and value sizes are matched, overriding "
+     "--keySize, --numSecondaryKeys and --valueSize [default: ].")
+    ("compressibility",
+     ProgramOptions::value<double>(&compressibility)->default_value(0),
+     "Fraction of each value made of repeated bytes rather than random ones, "
+     "from 0 (incompressible) to 1 [default: 0].")
+    ("seed",
+     ProgramOptions::value<uint64_t>(&seed)->default_value(0),
+     "Seed for generating the image [default: 0].");
+
+  OptionParser optionParser(clientOptions, argc, argv);
+
+  Generator gen;
+  gen.numRecords = numRecords;
+  gen.numPartitions = numPartitions;
+  gen.outputFile = outputFile;
+  gen.splitSuffixFormat = splitSuffixFormat;
+  gen.image.keySize = keySize;
+  gen.image.numSecondaryKeys = numSecondaryKeys;
+  gen.image.compressibility = std::min(std::max(compressibility, 0.0), 1.0);
+  gen.image.seed = seed;
+
+  if (outputFile.empty()) {
+    fprintf(stderr, "--outputFile is required\n");
+    return 1;
+  }
+  if (keyPattern == "hashed") {
+    gen.image.keyPattern = HASHED_KEYS;
+  } else if (keyPattern != "sequential") {
+    fprintf(stderr, "Invalid --keyPattern: %s\n", keyPattern.c_str());
+    return 1;
+  }
+  if (fitStats.size() > 0) {
+    if (!fitImageStats(fitStats, &gen.image)) {
+      fprintf(stderr, "Couldn't read image statistics from %s\n",
+          fitStats.c_str());
+      return 1;
+    }
+  } else if (!gen.image.valueSize.parse(valueSize)) {
+    fprintf(stderr, "Invalid --valueSize: %s\n", valueSize.c_str());
+    return 1;
+  }
+
+  printf("ImageGenerator: {numRecords: %ld, outputFile: %s, "
+      "numPartitions: %d, numThreads: %d, keySize: %u, keyPattern: %s, "
+      "numSecondaryKeys: %u, valueSize: %s %.0f %.0f, compressibility: %.2f, "
+      "seed: %lu}\n", numRecords, outputFile.c_str(), numPartitions,
+      numThreads, gen.image.keySize, keyPattern.c_str(),
+      gen.image.numSecondaryKeys,
+      gen.image.valueSize.kind == SizeDistribution::FIXED ? "fixed" :
+      gen.image.valueSize.kind == SizeDistribution::UNIFORM ? "uniform" :
+      "lognormal", gen.image.valueSize.a, gen.image.valueSize.b,
+      gen.image.compressibility, seed);
+
+  void (*generatorThread)(Generator*) = partitionGeneratorThread;
+  if (numPartitions == 0) {
+    gen.fd = open(outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (gen.fd < 0) {
+      fprintf(stderr, "Couldn't create %s: %s\n", outputFile.c_str(),
+          strerror(errno));
+      return 1;
+    }
+    generatorThread = chunkGeneratorThread;
+  }
+
+  uint64_t start = Cycles::rdtsc();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < numThreads; i++) {
+    threads.emplace_back(generatorThread, &gen);
+  }
+  for (int i = 0; i < numThreads; i++) {
+    threads[i].join();
+  }
+  if (gen.fd >= 0) {
+    close(gen.fd);
+  }
+  double seconds = Cycles::toSeconds(Cycles::rdtsc() - start);
+
+  if (gen.failed) {
+    return 1;
+  }
+  printf("Generated %lu records, %lu bytes in %.2fs (%.1f MB/s, "
+      "%.0f records/s)\n", gen.recordsWritten.load(),
+      gen.bytesWritten.load(), seconds,
+      (double)gen.bytesWritten / seconds / 1e6,
+      (double)gen.recordsWritten / seconds);
+
+  return 0;
+} catch (Exception& e) {
+    fprintf(stderr, "Exception: %s\n", e.str().c_str());
+    return 1;
+}
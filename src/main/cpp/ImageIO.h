@@ -0,0 +1,1763 @@
+/* Copyright (c) 2009-2015 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RAMCLOUDTOOLS_IMAGEIO_H
+#define RAMCLOUDTOOLS_IMAGEIO_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "OptionParser.h"
+#include "ImageFile.h"
+
+/*
+ * Block readers hand a table image to a parser in large blocks rather than
+ * record by record, so that the cost of getting bytes off the disk can be
+ * separated from the cost of parsing them, and so that different ways of
+ * reading (stdio, mmap, O_DIRECT, io_uring) can be swapped in underneath the
+ * same parser.
+ */
+
+/*
+ * Alignment of buffers, offsets and lengths for O_DIRECT I/O.
+ */
+#define IMAGE_IO_ALIGNMENT 4096
+
+namespace RAMCloud {
+
+/**
+ * Round a length up to a multiple of IMAGE_IO_ALIGNMENT.
+ */
+inline size_t
+alignedLength(size_t length)
+{
+  return (length + IMAGE_IO_ALIGNMENT - 1) & ~(size_t)(IMAGE_IO_ALIGNMENT - 1);
+}
+
+/**
+ * Allocate a buffer suitable for O_DIRECT I/O. Free it with free().
+ */
+inline char*
+allocAligned(size_t length)
+{
+  void* buffer;
+  if (posix_memalign(&buffer, IMAGE_IO_ALIGNMENT, alignedLength(length))
+      != 0) {
+    throw Exception(HERE, "couldn't allocate I/O buffer", errno);
+  }
+  return (char*)buffer;
+}
+
+/**
+ * How the image tools use the page cache for the files they stream through.
+ * A bulk tool reads or writes each byte once, so on a shared host letting
+ * its files fill the page cache only evicts other services' data.
+ */
+enum ImageIoMode {
+  /*
+   * Plain reads and writes through the page cache.
+   */
+  BUFFERED_IO,
+
+  /*
+   * O_DIRECT with aligned buffers, bypassing the page cache.
+   */
+  DIRECT_IO,
+
+  /*
+   * Through the page cache, but with POSIX_FADV_SEQUENTIAL readahead and
+   * pages dropped with POSIX_FADV_DONTNEED once the cursor has passed them.
+   */
+  FADVISE_IO,
+};
+
+/**
+ * Parse an ImageIoMode from its command line name: buffered, direct or
+ * fadvise.
+ */
+inline ImageIoMode
+parseImageIoMode(const std::string& name)
+{
+  if (name == "buffered") {
+    return BUFFERED_IO;
+  } else if (name == "direct") {
+    return DIRECT_IO;
+  } else if (name == "fadvise") {
+    return FADVISE_IO;
+  }
+  throw Exception(HERE, "unknown I/O mode " + name, 0);
+}
+
+/**
+ * Return how many bytes to ask for when reading the rest of a block into an
+ * I/O buffer. O_DIRECT needs whole pages, and stops at the end of the file;
+ * in the other modes a partly filled buffer has no room for more than what
+ * remains.
+ */
+inline size_t
+imageReadLength(ImageIoMode mode, size_t remaining)
+{
+  return mode == DIRECT_IO ? alignedLength(remaining) : remaining;
+}
+
+/**
+ * Add the --ioMode option to a tool's options.
+ */
+inline void
+addImageIoModeOption(OptionsDescription& options, std::string* ioMode)
+{
+  options.add_options()
+    ("ioMode",
+     ProgramOptions::value<std::string>(ioMode)->default_value("buffered"),
+     "How image files are read and written: buffered goes through the page "
+     "cache; direct uses O_DIRECT to bypass it; fadvise reads ahead "
+     "sequentially and drops pages from the cache once they've been "
+     "processed, so that one pass over a large image doesn't evict other "
+     "processes' data [default: buffered].");
+}
+
+/**
+ * Open an image file for reading in the given mode.
+ */
+inline int
+openImageFile(const std::string& path, ImageIoMode mode)
+{
+  int fd = open(path.c_str(), O_RDONLY | (mode == DIRECT_IO ? O_DIRECT : 0));
+  if (fd < 0) {
+    throw Exception(HERE, "couldn't open " + path, errno);
+  }
+  if (mode == FADVISE_IO) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+  return fd;
+}
+
+/**
+ * Drop a file's pages before the given offset from the page cache. The
+ * range always starts at the beginning of the file: the kernel only drops
+ * pages entirely inside the range, and may cache a file in multi-page
+ * folios that straddle the edges of a block.
+ */
+inline void
+dropCachedPages(int fd, uint64_t end)
+{
+  posix_fadvise(fd, 0, end, POSIX_FADV_DONTNEED);
+}
+
+/**
+ * Reads a file sequentially, one block at a time.
+ */
+class ImageBlockReader {
+ public:
+  virtual ~ImageBlockReader() {}
+
+  /**
+   * Return the next block of the file.
+   *
+   * \param[out] block
+   *      Set to the start of the block, which stays valid until the next
+   *      call.
+   * \return
+   *      Length of the block in bytes, 0 at the end of the file.
+   */
+  virtual size_t next(const char** block) = 0;
+};
+
+/**
+ * ImageBlockReader using buffered stdio.
+ */
+class FreadBlockReader : public ImageBlockReader {
+ public:
+  FreadBlockReader(const std::string& path, size_t blockSize)
+    : file(fopen(path.c_str(), "rb"))
+    , ownFile(true)
+    , buffer(blockSize)
+  {
+    if (file == NULL) {
+      throw Exception(HERE, "couldn't open " + path, errno);
+    }
+  }
+
+  /**
+   * Read from an already open stream, such as stdin, which is left open.
+   */
+  FreadBlockReader(FILE* file, size_t blockSize)
+    : file(file)
+    , ownFile(false)
+    , buffer(blockSize)
+  {}
+
+  ~FreadBlockReader()
+  {
+    if (ownFile) {
+      fclose(file);
+    }
+  }
+
+  size_t
+  next(const char** block)
+  {
+    size_t length = fread(&buffer[0], 1, buffer.size(), file);
+    if (length == 0 && ferror(file)) {
+      throw Exception(HERE, "read failed", errno);
+    }
+    *block = &buffer[0];
+    return length;
+  }
+
+ private:
+  FILE* file;
+  bool ownFile;
+  std::vector<char> buffer;
+};
+
+/**
+ * ImageBlockReader that maps the whole file and returns it as one block.
+ */
+class MmapBlockReader : public ImageBlockReader {
+ public:
+  explicit MmapBlockReader(const std::string& path)
+    : data(NULL)
+    , length(0)
+    , done(false)
+  {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw Exception(HERE, "couldn't open " + path, errno);
+    }
+    struct stat st;
+    fstat(fd, &st);
+    length = st.st_size;
+    if (length > 0) {
+      data = (char*)mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        close(fd);
+        throw Exception(HERE, "couldn't map " + path, errno);
+      }
+      madvise(data, length, MADV_SEQUENTIAL);
+    }
+    close(fd);
+  }
+
+  ~MmapBlockReader()
+  {
+    if (length > 0) {
+      munmap(data, length);
+    }
+  }
+
+  size_t
+  next(const char** block)
+  {
+    if (done) {
+      return 0;
+    }
+    done = true;
+    *block = data;
+    return length;
+  }
+
+ private:
+  char* data;
+  size_t length;
+  bool done;
+};
+
+/**
+ * ImageBlockReader using O_DIRECT reads, which bypass the page cache.
+ */
+class DirectBlockReader : public ImageBlockReader {
+ public:
+  DirectBlockReader(const std::string& path, size_t blockSize)
+    : fd(open(path.c_str(), O_RDONLY | O_DIRECT))
+    , blockSize(alignedLength(blockSize))
+    , buffer(NULL)
+  {
+    if (fd < 0) {
+      throw Exception(HERE, "couldn't open " + path + " with O_DIRECT",
+          errno);
+    }
+    buffer = allocAligned(this->blockSize);
+  }
+
+  ~DirectBlockReader()
+  {
+    free(buffer);
+    close(fd);
+  }
+
+  size_t
+  next(const char** block)
+  {
+    ssize_t length = read(fd, buffer, blockSize);
+    if (length < 0) {
+      throw Exception(HERE, "read failed", errno);
+    }
+    *block = buffer;
+    return length;
+  }
+
+ private:
+  int fd;
+  size_t blockSize;
+  char* buffer;
+};
+
+/**
+ * A minimal io_uring instance driven through the raw system calls, since
+ * liburing isn't available on the hosts these tools are built on.
+ */
+class IoUring {
+ public:
+  IoUring()
+    : fd(-1)
+    , params()
+    , sqRing(NULL)
+    , sqRingSize(0)
+    , cqRing(NULL)
+    , cqRingSize(0)
+    , sqes(NULL)
+    , sqHead(NULL)
+    , sqTail(NULL)
+    , sqMask(NULL)
+    , sqArray(NULL)
+    , cqHead(NULL)
+    , cqTail(NULL)
+    , cqMask(NULL)
+    , cqes(NULL)
+    , sqeTail(0)
+  {}
+
+  ~IoUring()
+  {
+    if (sqes != NULL) {
+      munmap(sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+    }
+    if (cqRing != NULL && cqRing != sqRing) {
+      munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != NULL) {
+      munmap(sqRing, sqRingSize);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  /**
+   * Set up the rings.
+   *
+   * \param entries
+   *      Size of the submission queue.
+   * \return
+   *      False if the kernel doesn't support io_uring (errno says why).
+   */
+  bool
+  init(unsigned entries)
+  {
+#ifdef __NR_io_uring_setup
+    memset(&params, 0, sizeof(params));
+    fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+      return false;
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+
+    sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+      sqRing = NULL;
+      return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      cqRing = sqRing;
+    } else {
+      cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (cqRing == MAP_FAILED) {
+        cqRing = NULL;
+        return false;
+      }
+    }
+    sqes = (struct io_uring_sqe*)mmap(NULL,
+        params.sq_entries * sizeof(struct io_uring_sqe),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+        IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+      sqes = NULL;
+      return false;
+    }
+
+    char* sq = (char*)sqRing;
+    sqHead = (unsigned*)(sq + params.sq_off.head);
+    sqTail = (unsigned*)(sq + params.sq_off.tail);
+    sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    sqArray = (unsigned*)(sq + params.sq_off.array);
+    char* cq = (char*)cqRing;
+    cqHead = (unsigned*)(cq + params.cq_off.head);
+    cqTail = (unsigned*)(cq + params.cq_off.tail);
+    cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    sqeTail = *sqTail;
+    return true;
+#else
+    errno = ENOSYS;
+    return false;
+#endif
+  }
+
+  /**
+   * Register buffers for IORING_OP_READ_FIXED.
+   *
+   * \return
+   *      False if they couldn't be registered (for example because of
+   *      RLIMIT_MEMLOCK), in which case plain reads must be used.
+   */
+  bool
+  registerBuffers(const struct iovec* buffers, unsigned count)
+  {
+#ifdef __NR_io_uring_register
+    return syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS,
+        buffers, count) == 0;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * Return whether the kernel supports an operation. Kernels 5.1 to 5.5
+   * set up rings but lack IORING_OP_READ and the probe itself, so this
+   * returns false for them.
+   */
+  bool
+  supportsOp(uint8_t op)
+  {
+#ifdef __NR_io_uring_register
+    const unsigned numOps = 256;
+    std::vector<char> memory(sizeof(struct io_uring_probe) +
+        numOps * sizeof(struct io_uring_probe_op));
+    struct io_uring_probe* probe = (struct io_uring_probe*)&memory[0];
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+        numOps) != 0) {
+      return false;
+    }
+    return op <= probe->last_op &&
+        (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * Return a cleared submission queue entry to fill in, or NULL if the
+   * submission queue is full.
+   */
+  struct io_uring_sqe*
+  getSqe()
+  {
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (sqeTail - head >= params.sq_entries) {
+      return NULL;
+    }
+    struct io_uring_sqe* sqe = &sqes[sqeTail & *sqMask];
+    sqArray[sqeTail & *sqMask] = sqeTail & *sqMask;
+    sqeTail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+  }
+
+  /**
+   * Submit the entries filled in since the last call.
+   */
+  void
+  submit()
+  {
+    unsigned toSubmit = sqeTail - *sqTail;
+    __atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+    while (toSubmit > 0) {
+      int submitted = enter(toSubmit, 0, 0);
+      if (submitted < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+          continue;
+        }
+        throw Exception(HERE, "io_uring_enter failed", errno);
+      }
+      toSubmit -= submitted;
+    }
+  }
+
+  /**
+   * Wait for the next completion.
+   *
+   * \param[out] cqe
+   *      Filled in with the completion.
+   */
+  void
+  wait(struct io_uring_cqe* cqe)
+  {
+    while (true) {
+      unsigned head = *cqHead;
+      if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        *cqe = cqes[head & *cqMask];
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        return;
+      }
+      if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+        throw Exception(HERE, "io_uring_enter failed", errno);
+      }
+    }
+  }
+
+ private:
+  int
+  enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+  {
+#ifdef __NR_io_uring_enter
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete,
+        flags, NULL, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+  }
+
+  int fd;
+  struct io_uring_params params;
+  void* sqRing;
+  size_t sqRingSize;
+  void* cqRing;
+  size_t cqRingSize;
+  struct io_uring_sqe* sqes;
+  unsigned* sqHead;
+  unsigned* sqTail;
+  unsigned* sqMask;
+  unsigned* sqArray;
+  unsigned* cqHead;
+  unsigned* cqTail;
+  unsigned* cqMask;
+  struct io_uring_cqe* cqes;
+
+  /*
+   * Tail of the submission queue including entries not yet submitted.
+   */
+  unsigned sqeTail;
+};
+
+/**
+ * ImageBlockReader that keeps several reads of the file queued in an
+ * io_uring, so that the disk stays busy while earlier blocks are parsed.
+ */
+class IoUringBlockReader : public ImageBlockReader {
+ public:
+  /**
+   * \param path
+   *      File to read.
+   * \param blockSize
+   *      Size of each read.
+   * \param queueDepth
+   *      Number of reads to keep queued.
+   * \param mode
+   *      How to use the page cache.
+   */
+  IoUringBlockReader(const std::string& path, size_t blockSize,
+      int queueDepth, ImageIoMode mode)
+    : fd(openImageFile(path, mode))
+    , mode(mode)
+    , blockSize(alignedLength(blockSize))
+    , fileSize(0)
+    , nextOffset(0)
+    , ring()
+    , fixedBuffers(false)
+    , slots(queueDepth)
+    , current(0)
+    , handedOut(-1)
+    , error(0)
+  {
+    struct stat st;
+    fstat(fd, &st);
+    fileSize = st.st_size;
+
+    if (!ring.init(queueDepth)) {
+      int error = errno;
+      close(fd);
+      throw Exception(HERE, "io_uring unavailable", error);
+    }
+    // IORING_OP_READ_FIXED is no older than IORING_OP_READ.
+    if (!ring.supportsOp(IORING_OP_READ)) {
+      close(fd);
+      throw Exception(HERE, "io_uring lacks IORING_OP_READ", EINVAL);
+    }
+
+    std::vector<struct iovec> iovecs(queueDepth);
+    for (int i = 0; i < queueDepth; i++) {
+      slots[i].buffer = allocAligned(this->blockSize);
+      iovecs[i].iov_base = slots[i].buffer;
+      iovecs[i].iov_len = this->blockSize;
+    }
+    fixedBuffers = ring.registerBuffers(&iovecs[0], queueDepth);
+
+    for (int i = 0; i < queueDepth; i++) {
+      queueRead(i);
+    }
+    ring.submit();
+  }
+
+  ~IoUringBlockReader()
+  {
+    // Reads still in flight write into the buffers; let them finish. If the
+    // ring itself fails, leak the buffers rather than free them under the
+    // kernel.
+    bool drained = true;
+    try {
+      for (size_t i = 0; i < slots.size(); i++) {
+        while (slots[i].inFlight) {
+          reap();
+        }
+      }
+    } catch (Exception& e) {
+      drained = false;
+    }
+    for (size_t i = 0; drained && i < slots.size(); i++) {
+      free(slots[i].buffer);
+    }
+    close(fd);
+  }
+
+  size_t
+  next(const char** block)
+  {
+    if (handedOut >= 0) {
+      dropBehind(handedOut);
+      queueRead(handedOut);
+      ring.submit();
+      handedOut = -1;
+    }
+
+    Slot& slot = slots[current];
+    if (!slot.active) {
+      return 0;
+    }
+    while (!slot.done) {
+      reap();
+    }
+    if (error != 0) {
+      throw Exception(HERE, "read failed", error);
+    }
+    slot.active = false;
+    handedOut = current;
+    current = (current + 1) % (int)slots.size();
+
+    *block = slot.buffer;
+    return slot.filled;
+  }
+
+ private:
+  /**
+   * A buffer and the read into it.
+   */
+  struct Slot {
+    Slot()
+      : buffer(NULL), offset(0), wanted(0), filled(0), active(false),
+        done(false), inFlight(false)
+    {}
+    char* buffer;
+    uint64_t offset;
+    size_t wanted;
+    size_t filled;
+    bool active;
+    bool done;
+
+    /*
+     * Whether the ring holds a read into the buffer.
+     */
+    bool inFlight;
+  };
+
+  /**
+   * In FADVISE_IO mode, drop the block in a slot from the page cache once
+   * the caller is done with it.
+   */
+  void
+  dropBehind(int index)
+  {
+    if (mode == FADVISE_IO) {
+      dropCachedPages(fd, slots[index].offset + slots[index].wanted);
+    }
+  }
+
+  /**
+   * Start reading the next block of the file into a slot, if there is one.
+   */
+  void
+  queueRead(int index)
+  {
+    Slot& slot = slots[index];
+    if (nextOffset >= fileSize) {
+      slot.active = false;
+      return;
+    }
+    slot.offset = nextOffset;
+    slot.wanted = std::min((uint64_t)blockSize, fileSize - nextOffset);
+    slot.filled = 0;
+    slot.active = true;
+    slot.done = false;
+    nextOffset += slot.wanted;
+    submitRead(index);
+  }
+
+  /**
+   * Queue a read of the unfilled part of a slot.
+   */
+  void
+  submitRead(int index)
+  {
+    Slot& slot = slots[index];
+    struct io_uring_sqe* sqe = ring.getSqe();
+    while (sqe == NULL) {
+      ring.submit();
+      sqe = ring.getSqe();
+    }
+    sqe->opcode = fixedBuffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->off = slot.offset + slot.filled;
+    sqe->addr = (uint64_t)(slot.buffer + slot.filled);
+    sqe->len = (uint32_t)imageReadLength(mode, slot.wanted - slot.filled);
+    sqe->buf_index = (uint16_t)index;
+    sqe->user_data = index;
+    slot.inFlight = true;
+  }
+
+  /**
+   * Wait for a read to complete and account for it, resubmitting the rest
+   * of a short read. A failed read completes its slot and sets error, which
+   * next() then throws.
+   */
+  void
+  reap()
+  {
+    struct io_uring_cqe cqe;
+    ring.wait(&cqe);
+    Slot& slot = slots[cqe.user_data];
+    slot.inFlight = false;
+    if (cqe.res < 0) {
+      error = -cqe.res;
+      slot.done = true;
+      return;
+    }
+    slot.filled += cqe.res;
+    if (cqe.res == 0 || slot.filled >= slot.wanted) {
+      slot.filled = std::min(slot.filled, slot.wanted);
+      slot.done = true;
+    } else {
+      if (mode == DIRECT_IO) {
+        // O_DIRECT also needs an aligned buffer and offset, so reread the
+        // partial last page.
+        slot.filled &= ~(size_t)(IMAGE_IO_ALIGNMENT - 1);
+      }
+      submitRead((int)cqe.user_data);
+      ring.submit();
+    }
+  }
+
+  int fd;
+  ImageIoMode mode;
+  size_t blockSize;
+  uint64_t fileSize;
+  uint64_t nextOffset;
+  IoUring ring;
+  bool fixedBuffers;
+  std::vector<Slot> slots;
+
+  /*
+   * Slot holding the next block to return. Slots are filled with
+   * consecutive blocks of the file in round-robin order.
+   */
+  int current;
+
+  /*
+   * Slot returned by the last call to next(), reused on the following call,
+   * or -1.
+   */
+  int handedOut;
+
+  /*
+   * errno of the first failed read, or 0.
+   */
+  int error;
+};
+
+/**
+ * ImageBlockReader that keeps several reads of the file queued with a small
+ * pool of threads calling pread(), for hosts without io_uring.
+ */
+class ThreadedBlockReader : public ImageBlockReader {
+ public:
+  /**
+   * \param path
+   *      File to read.
+   * \param blockSize
+   *      Size of each read.
+   * \param queueDepth
+   *      Number of reads to keep queued, and of threads issuing them.
+   * \param mode
+   *      How to use the page cache.
+   */
+  ThreadedBlockReader(const std::string& path, size_t blockSize,
+      int queueDepth, ImageIoMode mode)
+    : fd(openImageFile(path, mode))
+    , mode(mode)
+    , blockSize(alignedLength(blockSize))
+    , fileSize(0)
+    , nextOffset(0)
+    , mutex()
+    , readQueued()
+    , readDone()
+    , pending()
+    , slots(queueDepth)
+    , current(0)
+    , handedOut(-1)
+    , error(0)
+    , stopping(false)
+    , threads()
+  {
+    struct stat st;
+    fstat(fd, &st);
+    fileSize = st.st_size;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int i = 0; i < queueDepth; i++) {
+      slots[i].buffer = allocAligned(this->blockSize);
+      queueRead(i);
+    }
+    for (int i = 0; i < queueDepth; i++) {
+      threads.emplace_back(&ThreadedBlockReader::readerThread, this);
+    }
+  }
+
+  ~ThreadedBlockReader()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    readQueued.notify_all();
+    for (size_t i = 0; i < threads.size(); i++) {
+      threads[i].join();
+    }
+    for (size_t i = 0; i < slots.size(); i++) {
+      free(slots[i].buffer);
+    }
+    close(fd);
+  }
+
+  size_t
+  next(const char** block)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (handedOut >= 0) {
+      if (mode == FADVISE_IO) {
+        dropCachedPages(fd, slots[handedOut].offset + slots[handedOut].wanted);
+      }
+      queueRead(handedOut);
+      readQueued.notify_one();
+      handedOut = -1;
+    }
+
+    Slot& slot = slots[current];
+    if (!slot.active) {
+      return 0;
+    }
+    readDone.wait(lock, [&] { return slot.done; });
+    if (error != 0) {
+      throw Exception(HERE, "read failed", error);
+    }
+    slot.active = false;
+    handedOut = current;
+    current = (current + 1) % (int)slots.size();
+
+    *block = slot.buffer;
+    return slot.filled;
+  }
+
+ private:
+  /**
+   * A buffer and the read into it.
+   */
+  struct Slot {
+    Slot()
+      : buffer(NULL), offset(0), wanted(0), filled(0), active(false),
+        done(false)
+    {}
+    char* buffer;
+    uint64_t offset;
+    size_t wanted;
+    size_t filled;
+    bool active;
+    bool done;
+  };
+
+  /**
+   * Queue a read of the next block of the file into a slot, if there is
+   * one. Must be called with mutex held.
+   */
+  void
+  queueRead(int index)
+  {
+    Slot& slot = slots[index];
+    if (nextOffset >= fileSize) {
+      slot.active = false;
+      return;
+    }
+    slot.offset = nextOffset;
+    slot.wanted = std::min((uint64_t)blockSize, fileSize - nextOffset);
+    slot.filled = 0;
+    slot.active = true;
+    slot.done = false;
+    nextOffset += slot.wanted;
+    pending.push_back(index);
+  }
+
+  void
+  readerThread()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      readQueued.wait(lock, [&] { return stopping || !pending.empty(); });
+      if (stopping) {
+        return;
+      }
+      Slot& slot = slots[pending.front()];
+      pending.pop_front();
+
+      lock.unlock();
+      int readError = 0;
+      while (slot.filled < slot.wanted) {
+        ssize_t n = pread(fd, slot.buffer + slot.filled,
+            imageReadLength(mode, slot.wanted - slot.filled),
+            slot.offset + slot.filled);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n < 0) {
+          readError = errno;
+          break;
+        }
+        if (n == 0) {
+          break;
+        }
+        slot.filled += n;
+        if (mode == DIRECT_IO && slot.filled < slot.wanted) {
+          // As in IoUringBlockReader::reap.
+          slot.filled &= ~(size_t)(IMAGE_IO_ALIGNMENT - 1);
+        }
+      }
+      slot.filled = std::min(slot.filled, slot.wanted);
+      lock.lock();
+
+      if (readError != 0) {
+        error = readError;
+      }
+      slot.done = true;
+      readDone.notify_all();
+    }
+  }
+
+  int fd;
+  ImageIoMode mode;
+  size_t blockSize;
+  uint64_t fileSize;
+  uint64_t nextOffset;
+
+  /*
+   * Protects everything below, except the contents of a slot while its
+   * read is in progress.
+   */
+  std::mutex mutex;
+  std::condition_variable readQueued;
+  std::condition_variable readDone;
+
+  /*
+   * Slots waiting for a reader thread.
+   */
+  std::deque<int> pending;
+
+  std::vector<Slot> slots;
+  int current;
+  int handedOut;
+  int error;
+  bool stopping;
+  std::vector<std::thread> threads;
+};
+
+/**
+ * Parses records out of the blocks returned by an ImageBlockReader. Records
+ * are parsed in place where possible; one that straddles blocks is copied.
+ */
+class ImageRecordParser {
+ public:
+  explicit ImageRecordParser(ImageBlockReader* reader)
+    : reader(reader)
+    , block(NULL)
+    , length(0)
+    , offset(0)
+    , carry()
+  {}
+
+  /**
+   * Parse the next record.
+   *
+   * \param[out] view
+   *      Filled in with the record, which stays valid until the next call.
+   * \return
+   *      False at the end of the image. A partial record at the end is
+   *      ignored, as readImageRecord does.
+   */
+  bool
+  next(ImageRecordView* view)
+  {
+    while (true) {
+      if (offset < length &&
+          parseImageRecord(block + offset, length - offset, view)) {
+        offset += view->diskBytes;
+        return true;
+      }
+
+      // Out of whole records in this block; keep whatever part of a record
+      // is left and add blocks to it until it's complete.
+      carry.assign(block + offset, length - offset);
+      while (true) {
+        length = reader->next(&block);
+        offset = 0;
+        if (length == 0) {
+          return false;
+        }
+        if (carry.empty()) {
+          break;
+        }
+        size_t carried = carry.size();
+        carry.append(block, length);
+        if (parseImageRecord(carry.data(), carry.size(), view)) {
+          offset = view->diskBytes - carried;
+          return true;
+        }
+      }
+    }
+  }
+
+ private:
+  ImageBlockReader* reader;
+  const char* block;
+  size_t length;
+  size_t offset;
+  std::string carry;
+};
+
+/**
+ * Options choosing how the loaders read image files.
+ */
+struct ImageReadOptions {
+  /*
+   * "stream" for ifstream, "pread" for ThreadedBlockReader, "io_uring" for
+   * IoUringBlockReader (falling back to pread), or any other
+   * openImageBlockReader engine.
+   */
+  std::string engine;
+
+  /*
+   * Size of each read for the block engines.
+   */
+  int blockSize;
+
+  /*
+   * Number of reads kept queued by the pread and io_uring engines.
+   */
+  int queueDepth;
+
+  /*
+   * Name of an ImageIoMode: buffered, direct or fadvise.
+   */
+  std::string ioMode;
+};
+
+/**
+ * Add the options that fill in an ImageReadOptions to a tool's options.
+ */
+inline void
+addImageReadOptions(OptionsDescription& options, ImageReadOptions* readOptions)
+{
+  options.add_options()
+    ("readEngine",
+     ProgramOptions::value<std::string>(&readOptions->engine)->
+         default_value("io_uring"),
+     "How to read image files: io_uring keeps several reads queued and "
+     "parses in a separate thread, so that reading overlaps writing to "
+     "RAMCloud, and falls back to pread where io_uring is unavailable; pread "
+     "does the same with a pool of reader threads; stream reads "
+     "synchronously with an ifstream [default: io_uring].")
+    ("readBlockSize",
+     ProgramOptions::value<int>(&readOptions->blockSize)->
+         default_value(1 << 20),
+     "Size of each read for the io_uring and pread engines "
+     "[default: 1048576].")
+    ("readQueueDepth",
+     ProgramOptions::value<int>(&readOptions->queueDepth)->
+         default_value(4),
+     "Number of reads per file kept queued by the io_uring and pread "
+     "engines [default: 4].");
+  addImageIoModeOption(options, &readOptions->ioMode);
+}
+
+/**
+ * Open a block reader for an image file.
+ *
+ * \param path
+ *      File to read.
+ * \param engine
+ *      fread, mmap, direct, pread or io_uring. If io_uring isn't available
+ *      a pread reader is returned instead.
+ * \param blockSize
+ *      Size of each read.
+ * \param queueDepth
+ *      Number of reads kept queued by the pread and io_uring readers.
+ * \param mode
+ *      How the pread and io_uring readers use the page cache.
+ * \return
+ *      The reader, owned by the caller.
+ */
+inline ImageBlockReader*
+openImageBlockReader(const std::string& path, const std::string& engine,
+    size_t blockSize, int queueDepth, ImageIoMode mode)
+{
+  if (engine == "fread") {
+    return new FreadBlockReader(path, blockSize);
+  } else if (engine == "mmap") {
+    return new MmapBlockReader(path);
+  } else if (engine == "direct") {
+    return new DirectBlockReader(path, blockSize);
+  } else if (engine == "io_uring") {
+    try {
+      return new IoUringBlockReader(path, blockSize, queueDepth, mode);
+    } catch (Exception& e) {
+      static std::once_flag warned;
+      std::call_once(warned, [&] {
+        fprintf(stderr, "%s; reading with pread threads instead\n",
+            e.str().c_str());
+      });
+    }
+  } else if (engine != "pread") {
+    throw Exception(HERE, "unknown read engine " + engine, 0);
+  }
+  return new ThreadedBlockReader(path, blockSize, queueDepth, mode);
+}
+
+class ImageBatchQueue;
+
+/**
+ * A batch of records for one multiWrite.
+ */
+struct ImageBatch {
+  ImageBatch()
+    : records()
+    , count(0)
+    , diskBytes(0)
+    , tableId(0)
+    , freeQueue(NULL)
+    , failed(false)
+  {}
+
+  /*
+   * The batch's records are the first count entries. Entries beyond those
+   * are kept to reuse their buffers.
+   */
+  std::vector<ImageRecord> records;
+  uint32_t count;
+
+  /*
+   * Number of bytes the batch's records occupy in the image.
+   */
+  uint64_t diskBytes;
+
+  /*
+   * Table the records belong in, when batches from several images are
+   * uploaded by the same threads.
+   */
+  uint64_t tableId;
+
+  /*
+   * When batches are passed to upload threads through an ImageBatchQueue,
+   * the queue to return the batch to once it's been uploaded, and whether
+   * the upload failed.
+   */
+  ImageBatchQueue* freeQueue;
+  bool failed;
+};
+
+/**
+ * Fill a batch with the next records from a parser.
+ *
+ * \param parser
+ *      Source of the records.
+ * \param batchSize
+ *      Maximum number of records in the batch; the batch must have at least
+ *      this many entries in its records.
+ * \param[out] batch
+ *      Filled in with up to batchSize records.
+ * \return
+ *      False if the parser reached the end of the image.
+ */
+inline bool
+fillImageBatch(ImageRecordParser* parser, uint32_t batchSize,
+    ImageBatch* batch)
+{
+  ImageRecordView view;
+  batch->count = 0;
+  batch->diskBytes = 0;
+  while (batch->count < batchSize) {
+    if (!parser->next(&view)) {
+      return false;
+    }
+    ImageRecord& record = batch->records[batch->count];
+    record.keys.resize(view.keys.size());
+    for (size_t i = 0; i < view.keys.size(); i++) {
+      record.keys[i].assign((const char*)view.keys[i].key,
+          view.keys[i].keyLength);
+    }
+    record.value.assign(view.value, view.valueLength);
+    record.diskBytes = view.diskBytes;
+    batch->diskBytes += view.diskBytes;
+    batch->count++;
+  }
+  return true;
+}
+
+/**
+ * A bounded queue for passing batches between threads, for example from a
+ * thread parsing an image to the threads uploading it.
+ */
+class ImageBatchQueue {
+ public:
+  explicit ImageBatchQueue(size_t capacity)
+    : capacity(capacity)
+    , mutex()
+    , changed()
+    , batches()
+    , closed(false)
+  {}
+
+  /**
+   * Add a batch, waiting while the queue is full.
+   *
+   * \return
+   *      False if the queue has been closed, in which case the batch wasn't
+   *      added.
+   */
+  bool
+  push(ImageBatch* batch)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&] { return closed || batches.size() < capacity; });
+    if (closed) {
+      return false;
+    }
+    batches.push_back(batch);
+    changed.notify_all();
+    return true;
+  }
+
+  /**
+   * Remove the oldest batch, waiting while the queue is empty.
+   *
+   * \return
+   *      The batch, or NULL once the queue has been closed and emptied.
+   */
+  ImageBatch*
+  pop()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&] { return closed || !batches.empty(); });
+    if (batches.empty()) {
+      return NULL;
+    }
+    ImageBatch* batch = batches.front();
+    batches.pop_front();
+    changed.notify_all();
+    return batch;
+  }
+
+  /**
+   * Refuse further batches. Batches already queued can still be popped.
+   */
+  void
+  close()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    changed.notify_all();
+  }
+
+ private:
+  size_t capacity;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<ImageBatch*> batches;
+  bool closed;
+};
+
+/**
+ * Reads an image as batches of records. With the stream engine, each batch
+ * is read when it's asked for; with the others, a separate thread reads and
+ * parses batches ahead, so the caller's RPCs overlap with disk reads. The
+ * stream engine always reads through the page cache, whatever the I/O mode.
+ */
+class ImageBatchReader {
+ public:
+  /**
+   * \param path
+   *      Image file to read.
+   * \param options
+   *      How to read it.
+   * \param batchSize
+   *      Maximum number of records in a batch.
+   */
+  ImageBatchReader(const std::string& path, const ImageReadOptions& options,
+      uint32_t batchSize)
+    : batchSize(batchSize)
+    , fileStream()
+    , stream(NULL)
+    , mutex()
+    , changed()
+    , freeBatches()
+    , fullBatches()
+    , batches(options.engine == "stream" ? 1 : 3)
+    , lent(NULL)
+    , finished(false)
+    , stopping(false)
+    , error()
+    , thread()
+  {
+    // Check the mode here, so that a bad one is reported to the caller.
+    ImageIoMode mode = parseImageIoMode(options.ioMode);
+    for (size_t i = 0; i < batches.size(); i++) {
+      batches[i].records.resize(batchSize);
+      freeBatches.push_back(&batches[i]);
+    }
+    if (options.engine == "stream") {
+      fileStream.open(path.c_str(), std::ios::binary);
+      stream = &fileStream;
+      if (!fileStream) {
+        error = std::make_exception_ptr(Exception(HERE,
+            "couldn't open " + path, errno));
+      }
+    } else {
+      thread = std::thread(&ImageBatchReader::readAheadThread, this, path,
+          options, mode);
+    }
+  }
+
+  /**
+   * Read batches synchronously from a stream, such as stdin.
+   */
+  ImageBatchReader(std::istream& in, uint32_t batchSize)
+    : batchSize(batchSize)
+    , fileStream()
+    , stream(&in)
+    , mutex()
+    , changed()
+    , freeBatches()
+    , fullBatches()
+    , batches(1)
+    , lent(NULL)
+    , finished(false)
+    , stopping(false)
+    , error()
+    , thread()
+  {
+    batches[0].records.resize(batchSize);
+  }
+
+  ~ImageBatchReader()
+  {
+    if (thread.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      changed.notify_all();
+      thread.join();
+    }
+  }
+
+  /**
+   * Return the next batch. Throws an Exception if the image couldn't be
+   * opened or read, once the batches read before the failure have been
+   * returned.
+   *
+   * \return
+   *      The batch, which stays valid until the next call, or NULL at the
+   *      end of the image.
+   */
+  ImageBatch*
+  next()
+  {
+    if (stream != NULL) {
+      if (error) {
+        std::rethrow_exception(error);
+      }
+      ImageBatch* batch = &batches[0];
+      fillFromStream(batch);
+      if (stream->bad()) {
+        error = std::make_exception_ptr(Exception(HERE,
+            "reading image failed", errno));
+        std::rethrow_exception(error);
+      }
+      return batch->count > 0 ? batch : NULL;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (lent != NULL) {
+      freeBatches.push_back(lent);
+      lent = NULL;
+      changed.notify_all();
+    }
+    changed.wait(lock, [&] { return !fullBatches.empty() || finished; });
+    if (fullBatches.empty()) {
+      if (error) {
+        std::rethrow_exception(error);
+      }
+      return NULL;
+    }
+    lent = fullBatches.front();
+    fullBatches.pop_front();
+    return lent;
+  }
+
+ private:
+  void
+  fillFromStream(ImageBatch* batch)
+  {
+    batch->count = 0;
+    batch->diskBytes = 0;
+    while (batch->count < batchSize &&
+        readImageRecord(*stream, &batch->records[batch->count])) {
+      batch->diskBytes += batch->records[batch->count].diskBytes;
+      batch->count++;
+    }
+  }
+
+  /**
+   * Read and parse the image into free batches until it ends.
+   */
+  void
+  readAheadThread(std::string path, ImageReadOptions options,
+      ImageIoMode mode)
+  {
+    try {
+      std::unique_ptr<ImageBlockReader> reader(openImageBlockReader(path,
+          options.engine, options.blockSize, options.queueDepth, mode));
+      ImageRecordParser parser(reader.get());
+      bool more = true;
+      while (more) {
+        ImageBatch* batch;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          changed.wait(lock, [&] {
+            return stopping || !freeBatches.empty();
+          });
+          if (stopping) {
+            return;
+          }
+          batch = freeBatches.front();
+          freeBatches.pop_front();
+        }
+
+        more = fillImageBatch(&parser, batchSize, batch);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (batch->count > 0) {
+          fullBatches.push_back(batch);
+        } else {
+          freeBatches.push_back(batch);
+        }
+        changed.notify_all();
+      }
+    } catch (Exception& e) {
+      std::lock_guard<std::mutex> lock(mutex);
+      error = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    finished = true;
+    changed.notify_all();
+  }
+
+  uint32_t batchSize;
+  std::ifstream fileStream;
+
+  /*
+   * Stream to read synchronously from, or NULL when reading ahead.
+   */
+  std::istream* stream;
+
+  /*
+   * Protects the batch queues and flags below.
+   */
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<ImageBatch*> freeBatches;
+  std::deque<ImageBatch*> fullBatches;
+  std::vector<ImageBatch> batches;
+
+  /*
+   * Batch returned by the last call to next(), or NULL.
+   */
+  ImageBatch* lent;
+
+  bool finished;
+  bool stopping;
+
+  /*
+   * Why reading the image failed, if it did.
+   */
+  std::exception_ptr error;
+  std::thread thread;
+};
+
+/**
+ * Writes a table image through a large buffer.
+ */
+class ImageFileWriter {
+ public:
+  /**
+   * \param path
+   *      File to create or truncate.
+   * \param mode
+   *      How to use the page cache.
+   * \param bufferSize
+   *      Size of each write.
+   */
+  ImageFileWriter(const std::string& path, ImageIoMode mode,
+      size_t bufferSize)
+    : fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC |
+          (mode == DIRECT_IO ? O_DIRECT : 0), 0644))
+    , mode(mode)
+    , bufferSize(alignedLength(bufferSize))
+    , buffer(NULL)
+    , used(0)
+    , bytesWritten(0)
+    , bytesDropped(0)
+  {
+    if (fd < 0) {
+      throw Exception(HERE, "couldn't create " + path, errno);
+    }
+    buffer = allocAligned(this->bufferSize);
+  }
+
+  ~ImageFileWriter()
+  {
+    if (fd >= 0) {
+      close();
+    }
+    free(buffer);
+  }
+
+  /**
+   * Append a record to the image.
+   *
+   * \return
+   *      Number of bytes the record occupies in the image.
+   */
+  uint64_t
+  write(uint32_t numKeys, const KeyInfo* keys, const void* data,
+      uint32_t dataLength)
+  {
+    uint64_t size = imageRecordSize(numKeys, keys, dataLength);
+    if (size <= bufferSize - used) {
+      encodeImageRecord(buffer + used, numKeys, keys, data, dataLength);
+      used += size;
+    } else {
+      // Too big for what's left of the buffer; encode it piecewise.
+      if (numKeys > 1) {
+        uint32_t header = IMAGE_MULTIKEY_FLAG | numKeys;
+        append(&header, sizeof(header));
+      }
+      for (uint32_t i = 0; i < numKeys; i++) {
+        uint32_t keyLength = keys[i].keyLength;
+        append(&keyLength, sizeof(keyLength));
+        append(keys[i].key, keyLength);
+      }
+      append(&dataLength, sizeof(dataLength));
+      append(data, dataLength);
+    }
+    return size;
+  }
+
+  uint64_t
+  write(const ImageRecord& record)
+  {
+    keys.resize(record.keys.size());
+    for (size_t i = 0; i < record.keys.size(); i++) {
+      keys[i].key = record.keys[i].data();
+      keys[i].keyLength = (KeyLength)record.keys[i].size();
+    }
+    return write((uint32_t)keys.size(), keys.data(), record.value.data(),
+        (uint32_t)record.value.size());
+  }
+
+  /**
+   * Write out the buffered data and close the file.
+   *
+   * \param sync
+   *      Also wait for the data to reach the disk.
+   */
+  void
+  close(bool sync = false)
+  {
+    if (mode == DIRECT_IO) {
+      // O_DIRECT can only write whole blocks: pad the last one, then trim
+      // the file back to its real length.
+      uint64_t length = bytesWritten + used;
+      size_t padded = alignedLength(used);
+      memset(buffer + used, 0, padded - used);
+      used = padded;
+      flush();
+      if (ftruncate(fd, length) != 0) {
+        throw Exception(HERE, "ftruncate failed", errno);
+      }
+      bytesWritten = length;
+    } else {
+      flush();
+    }
+    if (mode == FADVISE_IO) {
+      dropWritten(bytesWritten);
+    }
+    if (sync) {
+      fsync(fd);
+    }
+    ::close(fd);
+    fd = -1;
+  }
+
+  /**
+   * Return the number of bytes written so far, including buffered ones.
+   */
+  uint64_t
+  size()
+  {
+    return bytesWritten + used;
+  }
+
+ private:
+  void
+  append(const void* data, size_t length)
+  {
+    const char* p = (const char*)data;
+    while (length > 0) {
+      size_t n = std::min(length, bufferSize - used);
+      memcpy(buffer + used, p, n);
+      used += n;
+      p += n;
+      length -= n;
+      if (used == bufferSize) {
+        flush();
+      }
+    }
+  }
+
+  void
+  flush()
+  {
+    size_t done = 0;
+    while (done < used) {
+      ssize_t n = ::write(fd, buffer + done, used - done);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw Exception(HERE, "write failed", errno);
+      }
+      done += n;
+    }
+    if (mode == FADVISE_IO) {
+      // Start writeback of this buffer's worth now, and drop everything
+      // before it, which has had a whole buffer's time to reach the disk.
+      sync_file_range(fd, bytesWritten, used, SYNC_FILE_RANGE_WRITE);
+      dropWritten(bytesWritten);
+    }
+    bytesWritten += used;
+    used = 0;
+  }
+
+  /**
+   * Wait for the file up to the given offset to be written back and drop it
+   * from the page cache; dirty pages can't be dropped.
+   */
+  void
+  dropWritten(uint64_t offset)
+  {
+    if (offset <= bytesDropped) {
+      return;
+    }
+    sync_file_range(fd, bytesDropped, offset - bytesDropped,
+        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+        SYNC_FILE_RANGE_WAIT_AFTER);
+    dropCachedPages(fd, offset);
+    bytesDropped = offset;
+  }
+
+  int fd;
+  ImageIoMode mode;
+  size_t bufferSize;
+  char* buffer;
+  size_t used;
+  uint64_t bytesWritten;
+
+  /*
+   * In FADVISE_IO mode, the file before this offset has been written back
+   * and dropped from the page cache.
+   */
+  uint64_t bytesDropped;
+  std::vector<KeyInfo> keys;
+};
+
+} // namespace RAMCloud
+
+#endif // RAMCLOUDTOOLS_IMAGEIO_H
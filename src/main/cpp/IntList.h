@@ -0,0 +1,48 @@
+/* Copyright (c) 2009-2015 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RAMCLOUDTOOLS_INTLIST_H
+#define RAMCLOUDTOOLS_INTLIST_H
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace RAMCloud {
+
+/**
+ * Parse a comma-separated list of integers (e.g. "1,2,4,8"), as taken by
+ * the benchmarks' sweep options.
+ *
+ * \param list
+ *      String to parse.
+ * \param[out] values
+ *      Parsed values are appended to this vector.
+ */
+inline void
+parseIntList(const std::string& list, std::vector<int>* values)
+{
+  std::stringstream ss(list);
+  std::string elem;
+  while (std::getline(ss, elem, ',')) {
+    if (elem.size() > 0) {
+      values->push_back(std::stoi(elem));
+    }
+  }
+}
+
+} // namespace RAMCloud
+
+#endif // RAMCLOUDTOOLS_INTLIST_H
@@ -0,0 +1,975 @@
+/* Copyright (c) 2009-2015 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RAMCLOUDTOOLS_LOADERSTATS_H
+#define RAMCLOUDTOOLS_LOADERSTATS_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "Cycles.h"
+#include "Key.h"
+#include "MultiWrite.h"
+#include "ObjectFinder.h"
+#include "RamCloud.h"
+#include "Tub.h"
+
+namespace RAMCloud {
+
+/*
+ * Loader threads update their statistics on every batch while the reporter
+ * thread reads them. Each thread's statistics occupy their own cache lines
+ * so that threads don't slow each other down with false sharing, and every
+ * field is a relaxed atomic so that the reporter never sees a torn value.
+ * Each field has a single writer, its own thread, which is why add() can
+ * use a plain load and store instead of a locked read-modify-write.
+ */
+#define LOADER_CACHE_LINE_SIZE 64
+
+/**
+ * Add to a counter that only the calling thread writes.
+ */
+template<typename T>
+inline void
+add(std::atomic<T>& counter, T value)
+{
+  counter.store(counter.load(std::memory_order_relaxed) + value,
+      std::memory_order_relaxed);
+}
+
+/**
+ * A histogram of latencies, with buckets spaced logarithmically (four per
+ * power of two) so that percentiles are accurate to within about 20% from
+ * nanoseconds up to minutes.
+ */
+struct LatencyHistogram {
+  enum { SUB_BUCKETS = 4, NUM_BUCKETS = 64 * SUB_BUCKETS };
+
+  LatencyHistogram()
+  {
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+      counts[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Return the bucket holding a latency.
+   */
+  static int
+  bucketOf(uint64_t ns)
+  {
+    if (ns < SUB_BUCKETS) {
+      return (int)ns;
+    }
+    int log2 = 63 - __builtin_clzll(ns);
+    int sub = (int)((ns >> (log2 - 2)) & (SUB_BUCKETS - 1));
+    return (log2 - 1) * SUB_BUCKETS + sub;
+  }
+
+  /**
+   * Return the largest latency that falls in a bucket.
+   */
+  static uint64_t
+  bucketLimit(int bucket)
+  {
+    if (bucket < SUB_BUCKETS) {
+      return bucket;
+    }
+    int log2 = bucket / SUB_BUCKETS + 1;
+    uint64_t sub = bucket % SUB_BUCKETS;
+    return ((SUB_BUCKETS + sub + 1) << (log2 - 2)) - 1;
+  }
+
+  /**
+   * Record one latency. Must only be called by the owning thread.
+   *
+   * \param ns
+   *      Latency in nanoseconds.
+   */
+  void
+  record(uint64_t ns)
+  {
+    add(counts[bucketOf(ns)], (uint64_t)1);
+  }
+
+  /**
+   * Record one latency. May be called by any thread.
+   *
+   * \param ns
+   *      Latency in nanoseconds.
+   */
+  void
+  recordShared(uint64_t ns)
+  {
+    counts[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * Copy the current bucket counts.
+   *
+   * \param[out] out
+   *      Array of NUM_BUCKETS entries, filled in with the counts.
+   */
+  void
+  read(uint64_t* out) const
+  {
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+      out[i] = counts[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Return a percentile of the latencies counted in a set of buckets.
+   *
+   * \param counts
+   *      Array of NUM_BUCKETS bucket counts, e.g. the difference between two
+   *      calls to read().
+   * \param percentile
+   *      Percentile to return, between 0 and 100.
+   * \return
+   *      The upper limit, in nanoseconds, of the bucket holding the
+   *      percentile, or 0 if the buckets are empty.
+   */
+  static uint64_t
+  percentile(const uint64_t* counts, double percentile)
+  {
+    uint64_t total = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+      total += counts[i];
+    }
+    if (total == 0) {
+      return 0;
+    }
+
+    uint64_t rank = (uint64_t)((double)total * percentile / 100.0);
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+      seen += counts[i];
+      if (seen > rank) {
+        return bucketLimit(i);
+      }
+    }
+    return bucketLimit(NUM_BUCKETS - 1);
+  }
+
+  std::atomic<uint64_t> counts[NUM_BUCKETS];
+};
+
+/**
+ * Stages of loading a batch of objects, each timed separately.
+ */
+enum LoaderStage {
+  READ_STAGE,   // Reading the batch's records from the image (disk and decode),
+                // or waiting for the read-ahead thread to have them.
+  BUILD_STAGE,  // Building the MultiWriteObjects for the batch.
+  RPC_STAGE,    // The multiWrite RPC itself.
+  NUM_STAGES
+};
+
+/**
+ * A set of per-thread loading statistics. Each loader thread continually
+ * updates these statistics, while a statistics reporting thread with a
+ * reference to each thread's stats regularly prints statistic summaries to the
+ * screen.
+ */
+struct alignas(LOADER_CACHE_LINE_SIZE) ThreadStats {
+  ThreadStats()
+    : objectsLoaded(0)
+    , filesLoaded(0)
+    , totalFilesToLoad(0)
+    , bytesReadFromDisk(0)
+    , bytesWrittenToRAMCloud(0)
+    , stageCycles()
+    , stageLatency()
+  {
+    for (int i = 0; i < NUM_STAGES; i++) {
+      stageCycles[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Account the time a batch spent in one stage.
+   *
+   * \param stage
+   *      Stage the batch went through.
+   * \param cycles
+   *      Time spent in the stage, in cycles.
+   */
+  void
+  recordStage(LoaderStage stage, uint64_t cycles)
+  {
+    add(stageCycles[stage], cycles);
+    stageLatency[stage].record(Cycles::toNanoseconds(cycles));
+  }
+
+  /*
+   * The total number of objects this thread has uploaded to RAMCloud.
+   */
+  std::atomic<long> objectsLoaded;
+
+  /*
+   * The total number of files this thread has uploaded.
+   */
+  std::atomic<long> filesLoaded;
+
+  /*
+   * The total number of files this thread has been given to load.
+   */
+  std::atomic<long> totalFilesToLoad;
+
+  /*
+   * The total number of bytes this thread has read from disk.
+   */
+  std::atomic<long> bytesReadFromDisk;
+
+  /*
+   * The total number of bytes (keys and values) this thread has written into
+   * RAMCloud.
+   */
+  std::atomic<long> bytesWrittenToRAMCloud;
+
+  /*
+   * Total time spent in each LoaderStage, in cycles.
+   */
+  std::atomic<uint64_t> stageCycles[NUM_STAGES];
+
+  /*
+   * Per batch latency of each LoaderStage.
+   */
+  alignas(LOADER_CACHE_LINE_SIZE) LatencyHistogram stageLatency[NUM_STAGES];
+};
+
+/**
+ * A consistent-enough copy of a ThreadStats, taken by the reporter thread.
+ */
+struct ThreadStatsSnapshot {
+  ThreadStatsSnapshot()
+    : objectsLoaded(0)
+    , filesLoaded(0)
+    , totalFilesToLoad(0)
+    , bytesReadFromDisk(0)
+    , bytesWrittenToRAMCloud(0)
+    , stageCycles()
+    , stageCounts(NUM_STAGES,
+        std::vector<uint64_t>(LatencyHistogram::NUM_BUCKETS, 0))
+  {}
+
+  /**
+   * Copy the current values of a thread's statistics.
+   */
+  void
+  read(const ThreadStats& stats)
+  {
+    objectsLoaded = stats.objectsLoaded.load(std::memory_order_relaxed);
+    filesLoaded = stats.filesLoaded.load(std::memory_order_relaxed);
+    totalFilesToLoad = stats.totalFilesToLoad.load(std::memory_order_relaxed);
+    bytesReadFromDisk =
+        stats.bytesReadFromDisk.load(std::memory_order_relaxed);
+    bytesWrittenToRAMCloud =
+        stats.bytesWrittenToRAMCloud.load(std::memory_order_relaxed);
+    for (int i = 0; i < NUM_STAGES; i++) {
+      stageCycles[i] = stats.stageCycles[i].load(std::memory_order_relaxed);
+      stats.stageLatency[i].read(&stageCounts[i][0]);
+    }
+  }
+
+  long objectsLoaded;
+  long filesLoaded;
+  long totalFilesToLoad;
+  long bytesReadFromDisk;
+  long bytesWrittenToRAMCloud;
+  uint64_t stageCycles[NUM_STAGES];
+  std::vector<std::vector<uint64_t>> stageCounts;
+};
+
+/*
+ * Largest ServerId index number whose writes the loaders attribute to the
+ * master; writes to masters beyond it are attributed to the last entry.
+ */
+#define LOADER_MAX_MASTERS 1024
+
+/*
+ * Room for a master's service locator in MasterStats; longer ones are
+ * truncated.
+ */
+#define LOADER_MAX_LOCATOR 96
+
+/**
+ * Write statistics for one destination master. Unlike ThreadStats, every
+ * loader thread writes to these, so updates use atomic read-modify-writes.
+ */
+struct alignas(LOADER_CACHE_LINE_SIZE) MasterStats {
+  MasterStats()
+    : named(false)
+    , locatorSet(false)
+    , locator()
+    , objectsWritten(0)
+    , bytesWritten(0)
+    , batches(0)
+    , rpcCycles(0)
+    , rpcLatency()
+  {}
+
+  /*
+   * Set by the first thread to see the master, which then records its
+   * locator and sets locatorSet.
+   */
+  std::atomic<bool> named;
+  std::atomic<bool> locatorSet;
+
+  /*
+   * The master's service locator, once locatorSet. It's kept in the struct
+   * rather than in a std::string so that the whole table can be placed in
+   * memory shared between processes.
+   */
+  char locator[LOADER_MAX_LOCATOR];
+
+  /*
+   * The total number of objects written to this master.
+   */
+  std::atomic<long> objectsWritten;
+
+  /*
+   * The total number of value and primary key bytes written to this master.
+   */
+  std::atomic<long> bytesWritten;
+
+  /*
+   * The total number of multiWrite RPCs sent to this master.
+   */
+  std::atomic<long> batches;
+
+  /*
+   * Total time spent waiting for this master's multiWrite RPCs, in cycles.
+   */
+  std::atomic<uint64_t> rpcCycles;
+
+  /*
+   * Latency of this master's multiWrite RPCs.
+   */
+  LatencyHistogram rpcLatency;
+};
+
+/**
+ * Write statistics for every destination master, indexed by the index
+ * number of the master's ServerId. It holds no pointers, so it can be
+ * placed in shared memory with newSharedStats.
+ */
+struct MasterStatsTable {
+  MasterStatsTable()
+    : masters()
+    , numMasters(0)
+  {}
+
+  MasterStats masters[LOADER_MAX_MASTERS];
+
+  /*
+   * One more than the largest index written to so far.
+   */
+  std::atomic<uint32_t> numMasters;
+
+  /**
+   * Return a printable name for a master.
+   */
+  std::string
+  nameOf(uint32_t index)
+  {
+    const MasterStats& master = masters[index];
+    if (!master.locatorSet.load(std::memory_order_acquire)) {
+      return std::to_string(index);
+    }
+    return std::to_string(index) + " (" + master.locator + ")";
+  }
+};
+
+/**
+ * Allocate and construct statistics in anonymous shared memory, so that
+ * processes forked afterwards update the same copy: a parent can then
+ * report on a load run by several worker processes. The memory is never
+ * freed. The statistics must be made of lock-free atomics and plain data.
+ *
+ * \param count
+ *      Number of objects to allocate.
+ */
+template<typename T>
+inline T*
+newSharedStats(size_t count)
+{
+  void* memory = mmap(NULL, sizeof(T) * count, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    throw Exception(HERE, "couldn't map shared statistics", errno);
+  }
+  T* stats = (T*)memory;
+  for (size_t i = 0; i < count; i++) {
+    new (&stats[i]) T();
+  }
+  return stats;
+}
+
+/**
+ * Write a batch of objects with one MultiWrite per destination master, all
+ * outstanding at once, and charge each master with its objects, bytes and
+ * RPC latency. This costs no more than RamCloud::multiWrite, which also
+ * sends one RPC per master, but shows which masters hold a batch up.
+ *
+ * \param client
+ *      Client to write with.
+ * \param tableId
+ *      Table all the objects are in.
+ * \param requests
+ *      Objects to write.
+ * \param count
+ *      Number of objects in requests.
+ * \param masterStats
+ *      Statistics to charge the writes to.
+ */
+inline void
+multiWriteByMaster(RamCloud* client, uint64_t tableId,
+    MultiWriteObject** requests, uint32_t count,
+    MasterStatsTable* masterStats)
+{
+  std::map<uint32_t, std::vector<MultiWriteObject*>> groups;
+  for (uint32_t i = 0; i < count; i++) {
+    uint64_t hash = Key::getHash(tableId, requests[i]->key,
+        requests[i]->keyLength);
+    TabletWithLocator* tablet = client->clientContext->objectFinder->
+        lookupTablet(tableId, hash);
+    uint32_t index = std::min(tablet->tablet.serverId.indexNumber(),
+        (uint32_t)LOADER_MAX_MASTERS - 1);
+    groups[index].push_back(requests[i]);
+
+    MasterStats& master = masterStats->masters[index];
+    if (!master.named.load(std::memory_order_relaxed) &&
+        !master.named.exchange(true)) {
+      snprintf(master.locator, sizeof(master.locator), "%s",
+          tablet->serviceLocator.c_str());
+      master.locatorSet.store(true, std::memory_order_release);
+    }
+  }
+
+  std::vector<Tub<MultiWrite>> rpcs(groups.size());
+  std::vector<uint32_t> indexes;
+  uint64_t start = Cycles::rdtsc();
+  for (auto& group : groups) {
+    rpcs[indexes.size()].construct(client, &group.second[0],
+        (uint32_t)group.second.size());
+    indexes.push_back(group.first);
+  }
+
+  size_t pending = rpcs.size();
+  while (pending > 0) {
+    client->poll();
+    for (size_t g = 0; g < rpcs.size(); g++) {
+      if (!rpcs[g] || !rpcs[g]->isReady()) {
+        continue;
+      }
+      uint64_t cycles = Cycles::rdtsc() - start;
+      rpcs[g]->wait();
+      rpcs[g].destroy();
+      pending--;
+
+      std::vector<MultiWriteObject*>& group = groups[indexes[g]];
+      long bytes = 0;
+      for (MultiWriteObject* object : group) {
+        bytes += object->keyLength + object->valueLength;
+      }
+      MasterStats& master = masterStats->masters[indexes[g]];
+      master.objectsWritten.fetch_add(group.size(), std::memory_order_relaxed);
+      master.bytesWritten.fetch_add(bytes, std::memory_order_relaxed);
+      master.batches.fetch_add(1, std::memory_order_relaxed);
+      master.rpcCycles.fetch_add(cycles, std::memory_order_relaxed);
+      master.rpcLatency.recordShared(Cycles::toNanoseconds(cycles));
+    }
+  }
+
+  if (indexes.empty()) {
+    return;
+  }
+  uint32_t numMasters = masterStats->numMasters.load();
+  while (indexes.back() >= numMasters &&
+      !masterStats->numMasters.compare_exchange_weak(numMasters,
+          indexes.back() + 1)) {
+  }
+}
+
+/**
+ * A copy of a master's statistics, taken by the reporter thread.
+ */
+struct MasterStatsSnapshot {
+  MasterStatsSnapshot()
+    : objectsWritten(0)
+    , bytesWritten(0)
+    , batches(0)
+    , rpcCycles(0)
+    , counts(LatencyHistogram::NUM_BUCKETS, 0)
+  {}
+
+  /**
+   * Copy the current values of a master's statistics.
+   */
+  void
+  read(const MasterStats& stats)
+  {
+    objectsWritten = stats.objectsWritten.load(std::memory_order_relaxed);
+    bytesWritten = stats.bytesWritten.load(std::memory_order_relaxed);
+    batches = stats.batches.load(std::memory_order_relaxed);
+    rpcCycles = stats.rpcCycles.load(std::memory_order_relaxed);
+    stats.rpcLatency.read(&counts[0]);
+  }
+
+  long objectsWritten;
+  long bytesWritten;
+  long batches;
+  uint64_t rpcCycles;
+  std::vector<uint64_t> counts;
+};
+
+/**
+ * One master's activity over a period, as printed by the reporter.
+ */
+struct MasterActivity {
+  uint32_t index;
+  double objectRate;
+  double byteRate;
+  long batches;
+  uint64_t meanLatency;
+  uint64_t p50Latency;
+  uint64_t p99Latency;
+};
+
+/**
+ * Compute the activity of every master between two sets of snapshots.
+ *
+ * \param last
+ *      Snapshots at the start of the period (empty for the whole run).
+ * \param curr
+ *      Snapshots at the end of the period.
+ * \param seconds
+ *      Length of the period in seconds.
+ * \param[out] activity
+ *      Filled in with one entry per master that wrote during the period,
+ *      slowest (by 99th percentile RPC latency) first.
+ */
+inline void
+masterActivity(std::vector<MasterStatsSnapshot>& last,
+    std::vector<MasterStatsSnapshot>& curr, double seconds,
+    std::vector<MasterActivity>* activity)
+{
+  activity->clear();
+  MasterStatsSnapshot empty;
+  std::vector<uint64_t> counts(LatencyHistogram::NUM_BUCKETS);
+  for (size_t i = 0; i < curr.size(); i++) {
+    MasterStatsSnapshot& l = i < last.size() ? last[i] : empty;
+    MasterStatsSnapshot& c = curr[i];
+    long batches = c.batches - l.batches;
+    if (batches == 0) {
+      continue;
+    }
+    for (int b = 0; b < LatencyHistogram::NUM_BUCKETS; b++) {
+      counts[b] = c.counts[b] - l.counts[b];
+    }
+
+    MasterActivity a;
+    a.index = (uint32_t)i;
+    a.objectRate = (double)(c.objectsWritten - l.objectsWritten) / seconds;
+    a.byteRate = (double)(c.bytesWritten - l.bytesWritten) / seconds;
+    a.batches = batches;
+    a.meanLatency = Cycles::toNanoseconds((c.rpcCycles - l.rpcCycles) /
+        batches);
+    a.p50Latency = LatencyHistogram::percentile(&counts[0], 50);
+    a.p99Latency = LatencyHistogram::percentile(&counts[0], 99);
+    activity->push_back(a);
+  }
+
+  std::sort(activity->begin(), activity->end(),
+      [](const MasterActivity& a, const MasterActivity& b) {
+        return a.p99Latency > b.p99Latency;
+      });
+}
+
+/**
+ * Take snapshots of every master written to so far.
+ */
+inline void
+readMasterStats(MasterStatsTable* masterStats,
+    std::vector<MasterStatsSnapshot>* snapshots)
+{
+  uint32_t numMasters = masterStats->numMasters.load();
+  snapshots->resize(numMasters);
+  for (uint32_t i = 0; i < numMasters; i++) {
+    snapshots->at(i).read(masterStats->masters[i]);
+  }
+}
+
+/**
+ * Print a summary line for each master written to during a load, slowest
+ * first.
+ *
+ * \param masterStats
+ *      Statistics collected during the load.
+ * \param seconds
+ *      Duration of the load in seconds.
+ */
+inline void
+printMasterSummary(MasterStatsTable* masterStats, double seconds)
+{
+  std::vector<MasterStatsSnapshot> none;
+  std::vector<MasterStatsSnapshot> all;
+  std::vector<MasterActivity> activity;
+  readMasterStats(masterStats, &all);
+  masterActivity(none, all, seconds, &activity);
+
+  printf("Per master summary (slowest first):\n");
+  printf("%-40s %10s %10s %10s %10s %10s %10s\n", "Master", "Obj/s", "MB/s",
+      "RPCs", "Avg(us)", "50th(us)", "99th(us)");
+  for (MasterActivity& a : activity) {
+    printf("%-40s %10.0f %10.1f %10ld %10lu %10lu %10lu\n",
+        masterStats->nameOf(a.index).c_str(), a.objectRate,
+        a.byteRate / 1e6, a.batches, a.meanLatency / 1000,
+        a.p50Latency / 1000, a.p99Latency / 1000);
+  }
+}
+
+/**
+ * Format the share of time spent in each stage as "read/build/rpc"
+ * percentages.
+ *
+ * \param cycles
+ *      Time spent in each stage over the interval, in cycles.
+ * \param[out] buf
+ *      Buffer to format into.
+ * \param length
+ *      Size of buf.
+ */
+inline void
+formatStageShares(const uint64_t* cycles, char* buf, size_t length)
+{
+  uint64_t total = 0;
+  for (int i = 0; i < NUM_STAGES; i++) {
+    total += cycles[i];
+  }
+  if (total == 0) {
+    snprintf(buf, length, "-");
+    return;
+  }
+  snprintf(buf, length, "%d/%d/%d",
+      (int)(100 * cycles[READ_STAGE] / total),
+      (int)(100 * cycles[BUILD_STAGE] / total),
+      (int)(100 * cycles[RPC_STAGE] / total));
+}
+
+/**
+ * Help text for the reportFormat option of the loaders.
+ */
+#define LOADER_REPORT_FORMAT_HELP \
+     "Format options for status report output.\n" \
+     "  O - Total objects uploaded per second.\n" \
+     "  o - Per thread objects uploaded per second.\n" \
+     "  F - Total files uploaded.\n" \
+     "  f - Per thread files uploaded.\n" \
+     "  B - Total write bandwidth to RAMCloud in MB/s.\n" \
+     "  b - Per thread write bandwidth to RAMCloud in MB/s.\n" \
+     "  D - Total disk read bandwidth in MB/s.\n" \
+     "  d - Per thread disk read bandwidth in MB/s.\n" \
+     "  L - Median multiWrite RPC latency over all threads in us.\n" \
+     "  l - Per thread median multiWrite RPC latency in us.\n" \
+     "  P - 99th percentile multiWrite RPC latency over all threads in us.\n" \
+     "  p - Per thread 99th percentile multiWrite RPC latency in us.\n" \
+     "  S - Share of time all threads spent reading/building/writing " \
+     "batches, in %.\n" \
+     "  s - Per thread share of time spent reading/building/writing " \
+     "batches, in %.\n" \
+     "  T - Total time elapsed.\n" \
+     "[default: OFBDT]"
+
+/**
+ * A thread which reports statistics on the loader threads in the system at a
+ * set interval. This thread gets information on each thread via a shared
+ * ThreadStat struct with each thread.
+ *
+ * \param threadStats
+ *      Array of all the shared ThreadStat structs, one per thread.
+ * \param numThreads
+ *      The number of loader threads.
+ * \param reportInterval
+ *      The number of seconds between reporting status to the screen.
+ * \param formatString
+ *      What columns of information to output to the screen.
+ * \param masterStats
+ *      Per master statistics, or NULL if the loader doesn't collect them.
+ * \param slowestMasters
+ *      Number of masters to list, slowest first, after each report line.
+ * \param keepReporting
+ *      If given, report until it's cleared, rather than until the threads
+ *      have loaded all their files.
+ */
+inline void
+statsReporterThread(struct ThreadStats *threadStats, int numThreads,
+    int reportInterval, std::string formatString,
+    MasterStatsTable *masterStats, int slowestMasters,
+    const std::atomic<bool> *keepReporting) {
+
+  int colWidth = 10;
+  const char *colFormatStr = "%10s";
+  const int numBuckets = LatencyHistogram::NUM_BUCKETS;
+
+  // Print the column headers.
+  for (int i = 0; i < numThreads; i++) {
+    if (formatString.find("o") != std::string::npos) {
+      printf(colFormatStr, (std::to_string(i) + ".o").c_str());
+    }
+
+    if (formatString.find("f") != std::string::npos) {
+      printf(colFormatStr, (std::to_string(i) + ".f").c_str());
+    }
+
+    if (formatString.find("b") != std::string::npos) {
+      printf(colFormatStr, (std::to_string(i) + ".b").c_str());
+    }
+
+    if (formatString.find("d") != std::string::npos) {
+      printf(colFormatStr, (std::to_string(i) + ".d").c_str());
+    }
+
+    if (formatString.find("l") != std::string::npos) {
+      printf(colFormatStr, (std::to_string(i) + ".l").c_str());
+    }
+
+    if (formatString.find("p") != std::string::npos) {
+      printf(colFormatStr, (std::to_string(i) + ".p").c_str());
+    }
+
+    if (formatString.find("s") != std::string::npos) {
+      printf(colFormatStr, (std::to_string(i) + ".s").c_str());
+    }
+  }
+
+  if (formatString.find("O") != std::string::npos) {
+    printf(colFormatStr, "O");
+  }
+
+  if (formatString.find("F") != std::string::npos) {
+    printf(colFormatStr, "F");
+  }
+
+  if (formatString.find("B") != std::string::npos) {
+    printf(colFormatStr, "B");
+  }
+
+  if (formatString.find("D") != std::string::npos) {
+    printf(colFormatStr, "D");
+  }
+
+  if (formatString.find("L") != std::string::npos) {
+    printf(colFormatStr, "L");
+  }
+
+  if (formatString.find("P") != std::string::npos) {
+    printf(colFormatStr, "P");
+  }
+
+  if (formatString.find("S") != std::string::npos) {
+    printf(colFormatStr, "S");
+  }
+
+  if (formatString.find("T") != std::string::npos) {
+    printf(colFormatStr, "T");
+  }
+
+  printf("\n");
+
+  std::vector<MasterStatsSnapshot> lastMasterStats;
+  std::vector<MasterStatsSnapshot> currMasterStats;
+  std::vector<MasterActivity> activity;
+  if (masterStats != NULL) {
+    readMasterStats(masterStats, &lastMasterStats);
+  }
+
+  std::vector<ThreadStatsSnapshot> lastThreadStats(numThreads);
+  std::vector<ThreadStatsSnapshot> currThreadStats(numThreads);
+  for (int i = 0; i < numThreads; i++) {
+    lastThreadStats[i].read(threadStats[i]);
+  }
+
+  time_t startTime;
+  time(&startTime);
+  while (true) {
+    sleep(reportInterval);
+
+    time_t currTime;
+    time(&currTime);
+    long timeElapsed = (long) difftime(currTime, startTime);
+
+    long totalCurrObjRate = 0;
+    long totalFilesLoaded = 0;
+    long totalFilesToLoad = 0;
+    long totalCurrReadRate = 0;
+    long totalCurrWriteRate = 0;
+    uint64_t totalRpcCounts[numBuckets] = {};
+    uint64_t totalStageCycles[NUM_STAGES] = {};
+    for (int i = 0; i < numThreads; i++) {
+      ThreadStatsSnapshot *lastStats = &lastThreadStats[i];
+      ThreadStatsSnapshot *currStats = &currThreadStats[i];
+      currStats->read(threadStats[i]);
+
+      long objectsLoaded =
+          currStats->objectsLoaded - lastStats->objectsLoaded;
+      long bytesReadFromDisk =
+          currStats->bytesReadFromDisk - lastStats->bytesReadFromDisk;
+      long byteWrittenToRAMCloud = currStats->bytesWrittenToRAMCloud
+          - lastStats->bytesWrittenToRAMCloud;
+
+      long currObjRate = objectsLoaded / reportInterval;
+      long currReadRate = bytesReadFromDisk / reportInterval;
+      long currWriteRate = byteWrittenToRAMCloud / reportInterval;
+
+      // RPC latencies and stage times over this interval only.
+      uint64_t rpcCounts[numBuckets];
+      for (int b = 0; b < numBuckets; b++) {
+        rpcCounts[b] = currStats->stageCounts[RPC_STAGE][b] -
+            lastStats->stageCounts[RPC_STAGE][b];
+        totalRpcCounts[b] += rpcCounts[b];
+      }
+      uint64_t stageCycles[NUM_STAGES];
+      for (int s = 0; s < NUM_STAGES; s++) {
+        stageCycles[s] = currStats->stageCycles[s] - lastStats->stageCycles[s];
+        totalStageCycles[s] += stageCycles[s];
+      }
+
+      if (formatString.find("o") != std::string::npos) {
+        printf(colFormatStr, std::to_string(currObjRate).c_str());
+      }
+
+      if (formatString.find("f") != std::string::npos) {
+        char buf[colWidth + 1];
+        snprintf(buf, sizeof(buf), "(%ld/%ld)", currStats->filesLoaded,
+            currStats->totalFilesToLoad);
+        printf(colFormatStr, buf);
+      }
+
+      if (formatString.find("b") != std::string::npos) {
+        printf(colFormatStr, std::to_string(currWriteRate / 1000000l).c_str());
+      }
+
+      if (formatString.find("d") != std::string::npos) {
+        printf(colFormatStr, std::to_string(currReadRate / 1000000l).c_str());
+      }
+
+      if (formatString.find("l") != std::string::npos) {
+        printf(colFormatStr, std::to_string(
+            LatencyHistogram::percentile(rpcCounts, 50) / 1000).c_str());
+      }
+
+      if (formatString.find("p") != std::string::npos) {
+        printf(colFormatStr, std::to_string(
+            LatencyHistogram::percentile(rpcCounts, 99) / 1000).c_str());
+      }
+
+      if (formatString.find("s") != std::string::npos) {
+        char buf[colWidth + 1];
+        formatStageShares(stageCycles, buf, sizeof(buf));
+        printf(colFormatStr, buf);
+      }
+
+      totalCurrObjRate += currObjRate;
+      totalCurrReadRate += currReadRate;
+      totalCurrWriteRate += currWriteRate;
+      totalFilesLoaded += currStats->filesLoaded;
+      totalFilesToLoad += currStats->totalFilesToLoad;
+    }
+
+    if (formatString.find("O") != std::string::npos) {
+      printf(colFormatStr, std::to_string(totalCurrObjRate).c_str());
+    }
+
+    if (formatString.find("F") != std::string::npos) {
+      char buf[colWidth + 1];
+      snprintf(buf, sizeof(buf), "(%ld/%ld)", totalFilesLoaded,
+          totalFilesToLoad);
+      printf(colFormatStr, buf);
+    }
+
+    if (formatString.find("B") != std::string::npos) {
+      printf(colFormatStr,
+          std::to_string(totalCurrWriteRate / 1000000l).c_str());
+    }
+
+    if (formatString.find("D") != std::string::npos) {
+      printf(colFormatStr,
+          std::to_string(totalCurrReadRate / 1000000l).c_str());
+    }
+
+    if (formatString.find("L") != std::string::npos) {
+      printf(colFormatStr, std::to_string(
+          LatencyHistogram::percentile(totalRpcCounts, 50) / 1000).c_str());
+    }
+
+    if (formatString.find("P") != std::string::npos) {
+      printf(colFormatStr, std::to_string(
+          LatencyHistogram::percentile(totalRpcCounts, 99) / 1000).c_str());
+    }
+
+    if (formatString.find("S") != std::string::npos) {
+      char buf[colWidth + 1];
+      formatStageShares(totalStageCycles, buf, sizeof(buf));
+      printf(colFormatStr, buf);
+    }
+
+    if (formatString.find("T") != std::string::npos) {
+      printf(colFormatStr, std::to_string(timeElapsed/60l).c_str());
+    }
+
+    printf("\n");
+
+    if (masterStats != NULL && slowestMasters > 0) {
+      readMasterStats(masterStats, &currMasterStats);
+      masterActivity(lastMasterStats, currMasterStats, reportInterval,
+          &activity);
+      if (!activity.empty()) {
+        printf("  Slowest masters (99th us, obj/s):");
+        for (int m = 0; m < slowestMasters && m < (int)activity.size(); m++) {
+          printf(" %u (%lu, %.0f)", activity[m].index,
+              activity[m].p99Latency / 1000, activity[m].objectRate);
+        }
+        printf("\n");
+      }
+      lastMasterStats.swap(currMasterStats);
+    }
+
+    // Capture the current stats as last seen stats.
+    lastThreadStats.swap(currThreadStats);
+
+    if (keepReporting != NULL ? !*keepReporting :
+        totalFilesLoaded == totalFilesToLoad) {
+      break;
+    }
+  }
+}
+
+} // namespace RAMCloud
+
+#endif // RAMCLOUDTOOLS_LOADERSTATS_H
@@ -13,7 +13,13 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <getopt.h>
@@ -21,8 +27,13 @@
 #include <time.h>
 #include <dirent.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <thread>
 
 #include "ClusterMetrics.h"
@@ -37,316 +48,639 @@
 #include "Tub.h"
 #include "IndexLookup.h"
 #include "TableEnumerator.h"
+#include "ImageFile.h"
+#include "FileLeases.h"
+#include "ImageIO.h"
+#include "LoaderStats.h"
+#include "StorageBackend.h"
+#include "TabletPlacement.h"
 
 using namespace RAMCloud;
 
-/** 
- * A set of per-thread loading statistics. Each loader thread continually
- * updates these statistics, while a statistics reporting thread with a
- * reference to each thread's stats regularly prints statistic summaries to the
- * screen.
+/**
+ * Return the name of the table an image file of the snapshot is loaded
+ * into: the file name up to ".img", so that the parts of a split image all
+ * go to the same table.
  */
-struct ThreadStats {
-  /*
-   * The total number of objects this thread has uploaded to RAMCloud.
-   */
-  long objectsLoaded = 0;
-
-  /*
-   * The total number of files this thread has uploaded.
-   */
-  long filesLoaded = 0;
-
-  /*
-   * The total number of files this thread has been given to load.
-   */
-  long totalFilesToLoad = 0;
-
-  /*
-   * The total number of bytes this thread has read from disk.
-   */
-  long bytesReadFromDisk = 0;
-
-  /*
-   * The total number of bytes (keys and values) this thread has written into
-   * RAMCloud.
-   */ 
-  long bytesWrittenToRAMCloud = 0;
-};
+static std::string
+imageTableName(const std::string& fileName,
+    const std::string& tableNameSuffix)
+{
+  return fileName.substr(0, fileName.find(".img")) + tableNameSuffix;
+}
 
 /**
- * A thread which reports statistics on the loader threads in the system at a
- * set interval. This thread gets information on each thread via a shared
- * ThreadStat struct with each thread.
+ * A loader thread which takes a set of files to load and loads them 
+ * sequentially.
  *
- * \param threadStats
- *      Array of all the shared ThreadStat structs, one per thread.
- * \param numThreads
- *      The number of loader threads.
- * \param reportInterval
- *      The number of seconds between reporting status to the screen.
- * \param formatString
- *      What columns of information to output to the screen.
+ * \param backend
+ *      Store to load into. Each thread gets its own backend because the
+ *      RAMCloud client object is not thread-safe.
+ * \param fileList
+ *      Master list of all the file names that compose the table.
+ * \param startIndex
+ *      The index in the load list at which this thread's loading work starts.
+ * \param length
+ *      The segment length in the load list for this thread.
+ * \param multiwriteSize
+ *      The size of multiwrites to use.
+ * \param numIndexes
+ *      Number of secondary indexes to create on each table before loading it.
+ * \param numIndexlets
+ *      Number of indexlets for each secondary index.
+ * \param balanceSample
+ *      If not 0, each table's tablets are placed to balance bytes across its
+ *      masters, judging from every balanceSample'th record of its images.
+ *      Every table is placed, by this thread or another loader, before any
+ *      file is loaded.
+ * \param readOptions
+ *      How to read the files.
+ * \param leaseOptions
+ *      If enabled, the thread claims files by lease, starting at startIndex,
+ *      until every file in fileList has been loaded; length is ignored.
+ * \param leaseOwner
+ *      Name of this thread in its leases.
+ * \param stats
+ *      Statistics for this thread.
  */
-void statsReporterThread(struct ThreadStats *threadStats, int numThreads, 
-    int reportInterval, std::string formatString) {
-
-  int colWidth = 10;
-  const char *colFormatStr = "%10s";
-
-  // Print the column headers.
-  for (int i = 0; i < numThreads; i++) {
-    if (formatString.find("o") != std::string::npos) {
-      printf(colFormatStr, (std::to_string(i) + ".o").c_str());
-    }
-
-    if (formatString.find("f") != std::string::npos) {
-      printf(colFormatStr, (std::to_string(i) + ".f").c_str());
-    }
-
-    if (formatString.find("b") != std::string::npos) {
-      printf(colFormatStr, (std::to_string(i) + ".b").c_str());
+void fileLoaderThread(StorageBackend *backend, int serverSpan,
+    std::vector<std::string> fileList, std::string snapshotDir, 
+    std::string tableNameSuffix, int startIndex, int length, 
+    int multiwriteSize, int numIndexes, int numIndexlets, int balanceSample,
+    ImageReadOptions readOptions, FileLeaseOptions leaseOptions,
+    std::string leaseOwner, struct ThreadStats *stats) {
+
+  // Place every table before claiming any files, so no lease goes unrenewed
+  // while images are sampled. Each thread starts with the table of its own
+  // first file, so that threads mostly place different tables.
+  std::map<std::string, uint64_t> balancedTableIds;
+  if (balanceSample > 0) {
+    std::map<std::string, std::vector<std::string>> tableImages;
+    std::vector<std::string> tableNames;
+    for (size_t i = 0; i < fileList.size(); i++) {
+      const std::string& fileName =
+          fileList[(startIndex + i) % fileList.size()];
+      std::string tableName = imageTableName(fileName, tableNameSuffix);
+      if (tableImages.count(tableName) == 0) {
+        tableNames.push_back(tableName);
+      }
+      tableImages[tableName].push_back(snapshotDir + "/" + fileName);
     }
-
-    if (formatString.find("d") != std::string::npos) {
-      printf(colFormatStr, (std::to_string(i) + ".d").c_str());
+    for (size_t i = 0; i < tableNames.size(); i++) {
+      balancedTableIds[tableNames[i]] = createBalancedTable(backend,
+          tableNames[i], serverSpan, tableImages[tableNames[i]],
+          balanceSample, leaseOwner);
     }
   }
 
-  if (formatString.find("O") != std::string::npos) {
-    printf(colFormatStr, "O");
-  }
-
-  if (formatString.find("F") != std::string::npos) {
-    printf(colFormatStr, "F");
-  }
-
-  if (formatString.find("B") != std::string::npos) {
-    printf(colFormatStr, "B");
+  Tub<FileLeases> leases;
+  if (leaseOptions.enabled()) {
+    uint64_t leaseTableId = backend->createTable(leaseOptions.table.c_str(),
+        serverSpan);
+    leases.construct(backend, leaseTableId, fileList, startIndex, leaseOwner,
+        leaseOptions.seconds);
+  } else {
+    stats->totalFilesToLoad = length;
   }
 
-  if (formatString.find("D") != std::string::npos) {
-    printf(colFormatStr, "D");
-  }
+  printf("Starting LoaderThread: {startIndex: %u, length: %u, "
+      "multiwriteSize: %u}\n", startIndex, length, multiwriteSize);
 
-  if (formatString.find("T") != std::string::npos) {
-    printf(colFormatStr, "T");
-  }
+  int nextIndex = startIndex;
+  while (true) {
+    int fIndex;
+    if (leases) {
+      fIndex = leases->claim();
+      if (fIndex < 0) {
+        break;
+      }
+      add(stats->totalFilesToLoad, 1l);
+    } else {
+      if (nextIndex == startIndex + length) {
+        break;
+      }
+      fIndex = nextIndex++;
+    }
+    std::string fileName = fileList[fIndex];
 
-  printf("\n");
+    std::string tableName = imageTableName(fileName, tableNameSuffix);
 
+    std::string filePath = snapshotDir + "/" + fileName;
+    ImageBatchReader reader(filePath, readOptions, multiwriteSize);
 
-  struct ThreadStats lastThreadStats[numThreads];
-  memcpy(lastThreadStats, threadStats, numThreads*sizeof(struct ThreadStats));
- 
-  time_t startTime;
-  time(&startTime); 
-  while (true) {
-    sleep(reportInterval);
+    uint64_t tableId;
+    if (balanceSample > 0) {
+      tableId = balancedTableIds[tableName];
+    } else {
+      tableId = backend->createTable(tableName.c_str(), serverSpan);
+    }
+    for (int i = 1; i <= numIndexes; i++) {
+      backend->createIndex(tableId, (uint8_t)i, (uint8_t)numIndexlets);
+    }
 
-    time_t currTime;
-    time(&currTime);
-    long timeElapsed = (long) difftime(currTime, startTime);
+    Tub<MultiWriteObject> objects[multiwriteSize];
+    MultiWriteObject* requests[multiwriteSize];
+    
+    std::vector<KeyInfo> keyInfo;
 
-    long totalCurrObjRate = 0;
-    long totalFilesLoaded = 0;
-    long totalFilesToLoad = 0;
-    long totalCurrReadRate = 0;
-    long totalCurrWriteRate = 0;
-    for (int i = 0; i < numThreads; i++) {
-      struct ThreadStats *lastStats = &lastThreadStats[i];
-      struct ThreadStats *currStats = &threadStats[i];
-
-      long objectsLoaded = 
-          currStats->objectsLoaded - lastStats->objectsLoaded;
-      long bytesReadFromDisk = 
-          currStats->bytesReadFromDisk - lastStats->bytesReadFromDisk;
-      long byteWrittenToRAMCloud = currStats->bytesWrittenToRAMCloud 
-          - lastStats->bytesWrittenToRAMCloud;
-
-      long currObjRate = objectsLoaded / reportInterval;
-      long currReadRate = bytesReadFromDisk / reportInterval;
-      long currWriteRate = byteWrittenToRAMCloud / reportInterval;
-
-      if (formatString.find("o") != std::string::npos) {
-        printf(colFormatStr, std::to_string(currObjRate).c_str());
+    bool leaseLost = false;
+    while (true) {
+      if (leases && !leases->renew()) {
+        leaseLost = true;
+        break;
       }
 
-      if (formatString.find("f") != std::string::npos) {
-        char buf[colWidth];
-        sprintf(buf, "(%d/%d)", currStats->filesLoaded, 
-            currStats->totalFilesToLoad);
-        printf(colFormatStr, buf);
+      uint64_t readStart = Cycles::rdtsc();
+      ImageBatch* batch;
+      try {
+        batch = reader.next();
+      } catch (Exception& e) {
+        // The file isn't counted as loaded, and its lease is left to expire
+        // so that another loader can retry it.
+        fprintf(stderr, "Reading %s failed: %s\n", filePath.c_str(),
+            e.str().c_str());
+        return;
       }
-
-      if (formatString.find("b") != std::string::npos) {
-        printf(colFormatStr, std::to_string(currWriteRate / 1000000l).c_str());
+      if (batch == NULL) {
+        break;
       }
+      stats->recordStage(READ_STAGE, Cycles::rdtsc() - readStart);
+      add(stats->bytesReadFromDisk, (long)batch->diskBytes);
+
+      uint64_t buildStart = Cycles::rdtsc();
+      add(stats->bytesWrittenToRAMCloud, (long)prepareMultiWrite(tableId,
+          batch->records, batch->count, &keyInfo, objects, requests));
+      uint64_t rpcStart = Cycles::rdtsc();
+      stats->recordStage(BUILD_STAGE, rpcStart - buildStart);
 
-      if (formatString.find("d") != std::string::npos) {
-        printf(colFormatStr, std::to_string(currReadRate / 1000000l).c_str());
+      try {
+        backend->multiWrite(tableId, requests, batch->count);
+      } catch(RAMCloud::ClientException& e) {
+        fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
+        return;
       }
+      stats->recordStage(RPC_STAGE, Cycles::rdtsc() - rpcStart);
       
-      totalCurrObjRate += currObjRate;
-      totalCurrReadRate += currReadRate;
-      totalCurrWriteRate += currWriteRate;
-      totalFilesLoaded += currStats->filesLoaded;
-      totalFilesToLoad += currStats->totalFilesToLoad;
+      add(stats->objectsLoaded, (long)batch->count);
     }
 
-    if (formatString.find("O") != std::string::npos) {
-      printf(colFormatStr, std::to_string(totalCurrObjRate).c_str());
+    if (leaseLost) {
+      // Another client has taken the file over and will load all of it.
+      add(stats->totalFilesToLoad, -1l);
+      continue;
     }
-
-    if (formatString.find("F") != std::string::npos) {
-      char buf[colWidth];
-      sprintf(buf, "(%d/%d)", totalFilesLoaded, totalFilesToLoad);
-      printf(colFormatStr, buf);
+    if (leases) {
+      leases->finish();
     }
 
-    if (formatString.find("B") != std::string::npos) {
-      printf(colFormatStr, 
-          std::to_string(totalCurrWriteRate / 1000000l).c_str());
-    }
+    add(stats->filesLoaded, 1l);
+  }
+}
 
-    if (formatString.find("D") != std::string::npos) {
-      printf(colFormatStr, 
-          std::to_string(totalCurrReadRate / 1000000l).c_str());
-    }
+/**
+ * Divide a number of files as evenly as possible among a number of loaders,
+ * and return the share of one of them.
+ *
+ * \param total
+ *      Number of files to divide.
+ * \param index
+ *      Index of the loader whose share to return.
+ * \param count
+ *      Number of loaders.
+ * \param[out] offset
+ *      Set to the index of the loader's first file.
+ * \param[out] size
+ *      Set to the number of files in the loader's share.
+ */
+void shareOf(int total, int index, int count, int *offset, int *size) {
+  int q = total / count;
+  int r = total % count;
+  if (index < r) {
+    *size = q + 1;
+    *offset = (q + 1) * index;
+  } else {
+    *size = q;
+    *offset = ((q + 1) * r) + (q * (index - r));
+  }
+}
 
-    if (formatString.find("T") != std::string::npos) {
-      printf(colFormatStr, std::to_string(timeElapsed/60l).c_str());
-    }
+/**
+ * Load a range of a snapshot's files, divided among a number of
+ * fileLoaderThreads, and wait for them to finish.
+ *
+ * \param newBackend
+ *      Makes the backend for each thread.
+ * \param fileList
+ *      Master list of all the file names that compose the snapshot.
+ * \param startIndex
+ *      Index in fileList of the first file to load.
+ * \param length
+ *      Number of files to load.
+ * \param numThreads
+ *      Number of threads to load them with.
+ * \param leaseOptions
+ *      If enabled, the threads start at their share of the range, but go on
+ *      to claim any file in fileList that other clients haven't loaded.
+ * \param tStats
+ *      Array of numThreads statistics, one for each thread.
+ * \return
+ *      False if any thread failed to load all of its files.
+ */
+bool loadFiles(std::function<StorageBackend*()> newBackend,
+    const std::vector<std::string>& fileList, int startIndex, int length,
+    int numThreads, int serverSpan, std::string snapshotDir,
+    std::string tableNameSuffix, int multiwriteSize, int numIndexes,
+    int numIndexlets, int balanceSample, ImageReadOptions readOptions,
+    FileLeaseOptions leaseOptions, ThreadStats *tStats) {
+  char hostName[256];
+  if (gethostname(hostName, sizeof(hostName)) != 0) {
+    snprintf(hostName, sizeof(hostName), "unknown");
+  }
+  hostName[sizeof(hostName) - 1] = '\0';
 
-    printf("\n");
+  std::vector<std::thread> threads;
+  StorageBackend *backends[numThreads];
+  for (int i = 0; i < numThreads; i++) {
+    int threadLoadOffset;
+    int threadLoadSize;
+    shareOf(length, i, numThreads, &threadLoadOffset, &threadLoadSize);
+    threadLoadOffset += startIndex;
 
-    // Capture the current stats as last seen stats.
-    memcpy(lastThreadStats, threadStats, 
-        numThreads*sizeof(struct ThreadStats));
+    backends[i] = newBackend();
 
-    if (totalFilesLoaded == totalFilesToLoad) {
-      break;
+    std::string leaseOwner = std::string(hostName) + ":" +
+        std::to_string(getpid()) + ":" + std::to_string(i);
+
+    threads.emplace_back(fileLoaderThread, backends[i], serverSpan, fileList,
+        snapshotDir, tableNameSuffix, threadLoadOffset, threadLoadSize, 
+        multiwriteSize, numIndexes, numIndexlets, balanceSample, readOptions,
+        leaseOptions, leaseOwner, &tStats[i]);
+  }
+
+  bool ok = true;
+  for (int i = 0; i < numThreads; i++) {
+    threads[i].join();
+    delete backends[i];
+    if (tStats[i].filesLoaded != tStats[i].totalFilesToLoad) {
+      ok = false;
     }
   }
-}  
- 
+  return ok;
+}
 
 /**
- * A loader thread which takes a set of files to load and loads them 
- * sequentially.
+ * An upload thread which writes batches parsed from streams by loadStream.
  *
- * \param client
- *      RAMCloud client object to use for this thread. Each thread currently
- *      gets its own client object because the RAMCloud client object is not
- *      thread-safe.
- * \param fileList
- *      Master list of all the file names that compose the table.
- * \param startIndex
- *      The index in the load list at which this thread's loading work starts.
- * \param length
- *      The segment length in the load list for this thread.
+ * \param backend
+ *      Store to load into; each thread has its own.
  * \param multiwriteSize
- *      The size of multiwrites to use.
+ *      Maximum number of records in a batch.
+ * \param fullBatches
+ *      Batches to upload, each into the table given by its tableId. The
+ *      thread returns once this is closed and empty.
+ * \param stats
+ *      Statistics for this thread.
  */
-void fileLoaderThread(RamCloud *client, int serverSpan,
-    std::vector<std::string> fileList, std::string snapshotDir, 
-    std::string tableNameSuffix, int startIndex, int length, 
-    int multiwriteSize, struct ThreadStats *stats) {
- 
-  stats->totalFilesToLoad = length;
+void streamUploaderThread(StorageBackend *backend, int multiwriteSize,
+    ImageBatchQueue* fullBatches, struct ThreadStats *stats) {
+  Tub<MultiWriteObject> objects[multiwriteSize];
+  MultiWriteObject* requests[multiwriteSize];
+  std::vector<KeyInfo> keyInfo;
 
-  printf("Starting LoaderThread: {startIndex: %u, length: %u, "
-      "multiwriteSize: %u}\n", startIndex, length, multiwriteSize);
+  while (true) {
+    uint64_t readStart = Cycles::rdtsc();
+    ImageBatch* batch = fullBatches->pop();
+    if (batch == NULL) {
+      break;
+    }
+    stats->recordStage(READ_STAGE, Cycles::rdtsc() - readStart);
+    add(stats->bytesReadFromDisk, (long)batch->diskBytes);
+
+    uint64_t buildStart = Cycles::rdtsc();
+    add(stats->bytesWrittenToRAMCloud, (long)prepareMultiWrite(batch->tableId,
+        batch->records, batch->count, &keyInfo, objects, requests));
+    uint64_t rpcStart = Cycles::rdtsc();
+    stats->recordStage(BUILD_STAGE, rpcStart - buildStart);
+
+    try {
+      backend->multiWrite(batch->tableId, requests, batch->count);
+      stats->recordStage(RPC_STAGE, Cycles::rdtsc() - rpcStart);
+      add(stats->objectsLoaded, (long)batch->count);
+    } catch(RAMCloud::ClientException& e) {
+      fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
+      batch->failed = true;
+    }
 
-  for (int fIndex = startIndex; fIndex < startIndex + length; fIndex++) { 
-    std::ifstream inFile;
-    std::string fileName = fileList[fIndex];
+    // The batch always goes back, even if it failed: its stream waits for
+    // all of its batches before finishing.
+    batch->freeQueue->push(batch);
+  }
+}
 
-    std::string tableName = fileName.substr(0, fileName.find(".img")) +
-        tableNameSuffix;
+/**
+ * Parse an image from a stream into batches for the streamUploaderThreads,
+ * and wait for them all to be uploaded.
+ *
+ * \param in
+ *      Stream to read, such as stdin or a client connection.
+ * \param tableId
+ *      Table to load the image into.
+ * \param blockSize
+ *      Size of each read from the stream.
+ * \param multiwriteSize
+ *      Number of records in each batch.
+ * \param numBatches
+ *      Number of batches this stream may have queued or uploading at once.
+ * \param fullBatches
+ *      Queue feeding the upload threads.
+ * \param[out] objectCount
+ *      Set to the number of objects read from the stream.
+ * \return
+ *      False if reading the stream or uploading any of it failed.
+ */
+bool loadStream(FILE* in, uint64_t tableId, int blockSize, int multiwriteSize,
+    int numBatches, ImageBatchQueue* fullBatches, uint64_t* objectCount) {
+  std::vector<ImageBatch> batches(numBatches);
+  ImageBatchQueue freeBatches(numBatches);
+  for (int i = 0; i < numBatches; i++) {
+    batches[i].records.resize(multiwriteSize);
+    batches[i].tableId = tableId;
+    batches[i].freeQueue = &freeBatches;
+    freeBatches.push(&batches[i]);
+  }
 
-    std::string filePath = snapshotDir + "/" + fileName;
-    inFile.open(filePath.c_str(), std::ios::binary);
+  bool ok = true;
+  *objectCount = 0;
+  ImageBatch* batch = NULL;
+  try {
+    FreadBlockReader blocks(in, blockSize);
+    ImageRecordParser parser(&blocks);
+    bool more = true;
+    while (more) {
+      batch = freeBatches.pop();
+      if (batch->failed) {
+        break;
+      }
+      more = fillImageBatch(&parser, multiwriteSize, batch);
+      if (batch->count == 0) {
+        break;
+      }
+      *objectCount += batch->count;
+      if (!fullBatches->push(batch)) {
+        ok = false;
+        break;
+      }
+      batch = NULL;
+    }
+  } catch (Exception& e) {
+    fprintf(stderr, "Reading image failed: %s\n", e.str().c_str());
+    ok = false;
+  }
+  if (batch != NULL) {
+    freeBatches.push(batch);
+  }
 
-    uint64_t tableId = client->createTable(tableName.c_str(), serverSpan);
+  // Wait for the upload threads to be done with every batch.
+  for (int i = 0; i < numBatches; i++) {
+    if (freeBatches.pop()->failed) {
+      ok = false;
+    }
+  }
+  return ok;
+}
 
-    Tub<MultiWriteObject> objects[multiwriteSize];
-    MultiWriteObject* requests[multiwriteSize];
-    
-    std::vector<std::string> keys;
-    std::vector<std::string> values;
-
-    char lenBuffer[sizeof(uint32_t)];
-    while(inFile.read(lenBuffer, sizeof(lenBuffer))) {
-      uint32_t keyLength = *((uint32_t*) lenBuffer); 
-      char keyBuffer[keyLength];
-      inFile.read(keyBuffer, keyLength);
-      keys.emplace_back((const char*)keyBuffer, keyLength);
-      
-      inFile.read(lenBuffer, sizeof(lenBuffer));
-      uint32_t dataLength = *((uint32_t*) lenBuffer);
-      char dataBuffer[dataLength];
-      inFile.read(dataBuffer, dataLength);
-      values.emplace_back((const char*)dataBuffer, dataLength);
-
-      stats->bytesReadFromDisk += sizeof(lenBuffer)*2 + keyLength + dataLength;
-
-      if (keys.size() == multiwriteSize) {
-        for (int i = 0; i < keys.size(); i++) {
-          objects[i].construct( tableId,
-                                (const void*) keys[i].data(),
-                                keys[i].size(),
-                                (const void*) values[i].data(),
-                                values[i].size() );
-          requests[i] = objects[i].get();
-
-          stats->bytesWrittenToRAMCloud += keys[i].size() + values[i].size();
-        }
+/*
+ * Set by SIGINT and SIGTERM to shut down an IngestServer.
+ */
+static volatile sig_atomic_t stopRequested = 0;
 
-        try {
-          client->multiWrite(requests, multiwriteSize);
-        } catch(RAMCloud::ClientException& e) {
-          fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
-          return;
-        }
-        
-        stats->objectsLoaded += multiwriteSize;
+static void
+requestStop(int /* signal */)
+{
+  stopRequested = 1;
+}
 
-        keys.clear();
-        values.clear();
+/**
+ * Accepts image streams on a socket and loads each into the table named at
+ * its start, with loadStream, so that all of them share one set of upload
+ * threads and clients. A client sends a line holding the table name, then
+ * the image, then shuts down its side of the connection; the server replies
+ * "OK <objects>" or "ERROR [<message>]" once the image has been uploaded,
+ * for example:
+ *
+ *     (echo usertable; gunzip -c usertable.img.gz) | nc -N -U /tmp/loader
+ */
+class IngestServer {
+ public:
+  /**
+   * \param control
+   *      Backend for creating tables; used by one stream at a time.
+   * \param fullBatches
+   *      Queue feeding the upload threads.
+   * \param stats
+   *      Statistics of the upload threads; each stream is counted as a file
+   *      in the first one.
+   */
+  IngestServer(StorageBackend* control, ImageBatchQueue* fullBatches,
+      ThreadStats* stats, int serverSpan, std::string tableNameSuffix,
+      int numIndexes, int numIndexlets, int blockSize, int multiwriteSize,
+      int numBatches)
+    : control(control)
+    , controlMutex()
+    , fullBatches(fullBatches)
+    , stats(stats)
+    , serverSpan(serverSpan)
+    , tableNameSuffix(tableNameSuffix)
+    , numIndexes(numIndexes)
+    , numIndexlets(numIndexlets)
+    , blockSize(blockSize)
+    , multiwriteSize(multiwriteSize)
+    , numBatches(numBatches)
+    , mutex()
+    , streamDone()
+    , activeStreams(0)
+    , nextStreamId(1)
+  {}
+
+  /**
+   * Accept streams until SIGINT or SIGTERM, then wait for the streams in
+   * progress to finish.
+   *
+   * \param listenFd
+   *      Socket returned by listenOn, which is closed on return.
+   * \param address
+   *      Address it was opened on.
+   */
+  void
+  run(int listenFd, const std::string& address)
+  {
+    printf("Listening for image streams on %s\n", address.c_str());
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (!stopRequested) {
+      // Poll with a timeout so that a stop request is noticed promptly.
+      struct pollfd pfd = { listenFd, POLLIN, 0 };
+      if (poll(&pfd, 1, 500) <= 0) {
+        continue;
+      }
+      int fd = accept(listenFd, NULL, NULL);
+      if (fd < 0) {
+        continue;
       }
+      std::lock_guard<std::mutex> lock(mutex);
+      activeStreams++;
+      std::thread(&IngestServer::serve, this, fd, nextStreamId++).detach();
     }
 
-    if (keys.size() > 0) {
-      for (int i = 0; i < keys.size(); i++) {
-        objects[i].construct( tableId,
-                              (const void*) keys[i].data(),
-                              keys[i].size(),
-                              (const void*) values[i].data(),
-                              values[i].size() );
-        requests[i] = objects[i].get();
+    close(listenFd);
+    if (address.compare(0, 5, "unix:") == 0) {
+      unlink(address.c_str() + 5);
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    printf("Stopping; waiting for %d streams to finish\n", activeStreams);
+    streamDone.wait(lock, [&] { return activeStreams == 0; });
+  }
 
-        stats->bytesWrittenToRAMCloud += keys[i].size() + values[i].size();
+  /**
+   * Open a listening socket.
+   *
+   * \param address
+   *      "unix:PATH" or "tcp:[HOST:]PORT".
+   */
+  static int
+  listenOn(const std::string& address)
+  {
+    int fd;
+    if (address.compare(0, 5, "unix:") == 0) {
+      std::string path = address.substr(5);
+      struct sockaddr_un sun;
+      memset(&sun, 0, sizeof(sun));
+      sun.sun_family = AF_UNIX;
+      if (path.size() >= sizeof(sun.sun_path)) {
+        throw Exception(HERE, "socket path too long: " + path, 0);
+      }
+      strcpy(sun.sun_path, path.c_str());
+      unlink(path.c_str());
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (fd < 0 || bind(fd, (struct sockaddr*)&sun, sizeof(sun)) != 0) {
+        throw Exception(HERE, "couldn't bind to " + address, errno);
+      }
+    } else if (address.compare(0, 4, "tcp:") == 0) {
+      std::string host = address.substr(4);
+      std::string port = host;
+      size_t colon = host.rfind(':');
+      if (colon == std::string::npos) {
+        host = "";
+      } else {
+        port = host.substr(colon + 1);
+        host = host.substr(0, colon);
+      }
+      struct addrinfo hints;
+      memset(&hints, 0, sizeof(hints));
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      hints.ai_flags = AI_PASSIVE;
+      struct addrinfo* info;
+      int error = getaddrinfo(host.empty() ? NULL : host.c_str(),
+          port.c_str(), &hints, &info);
+      if (error != 0) {
+        throw Exception(HERE, "couldn't resolve " + address + ": " +
+            gai_strerror(error), 0);
       }
+      fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+      int one = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      int bound = fd < 0 ? -1 : bind(fd, info->ai_addr, info->ai_addrlen);
+      freeaddrinfo(info);
+      if (bound != 0) {
+        throw Exception(HERE, "couldn't bind to " + address, errno);
+      }
+    } else {
+      throw Exception(HERE, "listen address must be unix:PATH or "
+          "tcp:[HOST:]PORT, not " + address, 0);
+    }
+    if (listen(fd, 128) != 0) {
+      throw Exception(HERE, "couldn't listen on " + address, errno);
+    }
+    return fd;
+  }
 
+ private:
+  /**
+   * Load one stream and reply to its client.
+   */
+  void
+  serve(int fd, int streamId)
+  {
+    FILE* in = fdopen(fd, "r");
+    char line[256];
+    bool ok = false;
+    std::string error;
+    uint64_t objectCount = 0;
+    if (fgets(line, sizeof(line), in) != NULL) {
+      line[strcspn(line, "\r\n")] = '\0';
+      std::string tableName = line + tableNameSuffix;
+      stats->totalFilesToLoad.fetch_add(1);
       try {
-        client->multiWrite(requests, keys.size());
-      } catch(RAMCloud::ClientException& e) {
-        fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
-        return;
+        uint64_t tableId;
+        {
+          std::lock_guard<std::mutex> lock(controlMutex);
+          tableId = control->createTable(tableName.c_str(), serverSpan);
+          for (int i = 1; i <= numIndexes; i++) {
+            control->createIndex(tableId, (uint8_t)i, (uint8_t)numIndexlets);
+          }
+        }
+        printf("Stream %d: loading into %s\n", streamId, tableName.c_str());
+        ok = loadStream(in, tableId, blockSize, multiwriteSize, numBatches,
+            fullBatches, &objectCount);
+      } catch (RAMCloud::ClientException& e) {
+        error = e.str();
+      } catch (RAMCloud::Exception& e) {
+        // Includes TransportException, which mustn't escape this detached
+        // thread and take the server down.
+        error = e.str();
       }
-
-      stats->objectsLoaded += keys.size();
-
-      keys.clear();
-      values.clear();
+      if (!error.empty()) {
+        fprintf(stderr, "RAMCloud exception: %s\n", error.c_str());
+      }
+      stats->filesLoaded.fetch_add(1);
+      printf("Stream %d: %s after %lu objects\n", streamId,
+          ok ? "done" : "failed", objectCount);
     }
+    if (ok) {
+      dprintf(fd, "OK %lu\n", objectCount);
+    } else {
+      dprintf(fd, "ERROR%s%s\n", error.empty() ? "" : " ", error.c_str());
+    }
+    fclose(in);
 
-    inFile.close();
-
-    stats->filesLoaded++;
+    std::lock_guard<std::mutex> lock(mutex);
+    activeStreams--;
+    streamDone.notify_all();
   }
-}
+
+  StorageBackend* control;
+  std::mutex controlMutex;
+  ImageBatchQueue* fullBatches;
+  ThreadStats* stats;
+  int serverSpan;
+  std::string tableNameSuffix;
+  int numIndexes;
+  int numIndexlets;
+  int blockSize;
+  int multiwriteSize;
+  int numBatches;
+
+  /*
+   * Protects activeStreams and nextStreamId.
+   */
+  std::mutex mutex;
+  std::condition_variable streamDone;
+  int activeStreams;
+  int nextStreamId;
+};
 
 /** 
  * A utility for uploading a table into RAMCloud from a table image generated
@@ -361,11 +695,20 @@ try
   std::string snapshotDir;
   std::string tableName;
   std::string tableNameSuffix;
+  std::string listenAddress;
   int serverSpan;
   int numThreads;
+  int processes;
   int multiwriteSize;
   int reportInterval;
   std::string reportFormat;
+  int slowestMasters;
+  int numIndexes;
+  int numIndexlets;
+  int balanceSample;
+  BackendOptions backendOptions;
+  ImageReadOptions readOptions;
+  FileLeaseOptions leaseOptions;
 
   // Set line buffering for stdout so that printf's and log messages
   // interleave properly.
@@ -390,6 +733,13 @@ try
     ("tableName",
      ProgramOptions::value<std::string>(&tableName)->default_value(""),
      "Table name to use when taking input from stdin [default: ]")
+    ("listen",
+     ProgramOptions::value<std::string>(&listenAddress)->default_value(""),
+     "Instead of reading stdin, run until interrupted as a server accepting "
+     "image streams on unix:PATH or tcp:[HOST:]PORT. A client sends a line "
+     "holding the table name, then the image, and gets back \"OK <objects>\" "
+     "or \"ERROR\" and the reason once it has been loaded. All streams "
+     "share the upload threads [default: ].")
     ("tableNameSuffix",
      ProgramOptions::value<std::string>(&tableNameSuffix)->default_value(""),
      "Suffix to append to the table names (for loading multiple copies of a "
@@ -401,8 +751,35 @@ try
     ("numThreads",
      ProgramOptions::value<int>(&numThreads)->
          default_value(1),
-     "Number of threads to use for uploading partitions in parallel. Only "
-     "useful when image file has been partitioned. [default: 1]")
+     "Number of threads to use for uploading in parallel: with --snapshotDir, "
+     "each loads a share of the image files; from stdin, each uploads "
+     "batches parsed by a single reader thread. [default: 1]")
+    ("processes",
+     ProgramOptions::value<int>(&processes)->
+         default_value(1),
+     "Number of worker processes to divide this client's share of "
+     "--snapshotDir among, each with numThreads threads and its own "
+     "clients. Their statistics are reported together, and the exit status "
+     "is non-zero if any of them fails [default: 1].")
+    ("numIndexes",
+     ProgramOptions::value<int>(&numIndexes)->
+         default_value(0),
+     "Number of secondary indexes to create on each table before loading. "
+     "Secondary keys stored in the images are then indexed as objects are "
+     "loaded [default: 0].")
+    ("numIndexlets",
+     ProgramOptions::value<int>(&numIndexlets)->
+         default_value(1),
+     "Number of indexlets for each secondary index [default: 1].")
+    ("balanceSample",
+     ProgramOptions::value<int>(&balanceSample)->
+         default_value(0),
+     "With --snapshotDir, place each table's tablets so that each of its "
+     "serverSpan masters gets an equal share of its bytes, rather than an "
+     "equal share of the key hash space. The share is judged from the key "
+     "hash and size of every Nth record of the table's images, which one "
+     "loader skims while the others wait, before anything is loaded. 0 "
+     "keeps createTable's uniform tablets [default: 0].")
     ("multiwriteSize",
      ProgramOptions::value<int>(&multiwriteSize)->
          default_value(32),
@@ -414,31 +791,62 @@ try
     ("reportFormat",
      ProgramOptions::value<std::string>(&reportFormat)->
          default_value("OFBDT"),
-     "Format options for status report output.\n"
-     "  O - Total objects uploaded per second.\n"
-     "  o - Per thread objects uploaded per second.\n"
-     "  F - Total files uploaded.\n"
-     "  f - Per thread files uploaded.\n"
-     "  B - Total write bandwidth to RAMCloud in MB/s.\n"
-     "  b - Per thread write bandwidth to RAMCloud in MB/s.\n"
-     "  D - Total disk read bandwidth in MB/s.\n"
-     "  d - Per thread disk read bandwidth in MB/s.\n"
-     "  T - Total time elapsed.\n"
-     "[default: OFBDT]");
+     LOADER_REPORT_FORMAT_HELP)
+    ("slowestMasters",
+     ProgramOptions::value<int>(&slowestMasters)->
+         default_value(3),
+     "Number of masters to list, slowest first, after each status report. "
+     "A summary of every master is printed when loading finishes "
+     "[default: 3].");
+  addBackendOptions(clientOptions, &backendOptions);
+  addImageReadOptions(clientOptions, &readOptions);
+  addFileLeaseOptions(clientOptions, &leaseOptions);
   
   OptionParser optionParser(clientOptions, argc, argv);
 
+  // Reject a bad --ioMode here rather than in the loader threads.
+  parseImageIoMode(readOptions.ioMode);
+
+  if (processes > 1 && snapshotDir.empty()) {
+    fprintf(stderr, "--processes needs --snapshotDir\n");
+    return 1;
+  }
+  if (leaseOptions.enabled() && snapshotDir.empty()) {
+    fprintf(stderr, "--leaseTable needs --snapshotDir\n");
+    return 1;
+  }
+  if (leaseOptions.enabled() && !(leaseOptions.seconds > 0)) {
+    fprintf(stderr, "--leaseSeconds must be positive\n");
+    return 1;
+  }
+
   printf("SnapshotLoader: {numClients: %u, clientIndex: %u, numThreads: %u, "
-      "serverSpan: %u, multiwriteSize: %u, reportInterval: %u, "
-      "reportFormat: %s}\n", 
-      numClients, clientIndex, numThreads, serverSpan, multiwriteSize, 
-      reportInterval, reportFormat.c_str());
+      "processes: %u, serverSpan: %u, multiwriteSize: %u, "
+      "reportInterval: %u, reportFormat: %s}\n", 
+      numClients, clientIndex, numThreads, processes, serverSpan,
+      multiwriteSize, reportInterval, reportFormat.c_str());
 
   std::string locator = optionParser.options.getExternalStorageLocator();
   if (locator.size() == 0) {
     locator = optionParser.options.getCoordinatorLocator();
   }
 
+  // With --processes, the master statistics go in shared memory so that
+  // the workers' writes are reported together.
+  static MasterStatsTable localMasterStats;
+  MasterStatsTable *masterStats = &localMasterStats;
+  if (processes > 1) {
+    masterStats = newSharedStats<MasterStatsTable>(1);
+  }
+  static FakeStore fakeStore;
+  std::function<StorageBackend*()> newBackend = [&]() {
+    return newStorageBackend(backendOptions,
+        [&]() { return new RamCloud(&optionParser.options); },
+        &fakeStore, masterStats);
+  };
+  uint64_t loadStart = Cycles::rdtsc();
+
+  bool ok = true;
   if (snapshotDir != "") {
     std::vector<std::string> fileList;
 
@@ -462,158 +870,142 @@ try
     * Calculate the segment of the list that this loader instance is
     * responsible for loading.
     */
-    int q = fileList.size() / numClients;
-    int r = fileList.size() % numClients;
-
     int loadSize;
     int loadOffset;
-    if (clientIndex < r) {
-      loadSize = q + 1;
-      loadOffset = (q + 1) * clientIndex;
-    } else {
-      loadSize = q;
-      loadOffset = ((q + 1) * r) + (q * (clientIndex - r));
-    }
-
-    /*
-    * Divvy up the load and start the threads.
-    */
-    std::vector<std::thread> threads;
-    RamCloud *clients[numThreads];
-    ThreadStats tStats[numThreads];
-    for (int i = 0; i < numThreads; i++) {
-      int qt = loadSize / numThreads;
-      int rt = loadSize % numThreads;
-
-      int threadLoadSize;
-      int threadLoadOffset;
-      if (i < rt) {
-        threadLoadSize = qt + 1;
-        threadLoadOffset = (qt + 1) * i;
-      } else {
-        threadLoadSize = qt;
-        threadLoadOffset = ((qt + 1) * rt) + (qt * (i - rt));
+    shareOf(fileList.size(), clientIndex, numClients, &loadOffset, &loadSize);
+
+    std::atomic<bool> loading(true);
+    if (processes > 1) {
+      /*
+      * Divvy up the load among worker processes, each with its own threads
+      * and clients. Their statistics are in shared memory, so this process
+      * reports on all of them.
+      */
+      ThreadStats *tStats =
+          newSharedStats<ThreadStats>(processes * numThreads);
+      std::vector<pid_t> workers;
+      for (int p = 0; p < processes; p++) {
+        int processLoadOffset;
+        int processLoadSize;
+        shareOf(loadSize, p, processes, &processLoadOffset, &processLoadSize);
+        pid_t pid = fork();
+        if (pid < 0) {
+          throw Exception(HERE, "fork failed", errno);
+        }
+        if (pid == 0) {
+          bool workerOk = loadFiles(newBackend, fileList,
+              loadOffset + processLoadOffset, processLoadSize, numThreads,
+              serverSpan, snapshotDir, tableNameSuffix, multiwriteSize,
+              numIndexes, numIndexlets, balanceSample, readOptions,
+              leaseOptions, &tStats[p * numThreads]);
+          fflush(stdout);
+          _exit(workerOk ? 0 : 1);
+        }
+        workers.push_back(pid);
       }
 
-      threadLoadOffset += loadOffset;
+      std::thread statsReporter(statsReporterThread, tStats,
+          processes * numThreads, reportInterval, reportFormat, masterStats,
+          slowestMasters, &loading);
 
-      clients[i] = new RamCloud(&optionParser.options);
+      for (int p = 0; p < processes; p++) {
+        int status;
+        while (waitpid(workers[p], &status, 0) < 0 && errno == EINTR) {
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+          fprintf(stderr, "Loader process %d (pid %d) failed\n", p,
+              workers[p]);
+          ok = false;
+        }
+      }
 
-      threads.emplace_back(fileLoaderThread, clients[i], serverSpan, fileList,
-          snapshotDir, tableNameSuffix, threadLoadOffset, threadLoadSize, 
-          multiwriteSize, &tStats[i]);
+      loading = false;
+      statsReporter.join();
+    } else {
+      ThreadStats tStats[numThreads];
+      std::thread statsReporter(statsReporterThread, (struct ThreadStats*)tStats,
+          numThreads, reportInterval, reportFormat, masterStats,
+          slowestMasters, &loading);
+
+      ok = loadFiles(newBackend, fileList, loadOffset, loadSize, numThreads,
+          serverSpan, snapshotDir, tableNameSuffix, multiwriteSize,
+          numIndexes, numIndexlets, balanceSample, readOptions, leaseOptions,
+          tStats);
+
+      loading = false;
+      statsReporter.join();
     }
-
-    // Give the threads some time to initialize their statistics. Otherwise the
-    // stats thread will find that totalFileLoaded == totalFilesToLoad and exit.
-    sleep(1);
-
-    // Start statistics reporting thread.
-    std::thread statsReporter(statsReporterThread, (struct ThreadStats*)tStats, 
-        numThreads, reportInterval, reportFormat);
-
+  } else {
+    // In this case we will read from stdin, or from the clients of
+    // --listen. Each stream is parsed into batches by its own thread, and
+    // numThreads threads upload the batches, each with its own backend.
+    StorageBackend *backends[numThreads];
+    ThreadStats tStats[numThreads];
     for (int i = 0; i < numThreads; i++) {
-      threads[i].join();
+      backends[i] = newBackend();
     }
 
-    statsReporter.join();
+    // Two batches per uploader, so each can have one waiting while it
+    // uploads another.
+    int numBatches = 2 * numThreads;
+    ImageBatchQueue fullBatches(numBatches);
 
-    for (int i = 0; i < numThreads; i++) {
-      delete clients[i];
-    }
-  } else {
-    // In this case we will read from stdin.
-    RamCloud client(&optionParser.options);
-    ThreadStats stats;
-  
-    std::thread statsReporter(statsReporterThread, (struct ThreadStats*)&stats, 
-        numThreads, reportInterval, reportFormat);
-
-    stats.totalFilesToLoad = 1;
-
-    printf("Loading from stdin: {tableName: %s, multiwriteSize: %u}\n", 
-        tableName.c_str(), multiwriteSize);
-
-    uint64_t tableId = client.createTable(tableName.c_str(), serverSpan);
-
-    Tub<MultiWriteObject> objects[multiwriteSize];
-    MultiWriteObject* requests[multiwriteSize];
-    
-    std::vector<std::string> keys;
-    std::vector<std::string> values;
-
-    char lenBuffer[sizeof(uint32_t)];
-    while(std::cin.read(lenBuffer, sizeof(lenBuffer))) {
-      uint32_t keyLength = *((uint32_t*) lenBuffer); 
-      char keyBuffer[keyLength];
-      std::cin.read(keyBuffer, keyLength);
-      keys.emplace_back((const char*)keyBuffer, keyLength);
-      
-      std::cin.read(lenBuffer, sizeof(lenBuffer));
-      uint32_t dataLength = *((uint32_t*) lenBuffer);
-      char dataBuffer[dataLength];
-      std::cin.read(dataBuffer, dataLength);
-      values.emplace_back((const char*)dataBuffer, dataLength);
-
-      stats.bytesReadFromDisk += sizeof(lenBuffer)*2 + keyLength + dataLength;
-
-      if (keys.size() == multiwriteSize) {
-        for (int i = 0; i < keys.size(); i++) {
-          objects[i].construct( tableId,
-                                (const void*) keys[i].data(),
-                                keys[i].size(),
-                                (const void*) values[i].data(),
-                                values[i].size() );
-          requests[i] = objects[i].get();
-
-          stats.bytesWrittenToRAMCloud += keys[i].size() + values[i].size();
-        }
-
-        try {
-          client.multiWrite(requests, multiwriteSize);
-        } catch(RAMCloud::ClientException& e) {
-          fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
-          return 1;
-        }
-        
-        stats.objectsLoaded += multiwriteSize;
+    uint64_t tableId = 0;
+    int listenFd = -1;
+    std::atomic<bool> serving(!listenAddress.empty());
+    if (serving) {
+      listenFd = IngestServer::listenOn(listenAddress);
+    } else {
+      printf("Loading from stdin: {tableName: %s, multiwriteSize: %u, "
+          "numThreads: %u}\n", tableName.c_str(), multiwriteSize, numThreads);
 
-        keys.clear();
-        values.clear();
+      tableId = backends[0]->createTable(tableName.c_str(), serverSpan);
+      for (int i = 1; i <= numIndexes; i++) {
+        backends[0]->createIndex(tableId, (uint8_t)i, (uint8_t)numIndexlets);
       }
+      tStats[0].totalFilesToLoad = 1;
     }
 
-    if (keys.size() > 0) {
-      for (int i = 0; i < keys.size(); i++) {
-        objects[i].construct( tableId,
-                              (const void*) keys[i].data(),
-                              keys[i].size(),
-                              (const void*) values[i].data(),
-                              values[i].size() );
-        requests[i] = objects[i].get();
-
-        stats.bytesWrittenToRAMCloud += keys[i].size() + values[i].size();
-      }
-
-      try {
-        client.multiWrite(requests, keys.size());
-      } catch(RAMCloud::ClientException& e) {
-        fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
-        return 1;
-      }
+    std::thread statsReporter(statsReporterThread, (struct ThreadStats*)tStats,
+        numThreads, reportInterval, reportFormat, masterStats,
+        slowestMasters, serving ? &serving : (std::atomic<bool>*)NULL);
 
-      stats.objectsLoaded += keys.size();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; i++) {
+      threads.emplace_back(streamUploaderThread, backends[i], multiwriteSize,
+          &fullBatches, &tStats[i]);
+    }
 
-      keys.clear();
-      values.clear();
+    if (serving) {
+      std::unique_ptr<StorageBackend> control(newBackend());
+      IngestServer server(control.get(), &fullBatches, &tStats[0],
+          serverSpan, tableNameSuffix, numIndexes, numIndexlets,
+          readOptions.blockSize, multiwriteSize, numBatches);
+      server.run(listenFd, listenAddress);
+      serving = false;
+    } else {
+      uint64_t objectCount;
+      ok = loadStream(stdin, tableId, readOptions.blockSize, multiwriteSize,
+          numBatches, &fullBatches, &objectCount);
+      add(tStats[0].filesLoaded, 1l);
     }
 
-    stats.filesLoaded++;
+    fullBatches.close();
+    for (int i = 0; i < numThreads; i++) {
+      threads[i].join();
+    }
 
     statsReporter.join();
+
+    for (int i = 0; i < numThreads; i++) {
+      delete backends[i];
+    }
   }
 
-  return 0;
+  printMasterSummary(masterStats,
+      Cycles::toSeconds(Cycles::rdtsc() - loadStart));
+
+  return ok ? 0 : 1;
 } catch (RAMCloud::ClientException& e) {
   fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
   return 1;
@@ -0,0 +1,907 @@
+/* Copyright (c) 2009-2015 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RAMCLOUDTOOLS_STORAGEBACKEND_H
+#define RAMCLOUDTOOLS_STORAGEBACKEND_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Cycles.h"
+#include "Object.h"
+#include "ObjectFinder.h"
+#include "OptionParser.h"
+#include "RamCloud.h"
+#include "TableEnumerator.h"
+#include "Tub.h"
+#include "ImageFile.h"
+#include "LoaderStats.h"
+
+namespace RAMCloud {
+
+/**
+ * Walks every object in a table. Returned by StorageBackend::scanTable.
+ */
+class TableScan {
+ public:
+  virtual ~TableScan() {}
+
+  /**
+   * Advance to the next object.
+   *
+   * \param[out] keys
+   *      Filled in with the object's keys, primary key first. The keys point
+   *      into memory owned by the scan, valid until the next call.
+   * \param[out] value
+   *      Set to the object's value, valid until the next call.
+   * \param[out] valueLength
+   *      Set to the length of the object's value in bytes.
+   * \return
+   *      False once every object has been returned.
+   */
+  virtual bool next(std::vector<KeyInfo>* keys, const void** value,
+      uint32_t* valueLength) = 0;
+};
+
+/**
+ * The operations the bulk loading and downloading tools need from a store.
+ * RamCloudBackend implements them with a real cluster; FakeBackend with an
+ * in-process hash map, so that the tools' client-side pipelines can be
+ * benchmarked without a cluster. Like a RamCloud client, a backend must only
+ * be used by one thread at a time.
+ */
+class StorageBackend {
+ public:
+  virtual ~StorageBackend() {}
+
+  /**
+   * Create a table, or return the id of the existing table with that name.
+   */
+  virtual uint64_t createTable(const char* name, uint32_t serverSpan) = 0;
+
+  /**
+   * Create a secondary index on a table.
+   */
+  virtual void createIndex(uint64_t tableId, uint8_t indexId,
+      uint8_t numIndexlets) = 0;
+
+  /**
+   * Return the id of an existing table.
+   */
+  virtual uint64_t getTableId(const char* name) = 0;
+
+  /**
+   * Write a batch of objects, all in the same table.
+   *
+   * \param tableId
+   *      Table the objects are in.
+   * \param requests
+   *      Objects to write.
+   * \param count
+   *      Number of objects in requests.
+   */
+  virtual void multiWrite(uint64_t tableId, MultiWriteObject** requests,
+      uint32_t count) = 0;
+
+  /**
+   * Read a batch of objects, all in the same table.
+   *
+   * \param tableId
+   *      Table the objects are in.
+   * \param keys
+   *      Primary keys of the objects to read.
+   * \param count
+   *      Number of objects to read.
+   * \param[out] values
+   *      Filled in with count entries, the value of each object.
+   * \param[out] found
+   *      Filled in with count entries, false for objects that don't exist.
+   */
+  virtual void multiRead(uint64_t tableId, const KeyInfo* keys,
+      uint32_t count, std::vector<std::string>* values,
+      std::vector<bool>* found) = 0;
+
+  /**
+   * Start a walk over every object in a table. The caller owns the scan.
+   */
+  virtual TableScan* scanTable(uint64_t tableId) = 0;
+
+  /**
+   * Read one object and its version.
+   *
+   * \param tableId
+   *      Table the object is in.
+   * \param key
+   *      Primary key of the object.
+   * \param[out] value
+   *      Filled in with the object's value.
+   * \param[out] version
+   *      Set to the object's version.
+   * \return
+   *      False if the object doesn't exist.
+   */
+  virtual bool readVersioned(uint64_t tableId, const std::string& key,
+      std::string* value, uint64_t* version) = 0;
+
+  /**
+   * Write one object, but only if its version is still a given one.
+   *
+   * \param tableId
+   *      Table the object is in.
+   * \param key
+   *      Primary key of the object.
+   * \param value
+   *      New value of the object.
+   * \param expectedVersion
+   *      Version the object must have, or 0 if it must not exist yet.
+   * \param[out] version
+   *      Set to the object's new version if it was written.
+   * \return
+   *      False if the object's version wasn't expectedVersion, in which case
+   *      nothing was written.
+   */
+  virtual bool conditionalWrite(uint64_t tableId, const std::string& key,
+      const std::string& value, uint64_t expectedVersion,
+      uint64_t* version) = 0;
+
+  /**
+   * Split a table into tablets at given key hashes, and give each tablet a
+   * master of its own from those the table is already on. Meant for new,
+   * empty tables, where moving tablets costs nothing.
+   *
+   * \param name
+   *      Name of the table.
+   * \param tableId
+   *      Id of the table.
+   * \param splits
+   *      First key hash of every tablet but the first, in increasing order.
+   */
+  virtual void placeTablets(const char* name, uint64_t tableId,
+      const std::vector<uint64_t>& splits) = 0;
+};
+
+/**
+ * StorageBackend for a real RAMCloud cluster.
+ */
+class RamCloudBackend : public StorageBackend {
+ public:
+  /**
+   * \param client
+   *      Client connected to the cluster. The backend takes ownership of it.
+   * \param masterStats
+   *      If not NULL, writes are charged to the master they go to (see
+   *      multiWriteByMaster).
+   */
+  RamCloudBackend(RamCloud* client, MasterStatsTable* masterStats)
+    : client(client)
+    , masterStats(masterStats)
+  {}
+
+  ~RamCloudBackend()
+  {
+    delete client;
+  }
+
+  uint64_t
+  createTable(const char* name, uint32_t serverSpan)
+  {
+    return client->createTable(name, serverSpan);
+  }
+
+  void
+  createIndex(uint64_t tableId, uint8_t indexId, uint8_t numIndexlets)
+  {
+    client->createIndex(tableId, indexId, 0, numIndexlets);
+  }
+
+  uint64_t
+  getTableId(const char* name)
+  {
+    return client->getTableId(name);
+  }
+
+  void
+  multiWrite(uint64_t tableId, MultiWriteObject** requests, uint32_t count)
+  {
+    if (masterStats != NULL) {
+      multiWriteByMaster(client, tableId, requests, count, masterStats);
+    } else {
+      client->multiWrite(requests, count);
+    }
+  }
+
+  void
+  multiRead(uint64_t tableId, const KeyInfo* keys, uint32_t count,
+      std::vector<std::string>* values, std::vector<bool>* found)
+  {
+    std::vector<Tub<ObjectBuffer>> buffers(count);
+    std::vector<MultiReadObject> objects(count);
+    std::vector<MultiReadObject*> requests(count);
+    for (uint32_t i = 0; i < count; i++) {
+      objects[i] = MultiReadObject(tableId, keys[i].key, keys[i].keyLength,
+          &buffers[i]);
+      requests[i] = &objects[i];
+    }
+    client->multiRead(&requests[0], count);
+
+    values->resize(count);
+    found->assign(count, false);
+    for (uint32_t i = 0; i < count; i++) {
+      if (objects[i].status != STATUS_OK) {
+        continue;
+      }
+      uint32_t length;
+      const char* value = (const char*)buffers[i]->getValue(&length);
+      values->at(i).assign(value, length);
+      found->at(i) = true;
+    }
+  }
+
+  TableScan*
+  scanTable(uint64_t tableId)
+  {
+    return new Scan(client, tableId);
+  }
+
+  bool
+  readVersioned(uint64_t tableId, const std::string& key, std::string* value,
+      uint64_t* version)
+  {
+    Buffer buffer;
+    try {
+      client->read(tableId, key.data(), (uint16_t)key.size(), &buffer, NULL,
+          version);
+    } catch (ObjectDoesntExistException& e) {
+      return false;
+    }
+    value->resize(buffer.size());
+    buffer.copy(0, buffer.size(), &(*value)[0]);
+    return true;
+  }
+
+  bool
+  conditionalWrite(uint64_t tableId, const std::string& key,
+      const std::string& value, uint64_t expectedVersion, uint64_t* version)
+  {
+    RejectRules rules;
+    memset(&rules, 0, sizeof(rules));
+    if (expectedVersion == 0) {
+      rules.exists = 1;
+    } else {
+      rules.doesntExist = 1;
+      rules.givenVersion = expectedVersion;
+      rules.versionNeGiven = 1;
+    }
+    try {
+      client->write(tableId, key.data(), (uint16_t)key.size(), value.data(),
+          (uint32_t)value.size(), &rules, version);
+    } catch (RejectRulesException& e) {
+      return false;
+    }
+    return true;
+  }
+
+  void
+  placeTablets(const char* name, uint64_t tableId,
+      const std::vector<uint64_t>& splits)
+  {
+    // Reuse the masters createTable chose, in the order of their tablets.
+    std::vector<Tablet> tablets;
+    listTablets(tableId, &tablets);
+    std::vector<uint64_t> masters;
+    for (size_t i = 0; i < tablets.size(); i++) {
+      uint64_t master = tablets[i].serverId.getId();
+      if (std::find(masters.begin(), masters.end(), master) ==
+          masters.end()) {
+        masters.push_back(master);
+      }
+    }
+
+    for (size_t i = 0; i < splits.size(); i++) {
+      bool isStart = false;
+      for (size_t t = 0; t < tablets.size(); t++) {
+        isStart |= tablets[t].startKeyHash == splits[i];
+      }
+      if (!isStart) {
+        client->splitTablet(name, splits[i]);
+      }
+    }
+    client->clientContext->objectFinder->flush(tableId);
+
+    // Every tablet now lies within one range between splits; move it to
+    // that range's master.
+    listTablets(tableId, &tablets);
+    for (size_t t = 0; t < tablets.size(); t++) {
+      size_t range = std::upper_bound(splits.begin(), splits.end(),
+          tablets[t].startKeyHash) - splits.begin();
+      uint64_t master = masters[range % masters.size()];
+      if (tablets[t].serverId.getId() != master) {
+        client->migrateTablet(tableId, tablets[t].startKeyHash,
+            tablets[t].endKeyHash, ServerId(master));
+      }
+    }
+    client->clientContext->objectFinder->flush(tableId);
+  }
+
+  /*
+   * The underlying client, for operations outside the StorageBackend
+   * interface.
+   */
+  RamCloud* client;
+
+ private:
+  /**
+   * TableScan over a TableEnumerator.
+   */
+  class Scan : public TableScan {
+   public:
+    Scan(RamCloud* client, uint64_t tableId)
+      : iter(*client, tableId, false)
+      , buffer()
+      , object()
+    {}
+
+    bool
+    next(std::vector<KeyInfo>* keys, const void** value,
+        uint32_t* valueLength)
+    {
+      if (!iter.hasNext()) {
+        return false;
+      }
+
+      uint32_t objectLength = 0;
+      const void* objectData = NULL;
+      iter.next(&objectLength, &objectData);
+      buffer.reset();
+      buffer.appendExternal(objectData, objectLength);
+      object.destroy();
+      object.construct(buffer);
+
+      keys->resize(object->getKeyCount());
+      for (uint32_t i = 0; i < keys->size(); i++) {
+        keys->at(i).key = object->getKey((KeyIndex)i,
+            &keys->at(i).keyLength);
+      }
+      *value = object->getValue(valueLength);
+      return true;
+    }
+
+   private:
+    TableEnumerator iter;
+    Buffer buffer;
+    Tub<Object> object;
+  };
+
+  /**
+   * Fill in the tablets of a table, in key hash order.
+   */
+  void
+  listTablets(uint64_t tableId, std::vector<Tablet>* tablets)
+  {
+    tablets->clear();
+    uint64_t hash = 0;
+    while (true) {
+      TabletWithLocator* tablet = client->clientContext->objectFinder->
+          lookupTablet(tableId, hash);
+      tablets->push_back(tablet->tablet);
+      if (tablet->tablet.endKeyHash == ~0UL) {
+        break;
+      }
+      hash = tablet->tablet.endKeyHash + 1;
+    }
+  }
+
+  MasterStatsTable* masterStats;
+};
+
+/**
+ * The objects held by FakeBackends. One store is shared by every backend
+ * of a process, just as every client of a cluster sees the same tables.
+ */
+class FakeStore {
+ public:
+  /**
+   * An object in the store. Objects are immutable once stored, so scans can
+   * hold on to them without locking.
+   */
+  struct StoredObject {
+    StoredObject()
+      : keys()
+      , value()
+      , version(1)
+    {}
+
+    std::vector<std::string> keys;
+    std::string value;
+
+    /*
+     * Set by putIfVersion; objects stored with put are all version 1.
+     */
+    uint64_t version;
+  };
+
+  typedef std::shared_ptr<const StoredObject> ObjectRef;
+
+  FakeStore()
+    : mutex()
+    , tableIds()
+    , shards()
+  {}
+
+  /**
+   * Return the id of a table, creating it if needed.
+   */
+  uint64_t
+  createTable(const std::string& name)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::string, uint64_t>::iterator it = tableIds.find(name);
+    if (it != tableIds.end()) {
+      return it->second;
+    }
+    uint64_t tableId = tableIds.size() + 1;
+    tableIds[name] = tableId;
+    return tableId;
+  }
+
+  /**
+   * Return the id of a table, or throw TableDoesntExistException.
+   */
+  uint64_t
+  getTableId(const std::string& name)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::string, uint64_t>::iterator it = tableIds.find(name);
+    if (it == tableIds.end()) {
+      throw TableDoesntExistException(HERE);
+    }
+    return it->second;
+  }
+
+  /**
+   * Store an object, replacing any object with the same primary key.
+   */
+  void
+  put(uint64_t tableId, ObjectRef object)
+  {
+    std::string key = storeKey(tableId, object->keys[0].data(),
+        (uint32_t)object->keys[0].size());
+    Shard& shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.objects[key] = object;
+  }
+
+  /**
+   * Store an object if the one it replaces has a given version, like a
+   * RAMCloud write with RejectRules.
+   *
+   * \param tableId
+   *      Table to store the object in.
+   * \param object
+   *      Object to store. Its version is set to one more than the version of
+   *      the object it replaces.
+   * \param expectedVersion
+   *      Version of the object to replace, or 0 if there must be none.
+   * \return
+   *      False if the current object's version isn't expectedVersion.
+   */
+  bool
+  putIfVersion(uint64_t tableId, std::shared_ptr<StoredObject> object,
+      uint64_t expectedVersion)
+  {
+    std::string key = storeKey(tableId, object->keys[0].data(),
+        (uint32_t)object->keys[0].size());
+    Shard& shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    ObjectRef& current = shard.objects[key];
+    uint64_t currentVersion = current ? current->version : 0;
+    if (currentVersion != expectedVersion) {
+      if (!current) {
+        shard.objects.erase(key);
+      }
+      return false;
+    }
+    object->version = currentVersion + 1;
+    current = object;
+    return true;
+  }
+
+  /**
+   * Store every record of a table image.
+   *
+   * \return
+   *      Number of objects stored.
+   */
+  uint64_t
+  loadImage(uint64_t tableId, std::istream& in)
+  {
+    uint64_t count = 0;
+    ImageRecord record;
+    while (readImageRecord(in, &record)) {
+      std::shared_ptr<StoredObject> object(new StoredObject);
+      object->keys.swap(record.keys);
+      object->value.swap(record.value);
+      put(tableId, object);
+      count++;
+    }
+    return count;
+  }
+
+  /**
+   * Return an object, or an empty reference if there is none.
+   */
+  ObjectRef
+  get(uint64_t tableId, const void* key, uint32_t keyLength)
+  {
+    std::string k = storeKey(tableId, key, keyLength);
+    Shard& shard = shardOf(k);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    std::unordered_map<std::string, ObjectRef>::iterator it =
+        shard.objects.find(k);
+    return it == shard.objects.end() ? ObjectRef() : it->second;
+  }
+
+  /**
+   * Append every object of a table in one shard to a vector.
+   */
+  void
+  list(uint64_t tableId, int shardIndex, std::vector<ObjectRef>* objects)
+  {
+    std::string prefix((const char*)&tableId, sizeof(tableId));
+    Shard& shard = shards[shardIndex];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for (auto& it : shard.objects) {
+      if (it.first.compare(0, prefix.size(), prefix) == 0) {
+        objects->push_back(it.second);
+      }
+    }
+  }
+
+  enum { NUM_SHARDS = 64 };
+
+ private:
+  /**
+   * Part of the store with its own lock, so that loader threads don't all
+   * serialize on one mutex.
+   */
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, ObjectRef> objects;
+  };
+
+  static std::string
+  storeKey(uint64_t tableId, const void* key, uint32_t keyLength)
+  {
+    std::string k((const char*)&tableId, sizeof(tableId));
+    k.append((const char*)key, keyLength);
+    return k;
+  }
+
+  Shard&
+  shardOf(const std::string& key)
+  {
+    return shards[std::hash<std::string>()(key) % NUM_SHARDS];
+  }
+
+  std::mutex mutex;
+  std::map<std::string, uint64_t> tableIds;
+  Shard shards[NUM_SHARDS];
+};
+
+/**
+ * Options selecting and tuning the StorageBackend used by a tool.
+ */
+struct BackendOptions {
+  /*
+   * "ramcloud" or "fake".
+   */
+  std::string backend;
+
+  /*
+   * Simulated latency of each FakeBackend RPC, in microseconds.
+   */
+  double fakeLatency;
+
+  /*
+   * Simulated bandwidth of each FakeBackend, in MB/s. 0 means unlimited.
+   */
+  double fakeBandwidth;
+
+  bool
+  isFake() const
+  {
+    return backend == "fake";
+  }
+};
+
+/**
+ * Add the options that fill in a BackendOptions to a tool's options.
+ */
+inline void
+addBackendOptions(OptionsDescription& options, BackendOptions* backendOptions)
+{
+  options.add_options()
+    ("backend",
+     ProgramOptions::value<std::string>(&backendOptions->backend)->
+         default_value("ramcloud"),
+     "Store to use: ramcloud for the cluster, or fake for an in-process "
+     "hash map with simulated RPC costs, to benchmark the tool itself "
+     "[default: ramcloud].")
+    ("fakeLatency",
+     ProgramOptions::value<double>(&backendOptions->fakeLatency)->
+         default_value(5),
+     "Simulated latency of each RPC with --backend=fake, in microseconds "
+     "[default: 5].")
+    ("fakeBandwidth",
+     ProgramOptions::value<double>(&backendOptions->fakeBandwidth)->
+         default_value(0),
+     "Simulated bandwidth of each client with --backend=fake, in MB/s. "
+     "0 means unlimited [default: 0].");
+}
+
+/**
+ * StorageBackend holding objects in a FakeStore. Each RPC costs the client
+ * thread a fixed latency plus transfer time, spent spinning as a RAMCloud
+ * client does while it polls for a response.
+ */
+class FakeBackend : public StorageBackend {
+ public:
+  /**
+   * \param store
+   *      Store holding the objects.
+   * \param options
+   *      Simulated RPC latency and bandwidth.
+   */
+  FakeBackend(FakeStore* store, const BackendOptions& options)
+    : store(store)
+    , latencyNs(options.fakeLatency * 1e03)
+    , bytesPerNs(options.fakeBandwidth * 1e06 / 1e09)
+  {}
+
+  uint64_t
+  createTable(const char* name, uint32_t /* serverSpan */)
+  {
+    simulateRpc(0);
+    return store->createTable(name);
+  }
+
+  void
+  createIndex(uint64_t /* tableId */, uint8_t /* indexId */,
+      uint8_t /* numIndexlets */)
+  {
+    // Secondary keys are stored with their objects; there is no index to
+    // build.
+    simulateRpc(0);
+  }
+
+  uint64_t
+  getTableId(const char* name)
+  {
+    simulateRpc(0);
+    return store->getTableId(name);
+  }
+
+  void
+  multiWrite(uint64_t tableId, MultiWriteObject** requests, uint32_t count)
+  {
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < count; i++) {
+      MultiWriteObject* request = requests[i];
+      std::shared_ptr<FakeStore::StoredObject> object(
+          new FakeStore::StoredObject);
+      if (request->numKeys > 1 && request->keyInfo != NULL) {
+        for (uint32_t k = 0; k < request->numKeys; k++) {
+          object->keys.emplace_back((const char*)request->keyInfo[k].key,
+              request->keyInfo[k].keyLength);
+          bytes += request->keyInfo[k].keyLength;
+        }
+      } else {
+        object->keys.emplace_back((const char*)request->key,
+            request->keyLength);
+        bytes += request->keyLength;
+      }
+      object->value.assign((const char*)request->value,
+          request->valueLength);
+      bytes += request->valueLength;
+      store->put(tableId, object);
+      request->status = STATUS_OK;
+    }
+    simulateRpc(bytes);
+  }
+
+  void
+  multiRead(uint64_t tableId, const KeyInfo* keys, uint32_t count,
+      std::vector<std::string>* values, std::vector<bool>* found)
+  {
+    uint64_t bytes = 0;
+    values->resize(count);
+    found->assign(count, false);
+    for (uint32_t i = 0; i < count; i++) {
+      FakeStore::ObjectRef object = store->get(tableId, keys[i].key,
+          keys[i].keyLength);
+      if (object) {
+        values->at(i) = object->value;
+        found->at(i) = true;
+        bytes += object->value.size();
+      }
+    }
+    simulateRpc(bytes);
+  }
+
+  TableScan*
+  scanTable(uint64_t tableId)
+  {
+    return new Scan(this, tableId);
+  }
+
+  bool
+  readVersioned(uint64_t tableId, const std::string& key, std::string* value,
+      uint64_t* version)
+  {
+    FakeStore::ObjectRef object = store->get(tableId, key.data(),
+        (uint32_t)key.size());
+    simulateRpc(object ? object->value.size() : 0);
+    if (!object) {
+      return false;
+    }
+    *value = object->value;
+    *version = object->version;
+    return true;
+  }
+
+  bool
+  conditionalWrite(uint64_t tableId, const std::string& key,
+      const std::string& value, uint64_t expectedVersion, uint64_t* version)
+  {
+    std::shared_ptr<FakeStore::StoredObject> object(
+        new FakeStore::StoredObject);
+    object->keys.push_back(key);
+    object->value = value;
+    simulateRpc(key.size() + value.size());
+    if (!store->putIfVersion(tableId, object, expectedVersion)) {
+      return false;
+    }
+    *version = object->version;
+    return true;
+  }
+
+  void
+  placeTablets(const char* /* name */, uint64_t /* tableId */,
+      const std::vector<uint64_t>& splits)
+  {
+    // A FakeStore has no masters to balance; just charge the RPCs.
+    for (size_t i = 0; i < splits.size(); i++) {
+      simulateRpc(0);
+    }
+  }
+
+ private:
+  /**
+   * TableScan over a FakeStore. Objects are fetched a shard at a time, and
+   * charged as enumeration RPCs of up to SCAN_RPC_BYTES each.
+   */
+  class Scan : public TableScan {
+   public:
+    enum { SCAN_RPC_BYTES = 1 << 20 };
+
+    Scan(FakeBackend* backend, uint64_t tableId)
+      : backend(backend)
+      , tableId(tableId)
+      , shard(0)
+      , objects()
+      , position(0)
+      , pendingBytes(0)
+    {}
+
+    bool
+    next(std::vector<KeyInfo>* keys, const void** value,
+        uint32_t* valueLength)
+    {
+      while (position == objects.size()) {
+        if (shard == FakeStore::NUM_SHARDS) {
+          backend->simulateRpc(pendingBytes);
+          pendingBytes = 0;
+          return false;
+        }
+        objects.clear();
+        position = 0;
+        backend->store->list(tableId, shard++, &objects);
+      }
+
+      const FakeStore::StoredObject& object = *objects[position++];
+      keys->resize(object.keys.size());
+      for (size_t i = 0; i < object.keys.size(); i++) {
+        keys->at(i).key = object.keys[i].data();
+        keys->at(i).keyLength = (KeyLength)object.keys[i].size();
+        pendingBytes += object.keys[i].size();
+      }
+      *value = object.value.data();
+      *valueLength = (uint32_t)object.value.size();
+      pendingBytes += object.value.size();
+
+      if (pendingBytes >= SCAN_RPC_BYTES) {
+        backend->simulateRpc(pendingBytes);
+        pendingBytes = 0;
+      }
+      return true;
+    }
+
+   private:
+    FakeBackend* backend;
+    uint64_t tableId;
+    int shard;
+    std::vector<FakeStore::ObjectRef> objects;
+    size_t position;
+    uint64_t pendingBytes;
+  };
+
+  /**
+   * Spin for the time an RPC transferring some bytes would take.
+   */
+  void
+  simulateRpc(uint64_t bytes)
+  {
+    double ns = latencyNs;
+    if (bytesPerNs > 0) {
+      ns += (double)bytes / bytesPerNs;
+    }
+    uint64_t stop = Cycles::rdtsc() + Cycles::fromNanoseconds((uint64_t)ns);
+    while (Cycles::rdtsc() < stop) {
+    }
+  }
+
+  FakeStore* store;
+  double latencyNs;
+  double bytesPerNs;
+};
+
+/**
+ * Create the StorageBackend selected by a tool's options.
+ *
+ * \param options
+ *      The tool's backend options.
+ * \param newClient
+ *      Called to create a RamCloud client when the backend is ramcloud.
+ * \param store
+ *      Store shared by fake backends.
+ * \param masterStats
+ *      Per master statistics to charge RAMCloud writes to, or NULL.
+ * \return
+ *      The new backend, owned by the caller.
+ */
+inline StorageBackend*
+newStorageBackend(const BackendOptions& options,
+    std::function<RamCloud*()> newClient, FakeStore* store,
+    MasterStatsTable* masterStats)
+{
+  if (options.isFake()) {
+    return new FakeBackend(store, options);
+  }
+  return new RamCloudBackend(newClient(), masterStats);
+}
+
+} // namespace RAMCloud
+
+#endif // RAMCLOUDTOOLS_STORAGEBACKEND_H
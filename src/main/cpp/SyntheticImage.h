@@ -0,0 +1,355 @@
+/* Copyright (c) 2009-2015 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RAMCLOUDTOOLS_SYNTHETICIMAGE_H
+#define RAMCLOUDTOOLS_SYNTHETICIMAGE_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+
+#include "ImageFile.h"
+
+namespace RAMCloud {
+
+/**
+ * Small, fast random number generator (splitmix64). Records are generated
+ * from a generator seeded with their index, so a record's contents don't
+ * depend on which thread generates it or in what order.
+ */
+class SplitMix64 {
+ public:
+  typedef uint64_t result_type;
+
+  explicit SplitMix64(uint64_t seed)
+    : state(seed)
+  {}
+
+  uint64_t
+  operator()()
+  {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+  static constexpr uint64_t min() { return 0; }
+  static constexpr uint64_t max() { return ~0ull; }
+
+ private:
+  uint64_t state;
+};
+
+/**
+ * A distribution of object sizes.
+ */
+struct SizeDistribution {
+  enum Kind {
+    /*
+     * Always a.
+     */
+    FIXED,
+
+    /*
+     * Uniform between a and b inclusive.
+     */
+    UNIFORM,
+
+    /*
+     * Lognormal with mean a and standard deviation b, in bytes.
+     */
+    LOGNORMAL,
+  };
+
+  Kind kind = FIXED;
+  double a = 0;
+  double b = 0;
+
+  /*
+   * Sizes are clamped to [minSize, maxSize].
+   */
+  uint32_t minSize = 0;
+  uint32_t maxSize = 1 << 20;
+
+  /**
+   * Draw a size.
+   */
+  uint32_t
+  sample(SplitMix64& rng) const
+  {
+    double size = a;
+    if (kind == UNIFORM) {
+      size = a + (double)(rng() % ((uint64_t)(b - a) + 1));
+    } else if (kind == LOGNORMAL) {
+      // Convert the mean and standard deviation of the sizes into those of
+      // the underlying normal distribution.
+      double variance = log(1 + (b * b) / (a * a));
+      std::lognormal_distribution<double> lognormal(
+          log(a) - variance / 2, sqrt(variance));
+      size = lognormal(rng);
+    }
+    size = std::max(size, (double)minSize);
+    size = std::min(size, (double)maxSize);
+    return (uint32_t)size;
+  }
+
+  /**
+   * Parse a distribution from its command line form: "N" or "fixed:N",
+   * "uniform:MIN:MAX", or "lognormal:MEAN:STDDEV".
+   *
+   * \return
+   *      False if the string isn't a valid distribution.
+   */
+  bool
+  parse(const std::string& spec)
+  {
+    char name[16];
+    double x, y;
+    if (sscanf(spec.c_str(), "%lf", &x) == 1 &&
+        spec.find(':') == std::string::npos) {
+      kind = FIXED;
+      a = x;
+      return x >= 0;
+    }
+    int n = sscanf(spec.c_str(), "%15[a-z]:%lf:%lf", name, &x, &y);
+    std::string kindName(name);
+    if (n == 2 && kindName == "fixed") {
+      kind = FIXED;
+      a = x;
+      return x >= 0;
+    }
+    if (n == 3 && kindName == "uniform") {
+      kind = UNIFORM;
+      a = x;
+      b = y;
+      return x >= 0 && y >= x;
+    }
+    if (n == 3 && kindName == "lognormal") {
+      kind = LOGNORMAL;
+      a = x;
+      b = y;
+      return x > 0 && y >= 0;
+    }
+    return false;
+  }
+};
+
+/**
+ * How the primary keys of synthetic objects are chosen.
+ */
+enum KeyPattern {
+  /*
+   * Zero-padded record index, so keys sort in generation order.
+   */
+  SEQUENTIAL_KEYS,
+
+  /*
+   * Hash of the record index: unique, but in no particular order.
+   */
+  HASHED_KEYS,
+};
+
+/**
+ * Generates the records of a synthetic table image.
+ */
+class SyntheticImage {
+ public:
+  SyntheticImage()
+    : keyPattern(SEQUENTIAL_KEYS)
+    , keySize(30)
+    , valueSize()
+    , numSecondaryKeys(0)
+    , compressibility(0)
+    , seed(0)
+  {
+    valueSize.a = 100;
+  }
+
+  /**
+   * Fill in a record.
+   *
+   * \param index
+   *      Index of the record in the image. The same index always gives the
+   *      same record.
+   * \param[out] record
+   *      Filled in with the record; its buffers are reused between calls.
+   */
+  void
+  makeRecord(uint64_t index, ImageRecord* record) const
+  {
+    SplitMix64 rng(seed ^ (index * 0xd1342543de82ef95ull));
+
+    record->keys.resize(1 + numSecondaryKeys);
+    uint64_t keyNumber = index;
+    if (keyPattern == HASHED_KEYS) {
+      keyNumber = SplitMix64(~index)();
+    }
+    formatKey("key", keyNumber, &record->keys[0]);
+    for (uint32_t i = 1; i <= numSecondaryKeys; i++) {
+      formatKey("sk", rng() % (index + 1), &record->keys[i]);
+    }
+
+    uint32_t length = valueSize.sample(rng);
+    record->value.resize(length);
+    fillValue(rng, &record->value[0], length);
+
+    record->diskBytes = 0;
+  }
+
+  /*
+   * How primary keys are chosen.
+   */
+  KeyPattern keyPattern;
+
+  /*
+   * Length of each key in bytes. Keys are padded to this length, and never
+   * shorter than needed to keep them unique.
+   */
+  uint32_t keySize;
+
+  /*
+   * Distribution of value sizes.
+   */
+  SizeDistribution valueSize;
+
+  /*
+   * Number of secondary keys in each record.
+   */
+  uint32_t numSecondaryKeys;
+
+  /*
+   * Fraction of each value that is a repeated byte rather than random, so
+   * that values compress to about (1 - compressibility) of their size.
+   */
+  double compressibility;
+
+  /*
+   * Seed for everything random about the image.
+   */
+  uint64_t seed;
+
+ private:
+  void
+  formatKey(const char* prefix, uint64_t number, std::string* key) const
+  {
+    int width = std::max((int)keySize - (int)strlen(prefix), 0);
+    key->resize(strlen(prefix) + std::max(width, 20) + 1);
+    int length = snprintf(&(*key)[0], key->size(), "%s%0*lu", prefix, width,
+        number);
+    key->resize(length);
+  }
+
+  /**
+   * Fill a value, mixing random and repeated bytes throughout it so that
+   * block compressors see the same ratio everywhere.
+   */
+  void
+  fillValue(SplitMix64& rng, char* data, uint32_t length) const
+  {
+    const uint32_t segment = 256;
+    uint32_t randomBytes = (uint32_t)((1 - compressibility) * segment + 0.5);
+    for (uint32_t offset = 0; offset < length; offset += segment) {
+      uint32_t n = std::min(segment, length - offset);
+      uint32_t r = std::min(randomBytes, n);
+      fillRandom(rng, data + offset, r);
+      memset(data + offset + r, 'x', n - r);
+    }
+  }
+
+  static void
+  fillRandom(SplitMix64& rng, char* data, uint32_t length)
+  {
+    uint32_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+      uint64_t word = rng();
+      memcpy(data + i, &word, sizeof(word));
+    }
+    uint64_t word = rng();
+    memcpy(data + i, &word, length - i);
+  }
+};
+
+/**
+ * Set up a SyntheticImage to resemble an existing image, from the output of
+ * ImageFileStats for it: the primary key size, the number of secondary keys,
+ * and a lognormal fit of the value sizes.
+ *
+ * \param path
+ *      File holding the ImageFileStats output.
+ * \param[out] image
+ *      Its key size, secondary keys and value size distribution are set.
+ * \return
+ *      False if the file couldn't be read or lacks the averages.
+ */
+inline bool
+fitImageStats(const std::string& path, SyntheticImage* image)
+{
+  FILE* in = fopen(path.c_str(), "r");
+  if (in == NULL) {
+    return false;
+  }
+
+  double objects = -1;
+  double keyBytes = -1;
+  double secondaryKeyBytes = 0;
+  double secondaryKeys = 0;
+  double valueMean = -1;
+  double valueStdDev = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), in) != NULL) {
+    char* p = line + strspn(line, " ");
+    double x;
+    if (sscanf(p, "Total Object Count: %lf", &x) == 1) {
+      objects = x;
+    } else if (sscanf(p, "Total Key Bytes: %lf", &x) == 1) {
+      keyBytes = x;
+    } else if (sscanf(p, "Secondary Key Bytes: %lf", &x) == 1) {
+      secondaryKeyBytes = x;
+    } else if (sscanf(p, "Average Secondary Key Count: %lf", &x) == 1) {
+      secondaryKeys = x;
+    } else if (sscanf(p, "Average Value Size: %lf", &x) == 1) {
+      valueMean = x;
+    } else if (sscanf(p, "Value Size Std Dev: %lf", &x) == 1) {
+      valueStdDev = x;
+    }
+  }
+  fclose(in);
+
+  if (objects <= 0 || keyBytes < 0 || valueMean < 0) {
+    return false;
+  }
+  image->keySize = (uint32_t)((keyBytes - secondaryKeyBytes) / objects + 0.5);
+  image->numSecondaryKeys = (uint32_t)(secondaryKeys + 0.5);
+  if (valueStdDev > 0 && valueMean > 0) {
+    image->valueSize.kind = SizeDistribution::LOGNORMAL;
+    image->valueSize.a = valueMean;
+    image->valueSize.b = valueStdDev;
+  } else {
+    image->valueSize.kind = SizeDistribution::FIXED;
+    image->valueSize.a = valueMean;
+  }
+  return true;
+}
+
+} // namespace RAMCloud
+
+#endif // RAMCLOUDTOOLS_SYNTHETICIMAGE_H
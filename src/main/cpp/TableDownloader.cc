@@ -33,6 +33,9 @@
 #include "Tub.h"
 #include "IndexLookup.h"
 #include "TableEnumerator.h"
+#include "ImageFile.h"
+#include "ImageIO.h"
+#include "StorageBackend.h"
 
 using namespace RAMCloud;
 
@@ -46,6 +49,10 @@ try
     long bytesPerFile;
     string splitSuffixFormat;
     string outputDir;
+    bool primaryKeyOnly;
+    BackendOptions backendOptions;
+    string fakeImage;
+    string ioModeName;
 
     // Set line buffering for stdout so that printf's and log messages
     // interleave properly.
@@ -83,21 +90,45 @@ try
          "[default: \".part%04d\"].")
         ("outputDir",
          ProgramOptions::value<string>(&outputDir),
-         "Directory to write image file.");
+         "Directory to write image file.")
+        ("primaryKeyOnly",
+         ProgramOptions::bool_switch(&primaryKeyOnly),
+         "Only write each object's primary key to the image, dropping any "
+         "secondary keys. The resulting image can be read by tools that "
+         "predate multi-key images.")
+        ("fakeImage",
+         ProgramOptions::value<string>(&fakeImage)->default_value(""),
+         "With --backend=fake, image file to fill the table with before "
+         "downloading it [default: ].");
+    addBackendOptions(clientOptions, &backendOptions);
+    addImageIoModeOption(clientOptions, &ioModeName);
     
     OptionParser optionParser(clientOptions, argc, argv);
+    ImageIoMode ioMode = parseImageIoMode(ioModeName);
     context.transportManager->setSessionTimeout(
             optionParser.options.getSessionTimeout());
 
-    LOG(NOTICE, "Connecting to %s",
-        optionParser.options.getCoordinatorLocator().c_str());
-
     string locator = optionParser.options.getExternalStorageLocator();
     if (locator.size() == 0) {
         locator = optionParser.options.getCoordinatorLocator();
     }
-    RamCloud client(&context, locator.c_str(),
-            optionParser.options.getClusterName().c_str());
+
+    FakeStore fakeStore;
+    std::unique_ptr<StorageBackend> backend(newStorageBackend(backendOptions,
+        [&]() {
+            LOG(NOTICE, "Connecting to %s",
+                optionParser.options.getCoordinatorLocator().c_str());
+            return new RamCloud(&context, locator.c_str(),
+                optionParser.options.getClusterName().c_str());
+        }, &fakeStore, NULL));
+
+    if (backendOptions.isFake() && fakeImage.size() > 0) {
+      std::ifstream in(fakeImage.c_str(), std::ios::binary);
+      uint64_t count = fakeStore.loadImage(
+          backend->createTable(tableName.c_str(), 1), in);
+      LOG(NOTICE, "Filled fake table %s with %lu objects from %s",
+          tableName.c_str(), count, fakeImage.c_str());
+    }
 
     long partitionCount = 0;
     char *outFileName;
@@ -113,47 +144,45 @@ try
       LOG(NOTICE, "Downloading table %s to %s", tableName.c_str(), outFileName);
     }
 
-    std::ofstream imageFile;
-    imageFile.open(outFileName, std::ios::binary);
+    std::unique_ptr<ImageFileWriter> imageFile(
+        new ImageFileWriter(outFileName, ioMode, 1 << 20));
 
     free(outFileName);
 
     uint64_t tableId;
-    tableId = client.getTableId(tableName.c_str());
+    tableId = backend->getTableId(tableName.c_str());
 
-    TableEnumerator iter(client, tableId, false);
+    std::unique_ptr<TableScan> scan(backend->scanTable(tableId));
 
-    uint32_t keyLength = 0;
-    const void* key = 0;
+    std::vector<KeyInfo> keys;
     uint32_t dataLength = 0;
-    const void* data = 0;
+    const void* data = NULL;
 
     long objCount = 0;    
     long totalByteCount = 0;
     long partitionByteCount = 0;
     uint64_t startTime = Cycles::rdtsc();
-    while (true) {
-      if (!iter.hasNext())
-        break;
-
-      iter.nextKeyAndData(&keyLength, &key, &dataLength, &data);
-      imageFile.write((char*) &keyLength, sizeof(uint32_t));
-      imageFile.write((char*) key, keyLength);
-      imageFile.write((char*) &dataLength, sizeof(uint32_t));
-      imageFile.write((char*) data, dataLength);
+    while (scan->next(&keys, &data, &dataLength)) {
+      uint32_t numKeys = primaryKeyOnly ? 1 : (uint32_t)keys.size();
+      uint32_t keysLength = 0;
+      for (uint32_t i = 0; i < numKeys; i++) {
+        keysLength += keys[i].keyLength;
+      }
+
+      imageFile->write(numKeys, keys.data(), data, dataLength);
               
       objCount++;
-      totalByteCount += keyLength + dataLength;
-      partitionByteCount += keyLength + dataLength;
+      totalByteCount += keysLength + dataLength;
+      partitionByteCount += keysLength + dataLength;
       
       if (bytesPerFile > 0 && partitionByteCount > bytesPerFile) {
         LOG(NOTICE, "Closing file...");    
-        imageFile.close();
+        imageFile->close();
         partitionCount++;
         asprintf(&outFileName, 
             (outputDir + "/" + tableName + ".img" + splitSuffixFormat).c_str(),
             partitionCount); 
-        imageFile.open(outFileName, std::ios::binary);
+        imageFile.reset(new ImageFileWriter(outFileName, ioMode, 1 << 20));
 
         LOG(NOTICE, "Downloading table %s to partition %s", tableName.c_str(), 
             outFileName);
@@ -169,7 +198,7 @@ try
     }
     uint64_t endTime = Cycles::rdtsc();
     LOG(NOTICE, "Closing file...");    
-    imageFile.close();
+    imageFile->close();
 
     LOG(NOTICE, "Table downloaded (objects: %lu, size: %luMB/%luKB/%luB, time: %0.2fs).", objCount, totalByteCount/(1024*1024), totalByteCount/(1024), totalByteCount, Cycles::toSeconds(endTime - startTime));
 
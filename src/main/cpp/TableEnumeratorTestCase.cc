@@ -20,6 +20,9 @@
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <sstream>
+#include <thread>
 
 #include "ClusterMetrics.h"
 #include "Context.h"
@@ -33,9 +36,102 @@
 #include "Tub.h"
 #include "IndexLookup.h"
 #include "TableEnumerator.h"
+#include "IntList.h"
 
 using namespace RAMCloud;
 
+/**
+ * A thread which populates a range of integer keys with multiwrites.
+ *
+ * \param client
+ *      RAMCloud client object to use for this thread. Each thread gets its own
+ *      client object because the RAMCloud client object is not thread-safe.
+ * \param tableId
+ *      Table to populate.
+ * \param firstKey
+ *      First key to write.
+ * \param numKeys
+ *      Number of consecutive keys to write.
+ * \param size
+ *      Size of each object's value in bytes.
+ * \param multiwriteSize
+ *      The size of multiwrites to use.
+ */
+void
+populateThread(RamCloud* client, uint64_t tableId, int firstKey, int numKeys,
+    int size, int multiwriteSize)
+{
+    std::vector<char> buf(size);
+    std::vector<int> keys(multiwriteSize);
+    Tub<MultiWriteObject> objects[multiwriteSize];
+    MultiWriteObject* requests[multiwriteSize];
+
+    for (int i = 0; i < numKeys; i += multiwriteSize) {
+      int n = std::min(multiwriteSize, numKeys - i);
+      for (int j = 0; j < n; j++) {
+        keys[j] = firstKey + i + j;
+        objects[j].construct(tableId, (const void*)&keys[j], sizeof(int),
+            (const void*)buf.data(), size);
+        requests[j] = objects[j].get();
+      }
+      client->multiWrite(requests, n);
+    }
+}
+
+/**
+ * A thread which enumerates the objects in a contiguous range of a table's
+ * tablets. This does the same work as a TableEnumerator, but stops at the
+ * end of the given key hash range instead of continuing to the end of the
+ * table.
+ *
+ * \param client
+ *      RAMCloud client object to use for this thread.
+ * \param tableId
+ *      Table to enumerate.
+ * \param keysOnly
+ *      If true, only enumerate keys (no values).
+ * \param firstKeyHash
+ *      Start key hash of the first tablet to enumerate.
+ * \param lastKeyHash
+ *      End key hash (inclusive) of the last tablet to enumerate.
+ * \param[out] objectCount
+ *      Filled in with the number of objects enumerated.
+ * \param[out] byteCount
+ *      Filled in with the number of bytes of object data enumerated.
+ */
+void
+enumeratorThread(RamCloud* client, uint64_t tableId, bool keysOnly,
+    uint64_t firstKeyHash, uint64_t lastKeyHash, long* objectCount,
+    long* byteCount)
+{
+    Buffer state;
+    Buffer objects;
+    uint64_t nextKeyHash = firstKeyHash;
+    while (true) {
+      nextKeyHash = client->enumerateTable(tableId, keysOnly, nextKeyHash,
+          state, objects);
+
+      uint32_t offset = 0;
+      while (offset < objects.size()) {
+        uint32_t len = *objects.getOffset<uint32_t>(offset);
+        offset += sizeof32(uint32_t) + len;
+        (*objectCount)++;
+        (*byteCount) += len;
+      }
+
+      // A next key hash of 0 means the end of the table was reached.
+      if (nextKeyHash == 0 || nextKeyHash > lastKeyHash) {
+        break;
+      }
+    }
+}
+
+/**
+ * A benchmark for table enumeration throughput. For every combination of
+ * server span and object size a table is populated in parallel with
+ * multiwrites, and then enumerated by 1..N concurrent enumerators, each
+ * responsible for a contiguous set of the table's tablets.
+ */
 int
 main(int argc, char *argv[])
 try
@@ -46,6 +142,12 @@ try
     int serverSpan;
     int numObjects;
     int size;
+    string serverSpans;
+    string sizes;
+    string enumeratorCounts;
+    string modes;
+    int numThreads;
+    int multiwriteSize;
 
     // Set line buffering for stdout so that printf's and log messages
     // interleave properly.
@@ -72,19 +174,76 @@ try
          ProgramOptions::value<string>(&tableName),
          "Name of the table to image.")
         ("serverSpan",
-         ProgramOptions::value<int>(&serverSpan),
+         ProgramOptions::value<int>(&serverSpan)->
+            default_value(1),
          "Server span for the table.")
         ("numObjects",
          ProgramOptions::value<int>(&numObjects),
          "Number of objects to upload.")
         ("size",
-         ProgramOptions::value<int>(&size),
-         "Size of objects to upload.");
+         ProgramOptions::value<int>(&size)->
+            default_value(100),
+         "Size of objects to upload.")
+        ("serverSpans",
+         ProgramOptions::value<string>(&serverSpans)->
+            default_value(""),
+         "Comma-separated list of server spans to sweep over. Overrides "
+         "serverSpan.")
+        ("sizes",
+         ProgramOptions::value<string>(&sizes)->
+            default_value(""),
+         "Comma-separated list of object sizes to sweep over. Overrides "
+         "size.")
+        ("enumerators",
+         ProgramOptions::value<string>(&enumeratorCounts)->
+            default_value("1"),
+         "Comma-separated list of concurrent enumerator counts to sweep over. "
+         "Tablets are divided evenly between enumerators, so counts above "
+         "the server span are capped at the server span [default: 1].")
+        ("modes",
+         ProgramOptions::value<string>(&modes)->
+            default_value("full"),
+         "Comma-separated list of enumeration modes to sweep over. Values "
+         "can be: full (keys and values), keysOnly [default: full].")
+        ("numThreads",
+         ProgramOptions::value<int>(&numThreads)->
+            default_value(1),
+         "Number of threads to use to populate the table [default: 1].")
+        ("multiwriteSize",
+         ProgramOptions::value<int>(&multiwriteSize)->
+            default_value(32),
+         "Size of multiwrites to use to populate the table [default: 32].");
     
     OptionParser optionParser(clientOptions, argc, argv);
     context.transportManager->setSessionTimeout(
             optionParser.options.getSessionTimeout());
 
+    std::vector<int> spanList;
+    std::vector<int> sizeList;
+    std::vector<int> enumeratorList;
+    parseIntList(serverSpans, &spanList);
+    parseIntList(sizes, &sizeList);
+    parseIntList(enumeratorCounts, &enumeratorList);
+    if (spanList.empty()) {
+      spanList.push_back(serverSpan);
+    }
+    if (sizeList.empty()) {
+      sizeList.push_back(size);
+    }
+    std::vector<bool> modeList;
+    std::stringstream ss(modes);
+    string mode;
+    while (std::getline(ss, mode, ',')) {
+      if (mode != "full" && mode != "keysOnly") {
+        fprintf(stderr, "Unknown mode: %s\n", mode.c_str());
+        return 1;
+      }
+      modeList.push_back(mode == "keysOnly");
+    }
+    int maxEnumerators = *std::max_element(enumeratorList.begin(),
+        enumeratorList.end());
+    int maxClients = std::max(numThreads, maxEnumerators);
+
     LOG(NOTICE, "Connecting to %s",
         optionParser.options.getCoordinatorLocator().c_str());
 
@@ -95,43 +254,114 @@ try
     RamCloud client(&context, locator.c_str(),
             optionParser.options.getClusterName().c_str());
 
-    LOG(NOTICE, "Testing enumeration on table %s with server span %d", tableName.c_str(), serverSpan);
+    std::vector<RamCloud*> clients(maxClients);
+    for (int i = 0; i < maxClients; i++) {
+      clients[i] = new RamCloud(&optionParser.options);
+    }
+
+    printf("%8s %10s %8s %12s %12s %12s %12s %12s %12s\n",
+        "Span",
+        "Size(B)",
+        "Enums",
+        "Mode",
+        "Objects",
+        "MB",
+        "Time(s)",
+        "Objs/s",
+        "MB/s");
 
-    uint64_t tableId;
-    tableId = client.createTable(tableName.c_str(), serverSpan);
+    bool passed = true;
+    for (int span : spanList) {
+      for (int objSize : sizeList) {
+        LOG(NOTICE, "Testing enumeration on table %s with server span %d "
+            "and object size %d", tableName.c_str(), span, objSize);
 
-    long byteCount = 0;
-    char buf[size];
-    uint64_t startTime = Cycles::rdtsc();
-    for(int i = 0; i < numObjects; i++ ) {
-      client.write(tableId, (char*)&i, sizeof(int), buf, size);
+        uint64_t tableId;
+        tableId = client.createTable(tableName.c_str(), span);
 
-      byteCount += sizeof(i) + size;
-      if (i % 100000 == 0) {
-        LOG(NOTICE, "Upload status (objects: %d, size: %dMB/%dKB/%dB, time: %0.2fs).", i, byteCount/(1024*1024), byteCount/(1024), byteCount, Cycles::toSeconds(Cycles::rdtsc() - startTime)); 
-      }      
+        uint64_t startTime = Cycles::rdtsc();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < numThreads; i++) {
+          int q = numObjects / numThreads;
+          int r = numObjects % numThreads;
+          int firstKey = (i < r) ? (q + 1) * i : ((q + 1) * r) + (q * (i - r));
+          int numKeys = (i < r) ? q + 1 : q;
+          threads.emplace_back(populateThread, clients[i], tableId, firstKey,
+              numKeys, objSize, multiwriteSize);
+        }
+        for (int i = 0; i < numThreads; i++) {
+          threads[i].join();
+        }
+        long byteCount = (long)numObjects * (sizeof(int) + objSize);
+        double secs = Cycles::toSeconds(Cycles::rdtsc() - startTime);
+        LOG(NOTICE, "Upload finished (objects: %d, size: %ldMB/%ldKB/%ldB, "
+            "time: %0.2fs, rate: %0.0f objs/s, %0.2f MB/s).", numObjects,
+            byteCount/(1024*1024), byteCount/(1024), byteCount, secs,
+            numObjects / secs, byteCount / secs / 1000000.0);
+
+        uint64_t tabletRange = 1 + ~0UL / span;
+        for (int numEnumerators : enumeratorList) {
+          numEnumerators = std::min(numEnumerators, span);
+          for (bool keysOnly : modeList) {
+            std::vector<long> objectCounts(numEnumerators, 0);
+            std::vector<long> byteCounts(numEnumerators, 0);
+
+            startTime = Cycles::rdtsc();
+            threads.clear();
+            for (int i = 0; i < numEnumerators; i++) {
+              int q = span / numEnumerators;
+              int r = span % numEnumerators;
+              int firstTablet = (i < r) ?
+                  (q + 1) * i : ((q + 1) * r) + (q * (i - r));
+              int numTablets = (i < r) ? q + 1 : q;
+              uint64_t firstKeyHash = firstTablet * tabletRange;
+              uint64_t lastKeyHash = (firstTablet + numTablets == span) ?
+                  ~0UL : (firstTablet + numTablets) * tabletRange - 1;
+              threads.emplace_back(enumeratorThread, clients[i], tableId,
+                  keysOnly, firstKeyHash, lastKeyHash, &objectCounts[i],
+                  &byteCounts[i]);
+            }
+
+            long count = 0;
+            byteCount = 0;
+            for (int i = 0; i < numEnumerators; i++) {
+              threads[i].join();
+              count += objectCounts[i];
+              byteCount += byteCounts[i];
+            }
+            secs = Cycles::toSeconds(Cycles::rdtsc() - startTime);
+
+            printf("%8d %10d %8d %12s %12ld %12.2f %12.2f %12.0f %12.2f\n",
+                span,
+                objSize,
+                numEnumerators,
+                keysOnly ? "keysOnly" : "full",
+                count,
+                byteCount / 1000000.0,
+                secs,
+                count / secs,
+                byteCount / secs / 1000000.0);
+
+            if (count != numObjects) {
+              LOG(WARNING, "Enumerated %ld objects, expected %d.", count,
+                  numObjects);
+              passed = false;
+            }
+          }
+        }
+
+        client.dropTable(tableName.c_str());
+      }
     }
-    LOG(NOTICE, "Upload finished (objects: %d, size: %dMB/%dKB/%dB, time: %0.2fs).", numObjects, byteCount/(1024*1024), byteCount/(1024), byteCount, Cycles::toSeconds(Cycles::rdtsc() - startTime)); 
-
-    TableEnumerator iter(client, tableId, false);
-
-    uint32_t count = 0;    
-    byteCount = 0;
-    uint32_t len = 0;
-    const void* object = 0;
-    startTime = Cycles::rdtsc();
-    while (iter.hasNext()) {
-      iter.next(&len, &object);
-      
-      count++;
-      byteCount += len;
-      if (count % 100000 == 0) {
-        LOG(NOTICE, "Enumeration status (objects: %d, size: %dMB/%dKB/%dB, time: %0.2fs).", count, byteCount/(1024*1024), byteCount/(1024), byteCount, Cycles::toSeconds(Cycles::rdtsc() - startTime)); 
-      }      
+
+    for (int i = 0; i < maxClients; i++) {
+      delete clients[i];
     }
-    LOG(NOTICE, "Enumeration finished (objects: %d, size: %dMB/%dKB/%dB, time: %0.2fs).", count, byteCount/(1024*1024), byteCount/(1024), byteCount, Cycles::toSeconds(Cycles::rdtsc() - startTime)); 
 
-    client.dropTable(tableName.c_str());
+    if (!passed) {
+      LOG(WARNING, "Test failed.");
+      return 1;
+    }
 
     LOG(NOTICE, "Test passed.");
 
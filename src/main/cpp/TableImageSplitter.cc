@@ -33,6 +33,8 @@
 #include "Tub.h"
 #include "IndexLookup.h"
 #include "TableEnumerator.h"
+#include "ImageFile.h"
+#include "ImageIO.h"
 
 using namespace RAMCloud;
 
@@ -50,6 +52,7 @@ try
   long bytesPerFile;
   string outputDir;
   string splitSuffixFormat;
+  ImageReadOptions readOptions;
 
   // Set line buffering for stdout so that printf's and log messages
   // interleave properly.
@@ -78,17 +81,19 @@ try
          default_value(".part%04d"),
      "Format string of the suffix to use for partitions. Must contain "
          "exactly one %d. [default: \".part%04d\"].");
+  addImageReadOptions(clientOptions, &readOptions);
   
   OptionParser optionParser(clientOptions, argc, argv);
+  ImageIoMode ioMode = parseImageIoMode(readOptions.ioMode);
 
   printf("TableImageSplitter: {imageFile: %s, objectsPerFile: %lu, "
-      "bytesPerFile: %lu, outputDir: %s, splitSuffixFormat: %s}\n", 
+      "bytesPerFile: %lu, outputDir: %s, splitSuffixFormat: %s, "
+      "ioMode: %s}\n", 
       imageFilePath.c_str(), objectsPerFile, bytesPerFile, outputDir.c_str(), 
-      splitSuffixFormat.c_str());
+      splitSuffixFormat.c_str(), readOptions.ioMode.c_str());
 
   // Open image file for splitting. 
-  std::ifstream inFile;
-  inFile.open(imageFilePath.c_str(), std::ios::binary);
+  ImageBatchReader inFile(imageFilePath, readOptions, 1000);
 
   size_t lastSlashIndex = imageFilePath.find_last_of("/");
   string imageFileName;
@@ -108,61 +113,44 @@ try
   asprintf(&outFileName, 
       (outputDir + "/" + imageFileName + splitSuffixFormat).c_str(),
       partitionCount); 
-  std::ofstream outFile;
-  outFile.open(outFileName, std::ios::binary);
+  std::unique_ptr<ImageFileWriter> outFile(
+      new ImageFileWriter(outFileName, ioMode, 1 << 20));
   printf("Creating %s... ", outFileName);
   free(outFileName);
 
   // Read the imagefile until there are no more objects left in the file.
-  char lenBuffer[sizeof(uint32_t)];
-  while(inFile.read(lenBuffer, sizeof(lenBuffer))) {
-    uint32_t keyLength = *((uint32_t*) lenBuffer); 
-    char keyBuffer[keyLength];
-    inFile.read(keyBuffer, keyLength);
-    
-    inFile.read(lenBuffer, sizeof(lenBuffer));
-    uint32_t dataLength = *((uint32_t*) lenBuffer);
-    char dataBuffer[dataLength];
-    inFile.read(dataBuffer, dataLength);
-
-    // Copy object to output file.
-    outFile.write((char*) &keyLength, sizeof(uint32_t));
-    outFile.write((char*) keyBuffer, keyLength);
-    outFile.write((char*) &dataLength, sizeof(uint32_t));
-    outFile.write((char*) dataBuffer, dataLength);
-
-    objCount++;
-    totalObjCount++;
-    byteCount += sizeof(uint32_t) + keyLength + sizeof(uint32_t) + dataLength;
-    totalObjByteCount += keyLength + dataLength;
-
-    // If we've filled up the partition, close it and start a new one.
-    if (objectsPerFile > 0) {
-      if (objCount == objectsPerFile) {
-        outFile.close();
-        partitionCount++;
-        printf("Done\n");
-
-        asprintf(&outFileName, 
-            (outputDir + "/" + imageFileName + splitSuffixFormat).c_str(),
-            partitionCount); 
-        outFile.open(outFileName, std::ios::binary);
-        printf("Creating %s... ", outFileName);
-        free(outFileName);
-        
-        objCount = 0;
-        byteCount = 0;
+  ImageBatch* batch;
+  while ((batch = inFile.next()) != NULL) {
+    for (uint32_t b = 0; b < batch->count; b++) {
+      const ImageRecord& record = batch->records[b];
+
+      // Copy object to output file.
+      outFile->write(record);
+
+      objCount++;
+      totalObjCount++;
+      byteCount += record.diskBytes;
+      for (size_t i = 0; i < record.keys.size(); i++) {
+        totalObjByteCount += record.keys[i].size();
+      }
+      totalObjByteCount += record.value.size();
+
+      // If we've filled up the partition, close it and start a new one.
+      bool full;
+      if (objectsPerFile > 0) {
+        full = (objCount == objectsPerFile);
+      } else {
+        full = (byteCount > bytesPerFile);
       }
-    } else {
-      if (byteCount > bytesPerFile) {
-        outFile.close();
+      if (full) {
+        outFile->close();
         partitionCount++;
         printf("Done\n");
 
         asprintf(&outFileName, 
             (outputDir + "/" + imageFileName + splitSuffixFormat).c_str(),
             partitionCount); 
-        outFile.open(outFileName, std::ios::binary);
+        outFile.reset(new ImageFileWriter(outFileName, ioMode, 1 << 20));
         printf("Creating %s... ", outFileName);
         free(outFileName);
         
@@ -172,12 +160,10 @@ try
     }
   }
 
-  outFile.close();
+  outFile->close();
   partitionCount++;
   printf("Done\n");
 
-  inFile.close();
-
   printf("Split table image into %lu partitions. Total objects: %lu. Total "
       "bytes: %lu\n", partitionCount, totalObjCount, totalObjByteCount);
 
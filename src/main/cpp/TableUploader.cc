@@ -20,6 +20,7 @@
 #include <assert.h>
 #include <time.h>
 
+#include <atomic>
 #include <iostream>
 #include <fstream>
 #include <thread>
@@ -36,208 +37,21 @@
 #include "Tub.h"
 #include "IndexLookup.h"
 #include "TableEnumerator.h"
+#include "ImageFile.h"
+#include "ImageIO.h"
+#include "LoaderStats.h"
+#include "StorageBackend.h"
+#include "TabletPlacement.h"
 
 using namespace RAMCloud;
 
-/** 
- * A set of per-thread loading statistics. Each loader thread continually
- * updates these statistics, while a statistics reporting thread with a
- * reference to each thread's stats regularly prints statistic summaries to the
- * screen.
- */
-struct ThreadStats {
-  /*
-   * The total number of objects this thread has uploaded to RAMCloud.
-   */
-  long objectsLoaded = 0;
-
-  /*
-   * The total number of files this thread has uploaded.
-   */
-  long filesLoaded = 0;
-
-  /*
-   * The total number of files this thread has been given to load.
-   */
-  long totalFilesToLoad = 0;
-
-  /*
-   * The total number of bytes this thread has read from disk.
-   */
-  long bytesReadFromDisk = 0;
-
-  /*
-   * The total number of bytes (keys and values) this thread has written into
-   * RAMCloud.
-   */ 
-  long bytesWrittenToRAMCloud = 0;
-};
-
-/**
- * A thread which reports statistics on the loader threads in the system at a
- * set interval. This thread gets information on each thread via a shared
- * ThreadStat struct with each thread.
- *
- * \param threadStats
- *      Array of all the shared ThreadStat structs, one per thread.
- * \param numThreads
- *      The number of loader threads.
- * \param reportInterval
- *      The number of seconds between reporting status to the screen.
- * \param formatString
- *      What columns of information to output to the screen.
- */
-void statsReporterThread(struct ThreadStats *threadStats, int numThreads, 
-    int reportInterval, std::string formatString) {
-
-  int colWidth = 10;
-  const char *colFormatStr = "%10s";
-
-  // Print the column headers.
-  for (int i = 0; i < numThreads; i++) {
-    if (formatString.find("o") != std::string::npos) {
-      printf(colFormatStr, (std::to_string(i) + ".o").c_str());
-    }
-
-    if (formatString.find("f") != std::string::npos) {
-      printf(colFormatStr, (std::to_string(i) + ".f").c_str());
-    }
-
-    if (formatString.find("b") != std::string::npos) {
-      printf(colFormatStr, (std::to_string(i) + ".b").c_str());
-    }
-
-    if (formatString.find("d") != std::string::npos) {
-      printf(colFormatStr, (std::to_string(i) + ".d").c_str());
-    }
-  }
-
-  if (formatString.find("O") != std::string::npos) {
-    printf(colFormatStr, "O");
-  }
-
-  if (formatString.find("F") != std::string::npos) {
-    printf(colFormatStr, "F");
-  }
-
-  if (formatString.find("B") != std::string::npos) {
-    printf(colFormatStr, "B");
-  }
-
-  if (formatString.find("D") != std::string::npos) {
-    printf(colFormatStr, "D");
-  }
-
-  if (formatString.find("T") != std::string::npos) {
-    printf(colFormatStr, "T");
-  }
-
-  printf("\n");
-
-
-  struct ThreadStats lastThreadStats[numThreads];
-  memcpy(lastThreadStats, threadStats, numThreads*sizeof(struct ThreadStats));
- 
-  time_t startTime;
-  time(&startTime); 
-  while (true) {
-    sleep(reportInterval);
-
-    time_t currTime;
-    time(&currTime);
-    long timeElapsed = (long) difftime(currTime, startTime);
-
-    long totalCurrObjRate = 0;
-    long totalFilesLoaded = 0;
-    long totalFilesToLoad = 0;
-    long totalCurrReadRate = 0;
-    long totalCurrWriteRate = 0;
-    for (int i = 0; i < numThreads; i++) {
-      struct ThreadStats *lastStats = &lastThreadStats[i];
-      struct ThreadStats *currStats = &threadStats[i];
-
-      long objectsLoaded = 
-          currStats->objectsLoaded - lastStats->objectsLoaded;
-      long bytesReadFromDisk = 
-          currStats->bytesReadFromDisk - lastStats->bytesReadFromDisk;
-      long byteWrittenToRAMCloud = currStats->bytesWrittenToRAMCloud 
-          - lastStats->bytesWrittenToRAMCloud;
-
-      long currObjRate = objectsLoaded / reportInterval;
-      long currReadRate = bytesReadFromDisk / reportInterval;
-      long currWriteRate = byteWrittenToRAMCloud / reportInterval;
-
-      if (formatString.find("o") != std::string::npos) {
-        printf(colFormatStr, std::to_string(currObjRate).c_str());
-      }
-
-      if (formatString.find("f") != std::string::npos) {
-        char buf[colWidth];
-        sprintf(buf, "(%d/%d)", currStats->filesLoaded, 
-            currStats->totalFilesToLoad);
-        printf(colFormatStr, buf);
-      }
-
-      if (formatString.find("b") != std::string::npos) {
-        printf(colFormatStr, std::to_string(currWriteRate / 1000000l).c_str());
-      }
-
-      if (formatString.find("d") != std::string::npos) {
-        printf(colFormatStr, std::to_string(currReadRate / 1000000l).c_str());
-      }
-      
-      totalCurrObjRate += currObjRate;
-      totalCurrReadRate += currReadRate;
-      totalCurrWriteRate += currWriteRate;
-      totalFilesLoaded += currStats->filesLoaded;
-      totalFilesToLoad += currStats->totalFilesToLoad;
-    }
-
-    if (formatString.find("O") != std::string::npos) {
-      printf(colFormatStr, std::to_string(totalCurrObjRate).c_str());
-    }
-
-    if (formatString.find("F") != std::string::npos) {
-      char buf[colWidth];
-      sprintf(buf, "(%d/%d)", totalFilesLoaded, totalFilesToLoad);
-      printf(colFormatStr, buf);
-    }
-
-    if (formatString.find("B") != std::string::npos) {
-      printf(colFormatStr, 
-          std::to_string(totalCurrWriteRate / 1000000l).c_str());
-    }
-
-    if (formatString.find("D") != std::string::npos) {
-      printf(colFormatStr, 
-          std::to_string(totalCurrReadRate / 1000000l).c_str());
-    }
-
-    if (formatString.find("T") != std::string::npos) {
-      printf(colFormatStr, std::to_string(timeElapsed/60l).c_str());
-    }
-
-    printf("\n");
-
-    // Capture the current stats as last seen stats.
-    memcpy(lastThreadStats, threadStats, 
-        numThreads*sizeof(struct ThreadStats));
-
-    if (totalFilesLoaded == totalFilesToLoad) {
-      break;
-    }
-  }
-}  
- 
-
 /**
  * A loader thread which takes a set of files to load and loads them 
  * sequentially.
  *
- * \param client
- *      RAMCloud client object to use for this thread. Each thread currently
- *      gets its own client object because the RAMCloud client object is not
- *      thread-safe.
+ * \param backend
+ *      Store to load into. Each thread gets its own backend because the
+ *      RAMCloud client object is not thread-safe.
  * \param fileList
  *      Master list of all the file names that compose the table.
  * \param startIndex
@@ -246,10 +60,15 @@ void statsReporterThread(struct ThreadStats *threadStats, int numThreads,
  *      The segment length in the load list for this thread.
  * \param multiwriteSize
  *      The size of multiwrites to use.
+ * \param readOptions
+ *      How to read the files.
+ * \param stats
+ *      Statistics for this thread.
  */
-void loaderThread(RamCloud *client, uint64_t tableId, 
+void loaderThread(StorageBackend *backend, uint64_t tableId, 
     std::vector<std::string> fileList, int startIndex, int length, 
-    int multiwriteSize, struct ThreadStats *stats) {
+    int multiwriteSize, ImageReadOptions readOptions,
+    struct ThreadStats *stats) {
  
   stats->totalFilesToLoad = length;
 
@@ -257,71 +76,47 @@ void loaderThread(RamCloud *client, uint64_t tableId,
       "multiwriteSize: %u}\n", startIndex, length, multiwriteSize);
 
   for (int fIndex = startIndex; fIndex < startIndex + length; fIndex++) { 
-    std::ifstream inFile;
-    inFile.open(fileList[fIndex].c_str(), std::ios::binary);
+    ImageBatchReader reader(fileList[fIndex], readOptions, multiwriteSize);
 
     Tub<MultiWriteObject> objects[multiwriteSize];
     MultiWriteObject* requests[multiwriteSize];
     
-    std::vector<std::string> keys;
-    std::vector<std::string> values;
-
-    char lenBuffer[sizeof(uint32_t)];
-    while(inFile.read(lenBuffer, sizeof(lenBuffer))) {
-      uint32_t keyLength = *((uint32_t*) lenBuffer); 
-      char keyBuffer[keyLength];
-      inFile.read(keyBuffer, keyLength);
-      keys.emplace_back((const char*)keyBuffer, keyLength);
-      
-      inFile.read(lenBuffer, sizeof(lenBuffer));
-      uint32_t dataLength = *((uint32_t*) lenBuffer);
-      char dataBuffer[dataLength];
-      inFile.read(dataBuffer, dataLength);
-      values.emplace_back((const char*)dataBuffer, dataLength);
-
-      stats->bytesReadFromDisk += sizeof(lenBuffer)*2 + keyLength + dataLength;
-
-      objects[keys.size() - 1].construct( tableId,
-                                    (const void*) keys.back().data(),
-                                    keyLength,
-                                    (const void*) values.back().data(),
-                                    dataLength );
-      requests[keys.size() - 1] = objects[keys.size() - 1].get();
-
-      stats->bytesWrittenToRAMCloud += keyLength + dataLength;
-
-      if (keys.size() == multiwriteSize) {
-        try {
-          client->multiWrite(requests, multiwriteSize);
-        } catch(RAMCloud::ClientException& e) {
-          fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
-          return;
-        }
-        
-        stats->objectsLoaded += multiwriteSize;
-
-        keys.clear();
-        values.clear();
+    std::vector<KeyInfo> keyInfo;
+
+    while (true) {
+      uint64_t readStart = Cycles::rdtsc();
+      ImageBatch* batch;
+      try {
+        batch = reader.next();
+      } catch (Exception& e) {
+        fprintf(stderr, "Reading %s failed: %s\n", fileList[fIndex].c_str(),
+            e.str().c_str());
+        return;
       }
-    }
+      if (batch == NULL) {
+        break;
+      }
+      stats->recordStage(READ_STAGE, Cycles::rdtsc() - readStart);
+      add(stats->bytesReadFromDisk, (long)batch->diskBytes);
+
+      uint64_t buildStart = Cycles::rdtsc();
+      add(stats->bytesWrittenToRAMCloud, (long)prepareMultiWrite(tableId,
+          batch->records, batch->count, &keyInfo, objects, requests));
+      uint64_t rpcStart = Cycles::rdtsc();
+      stats->recordStage(BUILD_STAGE, rpcStart - buildStart);
 
-    if (keys.size() > 0) {
       try {
-        client->multiWrite(requests, keys.size());
+        backend->multiWrite(tableId, requests, batch->count);
       } catch(RAMCloud::ClientException& e) {
         fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
         return;
       }
-
-      stats->objectsLoaded += keys.size();
-
-      keys.clear();
-      values.clear();
+      stats->recordStage(RPC_STAGE, Cycles::rdtsc() - rpcStart);
+      
+      add(stats->objectsLoaded, (long)batch->count);
     }
 
-    inFile.close();
-
-    stats->filesLoaded++;
+    add(stats->filesLoaded, 1l);
   }
 }
 
@@ -343,6 +138,12 @@ try
   int multiwriteSize;
   int reportInterval;
   std::string reportFormat;
+  int slowestMasters;
+  int numIndexes;
+  int numIndexlets;
+  int balanceSample;
+  BackendOptions backendOptions;
+  ImageReadOptions readOptions;
 
   // Set line buffering for stdout so that printf's and log messages
   // interleave properly.
@@ -380,6 +181,25 @@ try
          default_value(""),
      "Format string for partition suffixes. The setting of this option "
      "implies the existence of partitions. Must contain exactly one %d.")
+    ("numIndexes",
+     ProgramOptions::value<int>(&numIndexes)->
+         default_value(0),
+     "Number of secondary indexes to create on the table before loading. "
+     "Secondary keys stored in the image are then indexed as objects are "
+     "loaded [default: 0].")
+    ("numIndexlets",
+     ProgramOptions::value<int>(&numIndexlets)->
+         default_value(1),
+     "Number of indexlets for each secondary index [default: 1].")
+    ("balanceSample",
+     ProgramOptions::value<int>(&balanceSample)->
+         default_value(0),
+     "Place the table's tablets so that each of its serverSpan masters gets "
+     "an equal share of the image's bytes, rather than an equal share of "
+     "the key hash space. The share is judged from the key hash and size of "
+     "every Nth record, which one client skims from every partition while "
+     "the others wait, before anything is loaded. 0 keeps createTable's "
+     "uniform tablets [default: 0].")
     ("multiwriteSize",
      ProgramOptions::value<int>(&multiwriteSize)->
          default_value(32),
@@ -391,20 +211,21 @@ try
     ("reportFormat",
      ProgramOptions::value<std::string>(&reportFormat)->
          default_value("OFBDT"),
-     "Format options for status report output.\n"
-     "  O - Total objects uploaded per second.\n"
-     "  o - Per thread objects uploaded per second.\n"
-     "  F - Total files uploaded.\n"
-     "  f - Per thread files uploaded.\n"
-     "  B - Total write bandwidth to RAMCloud in MB/s.\n"
-     "  b - Per thread write bandwidth to RAMCloud in MB/s.\n"
-     "  D - Total disk read bandwidth in MB/s.\n"
-     "  d - Per thread disk read bandwidth in MB/s.\n"
-     "  T - Total time elapsed.\n"
-     "[default: OFBDT]");
+     LOADER_REPORT_FORMAT_HELP)
+    ("slowestMasters",
+     ProgramOptions::value<int>(&slowestMasters)->
+         default_value(3),
+     "Number of masters to list, slowest first, after each status report. "
+     "A summary of every master is printed when loading finishes "
+     "[default: 3].");
+  addBackendOptions(clientOptions, &backendOptions);
+  addImageReadOptions(clientOptions, &readOptions);
   
   OptionParser optionParser(clientOptions, argc, argv);
 
+  // Reject a bad --ioMode here rather than in the loader threads.
+  parseImageIoMode(readOptions.ioMode);
+
   printf("TableUploader: {numClients: %u, clientIndex: %u, numThreads: %u, "
       "tableName: %s, serverSpan: %u, imageFile: %s, splitSuffixFormat: %s, "
       "multiwriteSize: %u, reportInterval: %u, reportFormat: %s}\n", 
@@ -417,9 +238,13 @@ try
     locator = optionParser.options.getCoordinatorLocator();
   }
 
-  RamCloud client(locator.c_str());
-  uint64_t tableId;
-  tableId = client.createTable(tableName.c_str(), serverSpan);
+  static MasterStatsTable masterStats;
+  static FakeStore fakeStore;
+  auto newBackend = [&]() {
+    return newStorageBackend(backendOptions,
+        [&]() { return new RamCloud(locator.c_str()); },
+        &fakeStore, &masterStats);
+  };
 
   // Compile a list of all the files for this image file.
   std::vector<std::string> fileList;  
@@ -446,6 +271,20 @@ try
 
   printf("Found %u total files\n", fileList.size());
 
+  // Every client loads into the same table, so only one of them places its
+  // tablets; the rest wait for it.
+  std::unique_ptr<StorageBackend> backend(newBackend());
+  uint64_t tableId;
+  if (balanceSample > 0) {
+    tableId = createBalancedTable(backend.get(), tableName, serverSpan,
+        fileList, balanceSample, "client " + std::to_string(clientIndex));
+  } else {
+    tableId = backend->createTable(tableName.c_str(), serverSpan);
+  }
+  for (int i = 1; i <= numIndexes; i++) {
+    backend->createIndex(tableId, (uint8_t)i, (uint8_t)numIndexlets);
+  }
+
   /*
    * Calculate the segment of the list that this loader instance is
    * responsible for loading.
@@ -467,7 +306,8 @@ try
    * Divvy up the load and start the threads.
    */
   std::vector<std::thread> threads;
-  RamCloud *clients[numThreads];
+  uint64_t loadStart = Cycles::rdtsc();
+  StorageBackend *backends[numThreads];
   ThreadStats tStats[numThreads];
   for (int i = 0; i < numThreads; i++) {
     int qt = loadSize / numThreads;
@@ -485,31 +325,39 @@ try
 
     threadLoadOffset += loadOffset;
 
-    clients[i] = new RamCloud(locator.c_str());
+    backends[i] = newBackend();
 
-    threads.emplace_back(loaderThread, clients[i], tableId, fileList, 
-        threadLoadOffset, threadLoadSize, multiwriteSize, &tStats[i]);
+    threads.emplace_back(loaderThread, backends[i], tableId, fileList, 
+        threadLoadOffset, threadLoadSize, multiwriteSize, readOptions,
+        &tStats[i]);
   }
 
-  // Give the threads some time to initialize their statistics. Otherwise the
-  // stats thread will find that totalFileLoaded == totalFilesToLoad and exit.
-  sleep(1);
-
-  // Start statistics reporting thread.
+  // Report until the threads are done, rather than until every file has
+  // been loaded, since a thread that fails stops short.
+  std::atomic<bool> loading(true);
   std::thread statsReporter(statsReporterThread, (struct ThreadStats*)tStats, 
-      numThreads, reportInterval, reportFormat);
+      numThreads, reportInterval, reportFormat, &masterStats, slowestMasters,
+      &loading);
 
+  bool ok = true;
   for (int i = 0; i < numThreads; i++) {
     threads[i].join();
+    if (tStats[i].filesLoaded != tStats[i].totalFilesToLoad) {
+      ok = false;
+    }
   }
 
+  loading = false;
   statsReporter.join();
 
+  printMasterSummary(&masterStats,
+      Cycles::toSeconds(Cycles::rdtsc() - loadStart));
+
   for (int i = 0; i < numThreads; i++) {
-    delete clients[i];
+    delete backends[i];
   }
 
-  return 0;
+  return ok ? 0 : 1;
 } catch (RAMCloud::ClientException& e) {
   fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
   return 1;
@@ -0,0 +1,402 @@
+/* Copyright (c) 2009-2015 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RAMCLOUDTOOLS_TABLETPLACEMENT_H
+#define RAMCLOUDTOOLS_TABLETPLACEMENT_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Cycles.h"
+#include "Key.h"
+#include "ImageFile.h"
+#include "StorageBackend.h"
+
+namespace RAMCloud {
+
+/**
+ * The key hash of a sampled image record and the bytes it will take up on
+ * its master.
+ */
+struct KeyHashSample {
+  uint64_t hash;
+  uint64_t bytes;
+
+  bool
+  operator<(const KeyHashSample& other) const
+  {
+    return hash < other.hash;
+  }
+};
+
+/**
+ * Read the primary key and size of the next record of a table image,
+ * seeking past its secondary keys and value rather than reading them.
+ * Seeking past the end of a file succeeds, so a caller must compare the
+ * stream's position with the file's length to catch a truncated record.
+ *
+ * \param in
+ *      Stream to read from.
+ * \param[out] primaryKey
+ *      Filled in with the record's primary key.
+ * \param[out] diskBytes
+ *      Set to the size of the record in the image.
+ * \return
+ *      True if a complete record was skimmed, false at the end of the
+ *      stream.
+ */
+inline bool
+skimImageRecord(std::istream& in, std::string* primaryKey,
+    uint64_t* diskBytes)
+{
+  uint32_t header;
+  if (!in.read((char*)&header, sizeof(header))) {
+    return false;
+  }
+
+  uint32_t numKeys = 1;
+  uint32_t keyLength = header;
+  *diskBytes = sizeof(header);
+  if (header & IMAGE_MULTIKEY_FLAG) {
+    numKeys = header & ~IMAGE_MULTIKEY_FLAG;
+    if (!in.read((char*)&keyLength, sizeof(keyLength))) {
+      return false;
+    }
+    *diskBytes += sizeof(keyLength);
+  }
+
+  for (uint32_t i = 0; i < numKeys; i++) {
+    if (i > 0) {
+      if (!in.read((char*)&keyLength, sizeof(keyLength))) {
+        return false;
+      }
+      *diskBytes += sizeof(keyLength);
+    }
+    if (i == 0) {
+      primaryKey->resize(keyLength);
+      if (!in.read(&(*primaryKey)[0], keyLength)) {
+        return false;
+      }
+    } else {
+      in.seekg(keyLength, std::ios::cur);
+    }
+    *diskBytes += keyLength;
+  }
+
+  uint32_t dataLength;
+  if (!in.read((char*)&dataLength, sizeof(dataLength))) {
+    return false;
+  }
+  in.seekg(dataLength, std::ios::cur);
+  *diskBytes += sizeof(dataLength) + dataLength;
+
+  return !in.fail();
+}
+
+/**
+ * Sample the key hashes of a table image, weighted by the records' sizes.
+ *
+ * \param path
+ *      Image file to sample.
+ * \param tableId
+ *      Table the records will be loaded into, which their hashes depend on.
+ * \param sampleEvery
+ *      Sample every this many records. Every record is still skimmed, but
+ *      only the sampled ones are hashed and kept.
+ * \param[out] samples
+ *      The samples are appended to this.
+ * \param progress
+ *      Called every few thousand records, e.g. to renew a lease.
+ * \return
+ *      Number of records in the image.
+ */
+inline uint64_t
+sampleImageKeyHashes(const std::string& path, uint64_t tableId,
+    uint32_t sampleEvery, std::vector<KeyHashSample>* samples,
+    const std::function<void()>& progress)
+{
+  std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+  if (!in) {
+    throw Exception(HERE, "couldn't open " + path, errno);
+  }
+  in.seekg(0, std::ios::end);
+  std::streamoff fileLength = in.tellg();
+  in.seekg(0, std::ios::beg);
+
+  uint64_t records = 0;
+  std::string key;
+  uint64_t diskBytes;
+  while (skimImageRecord(in, &key, &diskBytes) && in.tellg() <= fileLength) {
+    if (records % 4096 == 0) {
+      progress();
+    }
+    if (records++ % sampleEvery != 0) {
+      continue;
+    }
+    KeyHashSample sample;
+    sample.hash = Key::getHash(tableId, key.data(), (uint16_t)key.size());
+    sample.bytes = diskBytes;
+    samples->push_back(sample);
+  }
+  return records;
+}
+
+/**
+ * Choose the key hashes at which to split a table into tablets that hold
+ * equal numbers of bytes.
+ *
+ * \param samples
+ *      Sampled records of the table. They are sorted by hash.
+ * \param numTablets
+ *      Number of tablets wanted.
+ * \return
+ *      The first key hash of every tablet but the first, in increasing
+ *      order. There may be fewer than numTablets - 1 if the samples are too
+ *      few to tell tablets apart.
+ */
+inline std::vector<uint64_t>
+chooseTabletSplits(std::vector<KeyHashSample>* samples, uint32_t numTablets)
+{
+  std::vector<uint64_t> splits;
+  std::sort(samples->begin(), samples->end());
+  uint64_t totalBytes = 0;
+  for (size_t i = 0; i < samples->size(); i++) {
+    totalBytes += samples->at(i).bytes;
+  }
+
+  uint64_t bytes = 0;
+  size_t i = 0;
+  for (uint32_t tablet = 1; tablet < numTablets; tablet++) {
+    uint64_t target = (uint64_t)((double)totalBytes * tablet / numTablets);
+    while (i < samples->size() && bytes + samples->at(i).bytes <= target) {
+      bytes += samples->at(i).bytes;
+      i++;
+    }
+    if (i == 0 || i == samples->size()) {
+      continue;
+    }
+
+    // Split halfway between the last sample below the target and the next,
+    // so unsampled records nearby are divided evenly.
+    uint64_t low = samples->at(i - 1).hash;
+    uint64_t high = samples->at(i).hash;
+    uint64_t split = low + (high - low) / 2 + 1;
+    if (split > high || (!splits.empty() && split <= splits.back())) {
+      continue;
+    }
+    splits.push_back(split);
+  }
+  return splits;
+}
+
+/**
+ * Return the largest fraction of the sampled bytes that any one tablet
+ * would get, given the hashes at which the table is split.
+ */
+inline double
+largestTabletShare(const std::vector<KeyHashSample>& samples,
+    const std::vector<uint64_t>& splits)
+{
+  std::vector<uint64_t> tabletBytes(splits.size() + 1);
+  uint64_t totalBytes = 0;
+  for (size_t i = 0; i < samples.size(); i++) {
+    size_t tablet = std::upper_bound(splits.begin(), splits.end(),
+        samples[i].hash) - splits.begin();
+    tabletBytes[tablet] += samples[i].bytes;
+    totalBytes += samples[i].bytes;
+  }
+  if (totalBytes == 0) {
+    return 0;
+  }
+  return (double)*std::max_element(tabletBytes.begin(), tabletBytes.end()) /
+      (double)totalBytes;
+}
+
+/**
+ * Return the key hashes at which createTable splits a table: serverSpan
+ * equal hash ranges.
+ */
+inline std::vector<uint64_t>
+uniformTabletSplits(uint32_t serverSpan)
+{
+  std::vector<uint64_t> splits;
+  uint64_t tabletRange = 1 + ~0UL / serverSpan;
+  for (uint32_t i = 1; i < serverSpan; i++) {
+    splits.push_back(i * tabletRange);
+  }
+  return splits;
+}
+
+/**
+ * Table holding one marker object per balanced table, keyed by the table's
+ * name: "placing OWNER" while a loader places its tablets, "failed OWNER"
+ * if it gave up, and "placed ID" once the table with that id is ready to
+ * load.
+ */
+#define TABLET_PLACEMENT_TABLE "tabletPlacement"
+
+/**
+ * How long a "placing" marker may go unrenewed before other loaders take
+ * the placement over, in seconds.
+ */
+#define TABLET_PLACEMENT_LEASE_SECONDS 30
+
+/**
+ * Create a table whose tablets each hold an equal share of the bytes in its
+ * images, rather than an equal share of the key hash space. The images are
+ * sampled, and the table's tablets are split and moved so that each of its
+ * serverSpan masters gets one range of equal bytes (see
+ * StorageBackend::placeTablets).
+ *
+ * Any number of loaders may call this for the same table at once. The one
+ * that claims the table's marker in TABLET_PLACEMENT_TABLE places it, and
+ * the others wait until it's done, so nothing is loaded into uniform
+ * tablets. The marker is a lease like those of FileLeases: the placer
+ * renews it while sampling, and waiters take over a marker whose version
+ * hasn't changed for TABLET_PLACEMENT_LEASE_SECONDS. A placer that fails
+ * marks the placement failed so that another loader takes it over at once.
+ * A marker left by a table that has since been dropped is ignored, as
+ * table ids aren't reused.
+ *
+ * \param backend
+ *      Store to create the table in.
+ * \param name
+ *      Name of the table.
+ * \param serverSpan
+ *      Number of masters to spread the table over.
+ * \param imageFiles
+ *      Images holding everything that will be loaded into the table. Every
+ *      caller must pass all of them, as any caller may be the one to place.
+ * \param sampleEvery
+ *      Sample every this many records of the images.
+ * \param owner
+ *      Name of this loader, recorded in the marker for diagnosis.
+ * \return
+ *      The table's id.
+ */
+inline uint64_t
+createBalancedTable(StorageBackend* backend, const std::string& name,
+    uint32_t serverSpan, const std::vector<std::string>& imageFiles,
+    uint32_t sampleEvery, const std::string& owner)
+{
+  if (serverSpan <= 1) {
+    return backend->createTable(name.c_str(), serverSpan);
+  }
+
+  uint64_t placementTableId = backend->createTable(TABLET_PLACEMENT_TABLE, 1);
+  std::string placing = "placing " + owner;
+  bool waiting = false;
+  uint64_t seenVersion = 0;
+  uint64_t seenSince = 0;
+  uint64_t version;
+  while (true) {
+    std::string marker;
+    if (!backend->readVersioned(placementTableId, name, &marker, &version)) {
+      version = 0;
+    } else if (marker.compare(0, 7, "placed ") == 0) {
+      uint64_t placedId = strtoull(marker.c_str() + 7, NULL, 10);
+      try {
+        if (backend->getTableId(name.c_str()) == placedId) {
+          return placedId;
+        }
+      } catch (TableDoesntExistException& e) {
+      }
+    } else if (marker.compare(0, 8, "placing ") == 0) {
+      uint64_t now = Cycles::rdtsc();
+      if (version != seenVersion) {
+        seenVersion = version;
+        seenSince = now;
+      }
+      if (Cycles::toSeconds(now - seenSince) <
+          TABLET_PLACEMENT_LEASE_SECONDS) {
+        if (!waiting) {
+          printf("Waiting for another loader to place the tablets of %s\n",
+              name.c_str());
+          waiting = true;
+        }
+        usleep(100000);
+        continue;
+      }
+      printf("Taking over the placement of %s from expired marker: %s\n",
+          name.c_str(), marker.c_str());
+    }
+    if (backend->conditionalWrite(placementTableId, name, placing, version,
+        &version)) {
+      break;
+    }
+  }
+
+  uint64_t lastRenewal = Cycles::rdtsc();
+  auto renew = [&]() {
+    uint64_t now = Cycles::rdtsc();
+    if (Cycles::toSeconds(now - lastRenewal) <
+        TABLET_PLACEMENT_LEASE_SECONDS / 3.0) {
+      return;
+    }
+    if (!backend->conditionalWrite(placementTableId, name, placing, version,
+        &version)) {
+      throw Exception(HERE, "lost the placement marker of " + name, 0);
+    }
+    lastRenewal = now;
+  };
+
+  uint64_t start = Cycles::rdtsc();
+  uint64_t tableId;
+  std::vector<KeyHashSample> samples;
+  uint64_t records = 0;
+  std::vector<uint64_t> splits;
+  try {
+    tableId = backend->createTable(name.c_str(), serverSpan);
+    for (size_t i = 0; i < imageFiles.size(); i++) {
+      records += sampleImageKeyHashes(imageFiles[i], tableId, sampleEvery,
+          &samples, renew);
+    }
+    splits = chooseTabletSplits(&samples, serverSpan);
+    renew();
+    backend->placeTablets(name.c_str(), tableId, splits);
+    if (!backend->conditionalWrite(placementTableId, name,
+        "placed " + std::to_string(tableId), version, &version)) {
+      throw Exception(HERE, "lost the placement marker of " + name, 0);
+    }
+  } catch (...) {
+    // Hand the placement on rather than have the others wait out the
+    // lease. This does nothing if the marker has already been taken over.
+    uint64_t failedVersion;
+    backend->conditionalWrite(placementTableId, name, "failed " + owner,
+        version, &failedVersion);
+    throw;
+  }
+
+  printf("Placed %lu tablets of %s from %lu of %lu records in %.2fs: the "
+      "largest gets %.1f%% of the bytes, rather than %.1f%%\n",
+      splits.size() + 1, name.c_str(), samples.size(), records,
+      Cycles::toSeconds(Cycles::rdtsc() - start),
+      100 * largestTabletShare(samples, splits),
+      100 * largestTabletShare(samples, uniformTabletSplits(serverSpan)));
+  return tableId;
+}
+
+} // namespace RAMCloud
+
+#endif // RAMCLOUDTOOLS_TABLETPLACEMENT_H
@@ -0,0 +1,403 @@
+/* Copyright (c) 2009-2015 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <assert.h>
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <random>
+#include <thread>
+
+#include "ClusterMetrics.h"
+#include "Context.h"
+#include "Cycles.h"
+#include "Dispatch.h"
+#include "ShortMacros.h"
+#include "Crc32C.h"
+#include "ObjectFinder.h"
+#include "OptionParser.h"
+#include "RamCloud.h"
+#include "Tub.h"
+#include "IndexLookup.h"
+#include "TableEnumerator.h"
+#include "IntList.h"
+
+using namespace RAMCloud;
+
+/**
+ * Width of the zero-padded decimal secondary keys. Zero-padding makes the
+ * lexicographic order of the keys (which is what indexes use) match their
+ * numeric order.
+ */
+#define SECONDARY_KEY_WIDTH 10
+
+/**
+ * Secondary keys of index k are a rotation of the primary keys, so that each
+ * index orders the objects differently while the mapping stays trivially
+ * invertible.
+ *
+ * \param primaryKey
+ *      Primary key of the object (0 .. numObjects-1).
+ * \param indexId
+ *      Index for which to compute the secondary key (1 .. numIndexes).
+ * \param numIndexes
+ *      Total number of secondary indexes.
+ * \param numObjects
+ *      Total number of objects.
+ * \return
+ *      Numeric value of the object's secondary key in the index.
+ */
+int
+secondaryKeyValue(int primaryKey, int indexId, int numIndexes, int numObjects)
+{
+    long offset = (long)(indexId - 1) * numObjects / numIndexes;
+    return (int)((primaryKey + offset) % numObjects);
+}
+
+/**
+ * Inverse of secondaryKeyValue.
+ */
+int
+primaryKeyOf(int secondaryValue, int indexId, int numIndexes, int numObjects)
+{
+    long offset = (long)(indexId - 1) * numObjects / numIndexes;
+    return (int)((secondaryValue - offset + numObjects) % numObjects);
+}
+
+/**
+ * A thread which populates a range of multi-key objects with multiwrites.
+ * Each object has an integer primary key and one zero-padded decimal string
+ * key per secondary index.
+ *
+ * \param client
+ *      RAMCloud client object to use for this thread. Each thread gets its own
+ *      client object because the RAMCloud client object is not thread-safe.
+ * \param tableId
+ *      Table to populate.
+ * \param firstKey
+ *      First primary key to write.
+ * \param numKeys
+ *      Number of consecutive primary keys to write.
+ * \param numIndexes
+ *      Number of secondary keys per object.
+ * \param numObjects
+ *      Total number of objects in the table.
+ * \param size
+ *      Size of each object's value in bytes.
+ * \param multiwriteSize
+ *      The size of multiwrites to use.
+ */
+void
+populateThread(RamCloud* client, uint64_t tableId, int firstKey, int numKeys,
+    int numIndexes, int numObjects, int size, int multiwriteSize)
+{
+    std::vector<char> value(size);
+    std::vector<int> primaryKeys(multiwriteSize);
+    std::vector<char> secondaryKeys(
+        multiwriteSize * numIndexes * (SECONDARY_KEY_WIDTH + 1));
+    std::vector<KeyInfo> keyInfo(multiwriteSize * (numIndexes + 1));
+    Tub<MultiWriteObject> objects[multiwriteSize];
+    MultiWriteObject* requests[multiwriteSize];
+
+    for (int i = 0; i < numKeys; i += multiwriteSize) {
+      int n = std::min(multiwriteSize, numKeys - i);
+      for (int j = 0; j < n; j++) {
+        primaryKeys[j] = firstKey + i + j;
+        KeyInfo* keys = &keyInfo[j * (numIndexes + 1)];
+        keys[0].key = &primaryKeys[j];
+        keys[0].keyLength = sizeof(int);
+        for (int k = 1; k <= numIndexes; k++) {
+          char* key = &secondaryKeys[
+              (j * numIndexes + k - 1) * (SECONDARY_KEY_WIDTH + 1)];
+          snprintf(key, SECONDARY_KEY_WIDTH + 1, "%0*d", SECONDARY_KEY_WIDTH,
+              secondaryKeyValue(primaryKeys[j], k, numIndexes, numObjects));
+          keys[k].key = key;
+          keys[k].keyLength = SECONDARY_KEY_WIDTH;
+        }
+        objects[j].construct(tableId, (const void*)value.data(), size,
+            (uint8_t)(numIndexes + 1), keys);
+        requests[j] = objects[j].get();
+      }
+      client->multiWrite(requests, n);
+    }
+}
+
+/**
+ * A benchmark for secondary index performance. Creates a table with one or
+ * more secondary indexes, populates it in parallel with multi-key objects,
+ * and then times point lookups and range scans of varying selectivity through
+ * IndexLookup, as well as multireads of the same objects by primary key.
+ */
+int
+main(int argc, char *argv[])
+try
+{
+    int clientIndex;
+    int numClients;
+    int serverSpan;
+    int numIndexlets;
+    int numIndexes;
+    int numObjects;
+    int objectSize;
+    string selectivities;
+    int count;
+    int numThreads;
+    int multiwriteSize;
+    uint32_t maxNumHashes;
+    bool csv;
+
+    // Set line buffering for stdout so that printf's and log messages
+    // interleave properly.
+    setvbuf(stdout, NULL, _IOLBF, 1024);
+
+    // need external context to set log levels with OptionParser
+    Context context(false);
+
+    OptionsDescription clientOptions("TimeIndexLookups");
+    clientOptions.add_options()
+
+        // These first two options are currently ignored. They're here so that
+        // this script can be run with cluster.py.
+        ("clientIndex",
+         ProgramOptions::value<int>(&clientIndex)->
+            default_value(0),
+         "Index of this client (first client is 0; currently ignored)")
+        ("numClients",
+         ProgramOptions::value<int>(&numClients)->
+            default_value(1),
+         "Total number of clients running (currently ignored)")
+
+        ("serverSpan",
+         ProgramOptions::value<int>(&serverSpan)->
+            default_value(1),
+         "Server span for the table [default: 1].")
+        ("numIndexlets",
+         ProgramOptions::value<int>(&numIndexlets)->
+            default_value(1),
+         "Number of indexlets for each secondary index [default: 1].")
+        ("numIndexes",
+         ProgramOptions::value<int>(&numIndexes)->
+            default_value(1),
+         "Number of secondary indexes on the table [default: 1].")
+        ("numObjects",
+         ProgramOptions::value<int>(&numObjects)->
+            default_value(100000),
+         "Number of objects to populate the table with [default: 100000].")
+        ("objectSize",
+         ProgramOptions::value<int>(&objectSize)->
+            default_value(100),
+         "Size of object values in bytes [default: 100].")
+        ("selectivities",
+         ProgramOptions::value<string>(&selectivities)->
+            default_value("1,10,100,1000"),
+         "Comma-separated list of the number of objects matched by each "
+         "lookup. 1 is a point lookup, anything larger a range scan "
+         "[default: 1,10,100,1000].")
+        ("count",
+         ProgramOptions::value<int>(&count)->
+            default_value(1000),
+         "Number of lookups to time per selectivity [default: 1000].")
+        ("numThreads",
+         ProgramOptions::value<int>(&numThreads)->
+            default_value(1),
+         "Number of threads to use to populate the table [default: 1].")
+        ("multiwriteSize",
+         ProgramOptions::value<int>(&multiwriteSize)->
+            default_value(32),
+         "Size of multiwrites to use to populate the table [default: 32].")
+        ("maxNumHashes",
+         ProgramOptions::value<uint32_t>(&maxNumHashes)->
+            default_value(1000),
+         "Maximum number of key hashes returned per index lookup RPC "
+         "[default: 1000].")
+        ("csv",
+         ProgramOptions::bool_switch(&csv),
+         "Output results as comma-separated values.");
+
+    OptionParser optionParser(clientOptions, argc, argv);
+    context.transportManager->setSessionTimeout(
+            optionParser.options.getSessionTimeout());
+
+    std::vector<int> selectivityList;
+    parseIntList(selectivities, &selectivityList);
+
+    LOG(NOTICE, "Connecting to %s",
+        optionParser.options.getCoordinatorLocator().c_str());
+
+    string locator = optionParser.options.getExternalStorageLocator();
+    if (locator.size() == 0) {
+        locator = optionParser.options.getCoordinatorLocator();
+    }
+    RamCloud client(&context, locator.c_str(),
+            optionParser.options.getClusterName().c_str());
+
+    uint64_t tableId;
+    tableId = client.createTable("test", serverSpan);
+    for (int k = 1; k <= numIndexes; k++) {
+      client.createIndex(tableId, (uint8_t)k, 0, (uint8_t)numIndexlets);
+    }
+
+    uint64_t startTime = Cycles::rdtsc();
+    std::vector<std::thread> threads;
+    std::vector<RamCloud*> clients(numThreads);
+    for (int i = 0; i < numThreads; i++) {
+      int q = numObjects / numThreads;
+      int r = numObjects % numThreads;
+      int firstKey = (i < r) ? (q + 1) * i : ((q + 1) * r) + (q * (i - r));
+      int numKeys = (i < r) ? q + 1 : q;
+      clients[i] = new RamCloud(&optionParser.options);
+      threads.emplace_back(populateThread, clients[i], tableId, firstKey,
+          numKeys, numIndexes, numObjects, objectSize, multiwriteSize);
+    }
+    for (int i = 0; i < numThreads; i++) {
+      threads[i].join();
+      delete clients[i];
+    }
+    double secs = Cycles::toSeconds(Cycles::rdtsc() - startTime);
+    LOG(NOTICE, "Populated %d objects with %d secondary keys each in %0.2fs "
+        "(%0.0f objs/s).", numObjects, numIndexes, secs, numObjects / secs);
+
+    if (csv) {
+      printf("Index,Method,Selectivity,Count,Objects,Min,Max,Avg,50th,90th,"
+          "99th,Lookups/s,Objs/s\n");
+    } else {
+      printf("%6s %10s %12s %8s %10s %10s %10s %10s %10s %10s %10s %12s "
+          "%12s\n",
+          "Index",
+          "Method",
+          "Selectivity",
+          "Count",
+          "Objects",
+          "Min",
+          "Max",
+          "Avg",
+          "50th",
+          "90th",
+          "99th",
+          "Lookups/s",
+          "Objs/s");
+    }
+
+    std::mt19937 rng(0);
+    for (int k = 1; k <= numIndexes; k++) {
+      for (int selectivity : selectivityList) {
+        selectivity = std::min(selectivity, numObjects);
+
+        // Pick the same starting secondary key values for both methods so
+        // that they fetch exactly the same objects.
+        std::uniform_int_distribution<int> dist(0, numObjects - selectivity);
+        std::vector<int> starts(count);
+        for (int i = 0; i < count; i++) {
+          starts[i] = dist(rng);
+        }
+
+        for (int method = 0; method < 2; method++) {
+          bool useIndex = (method == 0);
+          std::vector<uint64_t> latencyVec(count);
+          long objectsFetched = 0;
+
+          std::vector<int> primaryKeys(selectivity);
+          MultiReadObject requestObjects[selectivity];
+          MultiReadObject* requests[selectivity];
+          Tub<ObjectBuffer> values[selectivity];
+
+          for (int i = 0; i < count; i++) {
+            if (useIndex) {
+              char firstKey[SECONDARY_KEY_WIDTH + 1];
+              char lastKey[SECONDARY_KEY_WIDTH + 1];
+              snprintf(firstKey, sizeof(firstKey), "%0*d",
+                  SECONDARY_KEY_WIDTH, starts[i]);
+              snprintf(lastKey, sizeof(lastKey), "%0*d",
+                  SECONDARY_KEY_WIDTH, starts[i] + selectivity - 1);
+
+              uint64_t start = Cycles::rdtsc();
+              IndexLookup rangeLookup(&client, tableId, (uint8_t)k,
+                  firstKey, SECONDARY_KEY_WIDTH, 0, lastKey,
+                  SECONDARY_KEY_WIDTH, maxNumHashes);
+              while (rangeLookup.getNext()) {
+                objectsFetched++;
+              }
+              latencyVec[i] = Cycles::rdtsc() - start;
+            } else {
+              for (int j = 0; j < selectivity; j++) {
+                primaryKeys[j] = primaryKeyOf(starts[i] + j, k, numIndexes,
+                    numObjects);
+                requestObjects[j] = MultiReadObject(tableId,
+                    (char*)&primaryKeys[j], sizeof(int), &values[j]);
+                requests[j] = &requestObjects[j];
+              }
+
+              uint64_t start = Cycles::rdtsc();
+              client.multiRead(requests, selectivity);
+              latencyVec[i] = Cycles::rdtsc() - start;
+
+              for (int j = 0; j < selectivity; j++) {
+                if (requestObjects[j].status == STATUS_OK) {
+                  objectsFetched++;
+                }
+              }
+            }
+          }
+
+          if (objectsFetched != (long)count * selectivity) {
+            LOG(WARNING, "Index %d %s fetched %ld objects, expected %ld.", k,
+                useIndex ? "lookup" : "multiread", objectsFetched,
+                (long)count * selectivity);
+          }
+
+          std::sort(latencyVec.begin(), latencyVec.end());
+
+          uint64_t sum = 0;
+          for (int i = 0; i < count; i++) {
+            sum += latencyVec[i];
+          }
+          double totalSecs = Cycles::toSeconds(sum);
+
+          const char* rowFmt = csv ?
+              "%d,%s,%d,%d,%ld,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.0f,%.0f\n" :
+              "%6d %10s %12d %8d %10ld %10.3f %10.3f %10.3f %10.3f %10.3f "
+              "%10.3f %12.0f %12.0f\n";
+          printf(rowFmt,
+              k,
+              useIndex ? "index" : "multiread",
+              selectivity,
+              count,
+              objectsFetched,
+              Cycles::toNanoseconds(latencyVec[0])/1000.0,
+              Cycles::toNanoseconds(latencyVec[count-1])/1000.0,
+              Cycles::toNanoseconds(sum)/((float)count)/1000.0,
+              Cycles::toNanoseconds(latencyVec[count*50/100])/1000.0,
+              Cycles::toNanoseconds(latencyVec[count*90/100])/1000.0,
+              Cycles::toNanoseconds(latencyVec[count*99/100])/1000.0,
+              count / totalSecs,
+              objectsFetched / totalSecs);
+        }
+      }
+    }
+
+    client.dropTable("test");
+
+    return 0;
+} catch (RAMCloud::ClientException& e) {
+    fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
+    return 1;
+} catch (RAMCloud::Exception& e) {
+    fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
+    return 1;
+}
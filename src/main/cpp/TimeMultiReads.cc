@@ -21,6 +21,7 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <sstream>
 
 #include "ClusterMetrics.h"
 #include "Context.h"
@@ -35,9 +36,51 @@
 #include "IndexLookup.h"
 #include "TableEnumerator.h"
 #include "Transaction.h"
+#include "IntList.h"
 
 using namespace RAMCloud;
 
+/**
+ * Pick a set of integer keys whose placement across the tablets of a table
+ * is known ahead of time. Tablets are assumed to divide the key hash space
+ * evenly, which is the case for tables created with createTable(name, span).
+ *
+ * \param tableId
+ *      Table the keys will be written to (part of the key hash).
+ * \param serverSpan
+ *      Number of tablets in the table.
+ * \param spread
+ *      If true, key i lands on tablet (i % serverSpan). Otherwise all keys
+ *      land on tablet 0, i.e. on a single master.
+ * \param numKeys
+ *      Number of keys to pick.
+ * \param[out] keys
+ *      Filled in with the chosen keys.
+ */
+void
+placeKeys(uint64_t tableId, int serverSpan, bool spread, int numKeys,
+    std::vector<int>* keys)
+{
+    // For a span of 1 the range is the whole hash space, which doesn't fit
+    // in 64 bits.
+    uint64_t tabletRange = serverSpan > 1 ? 1 + ~0UL / serverSpan : 0;
+    std::vector<std::vector<int>> candidates(serverSpan);
+    keys->clear();
+    int next = 0;
+    for (int i = 0; i < numKeys; i++) {
+      int tablet = spread ? (i % serverSpan) : 0;
+      while (candidates[tablet].empty()) {
+        uint64_t keyHash = Key::getHash(tableId, (const void*)&next,
+            sizeof(int));
+        uint64_t owner = serverSpan > 1 ? keyHash / tabletRange : 0;
+        candidates[std::min(owner, (uint64_t)serverSpan - 1)].push_back(next);
+        next++;
+      }
+      keys->push_back(candidates[tablet].back());
+      candidates[tablet].pop_back();
+    }
+}
+
 int
 main(int argc, char *argv[])
 try
@@ -48,6 +91,11 @@ try
     int objectSize;
     int multiReadSize;
     int count;
+    string serverSpans;
+    string objectSizes;
+    string multiReadSizes;
+    string placements;
+    bool csv;
 
     // Set line buffering for stdout so that printf's and log messages
     // interleave properly.
@@ -71,19 +119,69 @@ try
          "Total number of clients running (currently ignored)")
     
         ("objectSize",
-         ProgramOptions::value<int>(&objectSize),
+         ProgramOptions::value<int>(&objectSize)->
+            default_value(100),
          "Size of objects in bytes.")
         ("multiReadSize",
-         ProgramOptions::value<int>(&multiReadSize),
+         ProgramOptions::value<int>(&multiReadSize)->
+            default_value(1),
          "Number of objects packed into a multiread.")
         ("count",
          ProgramOptions::value<int>(&count),
-         "Number of times to execute the multiread.");
+         "Number of times to execute the multiread.")
+        ("serverSpans",
+         ProgramOptions::value<string>(&serverSpans)->
+            default_value("1"),
+         "Comma-separated list of server spans to sweep over [default: 1].")
+        ("objectSizes",
+         ProgramOptions::value<string>(&objectSizes)->
+            default_value(""),
+         "Comma-separated list of object sizes to sweep over. Overrides "
+         "objectSize.")
+        ("multiReadSizes",
+         ProgramOptions::value<string>(&multiReadSizes)->
+            default_value(""),
+         "Comma-separated list of multiread sizes to sweep over. Overrides "
+         "multiReadSize.")
+        ("placements",
+         ProgramOptions::value<string>(&placements)->
+            default_value("spread"),
+         "Comma-separated list of placements of the objects in a multiread "
+         "to sweep over. Values can be: spread (round-robin across all "
+         "tablets of the table), single (all on the table's first tablet, "
+         "i.e. one master) [default: spread].")
+        ("csv",
+         ProgramOptions::bool_switch(&csv),
+         "Output results as comma-separated values.");
 
     OptionParser optionParser(clientOptions, argc, argv);
     context.transportManager->setSessionTimeout(
             optionParser.options.getSessionTimeout());
 
+    std::vector<int> spanList;
+    std::vector<int> sizeList;
+    std::vector<int> batchList;
+    parseIntList(serverSpans, &spanList);
+    parseIntList(objectSizes, &sizeList);
+    parseIntList(multiReadSizes, &batchList);
+    std::vector<string> placementList;
+    std::stringstream ss(placements);
+    string placement;
+    while (std::getline(ss, placement, ',')) {
+      if (placement != "spread" && placement != "single") {
+        fprintf(stderr, "Unknown placement: %s\n", placement.c_str());
+        return 1;
+      }
+      placementList.push_back(placement);
+    }
+    if (sizeList.empty()) {
+      sizeList.push_back(objectSize);
+    }
+    if (batchList.empty()) {
+      batchList.push_back(multiReadSize);
+    }
+    int maxBatch = *std::max_element(batchList.begin(), batchList.end());
+
     LOG(NOTICE, "Connecting to %s",
         optionParser.options.getCoordinatorLocator().c_str());
 
@@ -94,72 +192,111 @@ try
     RamCloud client(&context, locator.c_str(),
             optionParser.options.getClusterName().c_str());
 
-    uint64_t tableId;
-    tableId = client.createTable("test");
-
-    for (int i = 0; i < multiReadSize; i++) {
-      char randomValue[objectSize];
-      client.write(tableId, (char*)&i, sizeof(int), randomValue, objectSize);
+    if (csv) {
+      printf("Span,Placement,Size(B),Objects,Count,Min,Max,Avg,50th,90th,"
+          "95th,99th,Objs/s,MB/s\n");
+    } else {
+      printf("%8s %10s %12s %12s %12s %12s %12s %12s %12s %12s %12s %12s "
+          "%12s %12s\n",
+          "Span",
+          "Placement",
+          "Size(B)",
+          "Objects",
+          "Count",
+          "Min",
+          "Max",
+          "Avg",
+          "50th",
+          "90th",
+          "95th",
+          "99th",
+          "Objs/s",
+          "MB/s");
     }
 
-    printf("%12s %12s %12s %12s %12s %12s %12s %12s %12s %12s\n", 
-        "Size(B)",
-        "Objects",
-        "Count",
-        "Min",
-        "Max",
-        "Avg",
-        "50th",
-        "90th",
-        "95th",
-        "99th");
-
-    MultiReadObject requestObjects[multiReadSize];
-    MultiReadObject* requests[multiReadSize];
-    Tub<ObjectBuffer> values[multiReadSize];
-    int keys[multiReadSize];
-
-    for (int i = 0; i < multiReadSize; i++) {
-      keys[i] = i;
-      requestObjects[i] = MultiReadObject(tableId, (char*)&keys[i], 
-          sizeof(int), &values[i]);
-      requests[i] = &requestObjects[i];
-    }
+    for (int serverSpan : spanList) {
+      for (const string& placement : placementList) {
+        for (int size : sizeList) {
+          uint64_t tableId;
+          tableId = client.createTable("test", serverSpan);
 
-    uint64_t startTime, endTime;
-    uint64_t latency[count];
-    for (int i = 0; i < count; i++) {
-      startTime = Cycles::rdtsc();
-      try {
-        client.multiRead(requests, multiReadSize);
-      } catch (RAMCloud::ClientException& e) {
-      } catch (RAMCloud::Exception& e) {
-      } 
-      endTime = Cycles::rdtsc();
-      latency[i] = endTime - startTime;
-    }
-    std::vector<uint64_t> latencyVec (latency, latency+count);
+          // Keys for every batch size in the sweep are a prefix of this list,
+          // so one upload serves the whole row of the grid.
+          std::vector<int> keys;
+          placeKeys(tableId, serverSpan, placement == "spread", maxBatch,
+              &keys);
 
-    std::sort(latencyVec.begin(), latencyVec.end());
+          std::vector<char> randomValue(size);
+          Tub<MultiWriteObject> writeObjects[maxBatch];
+          MultiWriteObject* writeRequests[maxBatch];
+          for (int i = 0; i < maxBatch; i++) {
+            writeObjects[i].construct(tableId, (char*)&keys[i], sizeof(int),
+                (const void*)randomValue.data(), size);
+            writeRequests[i] = writeObjects[i].get();
+          }
+          client.multiWrite(writeRequests, maxBatch);
 
-    uint64_t sum = 0;
-    for (int i = 0; i < count; i++) {
-      sum += latencyVec[i];
-    }
+          for (int batch : batchList) {
+            MultiReadObject requestObjects[batch];
+            MultiReadObject* requests[batch];
+            Tub<ObjectBuffer> values[batch];
+
+            for (int i = 0; i < batch; i++) {
+              requestObjects[i] = MultiReadObject(tableId, (char*)&keys[i], 
+                  sizeof(int), &values[i]);
+              requests[i] = &requestObjects[i];
+            }
+
+            uint64_t startTime, endTime;
+            std::vector<uint64_t> latencyVec(count);
+            for (int i = 0; i < count; i++) {
+              startTime = Cycles::rdtsc();
+              try {
+                client.multiRead(requests, batch);
+              } catch (RAMCloud::ClientException& e) {
+              } catch (RAMCloud::Exception& e) {
+              } 
+              endTime = Cycles::rdtsc();
+              latencyVec[i] = endTime - startTime;
+            }
 
-    printf("%12d %12d %12d %12.3f %12.3f %12.3f %12.3f %12.3f %12.3f %12.3f\n", 
-        objectSize, 
-        multiReadSize,
-        count,
-        Cycles::toNanoseconds(latencyVec[0])/1000.0,
-        Cycles::toNanoseconds(latencyVec[count-1])/1000.0,
-        Cycles::toNanoseconds(sum)/((float)count)/1000.0,
-        Cycles::toNanoseconds(latencyVec[count*50/100])/1000.0,
-        Cycles::toNanoseconds(latencyVec[count*90/100])/1000.0,
-        Cycles::toNanoseconds(latencyVec[count*95/100])/1000.0,
-        Cycles::toNanoseconds(latencyVec[count*99/100])/1000.0);
-
-    client.dropTable("test");
+            std::sort(latencyVec.begin(), latencyVec.end());
+
+            uint64_t sum = 0;
+            for (int i = 0; i < count; i++) {
+              sum += latencyVec[i];
+            }
+
+            double totalSecs = Cycles::toSeconds(sum);
+            double objRate = (double)batch * count / totalSecs;
+            double mbRate = objRate * (size + sizeof(int)) / 1000000.0;
+
+            const char* rowFmt = csv ? 
+                "%d,%s,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,"
+                "%.0f,%.3f\n" :
+                "%8d %10s %12d %12d %12d %12.3f %12.3f %12.3f %12.3f %12.3f "
+                "%12.3f %12.3f %12.0f %12.3f\n";
+            printf(rowFmt,
+                serverSpan,
+                placement.c_str(),
+                size, 
+                batch,
+                count,
+                Cycles::toNanoseconds(latencyVec[0])/1000.0,
+                Cycles::toNanoseconds(latencyVec[count-1])/1000.0,
+                Cycles::toNanoseconds(sum)/((float)count)/1000.0,
+                Cycles::toNanoseconds(latencyVec[count*50/100])/1000.0,
+                Cycles::toNanoseconds(latencyVec[count*90/100])/1000.0,
+                Cycles::toNanoseconds(latencyVec[count*95/100])/1000.0,
+                Cycles::toNanoseconds(latencyVec[count*99/100])/1000.0,
+                objRate,
+                mbRate);
+          }
+
+          client.dropTable("test");
+        }
+      }
+    }
 
     return 0;
 } catch (RAMCloud::ClientException& e) {
@@ -0,0 +1,332 @@
+/* Copyright (c) 2009-2015 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <assert.h>
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+
+#include "ClusterMetrics.h"
+#include "Context.h"
+#include "Cycles.h"
+#include "Dispatch.h"
+#include "ShortMacros.h"
+#include "Crc32C.h"
+#include "ObjectFinder.h"
+#include "OptionParser.h"
+#include "RamCloud.h"
+#include "Tub.h"
+#include "IndexLookup.h"
+#include "TableEnumerator.h"
+#include "Transaction.h"
+#include "IntList.h"
+
+using namespace RAMCloud;
+
+/**
+ * A thread which repeatedly issues multiwrites of a fixed size to a table and
+ * records the latency of each one.
+ *
+ * \param client
+ *      RAMCloud client object to use for this thread. Each thread gets its own
+ *      client object because the RAMCloud client object is not thread-safe.
+ * \param tableId
+ *      Table to write to.
+ * \param threadIndex
+ *      Index of this thread, used to keep keys disjoint between threads.
+ * \param multiWriteSize
+ *      Number of objects packed into each multiwrite.
+ * \param valueSize
+ *      Size of each object's value in bytes.
+ * \param count
+ *      Number of multiwrites to issue.
+ * \param fresh
+ *      If true, every multiwrite writes keys that have never been written
+ *      before. Otherwise the same set of (pre-existing) keys is overwritten
+ *      each time.
+ * \param[out] latency
+ *      Filled in with the latency of each multiwrite in cycles.
+ * \param[out] elapsed
+ *      Filled in with the total time spent by this thread in cycles.
+ */
+void
+writerThread(RamCloud* client, uint64_t tableId, int threadIndex,
+    int multiWriteSize, int valueSize, int count, bool fresh,
+    std::vector<uint64_t>* latency, uint64_t* elapsed)
+{
+    std::vector<char> value(valueSize);
+    std::vector<uint64_t> keys(multiWriteSize);
+    Tub<MultiWriteObject> objects[multiWriteSize];
+    MultiWriteObject* requests[multiWriteSize];
+
+    // The top 16 bits of a key identify the writing thread, the rest is a
+    // per-thread sequence number.
+    uint64_t nextKey = ((uint64_t)threadIndex) << 48;
+
+    for (int i = 0; i < multiWriteSize; i++) {
+      keys[i] = nextKey++;
+    }
+
+    if (!fresh) {
+      // Pre-populate the keys so that the timed writes are all overwrites.
+      for (int i = 0; i < multiWriteSize; i++) {
+        objects[i].construct(tableId, (const void*)&keys[i], sizeof(uint64_t),
+            (const void*)value.data(), valueSize);
+        requests[i] = objects[i].get();
+      }
+      client->multiWrite(requests, multiWriteSize);
+    }
+
+    latency->resize(count);
+    uint64_t threadStart = Cycles::rdtsc();
+    for (int c = 0; c < count; c++) {
+      if (fresh && c > 0) {
+        for (int i = 0; i < multiWriteSize; i++) {
+          keys[i] = nextKey++;
+        }
+      }
+
+      for (int i = 0; i < multiWriteSize; i++) {
+        objects[i].construct(tableId, (const void*)&keys[i], sizeof(uint64_t),
+            (const void*)value.data(), valueSize);
+        requests[i] = objects[i].get();
+      }
+
+      uint64_t startTime = Cycles::rdtsc();
+      try {
+        client->multiWrite(requests, multiWriteSize);
+      } catch (RAMCloud::ClientException& e) {
+      } catch (RAMCloud::Exception& e) {
+      } 
+      uint64_t endTime = Cycles::rdtsc();
+      latency->at(c) = endTime - startTime;
+    }
+    *elapsed = Cycles::rdtsc() - threadStart;
+}
+
+/**
+ * A benchmark for multiwrite throughput and latency. Sweeps over a grid of
+ * server spans, multiwrite sizes, value sizes and thread counts, and reports
+ * one row of results per grid cell.
+ */
+int
+main(int argc, char *argv[])
+try
+{
+    int clientIndex;
+    int numClients;
+    int count;
+    string serverSpans;
+    string valueSizes;
+    string multiWriteSizes;
+    string threadCounts;
+    string mode;
+    bool csv;
+
+    // Set line buffering for stdout so that printf's and log messages
+    // interleave properly.
+    setvbuf(stdout, NULL, _IOLBF, 1024);
+
+    // need external context to set log levels with OptionParser
+    Context context(false);
+
+    OptionsDescription clientOptions("TimeMultiWrites");
+    clientOptions.add_options()
+
+        // These first two options are currently ignored. They're here so that
+        // this script can be run with cluster.py.
+        ("clientIndex",
+         ProgramOptions::value<int>(&clientIndex)->
+            default_value(0),
+         "Index of this client (first client is 0; currently ignored)")
+        ("numClients",
+         ProgramOptions::value<int>(&numClients)->
+            default_value(1),
+         "Total number of clients running (currently ignored)")
+    
+        ("serverSpans",
+         ProgramOptions::value<string>(&serverSpans)->
+            default_value("1"),
+         "Comma-separated list of server spans to sweep over [default: 1].")
+        ("valueSizes",
+         ProgramOptions::value<string>(&valueSizes)->
+            default_value("100"),
+         "Comma-separated list of value sizes in bytes to sweep over "
+         "[default: 100].")
+        ("multiWriteSizes",
+         ProgramOptions::value<string>(&multiWriteSizes)->
+            default_value("32"),
+         "Comma-separated list of multiwrite sizes to sweep over "
+         "[default: 32].")
+        ("threadCounts",
+         ProgramOptions::value<string>(&threadCounts)->
+            default_value("1"),
+         "Comma-separated list of writer thread counts to sweep over. Each "
+         "thread uses its own RAMCloud client [default: 1].")
+        ("mode",
+         ProgramOptions::value<string>(&mode)->
+            default_value("fresh"),
+         "Value can be one of: fresh (every multiwrite creates new objects), "
+         "overwrite (every multiwrite overwrites the same objects) "
+         "[default: fresh].")
+        ("count",
+         ProgramOptions::value<int>(&count)->
+            default_value(1000),
+         "Number of multiwrites each thread executes per grid cell "
+         "[default: 1000].")
+        ("csv",
+         ProgramOptions::bool_switch(&csv),
+         "Output results as comma-separated values.");
+
+    OptionParser optionParser(clientOptions, argc, argv);
+    context.transportManager->setSessionTimeout(
+            optionParser.options.getSessionTimeout());
+
+    if (mode != "fresh" && mode != "overwrite") {
+      fprintf(stderr, "Unknown mode: %s\n", mode.c_str());
+      return 1;
+    }
+
+    std::vector<int> spanList;
+    std::vector<int> sizeList;
+    std::vector<int> batchList;
+    std::vector<int> threadList;
+    parseIntList(serverSpans, &spanList);
+    parseIntList(valueSizes, &sizeList);
+    parseIntList(multiWriteSizes, &batchList);
+    parseIntList(threadCounts, &threadList);
+    int maxThreads = *std::max_element(threadList.begin(), threadList.end());
+
+    LOG(NOTICE, "Connecting to %s",
+        optionParser.options.getCoordinatorLocator().c_str());
+
+    string locator = optionParser.options.getExternalStorageLocator();
+    if (locator.size() == 0) {
+        locator = optionParser.options.getCoordinatorLocator();
+    }
+    RamCloud client(&context, locator.c_str(),
+            optionParser.options.getClusterName().c_str());
+
+    RamCloud *clients[maxThreads];
+    for (int i = 0; i < maxThreads; i++) {
+      clients[i] = new RamCloud(&optionParser.options);
+    }
+
+    if (csv) {
+      printf("Span,Mode,Threads,Size(B),Objects,Count,Min,Max,Avg,50th,90th,"
+          "95th,99th,Objs/s,MB/s\n");
+    } else {
+      printf("%8s %10s %8s %12s %12s %12s %12s %12s %12s %12s %12s %12s "
+          "%12s %12s %12s\n",
+          "Span",
+          "Mode",
+          "Threads",
+          "Size(B)",
+          "Objects",
+          "Count",
+          "Min",
+          "Max",
+          "Avg",
+          "50th",
+          "90th",
+          "95th",
+          "99th",
+          "Objs/s",
+          "MB/s");
+    }
+
+    for (int serverSpan : spanList) {
+      for (int numThreads : threadList) {
+        for (int size : sizeList) {
+          for (int batch : batchList) {
+            uint64_t tableId;
+            tableId = client.createTable("test", serverSpan);
+
+            std::vector<std::thread> threads;
+            std::vector<std::vector<uint64_t>> latencies(numThreads);
+            std::vector<uint64_t> elapsed(numThreads);
+            for (int i = 0; i < numThreads; i++) {
+              threads.emplace_back(writerThread, clients[i], tableId, i,
+                  batch, size, count, mode == "fresh", &latencies[i],
+                  &elapsed[i]);
+            }
+
+            uint64_t maxElapsed = 0;
+            std::vector<uint64_t> latencyVec;
+            for (int i = 0; i < numThreads; i++) {
+              threads[i].join();
+              latencyVec.insert(latencyVec.end(), latencies[i].begin(),
+                  latencies[i].end());
+              maxElapsed = std::max(maxElapsed, elapsed[i]);
+            }
+
+            client.dropTable("test");
+
+            std::sort(latencyVec.begin(), latencyVec.end());
+
+            uint64_t sum = 0;
+            size_t n = latencyVec.size();
+            for (size_t i = 0; i < n; i++) {
+              sum += latencyVec[i];
+            }
+
+            // Throughput is measured over wall-clock time, i.e. up until the
+            // slowest thread finished.
+            double objRate = (double)n * batch / Cycles::toSeconds(maxElapsed);
+            double mbRate = objRate * (size + sizeof(uint64_t)) / 1000000.0;
+
+            const char* rowFmt = csv ? 
+                "%d,%s,%d,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,"
+                "%.0f,%.3f\n" :
+                "%8d %10s %8d %12d %12d %12d %12.3f %12.3f %12.3f %12.3f "
+                "%12.3f %12.3f %12.3f %12.0f %12.3f\n";
+            printf(rowFmt,
+                serverSpan,
+                mode.c_str(),
+                numThreads,
+                size, 
+                batch,
+                count,
+                Cycles::toNanoseconds(latencyVec[0])/1000.0,
+                Cycles::toNanoseconds(latencyVec[n-1])/1000.0,
+                Cycles::toNanoseconds(sum)/((float)n)/1000.0,
+                Cycles::toNanoseconds(latencyVec[n*50/100])/1000.0,
+                Cycles::toNanoseconds(latencyVec[n*90/100])/1000.0,
+                Cycles::toNanoseconds(latencyVec[n*95/100])/1000.0,
+                Cycles::toNanoseconds(latencyVec[n*99/100])/1000.0,
+                objRate,
+                mbRate);
+          }
+        }
+      }
+    }
+
+    for (int i = 0; i < maxThreads; i++) {
+      delete clients[i];
+    }
+
+    return 0;
+} catch (RAMCloud::ClientException& e) {
+    fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
+    return 1;
+} catch (RAMCloud::Exception& e) {
+    fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
+    return 1;
+}
@@ -20,6 +20,8 @@
 
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <sstream>
 
 #include "ClusterMetrics.h"
 #include "Context.h"
@@ -34,9 +36,266 @@
 #include "IndexLookup.h"
 #include "Transaction.h"
 #include "TimeTrace.h"
+#include "Key.h"
+#include "PerfStats.h"
+#include "WireFormat.h"
 
 using namespace RAMCloud;
 
+/**
+ * One event from a TimeTrace.
+ */
+struct TraceEvent {
+  /*
+   * Time of the event on the client's clock, in nanoseconds.
+   */
+  double ns;
+
+  /*
+   * Machine that recorded the event: 0 for the client, otherwise 1 + the
+   * index number of the server's ServerId.
+   */
+  uint32_t machine;
+
+  /*
+   * The event's message.
+   */
+  string message;
+};
+
+/**
+ * Parse the output of TimeTrace::getTrace.
+ *
+ * \param text
+ *      Trace to parse. Must start with the CYCLES_PER_SECOND and
+ *      START_CYCLES lines that TimeTrace prints ahead of the events.
+ * \param machine
+ *      Machine the trace came from (see TraceEvent).
+ * \param offsetNs
+ *      Amount to subtract from the trace's clock to get the client's clock,
+ *      in nanoseconds.
+ * \param[out] events
+ *      The trace's events are appended here.
+ * \return
+ *      False if the trace has no START_CYCLES line, in which case its
+ *      events can't be placed on the client's clock.
+ */
+bool
+parseTrace(const string& text, uint32_t machine, double offsetNs,
+    std::vector<TraceEvent>* events)
+{
+  std::istringstream in(text);
+  string line;
+  double cyclesPerSecond = 0;
+  uint64_t startCycles = 0;
+  bool haveStart = false;
+  while (std::getline(in, line)) {
+    double ns;
+    int consumed = 0;
+    if (sscanf(line.c_str(), "CYCLES_PER_SECOND %lf", &cyclesPerSecond) == 1) {
+      continue;
+    }
+    if (sscanf(line.c_str(), "START_CYCLES %lu", &startCycles) == 1) {
+      haveStart = true;
+      continue;
+    }
+    if (!haveStart || cyclesPerSecond == 0) {
+      continue;
+    }
+    if (sscanf(line.c_str(), " %lf ns (+ %*f ns): %n", &ns, &consumed) < 1 ||
+        consumed == 0) {
+      continue;
+    }
+
+    TraceEvent event;
+    event.ns = (double)startCycles * 1e09 / cyclesPerSecond + ns - offsetNs;
+    event.machine = machine;
+    event.message = line.substr(consumed);
+    events->push_back(event);
+  }
+  return haveStart;
+}
+
+/**
+ * Split the response to serverControlAll(GET_TIME_TRACE) into one trace per
+ * server.
+ *
+ * \param rawData
+ *      Response buffer from serverControlAll.
+ * \param[out] traces
+ *      Filled in with each server's trace, keyed by the index number of the
+ *      server's ServerId.
+ */
+void
+parseTraces(Buffer* rawData, std::map<uint32_t, string>* traces)
+{
+  traces->clear();
+  uint32_t offset = sizeof(WireFormat::ServerControlAll::Response);
+  while (offset < rawData->size()) {
+    WireFormat::ServerControl::Response* header =
+        rawData->getOffset<WireFormat::ServerControl::Response>(offset);
+    offset += sizeof32(*header);
+    if ((header == NULL) ||
+        ((offset + header->outputLength) > rawData->size())) {
+      break;
+    }
+    uint32_t i = ServerId(header->serverId).indexNumber();
+    string& trace = (*traces)[i];
+    trace.resize(header->outputLength);
+    rawData->copy(offset, header->outputLength, &trace[0]);
+    offset += header->outputLength;
+  }
+}
+
+/**
+ * Estimate how far a server's clock is ahead of the client's. The server's
+ * PerfStats collection time is read repeatedly, and each reading is assumed
+ * to have been taken halfway through the RPC that fetched it; the reading
+ * with the shortest round trip bounds the error most tightly.
+ *
+ * \param client
+ *      Client connected to the cluster.
+ * \param tableId
+ *      Table with an object on the server.
+ * \param key
+ *      Key of an object on the server.
+ * \param keyLength
+ *      Length of key in bytes.
+ * \param probes
+ *      Number of readings to take.
+ * \param[out] offsetNs
+ *      Server clock minus client clock, in nanoseconds.
+ * \param[out] rttNs
+ *      Round trip time of the reading used, in nanoseconds. The offset is
+ *      accurate to within half of this.
+ */
+void
+estimateOffset(RamCloud* client, uint64_t tableId, const void* key,
+    uint16_t keyLength, int probes, double* offsetNs, double* rttNs)
+{
+  double clientCyclesPerNs = Cycles::perSecond() / 1e09;
+  *rttNs = -1;
+  for (int i = 0; i < probes; i++) {
+    Buffer output;
+    uint64_t start = Cycles::rdtsc();
+    ServerControlRpc rpc(client, tableId, key, keyLength,
+        WireFormat::ControlOp::GET_PERF_STATS, NULL, 0, &output);
+    rpc.wait();
+    uint64_t end = Cycles::rdtsc();
+
+    PerfStats stats;
+    if (output.size() < sizeof(stats)) {
+      continue;
+    }
+    output.copy(0, sizeof(stats), &stats);
+
+    double rtt = (double)(end - start) / clientCyclesPerNs;
+    if (*rttNs < 0 || rtt < *rttNs) {
+      double serverNs = (double)stats.collectionTime * 1e09 /
+          stats.cyclesPerSecond;
+      double clientNs = ((double)start + (double)(end - start) / 2) /
+          clientCyclesPerNs;
+      *rttNs = rtt;
+      *offsetNs = serverNs - clientNs;
+    }
+  }
+}
+
+/**
+ * Escape a string for use in JSON output.
+ */
+string
+jsonEscape(const string& s)
+{
+  string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char)c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+/**
+ * Write the events that fall within a set of operations to a Chrome trace
+ * (load it in chrome://tracing or Perfetto). Each operation is a process
+ * with a thread per machine; each event is drawn as a span from the
+ * previous event recorded by the same machine during the operation.
+ *
+ * \param out
+ *      Stream to write the trace to.
+ * \param events
+ *      All events, on the client's clock, sorted by time.
+ * \param ops
+ *      Indexes of the operations to write.
+ * \param opStartNs
+ *      Client time at which each operation started, in nanoseconds.
+ * \param opEndNs
+ *      Client time at which each operation ended, in nanoseconds.
+ */
+void
+writeChromeTrace(std::ostream& out, std::vector<TraceEvent>& events,
+    std::vector<int>& ops, std::vector<double>& opStartNs,
+    std::vector<double>& opEndNs)
+{
+  char line[512];
+  bool first = true;
+  out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+
+  for (size_t rank = 0; rank < ops.size(); rank++) {
+    int op = ops[rank];
+    double start = opStartNs[op];
+    double end = opEndNs[op];
+
+    snprintf(line, sizeof(line),
+        "%s{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %lu, "
+        "\"args\": {\"name\": \"op %d (%.1f us)\"}},\n"
+        "{\"name\": \"op %d\", \"ph\": \"X\", \"pid\": %lu, \"tid\": 0, "
+        "\"ts\": 0, \"dur\": %.3f}",
+        first ? "" : ",\n", rank, op, (end - start) / 1e03, op, rank,
+        (end - start) / 1e03);
+    out << line;
+    first = false;
+
+    std::map<uint32_t, double> prevNs;
+    std::vector<TraceEvent>::iterator it = std::lower_bound(
+        events.begin(), events.end(), start,
+        [](const TraceEvent& e, double ns) { return e.ns < ns; });
+    for (; it != events.end() && it->ns <= end; it++) {
+      string message = jsonEscape(it->message);
+      if (prevNs.find(it->machine) == prevNs.end()) {
+        string machineName = it->machine == 0 ? "client" :
+            "server " + std::to_string(it->machine - 1);
+        snprintf(line, sizeof(line),
+            ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %lu, "
+            "\"tid\": %u, \"args\": {\"name\": \"%s\"}}", rank, it->machine,
+            machineName.c_str());
+        out << line;
+        snprintf(line, sizeof(line),
+            "\"ph\": \"i\", \"s\": \"t\", \"pid\": %lu, \"tid\": %u, "
+            "\"ts\": %.3f", rank, it->machine, (it->ns - start) / 1e03);
+      } else {
+        double prev = prevNs[it->machine];
+        snprintf(line, sizeof(line),
+            "\"ph\": \"X\", \"pid\": %lu, \"tid\": %u, \"ts\": %.3f, "
+            "\"dur\": %.3f", rank, it->machine, (prev - start) / 1e03,
+            (it->ns - prev) / 1e03);
+      }
+      out << ",\n{\"name\": \"" << message << "\", " << line << "}";
+      prevNs[it->machine] = it->ns;
+    }
+  }
+
+  out << "\n]}\n";
+}
+
 int
 main(int argc, char *argv[])
 try
@@ -48,6 +307,9 @@ try
     int objectSize;
     int asyncReadSize;
     int count;
+    string traceFile;
+    int traceOps;
+    int probes;
 
     // Set line buffering for stdout so that printf's and log messages
     // interleave properly.
@@ -81,7 +343,24 @@ try
          "Number of objects to asynchronously read.")
         ("count",
          ProgramOptions::value<int>(&count),
-         "Number of times to execute the set of asynchronous reads.");
+         "Number of times to execute the set of asynchronous reads.")
+        ("traceFile",
+         ProgramOptions::value<string>(&traceFile)->
+            default_value(""),
+         "If given, collect the TimeTraces of every server as well as the "
+         "client, align them to the client's clock, and write a merged "
+         "timeline of the slowest operations to this file as a Chrome trace "
+         "(JSON).")
+        ("traceOps",
+         ProgramOptions::value<int>(&traceOps)->
+            default_value(1),
+         "Number of operations to include in the trace file, slowest first "
+         "[default: 1].")
+        ("probes",
+         ProgramOptions::value<int>(&probes)->
+            default_value(50),
+         "Number of round trips used to estimate each server's clock offset "
+         "[default: 50].");
     
     OptionParser optionParser(clientOptions, argc, argv);
     context.transportManager->setSessionTimeout(
@@ -125,12 +404,14 @@ try
     // Time asynchronous reads
     uint64_t startTime, endTime;
     uint64_t latency[count];
+    uint64_t opStart[count];
     for (int i = 0; i < count; i++) {
       Transaction tx(&client);
       Tub<Transaction::ReadOp> requests[asyncReadSize];
       Buffer values[asyncReadSize];
 
       startTime = Cycles::rdtsc();
+      TimeTrace::record(startTime, "op %u start", i);
 
       for (int i = 0; i < asyncReadSize; i++) {
         requests[i].construct(&tx, tableId, (char*)&keys[i], sizeof(int), 
@@ -142,7 +423,9 @@ try
       }
 
       endTime = Cycles::rdtsc();
+      TimeTrace::record(endTime, "op %u end", i);
       latency[i] = endTime - startTime;
+      opStart[i] = startTime;
 
       tx.commit();
     }
@@ -167,6 +450,78 @@ try
         Cycles::toNanoseconds(latencyVec[count*95/100])/1000.0,
         Cycles::toNanoseconds(latencyVec[count*99/100])/1000.0);
 
+    if (traceFile.size() > 0) {
+      // Estimate the clock offset of each server holding one of the
+      // objects, before the table (and the tablet map) goes away.
+      std::map<uint32_t, double> offsets;
+      for (int i = 0; i < asyncReadSize; i++) {
+        uint64_t hash = Key::getHash(tableId, (char*)&keys[i], sizeof(int));
+        ServerId serverId = client.clientContext->objectFinder->
+            lookupTablet(tableId, hash)->tablet.serverId;
+        if (offsets.find(serverId.indexNumber()) != offsets.end()) {
+          continue;
+        }
+
+        double offsetNs, rttNs;
+        estimateOffset(&client, tableId, (char*)&keys[i], sizeof(int),
+            probes, &offsetNs, &rttNs);
+        if (rttNs < 0) {
+          LOG(WARNING, "Couldn't estimate clock offset of server %s",
+              serverId.toString().c_str());
+          continue;
+        }
+        offsets[serverId.indexNumber()] = offsetNs;
+        LOG(NOTICE, "Server %s clock offset %.1f ns (+/- %.1f ns)",
+            serverId.toString().c_str(), offsetNs, rttNs / 2);
+      }
+
+      std::vector<TraceEvent> events;
+      if (!parseTrace(TimeTrace::getTrace(), 0, 0, &events)) {
+        LOG(WARNING, "Client TimeTrace has no START_CYCLES; "
+            "client events omitted");
+      }
+
+      Buffer traceBuf;
+      client.serverControlAll(WireFormat::ControlOp::GET_TIME_TRACE, NULL, 0,
+          &traceBuf);
+      std::map<uint32_t, string> traces;
+      parseTraces(&traceBuf, &traces);
+      for (auto& it : traces) {
+        if (offsets.find(it.first) == offsets.end()) {
+          // Only servers that held the objects took part in the ops.
+          continue;
+        }
+        if (!parseTrace(it.second, it.first + 1, offsets[it.first],
+            &events)) {
+          LOG(WARNING, "TimeTrace of server %u has no START_CYCLES; "
+              "its events are omitted", it.first);
+        }
+      }
+      std::sort(events.begin(), events.end(),
+          [](const TraceEvent& a, const TraceEvent& b) {
+            return a.ns < b.ns;
+          });
+
+      // Slowest operations first.
+      std::vector<int> ops(count);
+      std::vector<double> opStartNs(count);
+      std::vector<double> opEndNs(count);
+      double clientCyclesPerNs = Cycles::perSecond() / 1e09;
+      for (int i = 0; i < count; i++) {
+        ops[i] = i;
+        opStartNs[i] = (double)opStart[i] / clientCyclesPerNs;
+        opEndNs[i] = (double)(opStart[i] + latency[i]) / clientCyclesPerNs;
+      }
+      std::sort(ops.begin(), ops.end(), [&](int a, int b) {
+        return latency[a] > latency[b];
+      });
+      ops.resize(std::min(count, traceOps));
+
+      std::ofstream out(traceFile.c_str());
+      writeChromeTrace(out, events, ops, opStartNs, opEndNs);
+      LOG(NOTICE, "Wrote %lu operations to %s", ops.size(), traceFile.c_str());
+    }
+
     client.dropTable("test");
 
     TimeTrace::printToLog();
@@ -0,0 +1,453 @@
+/* Copyright (c) 2009-2015 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <assert.h>
+
+#include <cmath>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <random>
+#include <thread>
+
+#include "ClusterMetrics.h"
+#include "Context.h"
+#include "Cycles.h"
+#include "Dispatch.h"
+#include "ShortMacros.h"
+#include "Crc32C.h"
+#include "ObjectFinder.h"
+#include "OptionParser.h"
+#include "RamCloud.h"
+#include "Tub.h"
+#include "IndexLookup.h"
+#include "Transaction.h"
+#include "IntList.h"
+
+using namespace RAMCloud;
+
+/**
+ * Generates integers in [0, n) following a Zipfian distribution with the
+ * given skew. A skew of 0 yields a uniform distribution; the larger the skew,
+ * the more often the lowest numbered keys are picked.
+ */
+class ZipfGenerator {
+  public:
+    ZipfGenerator(int n, double skew)
+        : cdf(n)
+    {
+      double sum = 0.0;
+      for (int i = 0; i < n; i++) {
+        sum += 1.0 / std::pow((double)(i + 1), skew);
+        cdf[i] = sum;
+      }
+      for (int i = 0; i < n; i++) {
+        cdf[i] /= sum;
+      }
+    }
+
+    template<typename RNG>
+    int next(RNG& rng)
+    {
+      double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+      int i = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+      return std::min(i, (int)cdf.size() - 1);
+    }
+
+  private:
+    /// Cumulative distribution function, cdf[i] = P(X <= i).
+    std::vector<double> cdf;
+};
+
+/**
+ * Results collected by a single contentionThread.
+ */
+struct ContentionResults {
+  /*
+   * Latency of each committed transaction in cycles, from the start of its
+   * first attempt until the attempt that committed.
+   */
+  std::vector<uint64_t> latency;
+
+  /*
+   * Number of transactions that eventually committed.
+   */
+  long commits = 0;
+
+  /*
+   * Number of commit attempts that aborted (and were retried, or given up
+   * on).
+   */
+  long aborts = 0;
+
+  /*
+   * Number of transactions given up on after maxRetries aborts.
+   */
+  long failures = 0;
+
+  /*
+   * Total time spent by the thread, in cycles.
+   */
+  uint64_t elapsed = 0;
+};
+
+/**
+ * A thread which runs read-modify-write transactions over a shared set of hot
+ * keys. Each transaction picks keysPerTx distinct keys, reads them, increments
+ * the counter stored at the start of each value, writes them back and commits.
+ * Aborted transactions are retried on the same keys.
+ *
+ * \param client
+ *      RAMCloud client object to use for this thread. Each thread gets its own
+ *      client object because the RAMCloud client object is not thread-safe.
+ * \param tableId
+ *      Table holding the hot keys.
+ * \param seed
+ *      Seed for this thread's random number generator.
+ * \param hotKeys
+ *      Number of keys in the hot set.
+ * \param skew
+ *      Zipfian skew of key popularity within the hot set.
+ * \param keysPerTx
+ *      Number of keys each transaction reads and writes.
+ * \param objectSize
+ *      Size of the values in bytes.
+ * \param maxRetries
+ *      Number of times an aborted transaction is retried before giving up.
+ * \param count
+ *      Number of transactions to run.
+ * \param[out] results
+ *      Filled in with this thread's measurements.
+ */
+void
+contentionThread(RamCloud* client, uint64_t tableId, uint64_t seed,
+    int hotKeys, double skew, int keysPerTx, int objectSize, int maxRetries,
+    int count, ContentionResults* results)
+{
+    std::mt19937_64 rng(seed);
+    ZipfGenerator zipf(hotKeys, skew);
+    std::vector<int> keys;
+    std::vector<char> value(objectSize);
+
+    uint64_t threadStart = Cycles::rdtsc();
+    for (int c = 0; c < count; c++) {
+      keys.clear();
+      while ((int)keys.size() < keysPerTx) {
+        int key = zipf.next(rng);
+        if (std::find(keys.begin(), keys.end(), key) == keys.end()) {
+          keys.push_back(key);
+        }
+      }
+
+      uint64_t startTime = Cycles::rdtsc();
+      bool committed = false;
+      for (int attempt = 0; attempt <= maxRetries && !committed; attempt++) {
+        try {
+          Transaction tx(client);
+          for (int i = 0; i < keysPerTx; i++) {
+            Buffer buf;
+            tx.read(tableId, (char*)&keys[i], sizeof(int), &buf);
+            buf.copy(0, std::min(buf.size(), (uint32_t)objectSize),
+                value.data());
+            (*((uint64_t*)value.data()))++;
+            tx.write(tableId, (char*)&keys[i], sizeof(int), value.data(),
+                objectSize);
+          }
+          committed = tx.commit();
+        } catch (RAMCloud::ClientException& e) {
+        } catch (RAMCloud::Exception& e) {
+        } 
+
+        if (!committed) {
+          results->aborts++;
+        }
+      }
+      uint64_t endTime = Cycles::rdtsc();
+
+      if (committed) {
+        results->commits++;
+        results->latency.push_back(endTime - startTime);
+      } else {
+        results->failures++;
+      }
+    }
+    results->elapsed = Cycles::rdtsc() - threadStart;
+}
+
+/**
+ * A benchmark for transaction throughput under contention. Threads run
+ * read-modify-write transactions over a shared set of hot keys, and the
+ * committed transaction rate, abort rate and latency distribution are
+ * reported for every combination of hot set size and thread count.
+ */
+int
+main(int argc, char *argv[])
+try
+{
+    int clientIndex;
+    int numClients;
+    string tableName;
+    int serverSpan;
+    int objectSize;
+    string hotKeyCounts;
+    string threadCounts;
+    double skew;
+    int keysPerTx;
+    int maxRetries;
+    int count;
+    bool csv;
+
+    // Set line buffering for stdout so that printf's and log messages
+    // interleave properly.
+    setvbuf(stdout, NULL, _IOLBF, 1024);
+
+    // need external context to set log levels with OptionParser
+    Context context(false);
+
+    OptionsDescription clientOptions("TimeTransactionContention");
+    clientOptions.add_options()
+
+        ("clientIndex",
+         ProgramOptions::value<int>(&clientIndex)->
+            default_value(0),
+         "Index of this client (first client is 0) [default: 0].")
+        ("numClients",
+         ProgramOptions::value<int>(&numClients)->
+            default_value(1),
+         "Total number of clients running. All clients share the same hot "
+         "keys [default: 1].")
+
+        ("tableName",
+         ProgramOptions::value<string>(&tableName)->
+            default_value("contention"),
+         "Name of the table holding the hot keys [default: contention].")
+        ("serverSpan",
+         ProgramOptions::value<int>(&serverSpan)->
+            default_value(1),
+         "Server span for the table [default: 1].")
+        ("objectSize",
+         ProgramOptions::value<int>(&objectSize)->
+            default_value(100),
+         "Size of objects in bytes (at least 8) [default: 100].")
+        ("hotKeys",
+         ProgramOptions::value<string>(&hotKeyCounts)->
+            default_value("1000,100,10"),
+         "Comma-separated list of hot set sizes to sweep over "
+         "[default: 1000,100,10].")
+        ("threadCounts",
+         ProgramOptions::value<string>(&threadCounts)->
+            default_value("1"),
+         "Comma-separated list of thread counts (per client) to sweep over. "
+         "Each thread uses its own RAMCloud client [default: 1].")
+        ("skew",
+         ProgramOptions::value<double>(&skew)->
+            default_value(0.0),
+         "Zipfian skew of key popularity within the hot set; 0 is uniform "
+         "[default: 0].")
+        ("keysPerTx",
+         ProgramOptions::value<int>(&keysPerTx)->
+            default_value(2),
+         "Number of keys read and written by each transaction [default: 2].")
+        ("maxRetries",
+         ProgramOptions::value<int>(&maxRetries)->
+            default_value(100),
+         "Number of times an aborted transaction is retried before giving up "
+         "[default: 100].")
+        ("count",
+         ProgramOptions::value<int>(&count)->
+            default_value(1000),
+         "Number of transactions each thread runs per sweep point "
+         "[default: 1000].")
+        ("csv",
+         ProgramOptions::bool_switch(&csv),
+         "Output results as comma-separated values.");
+
+    OptionParser optionParser(clientOptions, argc, argv);
+    context.transportManager->setSessionTimeout(
+            optionParser.options.getSessionTimeout());
+
+    if (objectSize < (int)sizeof(uint64_t)) {
+      fprintf(stderr, "objectSize must be at least %lu bytes\n",
+          sizeof(uint64_t));
+      return 1;
+    }
+
+    std::vector<int> hotKeyList;
+    std::vector<int> threadList;
+    parseIntList(hotKeyCounts, &hotKeyList);
+    parseIntList(threadCounts, &threadList);
+    int maxThreads = *std::max_element(threadList.begin(), threadList.end());
+    int maxHotKeys = *std::max_element(hotKeyList.begin(), hotKeyList.end());
+
+    LOG(NOTICE, "Connecting to %s",
+        optionParser.options.getCoordinatorLocator().c_str());
+
+    string locator = optionParser.options.getExternalStorageLocator();
+    if (locator.size() == 0) {
+        locator = optionParser.options.getCoordinatorLocator();
+    }
+    RamCloud client(&context, locator.c_str(),
+            optionParser.options.getClusterName().c_str());
+
+    uint64_t tableId;
+    tableId = client.createTable(tableName.c_str(), serverSpan);
+
+    // Create the hot keys with zeroed counters. Every client does this, but
+    // with several clients only the first write of each key succeeds, so that
+    // counters aren't reset underneath clients that have already started. A
+    // single client zeroes them outright, so that counters left in the table
+    // by an earlier run don't throw off the check at the end.
+    std::vector<char> zeroValue(objectSize, 0);
+    RejectRules rejectRules;
+    memset(&rejectRules, 0, sizeof(rejectRules));
+    rejectRules.exists = numClients > 1 ? 1 : 0;
+    for (int key = 0; key < maxHotKeys; key++) {
+      try {
+        client.write(tableId, (char*)&key, sizeof(int), zeroValue.data(),
+            objectSize, &rejectRules);
+      } catch (RAMCloud::ObjectExistsException& e) {
+      }
+    }
+
+    std::vector<RamCloud*> clients(maxThreads);
+    for (int i = 0; i < maxThreads; i++) {
+      clients[i] = new RamCloud(&optionParser.options);
+    }
+
+    if (csv) {
+      printf("Clients,Threads,HotKeys,Skew,Keys/Tx,Commits,Aborts,Failures,"
+          "Tx/s,Abort(%%),Retries/Tx,Avg,50th,90th,99th,Max\n");
+    } else {
+      printf("%8s %8s %8s %6s %8s %10s %10s %10s %10s %10s %10s %10s %10s "
+          "%10s %10s %10s\n",
+          "Clients",
+          "Threads",
+          "HotKeys",
+          "Skew",
+          "Keys/Tx",
+          "Commits",
+          "Aborts",
+          "Failures",
+          "Tx/s",
+          "Abort(%)",
+          "Retries/Tx",
+          "Avg",
+          "50th",
+          "90th",
+          "99th",
+          "Max");
+    }
+
+    uint64_t totalIncrements = 0;
+    for (int hotKeys : hotKeyList) {
+      for (int numThreads : threadList) {
+        int txKeys = std::min(keysPerTx, hotKeys);
+
+        std::vector<std::thread> threads;
+        std::vector<ContentionResults> results(numThreads);
+        for (int i = 0; i < numThreads; i++) {
+          uint64_t seed = ((uint64_t)clientIndex << 32) + i;
+          threads.emplace_back(contentionThread, clients[i], tableId, seed,
+              hotKeys, skew, txKeys, objectSize, maxRetries, count,
+              &results[i]);
+        }
+
+        std::vector<uint64_t> latencyVec;
+        long commits = 0;
+        long aborts = 0;
+        long failures = 0;
+        uint64_t maxElapsed = 0;
+        for (int i = 0; i < numThreads; i++) {
+          threads[i].join();
+          latencyVec.insert(latencyVec.end(), results[i].latency.begin(),
+              results[i].latency.end());
+          commits += results[i].commits;
+          aborts += results[i].aborts;
+          failures += results[i].failures;
+          maxElapsed = std::max(maxElapsed, results[i].elapsed);
+        }
+        totalIncrements += (uint64_t)commits * txKeys;
+
+        std::sort(latencyVec.begin(), latencyVec.end());
+
+        uint64_t sum = 0;
+        size_t n = latencyVec.size();
+        for (size_t i = 0; i < n; i++) {
+          sum += latencyVec[i];
+        }
+        if (n == 0) {
+          // Every transaction failed; report zero latencies.
+          latencyVec.push_back(0);
+        }
+
+        const char* rowFmt = csv ?
+            "%d,%d,%d,%.2f,%d,%ld,%ld,%ld,%.0f,%.3f,%.3f,%.3f,%.3f,%.3f,"
+            "%.3f,%.3f\n" :
+            "%8d %8d %8d %6.2f %8d %10ld %10ld %10ld %10.0f %10.3f %10.3f "
+            "%10.3f %10.3f %10.3f %10.3f %10.3f\n";
+        printf(rowFmt,
+            numClients,
+            numThreads,
+            hotKeys,
+            skew,
+            txKeys,
+            commits,
+            aborts,
+            failures,
+            commits / Cycles::toSeconds(maxElapsed),
+            100.0 * aborts / (double)(commits + aborts),
+            aborts / (double)(commits + failures),
+            n == 0 ? 0.0 : Cycles::toNanoseconds(sum)/((double)n)/1000.0,
+            Cycles::toNanoseconds(latencyVec[n*50/100])/1000.0,
+            Cycles::toNanoseconds(latencyVec[n*90/100])/1000.0,
+            Cycles::toNanoseconds(latencyVec[n*99/100])/1000.0,
+            Cycles::toNanoseconds(latencyVec[latencyVec.size()-1])/1000.0);
+      }
+    }
+
+    for (int i = 0; i < maxThreads; i++) {
+      delete clients[i];
+    }
+
+    // With a single client every committed increment is ours, so the hot key
+    // counters must add up exactly.
+    if (numClients == 1) {
+      uint64_t counterSum = 0;
+      for (int key = 0; key < maxHotKeys; key++) {
+        Buffer buf;
+        client.read(tableId, (char*)&key, sizeof(int), &buf);
+        counterSum += *buf.getStart<uint64_t>();
+      }
+
+      client.dropTable(tableName.c_str());
+
+      if (counterSum != totalIncrements) {
+        LOG(WARNING, "Counter check failed (sum of counters: %lu, "
+            "committed increments: %lu).", counterSum, totalIncrements);
+        return 1;
+      }
+    }
+
+    return 0;
+} catch (RAMCloud::ClientException& e) {
+    fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
+    return 1;
+} catch (RAMCloud::Exception& e) {
+    fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
+    return 1;
+}
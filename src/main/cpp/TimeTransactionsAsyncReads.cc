@@ -20,6 +20,8 @@
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <thread>
 
 #include "ClusterMetrics.h"
 #include "Context.h"
@@ -36,6 +38,169 @@
 
 using namespace RAMCloud;
 
+/**
+ * Results collected by a single concurrentTxThread.
+ */
+struct TxThreadResults {
+  /*
+   * Latency of each round's read phase, in cycles. A read phase spans issuing
+   * every ReadOp of every concurrent transaction until the last one is
+   * complete.
+   */
+  std::vector<uint64_t> readLatency;
+
+  /*
+   * Latency of each individual commit, in cycles.
+   */
+  std::vector<uint64_t> commitLatency;
+
+  /*
+   * Number of transactions that committed.
+   */
+  long commits = 0;
+
+  /*
+   * Number of transactions that aborted.
+   */
+  long aborts = 0;
+
+  /*
+   * Total time spent by the thread, in cycles.
+   */
+  uint64_t elapsed = 0;
+};
+
+/**
+ * Compute the n'th percentile of a sorted vector of cycle counts, in
+ * microseconds.
+ */
+double
+percentileMicros(std::vector<uint64_t>& sorted, int n)
+{
+    if (sorted.size() == 0) {
+      return 0.0;
+    }
+    return Cycles::toNanoseconds(sorted[sorted.size()*n/100])/1000.0;
+}
+
+/**
+ * Compute the average of a vector of cycle counts, in microseconds.
+ */
+double
+averageMicros(std::vector<uint64_t>& values)
+{
+    if (values.size() == 0) {
+      return 0.0;
+    }
+    uint64_t sum = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+      sum += values[i];
+    }
+    return Cycles::toNanoseconds(sum)/((double)values.size())/1000.0;
+}
+
+/**
+ * A thread which keeps several transactions in flight at once. Each round
+ * starts concurrentTxs transactions, issues the batched ReadOps of all of
+ * them before waiting on any, buffers each transaction's writes, and then
+ * commits them one after another.
+ *
+ * Transaction::commit() is the only public way to start a commit and it blocks
+ * until the commit decision has been sent, so within one thread commits are
+ * serialized; the decision RPCs and the next round's reads still overlap with
+ * the outstanding commits. Use more threads to drive more commits in
+ * parallel.
+ *
+ * Every transaction touches a disjoint range of keys, so aborts here are
+ * caused by the commit protocol itself (e.g. timeouts) rather than conflicts.
+ *
+ * \param client
+ *      RAMCloud client object to use for this thread. Each thread gets its own
+ *      client object because the RAMCloud client object is not thread-safe.
+ * \param tableId
+ *      Table holding the objects to read and write.
+ * \param keyBase
+ *      First key of this thread's key range.
+ * \param concurrentTxs
+ *      Number of transactions in flight per round.
+ * \param readSetSize
+ *      Number of objects each transaction reads.
+ * \param writeSetSize
+ *      Number of objects each transaction writes.
+ * \param objectSize
+ *      Size of written values in bytes.
+ * \param count
+ *      Number of rounds to execute.
+ * \param[out] results
+ *      Filled in with this thread's measurements.
+ */
+void
+concurrentTxThread(RamCloud* client, uint64_t tableId, int keyBase,
+    int concurrentTxs, int readSetSize, int writeSetSize, int objectSize,
+    int count, TxThreadResults* results)
+{
+    int setSize = std::max(readSetSize, writeSetSize);
+    std::vector<int> keys(concurrentTxs * setSize);
+    for (size_t i = 0; i < keys.size(); i++) {
+      keys[i] = keyBase + i;
+    }
+    std::vector<char> value(objectSize);
+
+    uint64_t threadStart = Cycles::rdtsc();
+    for (int c = 0; c < count; c++) {
+      Tub<Transaction> txs[concurrentTxs];
+      Tub<Transaction::ReadOp> requests[concurrentTxs * readSetSize];
+      Buffer values[concurrentTxs * readSetSize];
+
+      for (int t = 0; t < concurrentTxs; t++) {
+        txs[t].construct(client);
+      }
+
+      uint64_t startTime = Cycles::rdtsc();
+
+      for (int t = 0; t < concurrentTxs; t++) {
+        for (int i = 0; i < readSetSize; i++) {
+          int r = t * readSetSize + i;
+          requests[r].construct(txs[t].get(), tableId,
+              (char*)&keys[t * setSize + i], sizeof(int), &values[r], true);
+        }
+      }
+
+      for (int r = 0; r < concurrentTxs * readSetSize; r++) {
+        requests[r].get()->wait();
+      }
+
+      uint64_t endTime = Cycles::rdtsc();
+      results->readLatency.push_back(endTime - startTime);
+
+      for (int t = 0; t < concurrentTxs; t++) {
+        for (int i = 0; i < writeSetSize; i++) {
+          txs[t]->write(tableId, (char*)&keys[t * setSize + i], sizeof(int),
+              value.data(), objectSize);
+        }
+      }
+
+      for (int t = 0; t < concurrentTxs; t++) {
+        startTime = Cycles::rdtsc();
+        bool committed = false;
+        try {
+          committed = txs[t]->commit();
+        } catch (RAMCloud::ClientException& e) {
+        } catch (RAMCloud::Exception& e) {
+        } 
+        endTime = Cycles::rdtsc();
+        results->commitLatency.push_back(endTime - startTime);
+
+        if (committed) {
+          results->commits++;
+        } else {
+          results->aborts++;
+        }
+      }
+    }
+    results->elapsed = Cycles::rdtsc() - threadStart;
+}
+
 int
 main(int argc, char *argv[])
 try
@@ -47,6 +212,9 @@ try
     int objectSize;
     int asyncReadSize;
     int count;
+    int numThreads;
+    int concurrentTxs;
+    int writeSetSize;
 
     // Set line buffering for stdout so that printf's and log messages
     // interleave properly.
@@ -80,7 +248,25 @@ try
          "Number of objects to asynchronously read.")
         ("count",
          ProgramOptions::value<int>(&count),
-         "Number of times to execute the set of asynchronous reads.");
+         "Number of times to execute the set of asynchronous reads.")
+        ("concurrentTxs",
+         ProgramOptions::value<int>(&concurrentTxs)->
+            default_value(0),
+         "Number of transactions each thread keeps in flight at once. When "
+         "set, times the read phase (asyncReadSize reads per transaction) and "
+         "the commit phase separately and reports commit throughput and "
+         "abort rate. When 0, times only the reads of one transaction at a "
+         "time [default: 0].")
+        ("numThreads",
+         ProgramOptions::value<int>(&numThreads)->
+            default_value(1),
+         "Number of threads running transactions, each with its own client. "
+         "Only used when concurrentTxs > 0 [default: 1].")
+        ("writeSetSize",
+         ProgramOptions::value<int>(&writeSetSize)->
+            default_value(0),
+         "Number of objects each transaction writes before committing. Only "
+         "used when concurrentTxs > 0 [default: 0].");
     
     OptionParser optionParser(clientOptions, argc, argv);
     context.transportManager->setSessionTimeout(
@@ -100,6 +286,95 @@ try
     client.dropTable("test");
     tableId = client.createTable("test", serverSpan);
     
+    if (concurrentTxs > 0) {
+      // Each transaction of each thread gets its own range of keys.
+      int setSize = std::max(asyncReadSize, writeSetSize);
+      int numKeys = numThreads * concurrentTxs * setSize;
+
+      std::vector<char> randomValue(objectSize);
+      std::vector<int> allKeys(numKeys);
+      const int batchSize = 256;
+      Tub<MultiWriteObject> objects[batchSize];
+      MultiWriteObject* requests[batchSize];
+      for (int i = 0; i < numKeys; i += batchSize) {
+        int n = std::min(batchSize, numKeys - i);
+        for (int j = 0; j < n; j++) {
+          allKeys[i + j] = i + j;
+          objects[j].construct(tableId, (char*)&allKeys[i + j], sizeof(int),
+              (const void*)randomValue.data(), objectSize);
+          requests[j] = objects[j].get();
+        }
+        client.multiWrite(requests, n);
+      }
+
+      std::vector<std::thread> threads;
+      std::vector<RamCloud*> clients(numThreads);
+      std::vector<TxThreadResults> results(numThreads);
+      for (int i = 0; i < numThreads; i++) {
+        clients[i] = new RamCloud(&optionParser.options);
+        threads.emplace_back(concurrentTxThread, clients[i], tableId,
+            i * concurrentTxs * setSize, concurrentTxs, asyncReadSize,
+            writeSetSize, objectSize, count, &results[i]);
+      }
+
+      std::vector<uint64_t> readLatency;
+      std::vector<uint64_t> commitLatency;
+      long commits = 0;
+      long aborts = 0;
+      uint64_t maxElapsed = 0;
+      for (int i = 0; i < numThreads; i++) {
+        threads[i].join();
+        delete clients[i];
+        readLatency.insert(readLatency.end(), results[i].readLatency.begin(),
+            results[i].readLatency.end());
+        commitLatency.insert(commitLatency.end(),
+            results[i].commitLatency.begin(), results[i].commitLatency.end());
+        commits += results[i].commits;
+        aborts += results[i].aborts;
+        maxElapsed = std::max(maxElapsed, results[i].elapsed);
+      }
+
+      std::sort(readLatency.begin(), readLatency.end());
+      std::sort(commitLatency.begin(), commitLatency.end());
+
+      printf("%8s %8s %8s %8s %12s %12s %12s %12s %12s %12s %12s %12s "
+          "%12s %12s\n",
+          "Threads",
+          "TxInFlt",
+          "Reads",
+          "Writes",
+          "Size(B)",
+          "Count",
+          "RdAvg",
+          "Rd50th",
+          "Rd99th",
+          "CmAvg",
+          "Cm50th",
+          "Cm99th",
+          "Commits/s",
+          "Abort(%)");
+      printf("%8d %8d %8d %8d %12d %12d %12.3f %12.3f %12.3f %12.3f %12.3f "
+          "%12.3f %12.0f %12.3f\n",
+          numThreads,
+          concurrentTxs,
+          asyncReadSize,
+          writeSetSize,
+          objectSize,
+          count,
+          averageMicros(readLatency),
+          percentileMicros(readLatency, 50),
+          percentileMicros(readLatency, 99),
+          averageMicros(commitLatency),
+          percentileMicros(commitLatency, 50),
+          percentileMicros(commitLatency, 99),
+          commits / Cycles::toSeconds(maxElapsed),
+          100.0 * aborts / (double)(commits + aborts));
+
+      client.dropTable("test");
+
+      return 0;
+    }
+
     // Write in values to read
     int keys[asyncReadSize];
     for (int i = 0; i < asyncReadSize; i++) {
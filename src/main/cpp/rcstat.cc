@@ -19,10 +19,23 @@
 #include <assert.h>
 
 #include <inttypes.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
 
 #include "ClusterMetrics.h"
 #include "Context.h"
@@ -75,75 +88,1452 @@ parseStats(Buffer* rawData, std::vector<PerfStats>* results)
 }
  
 /**
- * Check if the vector contains a particular element.
+ * How a column's value is derived from the PerfStats samples taken at the
+ * start and end of a reporting interval.
+ */
+enum ColumnKind {
+  RATE,         // Increase in a counter, per second.
+  UTILIZATION,  // Increase in a cycle counter, as a % of elapsed cycles.
+  GAUGE,        // Value at the end of the interval.
+  PERCENT       // Value at the end of the interval as a % of another field.
+};
+
+/**
+ * Describes one per server column that rcstat can display. The cluster-wide
+ * column has the same name with the first letter capitalized.
+ */
+struct Column {
+  /*
+   * Per server column name, as used in the format option.
+   */
+  const char* name;
+
+  /*
+   * Name of the column in exported metrics (see formatExposition).
+   */
+  const char* metricName;
+
+  /*
+   * How the column's value is computed from field (and base).
+   */
+  ColumnKind kind;
+
+  /*
+   * PerfStats field the column is derived from.
+   */
+  uint64_t PerfStats::* field;
+
+  /*
+   * For PERCENT columns, the field that field is a percentage of. NULL
+   * otherwise.
+   */
+  uint64_t PerfStats::* base;
+
+  /*
+   * Description shown in the format option's help.
+   */
+  const char* help;
+};
+
+/**
+ * Every column rcstat can display. Utilization columns are 100 for a thread
+ * that was busy for the entire interval; worker utilization can exceed 100
+ * since a server has many worker threads.
+ */
+const Column columnRegistry[] = {
+  {"ro", "read_objects_per_second",
+   RATE, &PerfStats::readCount, NULL,
+   "objects read/s"},
+  {"rob", "read_object_bytes_per_second",
+   RATE, &PerfStats::readObjectBytes, NULL,
+   "bytes in objects read/s"},
+  {"rkb", "read_key_bytes_per_second",
+   RATE, &PerfStats::readKeyBytes, NULL,
+   "bytes in keys read/s"},
+  {"wo", "write_objects_per_second",
+   RATE, &PerfStats::writeCount, NULL,
+   "objects written/s"},
+  {"wob", "write_object_bytes_per_second",
+   RATE, &PerfStats::writeObjectBytes, NULL,
+   "bytes in objects written/s"},
+  {"wkb", "write_key_bytes_per_second",
+   RATE, &PerfStats::writeKeyBytes, NULL,
+   "bytes in keys written/s"},
+  {"du", "dispatch_utilization_percent",
+   UTILIZATION, &PerfStats::dispatchActiveCycles, NULL,
+   "dispatch thread utilization %"},
+  {"wu", "worker_utilization_percent",
+   UTILIZATION, &PerfStats::workerActiveCycles, NULL,
+   "worker threads utilization %"},
+  {"nib", "network_input_bytes_per_second",
+   RATE, &PerfStats::networkInputBytes, NULL,
+   "network bytes received/s"},
+  {"nob", "network_output_bytes_per_second",
+   RATE, &PerfStats::networkOutputBytes, NULL,
+   "network bytes sent/s"},
+  {"lab", "log_appended_bytes_per_second",
+   RATE, &PerfStats::logBytesAppended, NULL,
+   "log bytes appended/s"},
+  {"rr", "replication_rpcs_per_second",
+   RATE, &PerfStats::replicationRpcs, NULL,
+   "replication RPCs/s"},
+  {"lsu", "log_sync_percent",
+   UTILIZATION, &PerfStats::logSyncCycles, NULL,
+   "time spent syncing the log, %"},
+  {"cib", "compactor_input_bytes_per_second",
+   RATE, &PerfStats::compactorInputBytes, NULL,
+   "bytes compacted in memory/s"},
+  {"csb", "compactor_survivor_bytes_per_second",
+   RATE, &PerfStats::compactorSurvivorBytes, NULL,
+   "bytes surviving compaction/s"},
+  {"cu", "compactor_utilization_percent",
+   UTILIZATION, &PerfStats::compactorActiveCycles, NULL,
+   "compactor utilization %"},
+  {"lmb", "cleaner_input_memory_bytes_per_second",
+   RATE, &PerfStats::cleanerInputMemoryBytes, NULL,
+   "bytes cleaned from memory/s"},
+  {"ldb", "cleaner_input_disk_bytes_per_second",
+   RATE, &PerfStats::cleanerInputDiskBytes, NULL,
+   "bytes cleaned from disk/s"},
+  {"lsb", "cleaner_survivor_bytes_per_second",
+   RATE, &PerfStats::cleanerSurvivorBytes, NULL,
+   "bytes surviving cleaning/s"},
+  {"lu", "cleaner_utilization_percent",
+   UTILIZATION, &PerfStats::cleanerActiveCycles, NULL,
+   "cleaner utilization %"},
+  {"mc", "memory_capacity_bytes",
+   GAUGE, &PerfStats::logMaxLiveBytes, NULL,
+   "memory capacity in bytes"},
+  {"mu", "memory_used_bytes",
+   GAUGE, &PerfStats::logLiveBytes, NULL,
+   "memory used in bytes"},
+  {"mup", "memory_used_percent",
+   PERCENT, &PerfStats::logLiveBytes, &PerfStats::logMaxLiveBytes,
+   "memory used as a % of capacity"},
+  {"mf", "memory_free_bytes",
+   GAUGE, &PerfStats::logAppendableBytes, NULL,
+   "memory free in bytes"},
+  {"mfp", "memory_free_percent",
+   PERCENT, &PerfStats::logAppendableBytes, &PerfStats::logMaxLiveBytes,
+   "memory free as a % of capacity"},
+};
+
+const int NUM_COLUMNS = sizeof(columnRegistry) / sizeof(columnRegistry[0]);
+
+/**
+ * Ways of aggregating a column over all servers, selected by suffixing the
+ * cluster-wide column name.
+ */
+enum Aggregation {
+  TOTAL,  // Sum of the per server values (mean for utilizations).
+  MAX,    // Largest per server value.
+  SKEW,   // Largest per server value divided by the mean.
+  SD,     // Standard deviation of the per server values.
+  NUM_AGGREGATIONS
+};
+
+/**
+ * Column name suffix of each Aggregation.
+ */
+const char* aggregationSuffixes[NUM_AGGREGATIONS] = {
+  "", ".max", ".skew", ".sd"
+};
+
+/**
+ * Find a per server column in the registry.
+ *
+ * \param name
+ *      Per server column name.
+ * \return
+ *      Index of the column in columnRegistry, or -1 if there is none.
+ */
+int
+findColumn(const std::string& name)
+{
+  for (int c = 0; c < NUM_COLUMNS; c++) {
+    if (name == columnRegistry[c].name) {
+      return c;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Name of a column's cluster-wide aggregate.
+ *
+ * \param column
+ *      Index of the column in columnRegistry.
+ * \param agg
+ *      Aggregation of the column.
+ */
+std::string
+aggregateName(int column, int agg)
+{
+  std::string name = columnRegistry[column].name;
+  name[0] = toupper(name[0]);
+  return name + aggregationSuffixes[agg];
+}
+
+/**
+ * Compute every registry column for one server over the interval between
+ * two of its PerfStats samples.
+ *
+ * \param c
+ *      Sample taken at the end of the interval.
+ * \param p
+ *      Sample taken at the start of the interval. If this is empty (0
+ *      collectionTime), e.g. because the server just joined the cluster,
+ *      all rates and utilizations are reported as 0.
+ * \param[out] m
+ *      Array of NUM_COLUMNS entries, filled in with the values.
+ */
+void
+computeMetrics(PerfStats& c, PerfStats& p, double* m)
+{
+  double cycles = 0.0;
+  if (p.collectionTime != 0 && c.collectionTime > p.collectionTime) {
+    cycles = (double)(c.collectionTime - p.collectionTime);
+  }
+  double secs = cycles / c.cyclesPerSecond;
+
+  for (int i = 0; i < NUM_COLUMNS; i++) {
+    const Column& col = columnRegistry[i];
+    uint64_t curr = c.*col.field;
+    // Counters go backwards if the server restarted.
+    double delta = curr >= p.*col.field ? (double)(curr - p.*col.field) : 0.0;
+
+    switch (col.kind) {
+      case RATE:
+        m[i] = secs > 0.0 ? delta / secs : 0.0;
+        break;
+      case UTILIZATION:
+        m[i] = cycles > 0.0 ? (100.0 * delta) / cycles : 0.0;
+        break;
+      case GAUGE:
+        m[i] = (double)curr;
+        break;
+      case PERCENT:
+        m[i] = c.*col.base > 0 ? (100.0 * curr) / c.*col.base : 0.0;
+        break;
+    }
+  }
+}
+
+/**
+ * Compute the cluster-wide aggregates of every registry column.
  *
- * \param v
- *      vector to search.
- * \param e
- *      element to search for.
+ * \param metrics
+ *      Per server values, one array of NUM_COLUMNS entries per server that
+ *      reported statistics.
+ * \param samples
+ *      The PerfStats sample each entry of metrics was computed from, used to
+ *      compute percentages of cluster-wide sums.
+ * \param[out] aggs
+ *      Array of NUM_COLUMNS x NUM_AGGREGATIONS entries, filled in with the
+ *      aggregates; aggs[c * NUM_AGGREGATIONS + a] is aggregation a of
+ *      column c.
+ */
+void
+aggregateMetrics(std::vector<std::vector<double>>& metrics,
+    std::vector<PerfStats*>& samples, double* aggs)
+{
+  size_t n = metrics.size();
+  for (int c = 0; c < NUM_COLUMNS; c++) {
+    const Column& col = columnRegistry[c];
+    double* a = &aggs[c * NUM_AGGREGATIONS];
+    double sum = 0.0;
+    double max = 0.0;
+    for (size_t i = 0; i < n; i++) {
+      sum += metrics[i][c];
+      max = std::max(max, metrics[i][c]);
+    }
+
+    double mean = n > 0 ? sum / n : 0.0;
+    double var = 0.0;
+    for (size_t i = 0; i < n; i++) {
+      var += (metrics[i][c] - mean) * (metrics[i][c] - mean);
+    }
+
+    a[TOTAL] = sum;
+    a[MAX] = max;
+    a[SKEW] = mean > 0.0 ? max / mean : 0.0;
+    a[SD] = n > 0 ? std::sqrt(var / n) : 0.0;
+
+    if (col.kind == UTILIZATION) {
+      a[TOTAL] = mean;
+    } else if (col.kind == PERCENT) {
+      double fieldSum = 0.0;
+      double baseSum = 0.0;
+      for (size_t i = 0; i < n; i++) {
+        fieldSum += (double)(samples[i]->*col.field);
+        baseSum += (double)(samples[i]->*col.base);
+      }
+      a[TOTAL] = baseSum > 0.0 ? (100.0 * fieldSum) / baseSum : 0.0;
+    }
+  }
+}
+
+/**
+ * The registry columns of every server for one reporting interval.
+ */
+struct Snapshot {
+  /*
+   * Per server values, one array of NUM_COLUMNS entries per server that
+   * reported statistics.
+   */
+  std::vector<std::vector<double>> metrics;
+
+  /*
+   * The PerfStats sample each entry of metrics was computed from.
+   */
+  std::vector<PerfStats*> samples;
+
+  /*
+   * Index number of the ServerId of each entry of metrics.
+   */
+  std::vector<uint32_t> serverIndexes;
+
+  /*
+   * Cluster-wide aggregates, as filled in by aggregateMetrics.
+   */
+  double aggs[NUM_COLUMNS * NUM_AGGREGATIONS];
+};
+
+/**
+ * Compute a Snapshot from two consecutive sets of samples.
+ *
+ * \param currStats
+ *      Samples taken at the end of the interval, as filled in by parseStats.
+ *      Must not be modified while snapshot is in use.
+ * \param prevStats
+ *      Samples taken at the start of the interval. Servers that have joined
+ *      since are treated as having an empty sample.
+ * \param[out] snapshot
+ *      Filled in with the interval's columns.
+ */
+void
+computeSnapshot(std::vector<PerfStats>& currStats,
+    std::vector<PerfStats>& prevStats, Snapshot* snapshot)
+{
+  snapshot->metrics.clear();
+  snapshot->samples.clear();
+  snapshot->serverIndexes.clear();
+
+  PerfStats empty = {};
+  for (size_t i = 0; i < currStats.size(); i++) {
+    PerfStats& c = currStats[i];
+    PerfStats& p = i < prevStats.size() ? prevStats[i] : empty;
+
+    if (c.collectionTime == 0) {
+      continue;
+    }
+
+    snapshot->metrics.emplace_back(NUM_COLUMNS);
+    computeMetrics(c, p, &snapshot->metrics.back()[0]);
+    snapshot->samples.push_back(&c);
+    snapshot->serverIndexes.push_back((uint32_t) i);
+  }
+
+  aggregateMetrics(snapshot->metrics, snapshot->samples, snapshot->aggs);
+}
+
+/**
+ * Render a Snapshot in the Prometheus text exposition format. Every per
+ * server column is exported as ramcloud_server_<metricName> with a server
+ * label holding the server's index number, and every cluster-wide aggregate
+ * as ramcloud_cluster_<metricName>[_max|_skew|_stddev].
+ *
+ * \param snapshot
+ *      Snapshot to render.
  * \return
- *      true if found, false otherwise.
+ *      The exposition, ready to be served as the body of a scrape.
+ */
+std::string
+formatExposition(Snapshot& snapshot)
+{
+  const char* aggregationMetricSuffixes[NUM_AGGREGATIONS] = {
+    "", "_max", "_skew", "_stddev"
+  };
+  const char* aggregationHelp[NUM_AGGREGATIONS] = {
+    "Cluster total", "Largest per server", "Max/mean across servers of",
+    "Standard deviation across servers of"
+  };
+
+  // Names and help can be long, so only the numbers go through a fixed
+  // buffer; %.15g needs at most 23 bytes.
+  std::string out;
+  char number[32];
+
+  out += "# HELP ramcloud_servers Number of servers reporting statistics.\n"
+      "# TYPE ramcloud_servers gauge\n"
+      "ramcloud_servers " + std::to_string(snapshot.metrics.size()) + "\n";
+
+  for (int c = 0; c < NUM_COLUMNS; c++) {
+    const Column& col = columnRegistry[c];
+    std::string server = std::string("ramcloud_server_") + col.metricName;
+    out += "# HELP " + server + " Per server " + col.help + ".\n"
+        "# TYPE " + server + " gauge\n";
+    for (size_t r = 0; r < snapshot.metrics.size(); r++) {
+      snprintf(number, sizeof(number), "%.15g", snapshot.metrics[r][c]);
+      out += server + "{server=\"" +
+          std::to_string(snapshot.serverIndexes[r]) + "\"} " + number + "\n";
+    }
+
+    for (int a = 0; a < NUM_AGGREGATIONS; a++) {
+      std::string cluster = std::string("ramcloud_cluster_") +
+          col.metricName + aggregationMetricSuffixes[a];
+      snprintf(number, sizeof(number), "%.15g",
+          snapshot.aggs[c * NUM_AGGREGATIONS + a]);
+      out += "# HELP " + cluster + " " + aggregationHelp[a] + " " + col.help +
+          ".\n"
+          "# TYPE " + cluster + " gauge\n" +
+          cluster + " " + number + "\n";
+    }
+  }
+
+  return out;
+}
+
+/**
+ * Serve scrapes of the exporter endpoint. Requests for /metrics get the most
+ * recent exposition produced by the poll loop in main, so any number of
+ * scrapers share a single set of cluster-wide RPCs; all other paths get a
+ * 404. Never returns.
+ *
+ * \param listenFd
+ *      Listening TCP socket.
+ * \param mutex
+ *      Protects exposition.
+ * \param exposition
+ *      Most recent exposition, replaced by the poll loop each interval.
+ */
+void
+exporterThread(int listenFd, std::mutex* mutex, std::string* exposition)
+{
+  while (true) {
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) {
+      if (errno != EINTR) {
+        LOG(WARNING, "Exporter accept failed: %s", strerror(errno));
+      }
+      continue;
+    }
+
+    // Don't let one stuck client hold up the others.
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Only the request line matters; any headers are ignored.
+    char request[1024];
+    ssize_t length = recv(fd, request, sizeof(request) - 1, 0);
+    if (length <= 0) {
+      close(fd);
+      continue;
+    }
+    request[length] = '\0';
+
+    std::string body;
+    const char* status;
+    const char* contentType = "text/plain; version=0.0.4; charset=utf-8";
+    if (strncmp(request, "GET /metrics ", 13) == 0 ||
+        strncmp(request, "GET /metrics?", 13) == 0) {
+      status = "200 OK";
+      std::lock_guard<std::mutex> lock(*mutex);
+      body = *exposition;
+    } else {
+      status = "404 Not Found";
+      body = "Not found; metrics are served at /metrics.\n";
+    }
+
+    char header[256];
+    snprintf(header, sizeof(header),
+        "HTTP/1.0 %s\r\n"
+        "Content-Type: %s\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n\r\n", status, contentType, body.size());
+    std::string response = header + body;
+
+    size_t sent = 0;
+    while (sent < response.size()) {
+      ssize_t n = send(fd, response.data() + sent, response.size() - sent,
+          MSG_NOSIGNAL);
+      if (n <= 0) {
+        break;
+      }
+      sent += n;
+    }
+    close(fd);
+  }
+}
+
+/**
+ * Open the exporter's listening socket.
+ *
+ * \param address
+ *      IPv4 address to listen on.
+ * \param port
+ *      TCP port to listen on.
+ * \return
+ *      The listening socket, or -1 on error (which has been logged).
+ */
+int
+openExporterSocket(const std::string& address, int port)
+{
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t) port);
+  if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+    LOG(ERROR, "Invalid exporter address: %s", address.c_str());
+    return -1;
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    LOG(ERROR, "Couldn't create exporter socket: %s", strerror(errno));
+    return -1;
+  }
+
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 64) != 0) {
+    LOG(ERROR, "Couldn't listen on %s:%d: %s", address.c_str(), port,
+        strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/*
+ * Recording files (--record) hold a sequence of PerfStats polls. The file
+ * starts with a header:
+ *
+ *   char magic[8] = "RCSTAT01" | uint32_t wordsPerSample
+ *
+ * where wordsPerSample is the number of 8-byte words in the recorder's
+ * PerfStats. The header is followed by frames, one per poll:
+ *
+ *   uint32_t payloadLength | payload
+ *
+ * The payload is a sequence of varints: flags, poll time in microseconds
+ * since the epoch, number of servers, and then for each server its ServerId
+ * index number followed by wordsPerSample zigzag-encoded deltas, one per
+ * PerfStats word. Deltas are relative to the same server's sample in the
+ * previous frame, so a steady cluster costs a few bytes per server per poll.
+ * Keyframes (flag bit 0) are relative to zero instead; the recorder writes
+ * one every RECORD_KEYFRAME_INTERVAL frames and at the start of every run,
+ * so runs can append to an existing file. A frame cut short by a crash is
+ * ignored on replay.
+ */
+#define RECORD_MAGIC "RCSTAT01"
+#define RECORD_KEYFRAME_INTERVAL 64
+
+/**
+ * Number of 8-byte words in a PerfStats.
+ */
+const uint32_t PERFSTATS_WORDS = sizeof(PerfStats) / sizeof(uint64_t);
+
+/**
+ * Append a varint to a buffer.
+ *
+ * \param out
+ *      Buffer to append to.
+ * \param value
+ *      Value to encode.
+ */
+void
+putVarint(std::string* out, uint64_t value)
+{
+  while (value >= 0x80) {
+    out->push_back((char)(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back((char)value);
+}
+
+/**
+ * Decode a varint.
+ *
+ * \param[in,out] p
+ *      Start of the varint, advanced past it.
+ * \param end
+ *      End of the readable data.
+ * \param[out] value
+ *      Decoded value.
+ * \return
+ *      False if the varint runs past end.
  */
 bool
-contains(std::vector<std::string> &v, const char *e) {
-  std::string elem(e);
-  if (std::find(v.begin(), v.end(), elem) != v.end()) {
+getVarint(const uint8_t** p, const uint8_t* end, uint64_t* value)
+{
+  *value = 0;
+  for (int shift = 0; *p < end && shift < 64; shift += 7) {
+    uint8_t byte = *(*p)++;
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Appends every poll of the cluster's PerfStats to a recording file.
+ */
+class StatsRecorder {
+ public:
+  StatsRecorder()
+    : file(NULL)
+    , prevStats()
+    , prevTime(0)
+    , frames(0)
+    , frame()
+  {}
+
+  ~StatsRecorder()
+  {
+    if (file != NULL) {
+      fclose(file);
+    }
+  }
+
+  /**
+   * Open a recording file, creating it if needed. A torn frame left at the
+   * end by a recorder that was killed mid-write is cut off, so that replay
+   * doesn't read its length prefix across the frames appended after it.
+   *
+   * \param path
+   *      File to append to.
+   * \return
+   *      False if the file couldn't be opened or isn't a recording made with
+   *      the same PerfStats layout.
+   */
+  bool
+  open(const std::string& path)
+  {
+    file = fopen(path.c_str(), "a+b");
+    if (file == NULL) {
+      fprintf(stderr, "Couldn't open %s: %s\n", path.c_str(), strerror(errno));
+      return false;
+    }
+
+    char magic[8];
+    uint32_t words;
+    off_t end = sizeof(magic) + sizeof(words);
+    rewind(file);
+    if (fread(magic, sizeof(magic), 1, file) == 1 &&
+        fread(&words, sizeof(words), 1, file) == 1) {
+      if (memcmp(magic, RECORD_MAGIC, sizeof(magic)) != 0 ||
+          words != PERFSTATS_WORDS) {
+        fprintf(stderr, "%s is not a compatible rcstat recording\n",
+            path.c_str());
+        return false;
+      }
+
+      struct stat st;
+      if (fstat(fileno(file), &st) != 0) {
+        fprintf(stderr, "Couldn't stat %s: %s\n", path.c_str(),
+            strerror(errno));
+        return false;
+      }
+      uint32_t length;
+      while (fseeko(file, end, SEEK_SET) == 0 &&
+          fread(&length, sizeof(length), 1, file) == 1 &&
+          end + (off_t)sizeof(length) + length <= st.st_size) {
+        end += sizeof(length) + length;
+      }
+      if (end < st.st_size) {
+        fprintf(stderr, "Dropping a torn frame of %ld bytes from the end of "
+            "%s\n", (long)(st.st_size - end), path.c_str());
+      }
+    } else {
+      // New, or torn before the header was complete.
+      end = 0;
+    }
+
+    if (ftruncate(fileno(file), end) != 0) {
+      fprintf(stderr, "Couldn't truncate %s: %s\n", path.c_str(),
+          strerror(errno));
+      return false;
+    }
+    fseeko(file, 0, SEEK_END);
+    if (end == 0) {
+      words = PERFSTATS_WORDS;
+      fwrite(RECORD_MAGIC, sizeof(magic), 1, file);
+      fwrite(&words, sizeof(words), 1, file);
+    }
     return true;
-  } else {
-    return false;
+  }
+
+  /**
+   * Append one poll to the file.
+   *
+   * \param stats
+   *      Samples from the poll, as filled in by parseStats.
+   */
+  void
+  record(std::vector<PerfStats>& stats)
+  {
+    uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    bool keyframe = (frames % RECORD_KEYFRAME_INTERVAL) == 0;
+    if (keyframe) {
+      prevStats.clear();
+      prevTime = 0;
+    }
+    prevStats.resize(std::max(prevStats.size(), stats.size()));
+
+    uint32_t numServers = 0;
+    for (size_t i = 0; i < stats.size(); i++) {
+      if (stats[i].collectionTime != 0) {
+        numServers++;
+      }
+    }
+
+    frame.clear();
+    putVarint(&frame, keyframe ? 1 : 0);
+    putVarint(&frame, now - prevTime);
+    putVarint(&frame, numServers);
+    for (size_t i = 0; i < stats.size(); i++) {
+      if (stats[i].collectionTime == 0) {
+        continue;
+      }
+      uint64_t curr[PERFSTATS_WORDS];
+      uint64_t prev[PERFSTATS_WORDS];
+      memcpy(curr, &stats[i], sizeof(curr));
+      memcpy(prev, &prevStats[i], sizeof(prev));
+
+      putVarint(&frame, i);
+      for (uint32_t w = 0; w < PERFSTATS_WORDS; w++) {
+        int64_t delta = (int64_t)(curr[w] - prev[w]);
+        putVarint(&frame, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+      }
+    }
+
+    uint32_t length = (uint32_t)frame.size();
+    fwrite(&length, sizeof(length), 1, file);
+    fwrite(frame.data(), frame.size(), 1, file);
+    fflush(file);
+
+    // Servers missing from this poll must be relative to zero next time.
+    for (size_t i = 0; i < prevStats.size(); i++) {
+      if (i < stats.size()) {
+        prevStats[i] = stats[i];
+      } else {
+        prevStats[i] = PerfStats();
+      }
+    }
+    prevTime = now;
+    frames++;
+  }
+
+ private:
+  /*
+   * Recording file, or NULL before open.
+   */
+  FILE* file;
+
+  /*
+   * Samples from the previous poll, indexed by ServerId index number.
+   */
+  std::vector<PerfStats> prevStats;
+
+  /*
+   * Time of the previous poll, in microseconds since the epoch.
+   */
+  uint64_t prevTime;
+
+  /*
+   * Number of frames written by this recorder.
+   */
+  uint64_t frames;
+
+  /*
+   * Encoding buffer, reused between frames.
+   */
+  std::string frame;
+};
+
+/**
+ * Reads the polls back out of a recording file.
+ */
+class StatsReplay {
+ public:
+  StatsReplay()
+    : data(NULL)
+    , size(0)
+    , offset(0)
+    , words(0)
+    , prevStats()
+    , prevTime(0)
+  {}
+
+  ~StatsReplay()
+  {
+    if (data != NULL) {
+      munmap((void*)data, size);
+    }
+  }
+
+  /**
+   * Map a recording file.
+   *
+   * \param path
+   *      File to read.
+   * \return
+   *      False if the file couldn't be mapped or isn't a recording.
+   */
+  bool
+  open(const std::string& path)
+  {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "Couldn't open %s: %s\n", path.c_str(), strerror(errno));
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 12) {
+      fprintf(stderr, "%s is not an rcstat recording\n", path.c_str());
+      close(fd);
+      return false;
+    }
+    size = st.st_size;
+    void* addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+      fprintf(stderr, "Couldn't map %s: %s\n", path.c_str(), strerror(errno));
+      return false;
+    }
+    data = (const uint8_t*)addr;
+    madvise(addr, size, MADV_SEQUENTIAL);
+
+    if (memcmp(data, RECORD_MAGIC, 8) != 0) {
+      fprintf(stderr, "%s is not an rcstat recording\n", path.c_str());
+      return false;
+    }
+    memcpy(&words, data + 8, sizeof(words));
+    offset = 12;
+    return true;
+  }
+
+  /**
+   * Decode the next poll.
+   *
+   * \param[out] time
+   *      Time of the poll, in microseconds since the epoch.
+   * \param[out] stats
+   *      Filled in with the poll's samples, indexed by ServerId index
+   *      number. Empty entries have 0 collectionTimes. Words that the
+   *      recording's PerfStats didn't have are 0.
+   * \return
+   *      False at the end of the recording.
+   */
+  bool
+  next(uint64_t* time, std::vector<PerfStats>* stats)
+  {
+    uint32_t length;
+    if (offset + sizeof(length) > size) {
+      return false;
+    }
+    memcpy(&length, data + offset, sizeof(length));
+    const uint8_t* p = data + offset + sizeof(length);
+    const uint8_t* end = p + length;
+    if (end > data + size) {
+      return false;
+    }
+    offset += sizeof(length) + length;
+
+    uint64_t flags, delta, numServers;
+    if (!getVarint(&p, end, &flags) || !getVarint(&p, end, &delta) ||
+        !getVarint(&p, end, &numServers)) {
+      return false;
+    }
+    if (flags & 1) {
+      prevStats.clear();
+      prevTime = 0;
+    }
+    *time = prevTime + delta;
+    prevTime = *time;
+
+    stats->clear();
+    std::vector<uint64_t> sample(std::max(words, PERFSTATS_WORDS));
+    for (uint64_t s = 0; s < numServers; s++) {
+      uint64_t index;
+      if (!getVarint(&p, end, &index)) {
+        return false;
+      }
+      std::vector<uint64_t>& prev = prevWords(index);
+      for (uint32_t w = 0; w < words; w++) {
+        uint64_t zigzag;
+        if (!getVarint(&p, end, &zigzag)) {
+          return false;
+        }
+        int64_t d = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+        sample[w] = prev[w] + (uint64_t)d;
+        prev[w] = sample[w];
+      }
+
+      if (index >= stats->size()) {
+        stats->resize(index + 1);
+      }
+      memcpy(&stats->at(index), &sample[0], sizeof(PerfStats));
+    }
+
+    // Servers missing from this poll are relative to zero next time.
+    for (size_t i = 0; i < prevStats.size(); i++) {
+      if (i >= stats->size() || stats->at(i).collectionTime == 0) {
+        std::fill(prevStats[i].begin(), prevStats[i].end(), 0);
+      }
+    }
+    return true;
+  }
+
+ private:
+  /**
+   * Return the previous frame's words for a server, allocating zeroes for
+   * a server not seen before.
+   */
+  std::vector<uint64_t>&
+  prevWords(uint64_t index)
+  {
+    if (index >= prevStats.size()) {
+      prevStats.resize(index + 1, std::vector<uint64_t>(words, 0));
+    }
+    return prevStats[index];
+  }
+
+  /*
+   * The mapped file.
+   */
+  const uint8_t* data;
+
+  /*
+   * Size of the mapped file in bytes.
+   */
+  size_t size;
+
+  /*
+   * Offset of the next frame.
+   */
+  size_t offset;
+
+  /*
+   * Number of words per sample in the recording.
+   */
+  uint32_t words;
+
+  /*
+   * Words of each server's sample in the previous frame, indexed by ServerId
+   * index number.
+   */
+  std::vector<std::vector<uint64_t>> prevStats;
+
+  /*
+   * Time of the previous frame.
+   */
+  uint64_t prevTime;
+};
+
+/**
+ * Prints Snapshots as fixed width columns, in the layout chosen by the
+ * format, top and topBy options.
+ */
+class ColumnPrinter {
+ public:
+  /**
+   * \param colWidth
+   *      Width of each column in characters.
+   * \param serverColumns
+   *      Per server columns to print, as indexes into columnRegistry.
+   * \param clusterColumns
+   *      Cluster-wide columns to print, as (column, Aggregation) pairs.
+   * \param top
+   *      If non-zero, print only this many servers, one per line, ranked by
+   *      topColumn.
+   * \param topColumn
+   *      Column to rank servers by in top mode.
+   * \param showTime
+   *      Print a leading column with the time of each interval.
+   */
+  ColumnPrinter(int colWidth, std::vector<int>& serverColumns,
+      std::vector<std::pair<int, int>>& clusterColumns, int top,
+      int topColumn, bool showTime)
+    : serverColumns(serverColumns)
+    , clusterColumns(clusterColumns)
+    , topColumns(serverColumns)
+    , top(top)
+    , topColumn(topColumn)
+    , showTime(showTime)
+  {
+    snprintf(colHdrFmtStr, sizeof(colHdrFmtStr), "%%%ds", colWidth);
+    snprintf(colStatFmtStr, sizeof(colStatFmtStr), "%%%d.0f", colWidth);
+    snprintf(colRatioFmtStr, sizeof(colRatioFmtStr), "%%%d.2f", colWidth);
+    snprintf(colTimeFmtStr, sizeof(colTimeFmtStr), "%%%d.1f", colWidth);
+
+    // In top mode, always show the column servers are ranked by.
+    if (top > 0 && std::find(topColumns.begin(), topColumns.end(), topColumn)
+        == topColumns.end()) {
+      topColumns.insert(topColumns.begin(), topColumn);
+    }
+  }
+
+  /**
+   * Print column headers. In top mode the headers are printed with every
+   * interval instead, so this does nothing.
+   *
+   * \param numServers
+   *      Number of servers whose per server columns will be printed.
+   */
+  void
+  printHeader(size_t numServers)
+  {
+    if (top > 0) {
+      return;
+    }
+
+    if (showTime) {
+      printf(colHdrFmtStr, "time");
+    }
+
+    for (size_t i = 0; i < numServers; i++) {
+      for (int c : serverColumns) {
+        printf(colHdrFmtStr, columnRegistry[c].name);
+      }
+    }
+
+    printClusterHeader();
+  }
+
+  /**
+   * Print one interval.
+   *
+   * \param snapshot
+   *      The interval's columns.
+   * \param time
+   *      Time of the interval, printed if showTime was set.
+   */
+  void
+  print(Snapshot& snapshot, double time)
+  {
+    std::vector<std::vector<double>>& metrics = snapshot.metrics;
+
+    if (top > 0) {
+      if (showTime) {
+        printf(colHdrFmtStr, "time");
+      }
+      printClusterHeader();
+    }
+
+    if (showTime) {
+      printf(colTimeFmtStr, time);
+    }
+
+    if (top == 0) {
+      for (size_t r = 0; r < metrics.size(); r++) {
+        for (int c : serverColumns) {
+          printf(colStatFmtStr, metrics[r][c]);
+        }
+      }
+    }
+
+    for (auto& ca : clusterColumns) {
+      printf(ca.second == SKEW ? colRatioFmtStr : colStatFmtStr,
+          snapshot.aggs[ca.first * NUM_AGGREGATIONS + ca.second]);
+    }
+
+    printf("\n");
+
+    if (top > 0) {
+      // Rank servers by the topBy column and print the busiest ones.
+      std::vector<size_t> rows;
+      for (size_t r = 0; r < metrics.size(); r++) {
+        rows.push_back(r);
+      }
+      std::sort(rows.begin(), rows.end(), [&](size_t a, size_t b) {
+        return metrics[a][topColumn] > metrics[b][topColumn];
+      });
+      rows.resize(std::min(rows.size(), (size_t)top));
+
+      printf(colHdrFmtStr, "server");
+      for (int c : topColumns) {
+        printf(colHdrFmtStr, columnRegistry[c].name);
+      }
+      printf("\n");
+
+      for (size_t r : rows) {
+        printf(colHdrFmtStr,
+            std::to_string(snapshot.serverIndexes[r]).c_str());
+        for (int c : topColumns) {
+          printf(colStatFmtStr, metrics[r][c]);
+        }
+        printf("\n");
+      }
+      printf("\n");
+    }
+  }
+
+ private:
+  void
+  printClusterHeader()
+  {
+    for (auto& ca : clusterColumns) {
+      printf(colHdrFmtStr, aggregateName(ca.first, ca.second).c_str());
+    }
+    printf("\n");
+  }
+
+  std::vector<int> serverColumns;
+  std::vector<std::pair<int, int>> clusterColumns;
+  std::vector<int> topColumns;
+  int top;
+  int topColumn;
+  bool showTime;
+  char colHdrFmtStr[32];
+  char colStatFmtStr[32];
+  char colRatioFmtStr[32];
+  char colTimeFmtStr[32];
+};
+
+/**
+ * Return a percentile of a set of values.
+ *
+ * \param values
+ *      Values, sorted in increasing order.
+ * \param percentile
+ *      Percentile to return, between 0 and 100.
+ */
+double
+percentileOf(std::vector<double>& values, double percentile)
+{
+  if (values.empty()) {
+    return 0.0;
+  }
+  size_t i = (size_t)(percentile / 100.0 * (double)(values.size() - 1) + 0.5);
+  return values[std::min(i, values.size() - 1)];
+}
+
+/**
+ * Print the distribution of each selected column over one window of a
+ * replayed recording.
+ *
+ * \param colWidth
+ *      Width of each column in characters.
+ * \param windowStart
+ *      Start of the window, in seconds since the start of the recording.
+ * \param names
+ *      Name of each selected column.
+ * \param values
+ *      Values of each selected column in every interval of the window.
+ *      Per server columns have one value per server per interval. Cleared
+ *      on return.
+ */
+void
+printWindowSummary(int colWidth, double windowStart,
+    std::vector<std::string>& names, std::vector<std::vector<double>>& values)
+{
+  for (size_t n = 0; n < names.size(); n++) {
+    std::vector<double>& v = values[n];
+    if (v.empty()) {
+      continue;
+    }
+    std::sort(v.begin(), v.end());
+    double sum = 0.0;
+    for (double x : v) {
+      sum += x;
+    }
+    printf("%*.1f%*s%*.0f%*.0f%*.0f%*.0f%*.0f%*.0f\n",
+        colWidth, windowStart, colWidth, names[n].c_str(),
+        colWidth, v.front(), colWidth, sum / (double)v.size(),
+        colWidth, percentileOf(v, 50), colWidth, percentileOf(v, 90),
+        colWidth, percentileOf(v, 99), colWidth, v.back());
+    v.clear();
   }
 }
 
+/**
+ * One interval of a replayed recording, ranked by imbalance.
+ */
+struct Imbalance {
+  /*
+   * Start of the interval, in seconds since the start of the recording.
+   */
+  double time;
+
+  /*
+   * Max/mean of the ranked column across servers.
+   */
+  double skew;
+
+  /*
+   * Index number of the server with the largest value.
+   */
+  uint32_t server;
+
+  /*
+   * Largest per server value.
+   */
+  double max;
+
+  /*
+   * Mean per server value.
+   */
+  double mean;
+};
+
+/**
+ * Replay a recording made with --record.
+ *
+ * \param path
+ *      Recording file.
+ * \param printer
+ *      Prints each interval, if window is 0.
+ * \param serverColumns
+ *      Per server columns selected by the format option.
+ * \param clusterColumns
+ *      Cluster-wide columns selected by the format option.
+ * \param window
+ *      If non-zero, instead of printing every interval, print the
+ *      distribution of each selected column over windows of this many
+ *      seconds.
+ * \param worst
+ *      If non-zero, finish by listing this many intervals with the most
+ *      imbalanced topColumn across servers.
+ * \param topColumn
+ *      Column to rank imbalance by.
+ * \param colWidth
+ *      Width of each column in characters.
+ * \return
+ *      0 on success, 1 if the recording couldn't be read.
+ */
+int
+replay(const std::string& path, ColumnPrinter& printer,
+    std::vector<int>& serverColumns,
+    std::vector<std::pair<int, int>>& clusterColumns, double window,
+    int worst, int topColumn, int colWidth)
+{
+  StatsReplay recording;
+  if (!recording.open(path)) {
+    return 1;
+  }
+
+  std::vector<std::string> names;
+  for (int c : serverColumns) {
+    names.push_back(columnRegistry[c].name);
+  }
+  for (auto& ca : clusterColumns) {
+    names.push_back(aggregateName(ca.first, ca.second));
+  }
+  std::vector<std::vector<double>> values(names.size());
+
+  if (window > 0) {
+    printf("%*s%*s%*s%*s%*s%*s%*s%*s\n", colWidth, "window", colWidth,
+        "column", colWidth, "min", colWidth, "mean", colWidth, "p50",
+        colWidth, "p90", colWidth, "p99", colWidth, "max");
+  }
+
+  std::vector<PerfStats> currStats;
+  std::vector<PerfStats> prevStats;
+  Snapshot snapshot;
+  std::vector<Imbalance> imbalances;
+  uint64_t time;
+  uint64_t startTime = 0;
+  double windowStart = 0.0;
+  bool first = true;
+  bool headerPrinted = false;
+  while (recording.next(&time, &currStats)) {
+    if (first) {
+      // The first poll has no previous sample to compute rates from.
+      startTime = time;
+      first = false;
+      prevStats.swap(currStats);
+      continue;
+    }
+
+    computeSnapshot(currStats, prevStats, &snapshot);
+    double seconds = (double)(time - startTime) / 1e6;
+
+    if (window > 0) {
+      if (seconds - windowStart >= window) {
+        printWindowSummary(colWidth, windowStart, names, values);
+        windowStart += window * floor((seconds - windowStart) / window);
+      }
+      size_t n = 0;
+      for (int c : serverColumns) {
+        for (auto& m : snapshot.metrics) {
+          values[n].push_back(m[c]);
+        }
+        n++;
+      }
+      for (auto& ca : clusterColumns) {
+        values[n++].push_back(
+            snapshot.aggs[ca.first * NUM_AGGREGATIONS + ca.second]);
+      }
+    } else {
+      if (!headerPrinted) {
+        printer.printHeader(snapshot.metrics.size());
+        headerPrinted = true;
+      }
+      printer.print(snapshot, seconds);
+    }
+
+    if (worst > 0 && snapshot.metrics.size() > 1) {
+      Imbalance imbalance;
+      imbalance.time = seconds;
+      imbalance.skew = snapshot.aggs[topColumn * NUM_AGGREGATIONS + SKEW];
+      imbalance.max = snapshot.aggs[topColumn * NUM_AGGREGATIONS + MAX];
+      imbalance.mean = imbalance.skew > 0.0 ?
+          imbalance.max / imbalance.skew : 0.0;
+      imbalance.server = 0;
+      for (size_t r = 0; r < snapshot.metrics.size(); r++) {
+        if (snapshot.metrics[r][topColumn] == imbalance.max) {
+          imbalance.server = snapshot.serverIndexes[r];
+        }
+      }
+      imbalances.push_back(imbalance);
+    }
+
+    prevStats.swap(currStats);
+  }
+
+  if (window > 0) {
+    printWindowSummary(colWidth, windowStart, names, values);
+  }
+
+  if (worst > 0) {
+    std::sort(imbalances.begin(), imbalances.end(),
+        [](const Imbalance& a, const Imbalance& b) {
+          return a.skew > b.skew;
+        });
+    imbalances.resize(std::min(imbalances.size(), (size_t)worst));
+
+    std::string name = columnRegistry[topColumn].name;
+    printf("\nMost imbalanced intervals by %s:\n", name.c_str());
+    printf("%*s%*s%*s%*s%*s\n", colWidth, "time", colWidth, "skew",
+        colWidth, "server", colWidth, "max", colWidth, "mean");
+    for (Imbalance& i : imbalances) {
+      printf("%*.1f%*.2f%*u%*.0f%*.0f\n", colWidth, i.time, colWidth, i.skew,
+          colWidth, i.server, colWidth, i.max, colWidth, i.mean);
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Generate the help text of the format option from the column registry.
+ */
+std::string
+formatHelp()
+{
+  std::string help =
+      "Format options for rcstat output. Options are comma-separated and "
+      "columns are printed in the order given. Read, write and other counter "
+      "statistics are per second rates over the last interval.\n";
+  for (int c = 0; c < NUM_COLUMNS; c++) {
+    char line[128];
+    snprintf(line, sizeof(line), "  %-5s- Total %s.\n  %-5s- Per server %s.\n",
+        aggregateName(c, TOTAL).c_str(), columnRegistry[c].help,
+        columnRegistry[c].name, columnRegistry[c].help);
+    help += line;
+  }
+  help +=
+      "Any total column can also be suffixed to show how the column is "
+      "spread across servers, e.g. Wo.max:\n"
+      "  .max  - Largest per server value.\n"
+      "  .skew - Largest per server value divided by the mean.\n"
+      "  .sd   - Standard deviation of the per server values.\n"
+      "Total utilization columns are the mean over all servers.\n"
+      "[default: mup,Mup]";
+  return help;
+}
+
 int
 main(int argc, char *argv[])
 try
 {
-  int interval;
+  double interval;
   int colWidth;
   std::string format;
+  int top;
+  std::string topBy;
+  int exportPort;
+  std::string exportAddress;
+  std::string recordFile;
+  std::string replayFile;
+  double window;
+  int worst;
 
   // Set line buffering for stdout so that printf's and log messages
   // interleave properly.
   setvbuf(stdout, NULL, _IOLBF, 1024);
 
+  std::string formatHelpText = formatHelp();
+
   OptionsDescription clientOptions("PerfStats");
   clientOptions.add_options()
 
     ("interval",
-     ProgramOptions::value<int>(&interval)->
+     ProgramOptions::value<double>(&interval)->
         default_value(1),
-     "Reporting interval for statistics in seconds (default: 1s).") 
+     "Reporting interval for statistics in seconds; may be fractional "
+     "(default: 1s).") 
     ("colWidth",
      ProgramOptions::value<int>(&colWidth)->
         default_value(12),
      "Column width for output (default: 12).") 
+    ("top",
+     ProgramOptions::value<int>(&top)->
+        default_value(0),
+     "If non-zero, instead of one set of columns per server, print the "
+     "cluster-wide columns followed by one row for each of the N servers "
+     "with the highest topBy column, every interval (default: 0).") 
+    ("topBy",
+     ProgramOptions::value<std::string>(&topBy)->
+        default_value("wo"),
+     "Per server column to rank servers by in top mode, e.g. wo for the "
+     "busiest writers, wu for the most CPU-bound servers or mup for the "
+     "fullest servers. Also the column whose imbalance --worst ranks "
+     "(default: wo).") 
+    ("exportPort",
+     ProgramOptions::value<int>(&exportPort)->
+        default_value(0),
+     "If non-zero, run as a Prometheus exporter instead of printing "
+     "columns: poll the cluster every interval and serve all columns for "
+     "every server over HTTP at /metrics on this port (default: 0).") 
+    ("exportAddress",
+     ProgramOptions::value<std::string>(&exportAddress)->
+        default_value("127.0.0.1"),
+     "Address the exporter listens on (default: 127.0.0.1).") 
+    ("record",
+     ProgramOptions::value<std::string>(&recordFile)->
+        default_value(""),
+     "Also append every poll to this recording file, for later analysis "
+     "with --replay.") 
+    ("replay",
+     ProgramOptions::value<std::string>(&replayFile)->
+        default_value(""),
+     "Instead of polling the cluster, print the intervals in this "
+     "recording file, with a leading time column in seconds.") 
+    ("window",
+     ProgramOptions::value<double>(&window)->
+        default_value(0),
+     "When replaying, if non-zero, print min, mean, p50, p90, p99 and max "
+     "of each format column over windows of this many seconds instead of "
+     "every interval (default: 0).") 
+    ("worst",
+     ProgramOptions::value<int>(&worst)->
+        default_value(0),
+     "When replaying, if non-zero, finish by listing the N intervals where "
+     "the topBy column was most imbalanced (max/mean) across servers "
+     "(default: 0).") 
     ("format",
      ProgramOptions::value<std::string>(&format)->
          default_value("mup,Mup"),
-     "Format options for rcstat output. Options are comma-separated.\n"
-     "  Ro   - Total number of objects read.\n"
-     "  ro   - Per server number of objects read.\n"
-     "  Rob  - Total number of bytes in objects read.\n"
-     "  rob  - Per server number of bytes in objects read.\n"
-     "  Rkb  - Total number of bytes in keys read.\n"
-     "  rkb  - Per server number of bytes in keys read.\n"
-     "  Wo   - Total number of objects written.\n"
-     "  wo   - Per server number of objects written.\n"
-     "  Wob  - Total number of bytes in objects written.\n"
-     "  wob  - Per server number of bytes in objects written.\n"
-     "  Wkb  - Total number of bytes in keys written.\n"
-     "  wkb  - Per server number of bytes in keys written.\n"
-     "  Mc   - Total memory capacity in bytes.\n"
-     "  mc   - Per server memory capacity in bytes.\n"
-     "  Mu   - Total amount of memory used in bytes.\n"
-     "  mu   - Per server amount of memory used in bytes.\n"
-     "  Mup  - Total amount of memory used as a \% of capacity.\n"
-     "  mup  - Per server amount of memory used as a \% of capacity.\n"
-     "  Mf   - Total amount of memory free in bytes.\n"
-     "  mf   - Per server amount of memory free in bytes.\n"
-     "  Mfp  - Total amount of memory free as a \% of capacity.\n"
-     "  mfp  - Per server amount of memory free as a \% of capacity.\n"
-     "[default: mup,Mup]");
+     formatHelpText.c_str());
 
   OptionParser optionParser(clientOptions, argc, argv);
 
@@ -152,14 +1542,55 @@ try
       locator = optionParser.options.getCoordinatorLocator();
   }
 
-  // Parse the format option for the output columns.
-  std::vector<std::string> columns; 
+  // Parse the format option into the per server and cluster-wide columns
+  // to print, as indexes into columnRegistry (and aggregations).
+  std::vector<int> serverColumns;
+  std::vector<std::pair<int, int>> clusterColumns;
   std::stringstream ss(format);
   std::string col;
   while (std::getline(ss, col, ',')) {
-    columns.push_back(col);
+    int c = findColumn(col);
+    if (c >= 0) {
+      serverColumns.push_back(c);
+      continue;
+    }
+
+    bool found = false;
+    for (c = 0; c < NUM_COLUMNS && !found; c++) {
+      for (int a = 0; a < NUM_AGGREGATIONS && !found; a++) {
+        if (col == aggregateName(c, a)) {
+          clusterColumns.push_back(std::make_pair(c, a));
+          found = true;
+        }
+      }
+    }
+    if (!found) {
+      fprintf(stderr, "Unknown format column: %s\n", col.c_str());
+      return 1;
+    }
+  }
+
+  int topColumn = findColumn(topBy);
+  if ((top > 0 || worst > 0) && topColumn < 0) {
+    fprintf(stderr, "Unknown topBy column: %s\n", topBy.c_str());
+    return 1;
+  }
+
+  if (replayFile.size() > 0) {
+    ColumnPrinter printer(colWidth, serverColumns, clusterColumns, top,
+        topColumn, true);
+    return replay(replayFile, printer, serverColumns, clusterColumns,
+        window, worst, topColumn, colWidth);
+  }
+
+  StatsRecorder recorder;
+  bool recording = recordFile.size() > 0;
+  if (recording && !recorder.open(recordFile)) {
+    return 1;
   }
 
+  useconds_t sleepMicros = (useconds_t)(interval * 1e6);
+
   RamCloud client(locator.c_str());
 
   std::vector<PerfStats> currStats;
@@ -167,79 +1598,62 @@ try
   client.serverControlAll(WireFormat::ControlOp::GET_PERF_STATS, NULL, 0, 
       &statBuf);
   parseStats(&statBuf, &currStats);
+  if (recording) {
+    recorder.record(currStats);
+  }
 
-  char colHdrFmtStr[32];
-  snprintf(colHdrFmtStr, sizeof(colHdrFmtStr), "%%%ds", colWidth);
-  char colStatFmtStr[32];
-  snprintf(colStatFmtStr, sizeof(colStatFmtStr), "%%%dllu", colWidth);
-
-  /*
-   * Print column headers.
-   */
-  for (size_t i = 0; i < currStats.size(); i++) {
-    if (currStats[i].collectionTime == 0) {
-      continue;
+  if (exportPort != 0) {
+    int listenFd = openExporterSocket(exportAddress, exportPort);
+    if (listenFd < 0) {
+      return 1;
     }
 
-    /*
-     * ro   - Per server number of objects read.
-     * rob  - Per server number of bytes in objects read.
-     * rkb  - Per server number of bytes in keys read.
-     * wo   - Per server number of objects written.
-     * wob  - Per server number of bytes in objects written.
-     * wkb  - Per server number of bytes in keys written.
-     * mc   - Per server memory capacity in bytes.
-     * mu   - Per server amount of memory used in bytes.
-     * mup  - Per server amount of memory used as a \% of capacity.
-     * mf   - Per server amount of memory free in bytes.
-     * mfp  - Per server amount of memory free as a \% of capacity.
-     */
-    if (contains(columns, "ro")) { printf(colHdrFmtStr, "ro"); }
-    if (contains(columns, "rob")) { printf(colHdrFmtStr, "rob"); }
-    if (contains(columns, "rkb")) { printf(colHdrFmtStr, "rkb"); }
-    if (contains(columns, "wo")) { printf(colHdrFmtStr, "wo"); }
-    if (contains(columns, "wob")) { printf(colHdrFmtStr, "wob"); }
-    if (contains(columns, "wkb")) { printf(colHdrFmtStr, "wkb"); }
-    if (contains(columns, "mc")) { printf(colHdrFmtStr, "mc"); }
-    if (contains(columns, "mu")) { printf(colHdrFmtStr, "mu"); }
-    if (contains(columns, "mup")) { printf(colHdrFmtStr, "mup"); }
-    if (contains(columns, "mf")) { printf(colHdrFmtStr, "mf"); }
-    if (contains(columns, "mfp")) { printf(colHdrFmtStr, "mfp"); }
+    std::mutex mutex;
+    std::string exposition;
+    std::thread server(exporterThread, listenFd, &mutex, &exposition);
+    server.detach();
+    LOG(NOTICE, "Serving metrics at http://%s:%d/metrics",
+        exportAddress.c_str(), exportPort);
+
+    std::vector<PerfStats> prevStats;
+    Snapshot snapshot;
+    while (true) {
+      usleep(sleepMicros);
+
+      prevStats.swap(currStats);
+      Buffer statBuf;
+      client.serverControlAll(WireFormat::ControlOp::GET_PERF_STATS, NULL, 0,
+          &statBuf);
+      parseStats(&statBuf, &currStats);
+      if (recording) {
+        recorder.record(currStats);
+      }
+      computeSnapshot(currStats, prevStats, &snapshot);
+
+      std::string next = formatExposition(snapshot);
+      std::lock_guard<std::mutex> lock(mutex);
+      exposition.swap(next);
+    }
   }
 
-  /*
-   * Ro   - Total number of objects read.
-   * Rob  - Total number of bytes in objects read.
-   * Rkb  - Total number of bytes in keys read.
-   * Wo   - Total number of objects written.
-   * Wob  - Total number of bytes in objects written.
-   * Wkb  - Total number of bytes in keys written.
-   * Mc   - Total memory capacity in bytes.
-   * Mu   - Total amount of memory used in bytes.
-   * Mup  - Total amount of memory used as a \% of capacity.
-   * Mf   - Total amount of memory free in bytes.
-   * Mfp  - Total amount of memory free as a \% of capacity.
-   */
-  if (contains(columns, "Ro")) { printf(colHdrFmtStr, "Ro"); }
-  if (contains(columns, "Rob")) { printf(colHdrFmtStr, "Rob"); }
-  if (contains(columns, "Rkb")) { printf(colHdrFmtStr, "Rkb"); }
-  if (contains(columns, "Wo")) { printf(colHdrFmtStr, "Wo"); }
-  if (contains(columns, "Wob")) { printf(colHdrFmtStr, "Wob"); }
-  if (contains(columns, "Wkb")) { printf(colHdrFmtStr, "Wkb"); }
-  if (contains(columns, "Mc")) { printf(colHdrFmtStr, "Mc"); }
-  if (contains(columns, "Mu")) { printf(colHdrFmtStr, "Mu"); }
-  if (contains(columns, "Mup")) { printf(colHdrFmtStr, "Mup"); }
-  if (contains(columns, "Mf")) { printf(colHdrFmtStr, "Mf"); }
-  if (contains(columns, "Mfp")) { printf(colHdrFmtStr, "Mfp"); }
-
-  printf("\n");
+  ColumnPrinter printer(colWidth, serverColumns, clusterColumns, top,
+      topColumn, false);
+
+  size_t numServers = 0;
+  for (size_t i = 0; i < currStats.size(); i++) {
+    if (currStats[i].collectionTime != 0) {
+      numServers++;
+    }
+  }
+  printer.printHeader(numServers);
 
   std::vector<PerfStats> prevStats;
+  Snapshot snapshot;
   while (true) {
-    sleep(interval);
+    usleep(sleepMicros);
   
     prevStats.clear(); 
-    for (int i = 0; i < currStats.size(); i++) {
+    for (size_t i = 0; i < currStats.size(); i++) {
       prevStats.push_back(currStats[i]);
     } 
 
@@ -247,75 +1661,11 @@ try
     client.serverControlAll(WireFormat::ControlOp::GET_PERF_STATS, NULL, 0, 
         &statBuf);
     parseStats(&statBuf, &currStats);
-
-    uint64_t Ro = 0;
-    uint64_t Rob = 0;
-    uint64_t Rkb = 0;
-    uint64_t Wo = 0;
-    uint64_t Wob = 0;
-    uint64_t Wkb = 0;
-    uint64_t Mc = 0;
-    uint64_t Mu = 0;
-    uint64_t Mf = 0;
-    for (size_t i = 0; i < currStats.size(); i++) {
-      PerfStats& c = currStats[i];
-      PerfStats& p = prevStats[i];
-
-      if (c.collectionTime == 0) {
-        continue;
-      }
-     
-      uint64_t ro = c.readCount;
-      uint64_t rob = c.readObjectBytes;
-      uint64_t rkb = c.readKeyBytes;
-      uint64_t wo = c.writeCount;
-      uint64_t wob = c.writeObjectBytes;
-      uint64_t wkb = c.writeKeyBytes;
-      uint64_t mc = c.logMaxLiveBytes;
-      uint64_t mu = c.logLiveBytes;
-      uint64_t mup = (100 * mu) / mc;
-      uint64_t mf = c.logAppendableBytes;
-      uint64_t mfp = (100 * mf) / mc;
-
-      if (contains(columns, "ro")) { printf(colStatFmtStr, ro); }
-      if (contains(columns, "rob")) { printf(colStatFmtStr, rob); }
-      if (contains(columns, "rkb")) { printf(colStatFmtStr, rkb); }
-      if (contains(columns, "wo")) { printf(colStatFmtStr, wo); }
-      if (contains(columns, "wob")) { printf(colStatFmtStr, wob); }
-      if (contains(columns, "wkb")) { printf(colStatFmtStr, wkb); }
-      if (contains(columns, "mc")) { printf(colStatFmtStr, mc); }
-      if (contains(columns, "mu")) { printf(colStatFmtStr, mu); }
-      if (contains(columns, "mup")) { printf(colStatFmtStr, mup); }
-      if (contains(columns, "mf")) { printf(colStatFmtStr, mf); }
-      if (contains(columns, "mfp")) { printf(colStatFmtStr, mfp); }
-
-      Ro += ro;
-      Rob += rob;
-      Rkb += rkb;
-      Wo += wo;
-      Wob += wob;
-      Wkb += wkb;
-      Mc += mc;
-      Mu += mu;
-      Mf += mf;
-    }
-
-    uint64_t Mup = (100 * Mu) / Mc;
-    uint64_t Mfp = (100 * Mf) / Mc;
-
-    if (contains(columns, "Ro")) { printf(colStatFmtStr, Ro); }
-    if (contains(columns, "Rob")) { printf(colStatFmtStr, Rob); }
-    if (contains(columns, "Rkb")) { printf(colStatFmtStr, Rkb); }
-    if (contains(columns, "Wo")) { printf(colStatFmtStr, Wo); }
-    if (contains(columns, "Wob")) { printf(colStatFmtStr, Wob); }
-    if (contains(columns, "Wkb")) { printf(colStatFmtStr, Wkb); }
-    if (contains(columns, "Mc")) { printf(colStatFmtStr, Mc); }
-    if (contains(columns, "Mu")) { printf(colStatFmtStr, Mu); }
-    if (contains(columns, "Mup")) { printf(colStatFmtStr, Mup); }
-    if (contains(columns, "Mf")) { printf(colStatFmtStr, Mf); }
-    if (contains(columns, "Mfp")) { printf(colStatFmtStr, Mfp); }
-
-    printf("\n");
+    if (recording) {
+      recorder.record(currStats);
+    }
+    computeSnapshot(currStats, prevStats, &snapshot);
+    printer.print(snapshot, 0.0);
   }
 
   return 0;